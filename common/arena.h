@@ -0,0 +1,219 @@
+#pragma once
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "error_codes.h"
+
+// Cache-line aligned bump arena for task descriptors and results.
+// Every allocation starts on a cache line boundary and is rounded up to
+// a whole number of lines, so objects allocated separately never share
+// a line: the threads writing their own descriptor or result do not
+// invalidate the neighbours' lines (no false sharing). The memory is
+// allocated and prefaulted once in init(); allocation is a single
+// atomic add, objects are released all at once by reset().
+
+namespace threading
+{
+constexpr size_t ARENA_CACHE_LINE_SIZE = 64;
+
+/**
+ * @brief Round the size up to a whole number of cache lines.
+ */
+constexpr size_t roundUpToCacheLine(size_t rdSize)
+{
+    return (rdSize + ARENA_CACHE_LINE_SIZE - 1) & ~(ARENA_CACHE_LINE_SIZE - 1);
+}
+
+class Arena
+{
+public:
+
+    Arena() :
+        mpBase(nullptr),
+        mdCapacity(0)
+    {
+        mdOffset.store(0, std::memory_order_relaxed);
+    }
+
+    ~Arena()
+    {
+        free(mpBase);
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    /**
+     * @brief Allocate and prefault the arena memory.
+     *
+     * @param[in] rdCapacity Arena size in bytes, rounded up to cache lines.
+     *
+     * @return Error code.
+     */
+    cmn::ErrCode init(size_t rdCapacity)
+    {
+        if (nullptr != mpBase)
+        {
+            return cmn::ErrCode::ALREADY_ENABLED;
+        }
+
+        const auto dCapacity = roundUpToCacheLine(rdCapacity);
+        if ((0 == dCapacity) || (0 != posix_memalign(&mpBase, ARENA_CACHE_LINE_SIZE, dCapacity)))
+        {
+            mpBase = nullptr;
+            return cmn::ErrCode::INVALID_ARGS;
+        }
+
+        // Fault the pages in now rather than on the first task.
+        memset(mpBase, 0, dCapacity);
+
+        mdCapacity = dCapacity;
+        mdOffset.store(0, std::memory_order_relaxed);
+        return cmn::ErrCode::OK;
+    }
+
+    /**
+     * @brief Allocate a cache-line aligned block. Lock-free, may be called
+     *        by several threads at once.
+     *
+     * @param[in] rdSize Block size, rounded up to cache lines.
+     *
+     * @return Block pointer, nullptr if the arena is exhausted.
+     */
+    void* allocate(size_t rdSize)
+    {
+        const auto dSize = roundUpToCacheLine(rdSize);
+        const auto dOffset = mdOffset.fetch_add(dSize, std::memory_order_relaxed);
+        if ((dOffset + dSize) > mdCapacity)
+        {
+            return nullptr;
+        }
+
+        return static_cast<char*>(mpBase) + dOffset;
+    }
+
+    /**
+     * @brief Construct an object in its own cache lines.
+     *        No destructor is ever called, so only trivially
+     *        destructible types are allowed.
+     *
+     * @return Object pointer, nullptr if the arena is exhausted.
+     */
+    template <typename T, typename... Args>
+    T* create(Args&&... rtArgs)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "Arena objects are never destroyed");
+        static_assert(alignof(T) <= ARENA_CACHE_LINE_SIZE, "Arena blocks are cache line aligned only");
+
+        void* pMemory = allocate(sizeof(T));
+        return (nullptr == pMemory) ? nullptr : new (pMemory) T(std::forward<Args>(rtArgs)...);
+    }
+
+    /**
+     * @brief Release all the objects at once. No object allocated
+     *        before may be used afterwards.
+     */
+    void reset()
+    {
+        mdOffset.store(0, std::memory_order_relaxed);
+    }
+
+    size_t capacity() const
+    {
+        return mdCapacity;
+    }
+
+    size_t used() const
+    {
+        const auto dOffset = mdOffset.load(std::memory_order_relaxed);
+        return (dOffset < mdCapacity) ? dOffset : mdCapacity;
+    }
+
+private:
+    void* mpBase;
+    size_t mdCapacity;
+    std::atomic<size_t> mdOffset;
+};
+
+/**
+ * @brief Array of per-thread (per-task) slots, every slot padded to whole
+ *        cache lines, so the threads writing their own slots never write
+ *        to the same line.
+ */
+template <typename T>
+class PaddedSlots
+{
+public:
+
+    static constexpr size_t SLOT_STRIDE = roundUpToCacheLine(sizeof(T));
+
+    PaddedSlots() :
+        mpSlots(nullptr),
+        mdCount(0)
+    {}
+
+    /**
+     * @brief Take the slots from the arena and default-construct them.
+     *
+     * @param[in] rtArena Arena to allocate from.
+     * @param[in] rdCount Number of slots.
+     *
+     * @return Error code.
+     */
+    cmn::ErrCode init(Arena& rtArena, size_t rdCount)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "Arena objects are never destroyed");
+        static_assert(alignof(T) <= ARENA_CACHE_LINE_SIZE, "Arena blocks are cache line aligned only");
+
+        auto pSlots = static_cast<char*>(rtArena.allocate(SLOT_STRIDE * rdCount));
+        if (nullptr == pSlots)
+        {
+            return cmn::ErrCode::OVERFLOW;
+        }
+
+        for (size_t dIdx = 0; dIdx < rdCount; ++dIdx)
+        {
+            new (pSlots + dIdx * SLOT_STRIDE) T();
+        }
+
+        mpSlots = pSlots;
+        mdCount = rdCount;
+        return cmn::ErrCode::OK;
+    }
+
+    T& operator[](size_t rdIdx)
+    {
+        return *reinterpret_cast<T*>(mpSlots + rdIdx * SLOT_STRIDE);
+    }
+
+    const T& operator[](size_t rdIdx) const
+    {
+        return *reinterpret_cast<const T*>(mpSlots + rdIdx * SLOT_STRIDE);
+    }
+
+    size_t size() const
+    {
+        return mdCount;
+    }
+
+    /**
+     * @brief Arena bytes needed for the given number of slots.
+     */
+    static constexpr size_t bytesFor(size_t rdCount)
+    {
+        return SLOT_STRIDE * rdCount;
+    }
+
+private:
+    char* mpSlots;
+    size_t mdCount;
+};
+
+template <typename T>
+constexpr size_t PaddedSlots<T>::SLOT_STRIDE;
+}
@@ -0,0 +1,598 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "error_codes.h"
+#include "string_utils.h"
+
+// Asynchronous logging backend. A thread which logs a message does
+// not format anything: it only copies a fixed-size record (severity,
+// location, format string pointer, raw argument values and a timestamp)
+// into its own single-producer/single-consumer ring. A low-priority
+// drain thread pops the records, formats them and hands the resulting
+// lines over to the sink (stdout/stderr + Syslog, see common.h).
+//
+// Please note that since the arguments are copied "as is", a string
+// argument (%s) is copied as a pointer only, so the string it points
+// to must outlive the record: string literals, clockIdToString() output
+// etc. are fine, stack buffers are not.
+
+namespace async_log
+{
+// Number of records per thread ring; must be a power of two.
+constexpr size_t RING_CAPACITY = 1024;
+
+// Raw arguments storage size within a record. Makes the whole
+// record exactly two cache lines long on a 64-bit target.
+constexpr size_t MAX_PAYLOAD_SIZE = 80;
+
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+// Max. length of a formatted message produced by the drain thread.
+constexpr size_t MAX_MESSAGE_LENGTH = str_utils::MAX_FORMAT_LENGTH;
+
+// Drain thread idle sleep between the ring polls.
+constexpr long DRAIN_IDLE_SLEEP_NSEC = 1000000;
+
+// stop() poll interval while waiting for the pushes in flight. A sleep,
+// not a yield: the producer may have a lower priority than the caller.
+constexpr long QUIESCE_SLEEP_NSEC = 10000;
+
+// Severity ID passed to the sink for the backend's own messages;
+// the sink should handle it as an error.
+constexpr int INTERNAL_SEVERITY = -1;
+
+static_assert((RING_CAPACITY & (RING_CAPACITY - 1)) == 0, "Ring capacity must be a power of two");
+
+/**
+ * @brief Formatter callback instantiated at the log call site for
+ *        the particular argument types. Unpacks the raw arguments and
+ *        formats the message.
+ */
+using Formatter = int (*)(char* rpOut, size_t rdOutSize, const char* rpFormat, const unsigned char* rpPayload);
+
+/**
+ * @brief Sink callback which receives a formatted message.
+ */
+using LogSink = void (*)(int rdSeverity, const char* rpFile, int rdLine, const char* rpMessage);
+
+/**
+ * @brief A single log record as it is stored in the ring.
+ */
+struct Record
+{
+    timespec tTimestamp;  // CLOCK_MONOTONIC time point, used to merge the rings in order.
+    const char* pFile;
+    const char* pFormat;
+    Formatter pFormatter;
+    int dSeverity;
+    int dLine;
+    alignas(8) unsigned char aPayload[MAX_PAYLOAD_SIZE];
+};
+
+/**
+ * @brief Per-thread SPSC ring. The producer (logging thread) owns
+ *        dTail, the consumer (drain thread) owns dHead; both indices
+ *        are placed into separate cache lines.
+ */
+struct Ring
+{
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> dHead;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> dTail;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> dDropped; // Records lost due to the ring overflow.
+    std::atomic<bool> bOrphaned;                           // Set when the producer thread exits.
+    std::atomic<bool> bBusy;                               // A push is in flight, see stop().
+    alignas(CACHE_LINE_SIZE) Record aRecords[RING_CAPACITY];
+};
+
+namespace detail
+{
+/**
+ * @brief Align the given offset up to the given power of two.
+ */
+constexpr size_t alignUp(size_t rdOffset, size_t rdAlign)
+{
+    return (rdOffset + rdAlign - 1) & ~(rdAlign - 1);
+}
+
+// Type under which a log argument is stored in a record: arrays (literals)
+// become pointers, cv-qualifiers of the values are dropped.
+template <typename T>
+using Stored = typename std::decay<const T>::type;
+
+// Helper type to carry the argument types through the unpacking recursion.
+template <typename... Args>
+struct TypeList {};
+
+// Compute the size of the packed arguments at compile time.
+template <typename... Args>
+struct Layout;
+
+template <>
+struct Layout<>
+{
+    static constexpr size_t size(size_t rdOffset) { return rdOffset; }
+};
+
+template <typename T, typename... Rest>
+struct Layout<T, Rest...>
+{
+    static constexpr size_t size(size_t rdOffset)
+    {
+        return Layout<Rest...>::size(alignUp(rdOffset, alignof(T)) + sizeof(T));
+    }
+};
+
+/**
+ * @brief str_utils::formatTo_va() wrapper to pass the unpacked arguments to.
+ *        Intentionally has no format attribute: the format is not a literal
+ *        here, it has been checked at the log call site.
+ */
+inline int formatInto(char* rpOut, size_t rdOutSize, const char* rpFormat, ...)
+{
+    va_list tArgs;
+    va_start(tArgs, rpFormat);
+    const auto dLen = str_utils::formatTo_va(rpOut, rdOutSize, rpFormat, tArgs);
+    va_end(tArgs);
+    return static_cast<int>(dLen);
+}
+
+inline void pack(unsigned char*, size_t)
+{}
+
+template <typename T, typename... Rest>
+void pack(unsigned char* rpOut, size_t rdOffset, const T& rtValue, const Rest&... rtRest)
+{
+    rdOffset = alignUp(rdOffset, alignof(T));
+    std::memcpy(rpOut + rdOffset, &rtValue, sizeof(T));
+    pack(rpOut, rdOffset + sizeof(T), rtRest...);
+}
+
+template <typename... Done>
+int unpackAndFormat(char* rpOut, size_t rdOutSize, const char* rpFormat, const unsigned char*, size_t,
+        TypeList<>, const Done&... rtDone)
+{
+    return formatInto(rpOut, rdOutSize, rpFormat, rtDone...);
+}
+
+template <typename T, typename... Rest, typename... Done>
+int unpackAndFormat(char* rpOut, size_t rdOutSize, const char* rpFormat, const unsigned char* rpIn, size_t rdOffset,
+        TypeList<T, Rest...>, const Done&... rtDone)
+{
+    rdOffset = alignUp(rdOffset, alignof(T));
+
+    T tValue;
+    std::memcpy(&tValue, rpIn + rdOffset, sizeof(T));
+
+    return unpackAndFormat(rpOut, rdOutSize, rpFormat, rpIn, rdOffset + sizeof(T), TypeList<Rest...>(),
+            rtDone..., tValue);
+}
+
+/**
+ * @brief Formatter instance for the given argument types.
+ */
+template <typename... Args>
+int formatRecord(char* rpOut, size_t rdOutSize, const char* rpFormat, const unsigned char* rpPayload)
+{
+    return unpackAndFormat(rpOut, rdOutSize, rpFormat, rpPayload, 0, TypeList<Args...>());
+}
+
+// Compile-time check that all the argument types may be copied bytewise.
+template <typename... Args>
+struct AllScalar;
+
+template <>
+struct AllScalar<> : std::true_type {};
+
+template <typename T, typename... Rest>
+struct AllScalar<T, Rest...> :
+    std::integral_constant<bool, std::is_scalar<T>::value && AllScalar<Rest...>::value> {};
+
+/**
+ * @brief Shared backend state.
+ */
+struct State
+{
+    std::mutex tLock; // Guards tRings only; never taken on the logging path once the ring exists.
+    std::vector<Ring*> tRings;
+    std::vector<Ring*> tSnapshot; // Drain thread private copy of tRings.
+    std::atomic<bool> bRunning {false};
+    std::atomic<bool> bStop {false};
+    pthread_t tDrainThread {};
+    LogSink pSink {nullptr};
+    size_t dTotalDropped {0};
+};
+
+inline State& state()
+{
+    static State tState;
+    return tState;
+}
+
+inline Ring* allocRing()
+{
+    void* pMem = nullptr;
+    if (0 != posix_memalign(&pMem, CACHE_LINE_SIZE, sizeof(Ring)))
+    {
+        return nullptr;
+    }
+
+    auto pRing = new (pMem) Ring;
+    pRing->dHead.store(0, std::memory_order_relaxed);
+    pRing->dTail.store(0, std::memory_order_relaxed);
+    pRing->dDropped.store(0, std::memory_order_relaxed);
+    pRing->bOrphaned.store(false, std::memory_order_relaxed);
+    pRing->bBusy.store(false, std::memory_order_relaxed);
+    return pRing;
+}
+
+inline void freeRing(Ring* rpRing)
+{
+    rpRing->~Ring();
+    free(rpRing);
+}
+
+/**
+ * @brief Thread-local ring holder. Marks the ring as orphaned
+ *        upon the thread exit so the drain thread could free it
+ *        after consuming the rest of the records.
+ */
+struct ThreadRing
+{
+    Ring* pRing = nullptr;
+
+    ~ThreadRing()
+    {
+        if (nullptr != pRing)
+        {
+            pRing->bOrphaned.store(true, std::memory_order_release);
+        }
+    }
+};
+
+inline ThreadRing& threadRing()
+{
+    thread_local ThreadRing tHolder;
+    return tHolder;
+}
+
+/**
+ * @brief Get the calling thread ring, allocate and register it if needed.
+ *
+ * @return Ring pointer or nullptr if allocation failed.
+ */
+inline Ring* myRing()
+{
+    auto& rtHolder = threadRing();
+    if (nullptr != rtHolder.pRing)
+    {
+        return rtHolder.pRing;
+    }
+
+    auto pRing = allocRing();
+    if (nullptr == pRing)
+    {
+        return nullptr;
+    }
+
+    auto& rtState = state();
+    std::lock_guard<std::mutex> tGuard(rtState.tLock);
+    rtState.tRings.push_back(pRing);
+    rtHolder.pRing = pRing;
+    return pRing;
+}
+
+inline bool isEarlier(const timespec& rtLeft, const timespec& rtRight)
+{
+    return (rtLeft.tv_sec < rtRight.tv_sec) ||
+        ((rtLeft.tv_sec == rtRight.tv_sec) && (rtLeft.tv_nsec < rtRight.tv_nsec));
+}
+
+/**
+ * @brief Consume all the records available at the moment, merging
+ *        the thread rings by the record timestamps. Also frees the rings
+ *        of the exited threads once they are empty.
+ *
+ * @return Number of records consumed.
+ */
+inline size_t drainOnce()
+{
+    auto& rtState = state();
+
+    // Work on a copy so a thread registering its ring is never blocked
+    // by the formatting and output below. The rings are only freed by
+    // the drain thread itself so the copy stays valid.
+    {
+        std::lock_guard<std::mutex> tGuard(rtState.tLock);
+        rtState.tSnapshot.assign(rtState.tRings.begin(), rtState.tRings.end());
+    }
+
+    char aMessage[MAX_MESSAGE_LENGTH];
+    size_t dConsumed = 0;
+
+    while (true)
+    {
+        Ring* pOldest = nullptr;
+        const Record* pOldestRecord = nullptr;
+
+        for (auto pRing : rtState.tSnapshot)
+        {
+            const auto dHead = pRing->dHead.load(std::memory_order_relaxed);
+            if (dHead == pRing->dTail.load(std::memory_order_acquire))
+            {
+                continue;
+            }
+
+            const auto& rtRecord = pRing->aRecords[dHead & (RING_CAPACITY - 1)];
+            if ((nullptr == pOldestRecord) || isEarlier(rtRecord.tTimestamp, pOldestRecord->tTimestamp))
+            {
+                pOldest = pRing;
+                pOldestRecord = &rtRecord;
+            }
+        }
+
+        if (nullptr == pOldest)
+        {
+            break;
+        }
+
+        pOldestRecord->pFormatter(aMessage, sizeof(aMessage), pOldestRecord->pFormat, pOldestRecord->aPayload);
+        rtState.pSink(pOldestRecord->dSeverity, pOldestRecord->pFile, pOldestRecord->dLine, aMessage);
+
+        pOldest->dHead.fetch_add(1, std::memory_order_release);
+        ++dConsumed;
+    }
+
+    // Collect the drop counters and release the rings left by the exited threads.
+    std::lock_guard<std::mutex> tGuard(rtState.tLock);
+    for (auto tIt = rtState.tRings.begin(); tIt != rtState.tRings.end();)
+    {
+        auto pRing = *tIt;
+        rtState.dTotalDropped += pRing->dDropped.exchange(0, std::memory_order_relaxed);
+
+        // The orphaned flag must be checked before the emptiness: once it
+        // is set, the producer will never push again.
+        if (pRing->bOrphaned.load(std::memory_order_acquire) &&
+                (pRing->dHead.load(std::memory_order_relaxed) == pRing->dTail.load(std::memory_order_acquire)))
+        {
+            freeRing(pRing);
+            tIt = rtState.tRings.erase(tIt);
+        }
+        else
+        {
+            ++tIt;
+        }
+    }
+
+    return dConsumed;
+}
+
+inline void* drainThreadFunc(void*)
+{
+    auto& rtState = state();
+    const timespec tIdleSleep {0, DRAIN_IDLE_SLEEP_NSEC};
+
+    while (not rtState.bStop.load(std::memory_order_acquire))
+    {
+        if (0 == drainOnce())
+        {
+            nanosleep(&tIdleSleep, nullptr);
+        }
+    }
+
+    // Flush whatever is left.
+    drainOnce();
+    return nullptr;
+}
+
+/**
+ * @brief Wait until no push is in flight. Called by stop() once the
+ *        running flag is cleared: a producer either sees the flag cleared
+ *        or is waited for here, so no record is queued after the final
+ *        drain.
+ */
+inline void waitForPushes()
+{
+    auto& rtState = state();
+    const timespec tSleep {0, QUIESCE_SLEEP_NSEC};
+
+    // The lock keeps the drain thread from freeing the rings meanwhile.
+    std::lock_guard<std::mutex> tGuard(rtState.tLock);
+    for (auto pRing : rtState.tRings)
+    {
+        while (pRing->bBusy.load(std::memory_order_seq_cst))
+        {
+            nanosleep(&tSleep, nullptr);
+        }
+    }
+}
+
+void stopAtExit();
+}
+
+/**
+ * @brief Check whether the asynchronous backend is active.
+ *
+ * @return True if log records should be pushed to the rings.
+ */
+inline bool isRunning()
+{
+    return detail::state().bRunning.load(std::memory_order_acquire);
+}
+
+/**
+ * @brief Pre-allocate and register the ring for the calling thread
+ *        so the first log call from a time-critical loop does not pay
+ *        for it.
+ *
+ * @return Error code.
+ */
+inline cmn::ErrCode attachThread()
+{
+    return (nullptr != detail::myRing()) ? cmn::ErrCode::OK : cmn::ErrCode::GENERAL_ERR;
+}
+
+/**
+ * @brief Push a log record to the calling thread ring. Never blocks:
+ *        if the ring is full the record is dropped and counted.
+ *        Check isRunning() first, the ring is allocated on the first push.
+ *
+ * @param rdSeverity Severity ID, passed to the sink as is.
+ * @param rpFile Source file.
+ * @param rdLine Source line.
+ * @param rpFormat printf()-like format string; must be a literal.
+ * @param rtArgs Format arguments, scalars only.
+ *
+ * @return False if the backend is not running (any more), so the record
+ *         must be logged synchronously; true if it has been queued or dropped.
+ */
+template <typename... Args>
+bool push(int rdSeverity, const char* rpFile, int rdLine, const char* rpFormat, const Args&... rtArgs)
+{
+    static_assert(detail::AllScalar<detail::Stored<Args>...>::value,
+            "Only scalar values may be logged asynchronously");
+    static_assert(detail::Layout<detail::Stored<Args>...>::size(0) <= MAX_PAYLOAD_SIZE,
+            "Too many log arguments for an async log record");
+
+    auto pRing = detail::myRing();
+    if (nullptr == pRing)
+    {
+        return false;
+    }
+
+    // Pairs with the running flag exchange and the busy flag poll in stop():
+    // both sides are sequentially consistent, so at least one of them sees
+    // the other's store.
+    pRing->bBusy.store(true, std::memory_order_seq_cst);
+    if (not detail::state().bRunning.load(std::memory_order_seq_cst))
+    {
+        pRing->bBusy.store(false, std::memory_order_release);
+        return false;
+    }
+
+    const auto dTail = pRing->dTail.load(std::memory_order_relaxed);
+    if ((dTail - pRing->dHead.load(std::memory_order_acquire)) >= RING_CAPACITY)
+    {
+        pRing->dDropped.fetch_add(1, std::memory_order_relaxed);
+        pRing->bBusy.store(false, std::memory_order_release);
+        return true;
+    }
+
+    auto& rtRecord = pRing->aRecords[dTail & (RING_CAPACITY - 1)];
+    clock_gettime(CLOCK_MONOTONIC, &rtRecord.tTimestamp);
+    rtRecord.pFile = rpFile;
+    rtRecord.pFormat = rpFormat;
+    rtRecord.pFormatter = &detail::formatRecord<detail::Stored<Args>...>;
+    rtRecord.dSeverity = rdSeverity;
+    rtRecord.dLine = rdLine;
+    detail::pack(rtRecord.aPayload, 0, static_cast<detail::Stored<Args>>(rtArgs)...);
+
+    pRing->dTail.store(dTail + 1, std::memory_order_release);
+    pRing->bBusy.store(false, std::memory_order_release);
+    return true;
+}
+
+/**
+ * @brief Start the drain thread. The drain thread always runs with
+ *        SCHED_OTHER policy regardless of the caller's one so it never
+ *        preempts the RT threads producing the records.
+ *
+ * @param rpSink Formatted messages consumer.
+ *
+ * @return Error code.
+ */
+inline cmn::ErrCode start(LogSink rpSink)
+{
+    auto& rtState = detail::state();
+    if (rtState.bRunning.load(std::memory_order_acquire))
+    {
+        return cmn::ErrCode::ALREADY_ENABLED;
+    }
+
+    rtState.pSink = rpSink;
+    rtState.bStop.store(false, std::memory_order_release);
+
+    pthread_attr_t tDrainAttr {};
+    pthread_attr_init(&tDrainAttr);
+    pthread_attr_setinheritsched(&tDrainAttr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&tDrainAttr, SCHED_OTHER);
+
+    sched_param tSchedParam {};
+    tSchedParam.sched_priority = 0;
+    pthread_attr_setschedparam(&tDrainAttr, &tSchedParam);
+
+    const auto dErr = pthread_create(&rtState.tDrainThread, &tDrainAttr, &detail::drainThreadFunc, nullptr);
+    pthread_attr_destroy(&tDrainAttr);
+
+    if (dErr != 0)
+    {
+        std::cerr << "Failed to create the log drain thread, error: " << dErr << std::endl;
+        return cmn::ErrCode::PTHREAD_ERR;
+    }
+
+    // Make sure the records are flushed even if the program
+    // leaves via exit() skipping the scope guards.
+    static bool bAtExitRegistered = false;
+    if (not bAtExitRegistered)
+    {
+        atexit(&detail::stopAtExit);
+        bAtExitRegistered = true;
+    }
+
+    rtState.bRunning.store(true, std::memory_order_release);
+    return cmn::ErrCode::OK;
+}
+
+/**
+ * @brief Stop the drain thread after flushing all the queued records,
+ *        the pushes in flight included. The log calls made after this
+ *        point are handled synchronously.
+ *
+ * @return Error code.
+ */
+inline cmn::ErrCode stop()
+{
+    auto& rtState = detail::state();
+    if (not rtState.bRunning.exchange(false, std::memory_order_seq_cst))
+    {
+        return cmn::ErrCode::NOT_ENABLED;
+    }
+
+    detail::waitForPushes();
+
+    rtState.bStop.store(true, std::memory_order_release);
+    pthread_join(rtState.tDrainThread, nullptr);
+
+    if (rtState.dTotalDropped > 0)
+    {
+        char aMessage[MAX_MESSAGE_LENGTH];
+        str_utils::formatTo(aMessage, sizeof(aMessage), "Async log: %zu records dropped due to ring overflow",
+                rtState.dTotalDropped);
+        rtState.pSink(INTERNAL_SEVERITY, __FILE__, __LINE__, aMessage);
+        rtState.dTotalDropped = 0;
+    }
+
+    return cmn::ErrCode::OK;
+}
+
+namespace detail
+{
+inline void stopAtExit()
+{
+    stop();
+}
+}
+}
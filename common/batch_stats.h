@@ -0,0 +1,630 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include <strings.h>
+
+#include "error_codes.h"
+#include "rt_time.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BATCH_STATS_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define BATCH_STATS_NEON 1
+#endif
+
+// Vectorized post-processing of timestamp captures kept as SoA int64
+// arrays: timespec to nanoseconds, deltas and errors against the period,
+// and min/max/mean/variance. On x86 the AVX2 or SSE4.2 kernels are picked
+// at run time (function target attributes, so no -m flags are needed);
+// AArch64 always has NEON. Everything else, e.g. 32-bit ARM lacking the
+// 64-bit lane compares, uses the scalar kernels. All the kernels return
+// exactly the same integers; the variance may differ in the last bits.
+
+namespace batch_stats
+{
+enum class SimdLevel
+{
+    Scalar,
+    Sse42,
+    Avx2,
+    Neon
+};
+
+/**
+ * @brief Statistics of a value array.
+ */
+struct SampleStats
+{
+    size_t dCount;
+    int64_t dMin;
+    int64_t dMax;
+    double dMean;
+    double dVariance;   // Population variance.
+
+    double stddev() const
+    {
+        return std::sqrt(dVariance);
+    }
+};
+
+inline const char* simdLevelToString(SimdLevel reLevel)
+{
+    switch (reLevel)
+    {
+        case SimdLevel::Sse42:
+            return "SSE4.2";
+        case SimdLevel::Avx2:
+            return "AVX2";
+        case SimdLevel::Neon:
+            return "NEON";
+        default:
+            return "Scalar";
+    }
+}
+
+/**
+ * @brief Parse a SIMD level name as returned by simdLevelToString(),
+ *        case-insensitive.
+ *
+ * @param rpValue Level name.
+ * @param reOutput Level output.
+ *
+ * @return Error code.
+ */
+inline cmn::ErrCode parseSimdLevel(const char* rpValue, SimdLevel& reOutput)
+{
+    static const SimdLevel aLevels[] = {SimdLevel::Scalar, SimdLevel::Sse42, SimdLevel::Avx2, SimdLevel::Neon};
+
+    for (const auto eLevel : aLevels)
+    {
+        if (0 == strcasecmp(rpValue, simdLevelToString(eLevel)))
+        {
+            reOutput = eLevel;
+            return cmn::ErrCode::OK;
+        }
+    }
+
+    return cmn::ErrCode::INVALID_ARGS;
+}
+
+/**
+ * @brief Get the best SIMD level the CPU supports.
+ */
+inline SimdLevel detectSimdLevel()
+{
+#if defined(BATCH_STATS_X86)
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return SimdLevel::Avx2;
+    }
+
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        return SimdLevel::Sse42;
+    }
+#elif defined(BATCH_STATS_NEON)
+    return SimdLevel::Neon;
+#endif
+
+    return SimdLevel::Scalar;
+}
+
+/**
+ * @brief Level used by the kernels, detectSimdLevel() by default.
+ */
+inline SimdLevel& activeSimdLevel()
+{
+    static SimdLevel eLevel = detectSimdLevel();
+    return eLevel;
+}
+
+/**
+ * @brief Select the kernels, e.g. to compare them.
+ *
+ * @param reLevel SIMD level; Scalar is always supported.
+ *
+ * @return Error code; NOT_SUPPORTED if the CPU lacks the level.
+ */
+inline cmn::ErrCode setSimdLevel(SimdLevel reLevel)
+{
+    const auto eDetected = detectSimdLevel();
+    const bool bSupported = (SimdLevel::Scalar == reLevel) || (eDetected == reLevel) ||
+        ((SimdLevel::Sse42 == reLevel) && (SimdLevel::Avx2 == eDetected));
+    if (not bSupported)
+    {
+        return cmn::ErrCode::NOT_SUPPORTED;
+    }
+
+    activeSimdLevel() = reLevel;
+    return cmn::ErrCode::OK;
+}
+
+namespace detail
+{
+// Deviations below 2^51 are converted to double with the 2^52 + 2^51
+// magic number: x86 has no int64 -> double conversion below AVX-512.
+constexpr double INT_TO_DOUBLE_MAGIC = 6755399441055744.0;
+constexpr uint64_t MAX_MAGIC_RANGE = uint64_t(1) << 51;
+
+// The scalar kernels take the count only: the SIMD ones pass their tail
+// as (pointer + done, count - done), a (begin, end) pair made GCC flag
+// the constant-count clones with -Waggressive-loop-optimizations.
+
+inline void subtractScalar(const int64_t* rpMinuend, const int64_t* rpSubtrahend, int64_t rdOffset, int64_t* rpOut,
+        size_t rdCount)
+{
+    for (size_t dIdx = 0; dIdx < rdCount; ++dIdx)
+    {
+        rpOut[dIdx] = rpMinuend[dIdx] - rpSubtrahend[dIdx] - rdOffset;
+    }
+}
+
+inline void timespecToNanosScalar(const int64_t* rpSec, const int64_t* rpNsec, int64_t* rpOut, size_t rdCount)
+{
+    for (size_t dIdx = 0; dIdx < rdCount; ++dIdx)
+    {
+        rpOut[dIdx] = rpSec[dIdx] * NSEC_PER_SEC + rpNsec[dIdx];
+    }
+}
+
+inline void minMaxSumScalar(const int64_t* rpValues, size_t rdCount, int64_t& rdMin, int64_t& rdMax, int64_t& rdSum)
+{
+    for (size_t dIdx = 0; dIdx < rdCount; ++dIdx)
+    {
+        const auto dValue = rpValues[dIdx];
+        rdMin = (dValue < rdMin) ? dValue : rdMin;
+        rdMax = (dValue > rdMax) ? dValue : rdMax;
+        rdSum += dValue;
+    }
+}
+
+inline double squaredDeviationsScalar(const int64_t* rpValues, size_t rdCount, int64_t rdCenter)
+{
+    double dSum = 0.0;
+    for (size_t dIdx = 0; dIdx < rdCount; ++dIdx)
+    {
+        const auto dDeviation = static_cast<double>(rpValues[dIdx] - rdCenter);
+        dSum += dDeviation * dDeviation;
+    }
+
+    return dSum;
+}
+
+#if defined(BATCH_STATS_X86)
+
+// The AVX2 kernels, four lanes.
+
+__attribute__((target("avx2")))
+inline void subtractAvx2(const int64_t* rpMinuend, const int64_t* rpSubtrahend, int64_t rdOffset, int64_t* rpOut,
+        size_t rdCount)
+{
+    const __m256i tOffset = _mm256_set1_epi64x(rdOffset);
+    size_t dIdx = 0;
+    for (; dIdx + 4 <= rdCount; dIdx += 4)
+    {
+        const __m256i tA = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rpMinuend + dIdx));
+        const __m256i tB = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rpSubtrahend + dIdx));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(rpOut + dIdx),
+                _mm256_sub_epi64(_mm256_sub_epi64(tA, tB), tOffset));
+    }
+
+    subtractScalar(rpMinuend + dIdx, rpSubtrahend + dIdx, rdOffset, rpOut + dIdx, rdCount - dIdx);
+}
+
+__attribute__((target("avx2")))
+inline void timespecToNanosAvx2(const int64_t* rpSec, const int64_t* rpNsec, int64_t* rpOut, size_t rdCount)
+{
+    // No 64-bit multiply: sec * 10^9 = lo32 * 10^9 + (hi32 * 10^9) << 32 (mod 2^64).
+    const __m256i tFactor = _mm256_set1_epi64x(NSEC_PER_SEC);
+    size_t dIdx = 0;
+    for (; dIdx + 4 <= rdCount; dIdx += 4)
+    {
+        const __m256i tSec = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rpSec + dIdx));
+        const __m256i tNsec = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rpNsec + dIdx));
+        const __m256i tLow = _mm256_mul_epu32(tSec, tFactor);
+        const __m256i tHigh = _mm256_mul_epu32(_mm256_srli_epi64(tSec, 32), tFactor);
+        const __m256i tProduct = _mm256_add_epi64(tLow, _mm256_slli_epi64(tHigh, 32));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(rpOut + dIdx), _mm256_add_epi64(tProduct, tNsec));
+    }
+
+    timespecToNanosScalar(rpSec + dIdx, rpNsec + dIdx, rpOut + dIdx, rdCount - dIdx);
+}
+
+__attribute__((target("avx2")))
+inline void minMaxSumAvx2(const int64_t* rpValues, size_t rdCount, int64_t& rdMin, int64_t& rdMax, int64_t& rdSum)
+{
+    __m256i tMin = _mm256_set1_epi64x(rdMin);
+    __m256i tMax = _mm256_set1_epi64x(rdMax);
+    __m256i tSum = _mm256_setzero_si256();
+
+    size_t dIdx = 0;
+    for (; dIdx + 4 <= rdCount; dIdx += 4)
+    {
+        const __m256i tValue = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rpValues + dIdx));
+        tMin = _mm256_blendv_epi8(tMin, tValue, _mm256_cmpgt_epi64(tMin, tValue));
+        tMax = _mm256_blendv_epi8(tMax, tValue, _mm256_cmpgt_epi64(tValue, tMax));
+        tSum = _mm256_add_epi64(tSum, tValue);
+    }
+
+    alignas(32) int64_t aMin[4];
+    alignas(32) int64_t aMax[4];
+    alignas(32) int64_t aSum[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(aMin), tMin);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(aMax), tMax);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(aSum), tSum);
+
+    for (size_t dLane = 0; dLane < 4; ++dLane)
+    {
+        rdMin = (aMin[dLane] < rdMin) ? aMin[dLane] : rdMin;
+        rdMax = (aMax[dLane] > rdMax) ? aMax[dLane] : rdMax;
+        rdSum += aSum[dLane];
+    }
+
+    minMaxSumScalar(rpValues + dIdx, rdCount - dIdx, rdMin, rdMax, rdSum);
+}
+
+__attribute__((target("avx2")))
+inline double squaredDeviationsAvx2(const int64_t* rpValues, size_t rdCount, int64_t rdCenter)
+{
+    const __m256i tCenter = _mm256_set1_epi64x(rdCenter);
+    const __m256d tMagic = _mm256_set1_pd(INT_TO_DOUBLE_MAGIC);
+    __m256d tSum = _mm256_setzero_pd();
+
+    size_t dIdx = 0;
+    for (; dIdx + 4 <= rdCount; dIdx += 4)
+    {
+        const __m256i tValue = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rpValues + dIdx));
+        const __m256i tBiased = _mm256_add_epi64(_mm256_sub_epi64(tValue, tCenter), _mm256_castpd_si256(tMagic));
+        const __m256d tDeviation = _mm256_sub_pd(_mm256_castsi256_pd(tBiased), tMagic);
+        tSum = _mm256_add_pd(tSum, _mm256_mul_pd(tDeviation, tDeviation));
+    }
+
+    alignas(32) double aSum[4];
+    _mm256_store_pd(aSum, tSum);
+    return aSum[0] + aSum[1] + aSum[2] + aSum[3] + squaredDeviationsScalar(rpValues + dIdx, rdCount - dIdx, rdCenter);
+}
+
+// The SSE4.2 kernels (pcmpgtq), two lanes.
+
+__attribute__((target("sse4.2")))
+inline void subtractSse42(const int64_t* rpMinuend, const int64_t* rpSubtrahend, int64_t rdOffset, int64_t* rpOut,
+        size_t rdCount)
+{
+    const __m128i tOffset = _mm_set1_epi64x(rdOffset);
+    size_t dIdx = 0;
+    for (; dIdx + 2 <= rdCount; dIdx += 2)
+    {
+        const __m128i tA = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rpMinuend + dIdx));
+        const __m128i tB = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rpSubtrahend + dIdx));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rpOut + dIdx), _mm_sub_epi64(_mm_sub_epi64(tA, tB), tOffset));
+    }
+
+    subtractScalar(rpMinuend + dIdx, rpSubtrahend + dIdx, rdOffset, rpOut + dIdx, rdCount - dIdx);
+}
+
+__attribute__((target("sse4.2")))
+inline void timespecToNanosSse42(const int64_t* rpSec, const int64_t* rpNsec, int64_t* rpOut, size_t rdCount)
+{
+    const __m128i tFactor = _mm_set1_epi64x(NSEC_PER_SEC);
+    size_t dIdx = 0;
+    for (; dIdx + 2 <= rdCount; dIdx += 2)
+    {
+        const __m128i tSec = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rpSec + dIdx));
+        const __m128i tNsec = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rpNsec + dIdx));
+        const __m128i tLow = _mm_mul_epu32(tSec, tFactor);
+        const __m128i tHigh = _mm_mul_epu32(_mm_srli_epi64(tSec, 32), tFactor);
+        const __m128i tProduct = _mm_add_epi64(tLow, _mm_slli_epi64(tHigh, 32));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rpOut + dIdx), _mm_add_epi64(tProduct, tNsec));
+    }
+
+    timespecToNanosScalar(rpSec + dIdx, rpNsec + dIdx, rpOut + dIdx, rdCount - dIdx);
+}
+
+__attribute__((target("sse4.2")))
+inline void minMaxSumSse42(const int64_t* rpValues, size_t rdCount, int64_t& rdMin, int64_t& rdMax, int64_t& rdSum)
+{
+    __m128i tMin = _mm_set1_epi64x(rdMin);
+    __m128i tMax = _mm_set1_epi64x(rdMax);
+    __m128i tSum = _mm_setzero_si128();
+
+    size_t dIdx = 0;
+    for (; dIdx + 2 <= rdCount; dIdx += 2)
+    {
+        const __m128i tValue = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rpValues + dIdx));
+        tMin = _mm_blendv_epi8(tMin, tValue, _mm_cmpgt_epi64(tMin, tValue));
+        tMax = _mm_blendv_epi8(tMax, tValue, _mm_cmpgt_epi64(tValue, tMax));
+        tSum = _mm_add_epi64(tSum, tValue);
+    }
+
+    alignas(16) int64_t aMin[2];
+    alignas(16) int64_t aMax[2];
+    alignas(16) int64_t aSum[2];
+    _mm_store_si128(reinterpret_cast<__m128i*>(aMin), tMin);
+    _mm_store_si128(reinterpret_cast<__m128i*>(aMax), tMax);
+    _mm_store_si128(reinterpret_cast<__m128i*>(aSum), tSum);
+
+    for (size_t dLane = 0; dLane < 2; ++dLane)
+    {
+        rdMin = (aMin[dLane] < rdMin) ? aMin[dLane] : rdMin;
+        rdMax = (aMax[dLane] > rdMax) ? aMax[dLane] : rdMax;
+        rdSum += aSum[dLane];
+    }
+
+    minMaxSumScalar(rpValues + dIdx, rdCount - dIdx, rdMin, rdMax, rdSum);
+}
+
+__attribute__((target("sse4.2")))
+inline double squaredDeviationsSse42(const int64_t* rpValues, size_t rdCount, int64_t rdCenter)
+{
+    const __m128i tCenter = _mm_set1_epi64x(rdCenter);
+    const __m128d tMagic = _mm_set1_pd(INT_TO_DOUBLE_MAGIC);
+    __m128d tSum = _mm_setzero_pd();
+
+    size_t dIdx = 0;
+    for (; dIdx + 2 <= rdCount; dIdx += 2)
+    {
+        const __m128i tValue = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rpValues + dIdx));
+        const __m128i tBiased = _mm_add_epi64(_mm_sub_epi64(tValue, tCenter), _mm_castpd_si128(tMagic));
+        const __m128d tDeviation = _mm_sub_pd(_mm_castsi128_pd(tBiased), tMagic);
+        tSum = _mm_add_pd(tSum, _mm_mul_pd(tDeviation, tDeviation));
+    }
+
+    alignas(16) double aSum[2];
+    _mm_store_pd(aSum, tSum);
+    return aSum[0] + aSum[1] + squaredDeviationsScalar(rpValues + dIdx, rdCount - dIdx, rdCenter);
+}
+
+#elif defined(BATCH_STATS_NEON)
+
+// The NEON kernels, two lanes.
+
+inline void subtractNeon(const int64_t* rpMinuend, const int64_t* rpSubtrahend, int64_t rdOffset, int64_t* rpOut,
+        size_t rdCount)
+{
+    const int64x2_t tOffset = vdupq_n_s64(rdOffset);
+    size_t dIdx = 0;
+    for (; dIdx + 2 <= rdCount; dIdx += 2)
+    {
+        const int64x2_t tA = vld1q_s64(rpMinuend + dIdx);
+        const int64x2_t tB = vld1q_s64(rpSubtrahend + dIdx);
+        vst1q_s64(rpOut + dIdx, vsubq_s64(vsubq_s64(tA, tB), tOffset));
+    }
+
+    subtractScalar(rpMinuend + dIdx, rpSubtrahend + dIdx, rdOffset, rpOut + dIdx, rdCount - dIdx);
+}
+
+inline void timespecToNanosNeon(const int64_t* rpSec, const int64_t* rpNsec, int64_t* rpOut, size_t rdCount)
+{
+    // No 64-bit lane multiply: sec * 10^9 = lo32 * 10^9 + (hi32 * 10^9) << 32 (mod 2^64).
+    size_t dIdx = 0;
+    for (; dIdx + 2 <= rdCount; dIdx += 2)
+    {
+        const uint64x2_t tSec = vreinterpretq_u64_s64(vld1q_s64(rpSec + dIdx));
+        const uint64x2_t tLow = vmull_n_u32(vmovn_u64(tSec), NSEC_PER_SEC);
+        const uint64x2_t tHigh = vmull_n_u32(vshrn_n_u64(tSec, 32), NSEC_PER_SEC);
+        const uint64x2_t tProduct = vaddq_u64(tLow, vshlq_n_u64(tHigh, 32));
+        vst1q_s64(rpOut + dIdx, vaddq_s64(vreinterpretq_s64_u64(tProduct), vld1q_s64(rpNsec + dIdx)));
+    }
+
+    timespecToNanosScalar(rpSec + dIdx, rpNsec + dIdx, rpOut + dIdx, rdCount - dIdx);
+}
+
+inline void minMaxSumNeon(const int64_t* rpValues, size_t rdCount, int64_t& rdMin, int64_t& rdMax, int64_t& rdSum)
+{
+    int64x2_t tMin = vdupq_n_s64(rdMin);
+    int64x2_t tMax = vdupq_n_s64(rdMax);
+    int64x2_t tSum = vdupq_n_s64(0);
+
+    size_t dIdx = 0;
+    for (; dIdx + 2 <= rdCount; dIdx += 2)
+    {
+        const int64x2_t tValue = vld1q_s64(rpValues + dIdx);
+        tMin = vbslq_s64(vcgtq_s64(tMin, tValue), tValue, tMin);
+        tMax = vbslq_s64(vcgtq_s64(tValue, tMax), tValue, tMax);
+        tSum = vaddq_s64(tSum, tValue);
+    }
+
+    int64_t aMin[2];
+    int64_t aMax[2];
+    vst1q_s64(aMin, tMin);
+    vst1q_s64(aMax, tMax);
+
+    for (size_t dLane = 0; dLane < 2; ++dLane)
+    {
+        rdMin = (aMin[dLane] < rdMin) ? aMin[dLane] : rdMin;
+        rdMax = (aMax[dLane] > rdMax) ? aMax[dLane] : rdMax;
+    }
+
+    rdSum += vaddvq_s64(tSum);
+    minMaxSumScalar(rpValues + dIdx, rdCount - dIdx, rdMin, rdMax, rdSum);
+}
+
+inline double squaredDeviationsNeon(const int64_t* rpValues, size_t rdCount, int64_t rdCenter)
+{
+    const int64x2_t tCenter = vdupq_n_s64(rdCenter);
+    float64x2_t tSum = vdupq_n_f64(0.0);
+
+    size_t dIdx = 0;
+    for (; dIdx + 2 <= rdCount; dIdx += 2)
+    {
+        const float64x2_t tDeviation = vcvtq_f64_s64(vsubq_s64(vld1q_s64(rpValues + dIdx), tCenter));
+        tSum = vfmaq_f64(tSum, tDeviation, tDeviation);
+    }
+
+    return vaddvq_f64(tSum) + squaredDeviationsScalar(rpValues + dIdx, rdCount - dIdx, rdCenter);
+}
+
+#endif
+}
+
+/**
+ * @brief rpOut[i] = rpMinuend[i] - rpSubtrahend[i] - rdOffset.
+ *        The output may alias either input.
+ *
+ * @param rpMinuend Minuend array.
+ * @param rpSubtrahend Subtrahend array.
+ * @param rdOffset Value subtracted from every difference, e.g. the period.
+ * @param rpOut Output array.
+ * @param rdCount Arrays length.
+ */
+inline void subtract(const int64_t* rpMinuend, const int64_t* rpSubtrahend, int64_t rdOffset, int64_t* rpOut,
+        size_t rdCount)
+{
+    switch (activeSimdLevel())
+    {
+#if defined(BATCH_STATS_X86)
+        case SimdLevel::Avx2:
+            detail::subtractAvx2(rpMinuend, rpSubtrahend, rdOffset, rpOut, rdCount);
+            return;
+        case SimdLevel::Sse42:
+            detail::subtractSse42(rpMinuend, rpSubtrahend, rdOffset, rpOut, rdCount);
+            return;
+#elif defined(BATCH_STATS_NEON)
+        case SimdLevel::Neon:
+            detail::subtractNeon(rpMinuend, rpSubtrahend, rdOffset, rpOut, rdCount);
+            return;
+#endif
+        default:
+            detail::subtractScalar(rpMinuend, rpSubtrahend, rdOffset, rpOut, rdCount);
+            return;
+    }
+}
+
+/**
+ * @brief Deltas between consecutive timestamps minus the requested period,
+ *        i.e. the period errors: rpOut[i] = rpStamps[i + 1] - rpStamps[i] - rdPeriod.
+ *        Pass a zero period to get the plain deltas.
+ *
+ * @param rpStamps Timestamps, nanoseconds.
+ * @param rdCount Number of timestamps; rdCount - 1 values are written.
+ * @param rdPeriod Requested period, nanoseconds.
+ * @param rpOut Output array, may not alias rpStamps.
+ */
+inline void periodErrors(const int64_t* rpStamps, size_t rdCount, int64_t rdPeriod, int64_t* rpOut)
+{
+    if (rdCount > 1)
+    {
+        subtract(rpStamps + 1, rpStamps, rdPeriod, rpOut, rdCount - 1);
+    }
+}
+
+/**
+ * @brief Convert SoA timespec arrays into nanoseconds. The fields must be
+ *        normalized the usual way, see rt_time::Nanos::fromTimespec().
+ *
+ * @param rpSec tv_sec array.
+ * @param rpNsec tv_nsec array.
+ * @param rpOut Output array, may alias either input.
+ * @param rdCount Arrays length.
+ */
+inline void timespecToNanos(const int64_t* rpSec, const int64_t* rpNsec, int64_t* rpOut, size_t rdCount)
+{
+    switch (activeSimdLevel())
+    {
+#if defined(BATCH_STATS_X86)
+        case SimdLevel::Avx2:
+            detail::timespecToNanosAvx2(rpSec, rpNsec, rpOut, rdCount);
+            return;
+        case SimdLevel::Sse42:
+            detail::timespecToNanosSse42(rpSec, rpNsec, rpOut, rdCount);
+            return;
+#elif defined(BATCH_STATS_NEON)
+        case SimdLevel::Neon:
+            detail::timespecToNanosNeon(rpSec, rpNsec, rpOut, rdCount);
+            return;
+#endif
+        default:
+            detail::timespecToNanosScalar(rpSec, rpNsec, rpOut, rdCount);
+            return;
+    }
+}
+
+/**
+ * @brief Compute min, max, mean and variance in two passes: integer
+ *        min/max/sum first, then the squared deviations from the rounded
+ *        mean. The sum of the values must fit into int64, which holds for
+ *        deltas and errors (not for absolute timestamps of long captures).
+ *
+ * @param rpValues Values.
+ * @param rdCount Number of values.
+ *
+ * @return Statistics; all zero for an empty array.
+ */
+inline SampleStats computeStats(const int64_t* rpValues, size_t rdCount)
+{
+    SampleStats tStats {0, 0, 0, 0.0, 0.0};
+    if (0 == rdCount)
+    {
+        return tStats;
+    }
+
+    int64_t dMin = INT64_MAX;
+    int64_t dMax = INT64_MIN;
+    int64_t dSum = 0;
+    const auto eLevel = activeSimdLevel();
+
+    switch (eLevel)
+    {
+#if defined(BATCH_STATS_X86)
+        case SimdLevel::Avx2:
+            detail::minMaxSumAvx2(rpValues, rdCount, dMin, dMax, dSum);
+            break;
+        case SimdLevel::Sse42:
+            detail::minMaxSumSse42(rpValues, rdCount, dMin, dMax, dSum);
+            break;
+#elif defined(BATCH_STATS_NEON)
+        case SimdLevel::Neon:
+            detail::minMaxSumNeon(rpValues, rdCount, dMin, dMax, dSum);
+            break;
+#endif
+        default:
+            detail::minMaxSumScalar(rpValues, rdCount, dMin, dMax, dSum);
+            break;
+    }
+
+    const double dMean = static_cast<double>(dSum) / static_cast<double>(rdCount);
+    const auto dCenter = static_cast<int64_t>(std::llround(dMean));
+
+    // The x86 conversion trick needs every deviation below 2^51 ns (~26 days).
+    // The unsigned differences do not overflow for any range.
+    const bool bMagicRange =
+        ((static_cast<uint64_t>(dMax) - static_cast<uint64_t>(dCenter)) < detail::MAX_MAGIC_RANGE) &&
+        ((static_cast<uint64_t>(dCenter) - static_cast<uint64_t>(dMin)) < detail::MAX_MAGIC_RANGE);
+
+    double dSquares = 0.0;
+    switch (bMagicRange ? eLevel : SimdLevel::Scalar)
+    {
+#if defined(BATCH_STATS_X86)
+        case SimdLevel::Avx2:
+            dSquares = detail::squaredDeviationsAvx2(rpValues, rdCount, dCenter);
+            break;
+        case SimdLevel::Sse42:
+            dSquares = detail::squaredDeviationsSse42(rpValues, rdCount, dCenter);
+            break;
+#elif defined(BATCH_STATS_NEON)
+        case SimdLevel::Neon:
+            dSquares = detail::squaredDeviationsNeon(rpValues, rdCount, dCenter);
+            break;
+#endif
+        default:
+            dSquares = detail::squaredDeviationsScalar(rpValues, rdCount, dCenter);
+            break;
+    }
+
+    // Sum((x - mean)^2) = Sum((x - c)^2) - n * (mean - c)^2.
+    const double dShift = dMean - static_cast<double>(dCenter);
+    const double dVariance = dSquares / static_cast<double>(rdCount) - dShift * dShift;
+
+    tStats.dCount = rdCount;
+    tStats.dMin = dMin;
+    tStats.dMax = dMax;
+    tStats.dMean = dMean;
+    tStats.dVariance = (dVariance > 0.0) ? dVariance : 0.0;
+    return tStats;
+}
+}
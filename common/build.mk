@@ -0,0 +1,93 @@
+# Build settings shared by all the Makefiles. Set COMMON_DIR to the
+# path of this directory before including it.
+#
+#   make [BUILD=<profile>] [ARCH=<target>] [CROSS_COMPILE=<prefix>]
+#
+# BUILD profiles:
+#   debug           -O0, full debug info.
+#   release         -O2, asserts off.
+#   relwithdebinfo  -O2 with debug info (default): the numbers mean
+#                   something and the binaries are still debuggable.
+#   lto             -O3 with link time optimization, asserts off.
+#
+# ARCH targets:
+#   generic         Compiler default, runs on any CPU of the ISA (default).
+#   native          The build machine.
+#   x86-64-v2       Nehalem and later: SSE4.2, POPCNT.
+#   x86-64-v3       Haswell and later: AVX2, BMI2, FMA.
+#   pi3, pi4, pi5   Raspberry Pi 3/4/5 (Cortex-A53/A72/A76, AArch64),
+#                   cross-built with e.g. CROSS_COMPILE=aarch64-linux-gnu-.
+#
+# Switching the profile or the target rebuilds everything, the flags
+# are kept in .build_flags of every directory.
+
+.DEFAULT_GOAL := all
+
+BUILD ?= relwithdebinfo
+ARCH ?= generic
+
+CXX = $(CROSS_COMPILE)g++
+AR = $(CROSS_COMPILE)gcc-ar
+
+ifeq ($(BUILD),debug)
+OPT_FLAGS = -O0 -ggdb
+else ifeq ($(BUILD),release)
+OPT_FLAGS = -O2 -DNDEBUG
+else ifeq ($(BUILD),relwithdebinfo)
+OPT_FLAGS = -O2 -ggdb
+else ifeq ($(BUILD),lto)
+OPT_FLAGS = -O3 -DNDEBUG -flto=auto
+# The code is generated at the link, so are the optimizer warnings.
+LTO_LDFLAGS = -O3 -flto=auto -Wall -Werror
+else
+$(error Unknown BUILD=$(BUILD): use debug, release, relwithdebinfo or lto)
+endif
+
+ifeq ($(ARCH),generic)
+ARCH_FLAGS =
+else ifeq ($(ARCH),native)
+ARCH_FLAGS = -march=native
+else ifeq ($(ARCH),x86-64-v2)
+ARCH_FLAGS = -march=x86-64-v2 -mtune=generic
+else ifeq ($(ARCH),x86-64-v3)
+ARCH_FLAGS = -march=x86-64-v3 -mtune=generic
+else ifeq ($(ARCH),pi3)
+ARCH_FLAGS = -mcpu=cortex-a53
+else ifeq ($(ARCH),pi4)
+ARCH_FLAGS = -mcpu=cortex-a72
+else ifeq ($(ARCH),pi5)
+ARCH_FLAGS = -mcpu=cortex-a76
+else
+$(error Unknown ARCH=$(ARCH): use generic, native, x86-64-v2, x86-64-v3, pi3, pi4 or pi5)
+endif
+
+INCLUDE_DIRS = -I$(COMMON_DIR)
+CXXFLAGS = --std=c++11 -Wall -Werror -Wpedantic $(OPT_FLAGS) $(ARCH_FLAGS) $(INCLUDE_DIRS) $(CXXDEFS) -MMD -MP
+LDFLAGS = $(ARCH_FLAGS) $(LTO_LDFLAGS)
+LDLIBS = -lpthread -lstdc++ -lrt
+
+# The logging, the scheduler setup and the clock helpers, built once
+# per directory tree with the same flags as the programs.
+LIBCOMMON_SRCS = common.cpp threading.cpp rt_time.cpp
+LIBCOMMON = $(COMMON_DIR)/libcommon.a
+
+# Rewritten only when the flags change, so a profile or target switch
+# rebuilds the objects and relinks the programs.
+BUILD_FLAGS_FILE = .build_flags
+BUILD_FLAGS = $(CXX) $(CXXFLAGS) $(LDFLAGS)
+$(shell echo '$(BUILD_FLAGS)' | cmp -s - $(BUILD_FLAGS_FILE) || echo '$(BUILD_FLAGS)' > $(BUILD_FLAGS_FILE))
+
+%.o: %.cpp $(BUILD_FLAGS_FILE)
+	$(CXX) $(CXXFLAGS) -c -o $@ $<
+
+# Every program links the library, which is brought up to date first.
+ifneq ($(COMMON_DIR),.)
+$(LIBCOMMON): FORCE
+	$(MAKE) -C $(COMMON_DIR) libcommon.a
+endif
+
+FORCE:
+
+.PHONY: FORCE
+
+-include $(wildcard *.d)
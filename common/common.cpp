@@ -0,0 +1,40 @@
+#include <cstdarg>
+
+#include "common.h"
+
+// Out-of-line part of common.h, built into libcommon.
+
+void pushLogLine(LogSeverity reSeverity, const char* rpFile, int rdLine, const char* rpMessage)
+{
+    // Location prefix + message; long enough for any message
+    // produced by logNotify() plus the location.
+    char aLog[str_utils::MAX_FORMAT_LENGTH * 2];
+
+    const char* pSeverityStr = reSeverity == LogSeverity::TRACE ? "TRACE" : "ERROR";
+    str_utils::formatTo(aLog, sizeof(aLog), "[%s] %s @ %d: %s", pSeverityStr, rpFile, rdLine, rpMessage);
+
+    if (reSeverity == LogSeverity::ERROR)
+    {
+        std::cerr << aLog << std::endl;
+    }
+    else
+    {
+        // All other severity levels considered as non-error ones.
+        std::cout << aLog << std::endl;
+    }
+
+    const auto tSyslogSeverity = reSeverity == LogSeverity::TRACE ? LOG_DEBUG : LOG_ERR;
+    syslog(tSyslogSeverity, "%s", aLog);
+}
+
+void logNotify(LogSeverity reSeverity, const char* rpFile, int rdLine, const char* rpFormat, ...)
+{
+    va_list tArgs;
+    va_start(tArgs, rpFormat);
+
+    char* pMessage = str_utils::threadBuffer();
+    str_utils::formatTo_va(pMessage, str_utils::MAX_FORMAT_LENGTH, rpFormat, tArgs);
+    va_end(tArgs);
+
+    pushLogLine(reSeverity, rpFile, rdLine, pMessage);
+}
@@ -1,11 +1,17 @@
 #pragma once
 
-#include <functional>
+#include <cerrno>
+#include <cstring>
 #include <iostream>
+#include <type_traits>
+#include <utility>
 
+#include <fcntl.h>
+#include <sys/utsname.h>
 #include <syslog.h>
 #include <unistd.h>
 
+#include "async_log.h"
 #include "error_codes.h"
 #include "string_utils.h"
 
@@ -21,42 +27,62 @@ enum class LogSeverity
 };
 
 /**
- * @brief Format and push log message to stdout/stderr and Syslog.
+ * @brief Push a ready log message to stdout/stderr and Syslog.
  *
  * @param reSeverity Severity level ID.
  * @param rpFile Source file where CMN_LOG_... was called.
  * @param rdLine Line at which CMN_LOG_... was called.
- * @param ... Format string and params given in a printf()-like form.
+ * @param rpMessage Formatted message.
  */
-void logNotify(LogSeverity reSeverity, const char* rpFile, int rdLine, ...)
-{
-    va_list tArgs;
-    va_start(tArgs, rdLine);
-
-    const char* pFormat = va_arg(tArgs, const char*);
-    const auto tFmt = str_utils::format_va(pFormat, tArgs);
-    va_end(tArgs);
+void pushLogLine(LogSeverity reSeverity, const char* rpFile, int rdLine, const char* rpMessage);
 
-    const char* pSeverityStr = reSeverity == LogSeverity::TRACE ? "TRACE" : "ERROR";
-    const auto tLocation = str_utils::format("[%s] %s @ %d: ", pSeverityStr, rpFile, rdLine);
-    const std::string tLog = tLocation + tFmt;
+/**
+ * @brief Format and push log message to stdout/stderr and Syslog.
+ *        No heap allocation is done: the message is formatted into
+ *        the calling thread's buffer (see str_utils::threadBuffer()).
+ *
+ * @param reSeverity Severity level ID.
+ * @param rpFile Source file where CMN_LOG_... was called.
+ * @param rdLine Line at which CMN_LOG_... was called.
+ * @param rpFormat Format string.
+ * @param ... Format params given in a printf()-like form.
+ */
+void logNotify(LogSeverity reSeverity, const char* rpFile, int rdLine, const char* rpFormat, ...);
 
-    if (reSeverity == LogSeverity::ERROR)
-    {
-        std::cerr << tLog << std::endl;
-    }
-    else
+/**
+ * @brief Log message dispatcher used by CMN_LOG_... macros. If the
+ *        asynchronous backend is running (see cmn::startAsyncLogging())
+ *        the message is only queued by the calling thread, otherwise
+ *        it is formatted and pushed in place by logNotify().
+ *
+ * @param reSeverity Severity level ID.
+ * @param rpFile Source file where CMN_LOG_... was called.
+ * @param rdLine Line at which CMN_LOG_... was called.
+ * @param rpFormat Format string.
+ * @param rtArgs Format params.
+ */
+template <typename... Args>
+void logRecord(LogSeverity reSeverity, const char* rpFile, int rdLine, const char* rpFormat, const Args&... rtArgs)
+{
+    // Never block here: if the ring is full the record is dropped and
+    // reported by the backend. The synchronous path is taken only if the
+    // backend is stopped, even if it happens meanwhile.
+    if (async_log::isRunning() &&
+            async_log::push(static_cast<int>(reSeverity), rpFile, rdLine, rpFormat, rtArgs...))
     {
-        // All other severity levels considered as non-error ones.
-        std::cout << tLog << std::endl;
+        return;
     }
 
-    const auto tSyslogSeverity = reSeverity == LogSeverity::TRACE ? LOG_DEBUG : LOG_ERR;
-    syslog(tSyslogSeverity, "%s", tLog.c_str());
+    logNotify(reSeverity, rpFile, rdLine, rpFormat, rtArgs...);
 }
 
-#define CMN_LOG_TRACE(...) logNotify(LogSeverity::TRACE, __FILE__, __LINE__, __VA_ARGS__);
-#define CMN_LOG_ERROR(...) logNotify(LogSeverity::ERROR, __FILE__, __LINE__, __VA_ARGS__);
+// The unevaluated checkFormat() "call" makes the compiler validate
+// the arguments against the format string at compile time.
+
+#define CMN_LOG_TRACE(...) ((void) sizeof(str_utils::checkFormat(__VA_ARGS__)),\
+        logRecord(LogSeverity::TRACE, __FILE__, __LINE__, __VA_ARGS__));
+#define CMN_LOG_ERROR(...) ((void) sizeof(str_utils::checkFormat(__VA_ARGS__)),\
+        logRecord(LogSeverity::ERROR, __FILE__, __LINE__, __VA_ARGS__));
 
 // A general-purpose macro to handle standard POSIX calls
 // returning errors according to the well-known scheme
@@ -83,8 +109,12 @@ namespace cmn
  *        must be provided with a callback which should implement cleanup,
  *        resources release etc. Basically, this class implements try: ... finally:
  *        paradigm from the languages like Object Pascal or Python.
+ *        The callback type is a template parameter, so a lambda is stored
+ *        and called inline: no std::function allocation or indirect call.
+ *        Use makeScopeGuard() to deduce the type.
  */
-class Finally
+template <typename F>
+class ScopeGuard
 {
 public:
 
@@ -94,75 +124,99 @@ public:
      * @param[in] rtHandler Function (callback) to be invoked
      *                      upon class instance destruction.
      */
-    explicit Finally(const std::function<void()>& rtHandler) :
-        mtHandler(rtHandler)
+    explicit ScopeGuard(F&& rtHandler) :
+        mtHandler(std::move(rtHandler)),
+        mbActive(true)
+    {}
+
+    explicit ScopeGuard(const F& rtHandler) :
+        mtHandler(rtHandler),
+        mbActive(true)
     {}
 
+    /**
+     * @brief Move constructor: the responsibility for the cleanup
+     *        moves to the new guard.
+     */
+    ScopeGuard(ScopeGuard&& rtOther) :
+        mtHandler(std::move(rtOther.mtHandler)),
+        mbActive(rtOther.mbActive)
+    {
+        rtOther.dismiss();
+    }
+
     /**
      * @brief Destructor.
      */
-    ~Finally()
+    ~ScopeGuard()
     {
-        mtHandler();
+        if (mbActive)
+        {
+            mtHandler();
+        }
     }
 
-    // Default implementations for the other constructors
-    // and assignment operators to make the compiler happy.
+    /**
+     * @brief Cancel the cleanup, e.g. once the resource ownership
+     *        has been passed elsewhere.
+     */
+    void dismiss()
+    {
+        mbActive = false;
+    }
 
-    Finally(const Finally& rtOther) = default;
-    Finally(Finally&& rtOther) = default;
-    Finally& operator=(const Finally& rtOther) = default;
-    Finally& operator=(Finally&& rtOther) = default;
+    // A copy would run the cleanup twice.
+    ScopeGuard(const ScopeGuard&) = delete;
+    ScopeGuard& operator=(const ScopeGuard&) = delete;
+    ScopeGuard& operator=(ScopeGuard&&) = delete;
 
 private:
-    const std::function<void()> mtHandler;
+    F mtHandler;
+    bool mbActive;
 };
 
 /**
- * @brief Call `uname -a` to get system info and
- *        send it to Syslog.
+ * @brief Make a scope guard calling the given callback on scope exit:
+ *        auto tGuard = makeScopeGuard([]() { ... });
+ *
+ * @param[in] rtHandler Callback.
+ *
+ * @return Scope guard.
+ */
+template <typename F>
+ScopeGuard<typename std::decay<F>::type> makeScopeGuard(F&& rtHandler)
+{
+    return ScopeGuard<typename std::decay<F>::type>(std::forward<F>(rtHandler));
+}
+
+// Syslog file truncated by prepareSyslog().
+constexpr auto SYSLOG_PATH = "/var/log/syslog";
+
+/**
+ * @brief Get system info with uname(2) and send it to Syslog
+ *        in the `uname -a` format.
  *
  *        Please note that system("uname...") produces
  *        an extra output (user name, "pi" in my case, is
  *        added by some reason) which goes to Syslog and
- *        makes the autograder unhappy.
+ *        makes the autograder unhappy; no process is
+ *        spawned now, so there is no extra output either.
  *
  * @return Error code.
  */
-ErrCode pushUnameOutput()
+inline ErrCode pushUnameOutput()
 {
-    // Call uname and open a pipe to interact with it.
-    FILE* pFile = popen("/usr/bin/uname -a", "r");
-
-    if (nullptr == pFile)
+    utsname tInfo {};
+    if (0 != uname(&tInfo))
     {
-        std::cerr << "Failed to invoke uname";
+        std::cerr << "Failed to get uname info: " << errno << " (" << strerror(errno) << ")" << std::endl;
         return ErrCode::GENERAL_ERR;
     }
 
-    // A plenty for uname output which is one-liner. Since a typical
-    // thread stack is something like a couple of Megs we can afford
-    // 2K on stack without a risk of tampering. The buffer is zero-
-    // initialized.
-    char aOutBuf[2048] {};
-
-    Finally tPipeGuard([&pFile]()
-            {
-                // Free the pipe.
-                pclose(pFile);
-            });
-
-    // Read the output. We don't need a loop here since
-    // uname outputs one line which is shorter than the
-    // buffer we allocate.
-    if (nullptr == fgets(aOutBuf, sizeof(aOutBuf), pFile))
-    {
-        std::cerr << "Failed to get uname output";
-        return ErrCode::GENERAL_ERR;
-    }
-
-    // Push uname output to Syslog.
-    syslog(LOG_DEBUG, "%s", aOutBuf);
+    // coreutils uname reports the OS name after the machine.
+    const bool bLinux = (0 == strcmp(tInfo.sysname, "Linux"));
+    syslog(LOG_DEBUG, "%s %s %s %s %s%s", tInfo.sysname, tInfo.nodename, tInfo.release,
+            tInfo.version, tInfo.machine, bLinux ? " GNU/Linux" : "");
 
     return ErrCode::OK;
 }
@@ -172,24 +226,61 @@ ErrCode pushUnameOutput()
  *        uname output to it.
  *
  * @param[in] rpSyslogLabel Label to be used to prepend all messages.
+ * @param[in] rbTruncate If true - truncate the Syslog file first.
  *
  * @return Error code.
  */
-ErrCode prepareSyslog(const char* rpSyslogLabel)
+inline ErrCode prepareSyslog(const char* rpSyslogLabel, bool rbTruncate = true)
 {
-    // A lazy approach: I didn't want to add another
-    // FILE*- or stream-based code just to truncate
-    // Syslog fire; for the educational purpose
-    // system() call may be enough.
-    //
     // Syslog is truncated to remove the old info
-    // which could break the autograder.
-    if (0 != system("/usr/bin/truncate -s 0 /var/log/syslog"))
+    // which could break the autograder. Done in-process:
+    // forking /usr/bin/truncate was slow and did not work
+    // in the containers lacking the binary. The file is
+    // created if missing, as truncate does.
+    if (rbTruncate)
     {
-        return ErrCode::GENERAL_ERR;
+        const int dFd = open(SYSLOG_PATH, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+        if (dFd < 0)
+        {
+            std::cerr << "Failed to truncate " << SYSLOG_PATH << ": " << errno << " (" << strerror(errno) << ")"
+                      << std::endl;
+            return ErrCode::GENERAL_ERR;
+        }
+
+        close(dFd);
     }
 
     openlog(rpSyslogLabel, LOG_NDELAY, LOG_DAEMON);
     return pushUnameOutput();
 }
+
+/**
+ * @brief Switch CMN_LOG_... macros to the asynchronous mode: the calling
+ *        threads only queue the records while formatting and output are
+ *        done by a low-priority drain thread. Should be called before
+ *        the scheduler is adjusted so the drain thread is created
+ *        from a non-RT context.
+ *
+ * @return Error code.
+ */
+inline ErrCode startAsyncLogging()
+{
+    return async_log::start([](int rdSeverity, const char* rpFile, int rdLine, const char* rpMessage)
+            {
+                const auto eSeverity = (rdSeverity == static_cast<int>(LogSeverity::TRACE)) ?
+                    LogSeverity::TRACE : LogSeverity::ERROR;
+                pushLogLine(eSeverity, rpFile, rdLine, rpMessage);
+            });
+}
+
+/**
+ * @brief Flush the queued log records and switch CMN_LOG_... macros
+ *        back to the synchronous mode. Also called automatically at exit.
+ *
+ * @return Error code.
+ */
+inline ErrCode stopAsyncLogging()
+{
+    return async_log::stop();
+}
 }
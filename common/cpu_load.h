@@ -0,0 +1,557 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+#include <strings.h>
+
+#include "batch_stats.h"
+#include "common.h"
+#include "error_codes.h"
+#include "rt_time.h"
+#include "threading.h"
+
+// Synthetic CPU load kernels for the throughput measurements:
+//   scalar - a dependent chain of integer additions, the sum 1..n;
+//   vector - the batch_stats SIMD statistics over an L1-resident block;
+//   stream - a sequential read of a buffer far larger than the LLC,
+//            bound by the memory bandwidth;
+//   chase  - a dependent random walk over the cache lines of such
+//            a buffer, bound by the memory latency.
+// The data of all the kernels is built once per LoadSet and only read
+// afterwards, so any number of threads may share a set; the state of
+// every thread is its own LoadCursor.
+
+namespace cpu_load
+{
+enum class LoadKernel
+{
+    Scalar,
+    Vector,
+    Stream,
+    Chase
+};
+
+// Work done by one unit of every kernel.
+constexpr size_t SCALAR_UNIT_ADDS = 4096;
+constexpr size_t VECTOR_BLOCK_VALUES = 2048;      // 16 KiB, one block per unit.
+constexpr size_t STREAM_UNIT_BYTES = 64 * 1024;
+constexpr size_t CHASE_UNIT_LOADS = 1024;
+
+// Bytes of the stream and of the chase buffers each: beyond
+// the last level cache of the current machines.
+constexpr size_t DEFAULT_LOAD_FOOTPRINT = 64 * 1024 * 1024;
+
+constexpr size_t LOAD_CACHE_LINE = 64;
+constexpr size_t CHASE_LINE_WORDS = LOAD_CACHE_LINE / sizeof(uint64_t);
+
+// The kernels run in calibrated slices of this length,
+// the clock is read once per slice.
+constexpr int64_t LOAD_SLICE_NS = 1000000;
+
+/**
+ * @brief LoadSet::init() regions: the data read by the kernels.
+ */
+enum LoadRegions : unsigned
+{
+    LOAD_REGION_NONE = 0,
+    LOAD_REGION_VECTOR = 1 << 0,    // The vector block, 16 KiB.
+    LOAD_REGION_STREAM = 1 << 1,    // The stream buffer, the footprint.
+    LOAD_REGION_CHASE = 1 << 2      // The chase ring, the footprint.
+};
+
+/**
+ * @brief Get the regions read by the kernel.
+ *
+ * @param reKernel Kernel.
+ *
+ * @return LoadRegions bits, none for the scalar kernel.
+ */
+inline unsigned loadKernelRegions(LoadKernel reKernel)
+{
+    switch (reKernel)
+    {
+        case LoadKernel::Vector:
+            return LOAD_REGION_VECTOR;
+        case LoadKernel::Stream:
+            return LOAD_REGION_STREAM;
+        case LoadKernel::Chase:
+            return LOAD_REGION_CHASE;
+        default:
+            return LOAD_REGION_NONE;
+    }
+}
+
+/**
+ * @brief Get the kernel name.
+ *
+ * @param reKernel Kernel.
+ *
+ * @return Kernel name.
+ */
+inline const char* loadKernelToString(LoadKernel reKernel)
+{
+    switch (reKernel)
+    {
+        case LoadKernel::Vector:
+            return "vector";
+        case LoadKernel::Stream:
+            return "stream";
+        case LoadKernel::Chase:
+            return "chase";
+        default:
+            return "scalar";
+    }
+}
+
+/**
+ * @brief Get the unit of the kernel work, see runKernel().
+ *
+ * @param reKernel Kernel.
+ *
+ * @return Unit name.
+ */
+inline const char* loadKernelUnit(LoadKernel reKernel)
+{
+    switch (reKernel)
+    {
+        case LoadKernel::Vector:
+            return "values";
+        case LoadKernel::Stream:
+            return "bytes";
+        case LoadKernel::Chase:
+            return "loads";
+        default:
+            return "adds";
+    }
+}
+
+/**
+ * @brief Parse a kernel name as returned by loadKernelToString(),
+ *        case-insensitive.
+ *
+ * @param rpValue Kernel name.
+ * @param reOutput Kernel output.
+ *
+ * @return Status code.
+ */
+inline cmn::ErrCode parseLoadKernel(const char* rpValue, LoadKernel& reOutput)
+{
+    static const LoadKernel aKernels[] = {LoadKernel::Scalar, LoadKernel::Vector, LoadKernel::Stream,
+                                          LoadKernel::Chase};
+
+    for (const auto eKernel : aKernels)
+    {
+        if (0 == strcasecmp(rpValue, loadKernelToString(eKernel)))
+        {
+            reOutput = eKernel;
+            return cmn::ErrCode::OK;
+        }
+    }
+
+    return cmn::ErrCode::INVALID_ARGS;
+}
+
+/**
+ * @brief Sum the numbers from 1 to the one given, one addition after
+ *        the other: the empty asm keeps the compiler from folding the
+ *        loop into n(n+1)/2 or vectorizing it.
+ *
+ * @param rdLast Last number to add.
+ *
+ * @return Sum.
+ */
+inline uint64_t sumTo(uint64_t rdLast)
+{
+    uint64_t dSum = 0;
+    for (uint64_t dIdx = 1; dIdx <= rdLast; ++dIdx)
+    {
+        dSum += dIdx;
+        asm volatile("" : "+r"(dSum));
+    }
+
+    return dSum;
+}
+
+/**
+ * @brief Data of the kernels: the vector block, the stream buffer and
+ *        the chase ring, in one mapping on the given NUMA node. Only the
+ *        regions asked for are mapped and prefaulted, a kernel must not
+ *        run on a set without its regions, see loadKernelRegions().
+ */
+class LoadSet
+{
+public:
+
+    LoadSet() = default;
+
+    LoadSet(const LoadSet& rtOther) = delete;
+    LoadSet& operator=(const LoadSet& rtOther) = delete;
+
+    ~LoadSet()
+    {
+        threading::freeOnNode(mpMemory, mdSize);
+    }
+
+    /**
+     * @brief Allocate and fill the data. The chase ring is a single
+     *        random cycle over all its cache lines (Sattolo's shuffle),
+     *        so the walk visits every line and the prefetchers cannot
+     *        guess the next one.
+     *
+     * @param[in] rdRegions LoadRegions bits, e.g. loadKernelRegions() of the kernels to run.
+     * @param[in] rdFootprint Bytes of the stream and of the chase buffers each.
+     * @param[in] rdNode NUMA node, negative - the node of the calling thread.
+     *
+     * @return Error code.
+     */
+    cmn::ErrCode init(unsigned rdRegions, size_t rdFootprint = DEFAULT_LOAD_FOOTPRINT, int rdNode = -1)
+    {
+        if (nullptr != mpMemory)
+        {
+            return cmn::ErrCode::ALREADY_ENABLED;
+        }
+
+        const size_t dVectorValues = (0 != (rdRegions & LOAD_REGION_VECTOR)) ? VECTOR_BLOCK_VALUES : 0;
+        mdStreamBytes = (0 != (rdRegions & LOAD_REGION_STREAM)) ?
+                (std::max(rdFootprint / STREAM_UNIT_BYTES, static_cast<size_t>(1)) * STREAM_UNIT_BYTES) : 0;
+        mdChaseLines = (0 != (rdRegions & LOAD_REGION_CHASE)) ?
+                std::max(rdFootprint / LOAD_CACHE_LINE, static_cast<size_t>(2)) : 0;
+        mdSize = dVectorValues * sizeof(int64_t) + mdStreamBytes + mdChaseLines * LOAD_CACHE_LINE;
+
+        // The scalar kernel reads no memory.
+        if (0 == mdSize)
+        {
+            return cmn::ErrCode::OK;
+        }
+
+        mpMemory = threading::allocateOnNode(mdSize, rdNode);
+        if (nullptr == mpMemory)
+        {
+            return cmn::ErrCode::GENERAL_ERR;
+        }
+
+        mpVector = static_cast<int64_t*>(mpMemory);
+        mpStream = reinterpret_cast<const uint64_t*>(mpVector + dVectorValues);
+        mpChase = mpStream + mdStreamBytes / sizeof(uint64_t);
+
+        // xorshift64: the same data on every run.
+        uint64_t dRandom = 0x9e3779b97f4a7c15ull;
+        auto fNext = [&dRandom]()
+        {
+            dRandom ^= dRandom << 13;
+            dRandom ^= dRandom >> 7;
+            dRandom ^= dRandom << 17;
+            return dRandom;
+        };
+
+        for (size_t dIdx = 0; dIdx < dVectorValues; ++dIdx)
+        {
+            mpVector[dIdx] = static_cast<int64_t>(fNext() >> 40);
+        }
+
+        auto pStream = const_cast<uint64_t*>(mpStream);
+        for (size_t dIdx = 0; dIdx < mdStreamBytes / sizeof(uint64_t); ++dIdx)
+        {
+            pStream[dIdx] = dIdx;
+        }
+
+        auto pChase = const_cast<uint64_t*>(mpChase);
+        for (size_t dLine = 0; dLine < mdChaseLines; ++dLine)
+        {
+            pChase[dLine * CHASE_LINE_WORDS] = dLine;
+        }
+
+        for (size_t dLine = (mdChaseLines > 0) ? (mdChaseLines - 1) : 0; dLine > 0; --dLine)
+        {
+            const auto dOther = static_cast<size_t>(fNext() % dLine);
+            std::swap(pChase[dLine * CHASE_LINE_WORDS], pChase[dOther * CHASE_LINE_WORDS]);
+        }
+
+        return cmn::ErrCode::OK;
+    }
+
+    const int64_t* vectorBlock() const
+    {
+        return mpVector;
+    }
+
+    const uint64_t* stream() const
+    {
+        return mpStream;
+    }
+
+    size_t streamBytes() const
+    {
+        return mdStreamBytes;
+    }
+
+    const uint64_t* chase() const
+    {
+        return mpChase;
+    }
+
+    size_t chaseLines() const
+    {
+        return mdChaseLines;
+    }
+
+private:
+    void* mpMemory = nullptr;
+    size_t mdSize = 0;
+    int64_t* mpVector = nullptr;
+    const uint64_t* mpStream = nullptr;
+    size_t mdStreamBytes = 0;
+    const uint64_t* mpChase = nullptr;      // Next line index in the first word of every line.
+    size_t mdChaseLines = 0;
+};
+
+/**
+ * @brief Per-thread kernel state: where the stream and the chase go on
+ *        and the checksum which keeps the results alive.
+ */
+struct LoadCursor
+{
+    size_t dStreamOffset = 0;
+    uint64_t dChaseLine = 0;
+    uint64_t dChecksum = 0;
+};
+
+/**
+ * @brief Make a cursor for the given index. The neighbouring indices
+ *        start the golden ratio of the buffers apart, so the threads or
+ *        the tasks do not read what the previous one has just brought
+ *        into the cache.
+ *
+ * @param rtSet Kernel data.
+ * @param rdIdx Thread or task index.
+ *
+ * @return Cursor.
+ */
+inline LoadCursor cursorFor(const LoadSet& rtSet, size_t rdIdx)
+{
+    constexpr double GOLDEN_RATIO_FRACTION = 0.6180339887498949;
+
+    LoadCursor tCursor;
+    const auto dPhase = static_cast<double>(rdIdx) * GOLDEN_RATIO_FRACTION;
+    const auto dFraction = dPhase - static_cast<double>(static_cast<uint64_t>(dPhase));
+    const auto dStreamUnits = rtSet.streamBytes() / STREAM_UNIT_BYTES;
+
+    tCursor.dStreamOffset = static_cast<size_t>(dFraction * static_cast<double>(dStreamUnits)) * STREAM_UNIT_BYTES;
+
+    // The ring is a single cycle: any line is a start as good as another.
+    tCursor.dChaseLine = static_cast<uint64_t>(dFraction * static_cast<double>(rtSet.chaseLines()));
+    return tCursor;
+}
+
+/**
+ * @brief Work done over a time span.
+ */
+struct LoadResult
+{
+    uint64_t dWork;            // In loadKernelUnit() units.
+    rt_time::Nanos tElapsed;
+
+    double throughput() const
+    {
+        return (tElapsed > rt_time::Nanos()) ?
+            (static_cast<double>(dWork) * 1e9 / static_cast<double>(tElapsed.count())) : 0.0;
+    }
+};
+
+/**
+ * @brief Run the kernel units.
+ *
+ * @param[in] reKernel Kernel.
+ * @param[in] rtSet Kernel data; not used by the scalar kernel.
+ * @param[in,out] rtCursor State of the calling thread.
+ * @param[in] rdUnits Number of units.
+ *
+ * @return Work done, in loadKernelUnit() units.
+ */
+inline uint64_t runKernel(LoadKernel reKernel, const LoadSet& rtSet, LoadCursor& rtCursor, size_t rdUnits)
+{
+    switch (reKernel)
+    {
+        case LoadKernel::Vector:
+            for (size_t dUnit = 0; dUnit < rdUnits; ++dUnit)
+            {
+                const auto tStats = batch_stats::computeStats(rtSet.vectorBlock(), VECTOR_BLOCK_VALUES);
+                rtCursor.dChecksum += static_cast<uint64_t>(tStats.dMax - tStats.dMin);
+            }
+
+            return rdUnits * VECTOR_BLOCK_VALUES;
+
+        case LoadKernel::Stream:
+            for (size_t dUnit = 0; dUnit < rdUnits; ++dUnit)
+            {
+                // Independent accumulators: the loads, not the additions, set the pace.
+                const auto pWords = rtSet.stream() + rtCursor.dStreamOffset / sizeof(uint64_t);
+                uint64_t aSums[4] = {0, 0, 0, 0};
+                for (size_t dIdx = 0; dIdx < STREAM_UNIT_BYTES / sizeof(uint64_t); dIdx += 4)
+                {
+                    aSums[0] += pWords[dIdx];
+                    aSums[1] += pWords[dIdx + 1];
+                    aSums[2] += pWords[dIdx + 2];
+                    aSums[3] += pWords[dIdx + 3];
+                }
+
+                rtCursor.dChecksum += aSums[0] + aSums[1] + aSums[2] + aSums[3];
+                rtCursor.dStreamOffset = (rtCursor.dStreamOffset + STREAM_UNIT_BYTES) % rtSet.streamBytes();
+            }
+
+            return rdUnits * STREAM_UNIT_BYTES;
+
+        case LoadKernel::Chase:
+        {
+            // Every load needs the previous one: one miss after the other.
+            auto dLine = rtCursor.dChaseLine % rtSet.chaseLines();
+            const auto pChase = rtSet.chase();
+            for (size_t dLoad = 0; dLoad < rdUnits * CHASE_UNIT_LOADS; ++dLoad)
+            {
+                dLine = pChase[dLine * CHASE_LINE_WORDS];
+            }
+
+            rtCursor.dChaseLine = dLine;
+            rtCursor.dChecksum += dLine;
+            return rdUnits * CHASE_UNIT_LOADS;
+        }
+
+        default:
+            for (size_t dUnit = 0; dUnit < rdUnits; ++dUnit)
+            {
+                rtCursor.dChecksum += sumTo(SCALAR_UNIT_ADDS);
+            }
+
+            return rdUnits * SCALAR_UNIT_ADDS;
+    }
+}
+
+// Timed runs of the calibration at the final unit count, the fastest
+// one counts: the first runs pay for the cold caches and TLBs.
+constexpr size_t CALIBRATION_RUNS = 5;
+
+/**
+ * @brief Time the kernel units on the calling thread.
+ *
+ * @param[in] reKernel Kernel.
+ * @param[in] rtSet Kernel data.
+ * @param[in,out] rtCursor State of the calling thread.
+ * @param[in] rdUnits Number of units.
+ *
+ * @return Run time in nanoseconds.
+ */
+inline int64_t timeKernel(LoadKernel reKernel, const LoadSet& rtSet, LoadCursor& rtCursor, size_t rdUnits)
+{
+    rt_time::Nanos tStart;
+    rt_time::Nanos tEnd;
+    rt_time::getTime(rt_time::ClockTypeId::MonotonicRaw, tStart);
+    runKernel(reKernel, rtSet, rtCursor, rdUnits);
+    rt_time::getTime(rt_time::ClockTypeId::MonotonicRaw, tEnd);
+    return (tEnd - tStart).count();
+}
+
+/**
+ * @brief Calibrate the kernel on the calling thread: the number of
+ *        units taking LOAD_SLICE_NS.
+ *
+ * @param[in] reKernel Kernel.
+ * @param[in] rtSet Kernel data.
+ *
+ * @return Units per slice, at least 1.
+ */
+inline size_t calibrateSlice(LoadKernel reKernel, const LoadSet& rtSet)
+{
+    LoadCursor tCursor;
+
+    // Double the units until a run is long enough to be timed well.
+    size_t dUnits = 1;
+    while ((timeKernel(reKernel, rtSet, tCursor, dUnits) < LOAD_SLICE_NS / 4) &&
+            (dUnits < (static_cast<size_t>(1) << 30)))
+    {
+        dUnits *= 2;
+    }
+
+    auto dElapsed = timeKernel(reKernel, rtSet, tCursor, dUnits);
+    for (size_t dRun = 1; dRun < CALIBRATION_RUNS; ++dRun)
+    {
+        dElapsed = std::min(dElapsed, timeKernel(reKernel, rtSet, tCursor, dUnits));
+    }
+
+    const auto dSlice = static_cast<double>(dUnits) * LOAD_SLICE_NS / static_cast<double>(std::max<int64_t>(dElapsed, 1));
+    return std::max(static_cast<size_t>(dSlice), static_cast<size_t>(1));
+}
+
+/**
+ * @brief Run the kernel slices until the duration is over.
+ *
+ * @param[in] reKernel Kernel.
+ * @param[in] rtSet Kernel data.
+ * @param[in,out] rtCursor State of the calling thread.
+ * @param[in] rdSliceUnits Units per slice, see calibrateSlice().
+ * @param[in] rtDuration Run time.
+ *
+ * @return Work done and the time it took.
+ */
+inline LoadResult runFor(LoadKernel reKernel, const LoadSet& rtSet, LoadCursor& rtCursor, size_t rdSliceUnits,
+        rt_time::Nanos rtDuration)
+{
+    rt_time::Nanos tStart;
+    rt_time::Nanos tNow;
+    rt_time::getTime(rt_time::ClockTypeId::MonotonicRaw, tStart);
+
+    LoadResult tResult {0, rt_time::Nanos()};
+    do
+    {
+        tResult.dWork += runKernel(reKernel, rtSet, rtCursor, rdSliceUnits);
+        rt_time::getTime(rt_time::ClockTypeId::MonotonicRaw, tNow);
+        tResult.tElapsed = tNow - tStart;
+    }
+    while (tResult.tElapsed < rtDuration);
+
+    return tResult;
+}
+
+/**
+ * @brief Fixed amount of the kernel work, e.g. one task of a thread pool:
+ *        the units calibrated for a duration on the calling thread.
+ */
+struct LoadJob
+{
+    LoadKernel eKernel;
+    const LoadSet* pSet;
+    size_t dUnits;
+
+    /**
+     * @brief Calibrate the job.
+     *
+     * @param[in] reKernel Kernel.
+     * @param[in] rtSet Kernel data, must outlive the job.
+     * @param[in] rtDuration Job run time on the calling thread's CPU.
+     *
+     * @return Job.
+     */
+    static LoadJob calibrate(LoadKernel reKernel, const LoadSet& rtSet, rt_time::Nanos rtDuration)
+    {
+        const auto dUnits = static_cast<double>(calibrateSlice(reKernel, rtSet)) *
+                static_cast<double>(rtDuration.count()) / LOAD_SLICE_NS;
+        return LoadJob {reKernel, &rtSet, std::max(static_cast<size_t>(dUnits), static_cast<size_t>(1))};
+    }
+
+    /**
+     * @brief Run the job.
+     *
+     * @param[in] rdIdx Task index, see cursorFor().
+     * @param[out] rdChecksum Checksum of the kernel results.
+     *
+     * @return Work done, in loadKernelUnit() units.
+     */
+    uint64_t run(size_t rdIdx, uint64_t& rdChecksum) const
+    {
+        auto tCursor = cursorFor(*pSet, rdIdx);
+        const auto dWork = runKernel(eKernel, *pSet, tCursor, dUnits);
+        rdChecksum = tCursor.dChecksum;
+        return dWork;
+    }
+};
+}
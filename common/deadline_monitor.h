@@ -0,0 +1,249 @@
+#pragma once
+
+#include <atomic>
+#include <cinttypes>
+#include <cstdint>
+
+#include <strings.h>
+
+#include "common.h"
+#include "rt_time.h"
+
+namespace rt_time
+{
+/**
+ * @brief What to do once a period's work has overrun its deadline.
+ */
+enum class OverrunPolicy
+{
+    CatchUp,    // Run the missed periods back to back until on time again.
+    Skip,       // Drop the missed periods, resume on the original period grid.
+    Callback    // Let the callback decide (CatchUp or Skip).
+};
+
+/**
+ * @brief Deadline miss details passed to the overrun callback.
+ */
+struct DeadlineMiss
+{
+    uint64_t dPeriod;          // Index of the period which overran, from 0.
+    Nanos tOverrun;            // How late the work completed.
+    uint64_t dConsecutive;     // Misses in a row, this one included.
+};
+
+// Called by the monitored thread on every miss, so it must obey the same
+// RT rules as the loop itself. Returns OverrunPolicy::CatchUp or ::Skip.
+using OverrunCallback = OverrunPolicy (*)(const DeadlineMiss& rtMiss, void* rpContext);
+
+inline const char* overrunPolicyToString(OverrunPolicy rePolicy)
+{
+    switch (rePolicy)
+    {
+        case OverrunPolicy::Skip:
+            return "skip";
+        case OverrunPolicy::Callback:
+            return "callback";
+        default:
+            return "catch-up";
+    }
+}
+
+/**
+ * @brief Parse an overrun policy name as returned by overrunPolicyToString(),
+ *        case-insensitive.
+ *
+ * @param rpValue Policy name.
+ * @param reOutput Policy output.
+ *
+ * @return Status code.
+ */
+inline cmn::ErrCode parseOverrunPolicy(const char* rpValue, OverrunPolicy& reOutput)
+{
+    static const OverrunPolicy aPolicies[] = {OverrunPolicy::CatchUp, OverrunPolicy::Skip, OverrunPolicy::Callback};
+
+    for (const auto ePolicy : aPolicies)
+    {
+        if (0 == strcasecmp(rpValue, overrunPolicyToString(ePolicy)))
+        {
+            reOutput = ePolicy;
+            return cmn::ErrCode::OK;
+        }
+    }
+
+    return cmn::ErrCode::INVALID_ARGS;
+}
+
+/**
+ * @brief Deadline miss detection for a PeriodicTimer loop: the work of
+ *        a period must be complete before the next period starts (or
+ *        the relative deadline given, if shorter). Call
+ *        check() once the work is done, right before the next waitNext().
+ *        The counters have a single writer (the loop thread) and are
+ *        updated with relaxed stores, no lock or RMW; other threads may
+ *        read them at any time, every counter on its own.
+ */
+class DeadlineMonitor
+{
+public:
+
+    /**
+     * @brief Class constructor.
+     *
+     * @param[in] rePolicy Overrun policy.
+     * @param[in] rpCallback Callback for OverrunPolicy::Callback; without
+     *                       it the policy acts as CatchUp.
+     * @param[in] rpContext Callback context.
+     * @param[in] rtRelativeDeadline Deadline relative to the period start,
+     *                               0 - the end of the period.
+     */
+    explicit DeadlineMonitor(OverrunPolicy rePolicy = OverrunPolicy::CatchUp, OverrunCallback rpCallback = nullptr,
+            void* rpContext = nullptr, Nanos rtRelativeDeadline = Nanos()) :
+        mePolicy(rePolicy),
+        mpCallback(rpCallback),
+        mpContext(rpContext),
+        mtRelativeDeadline(rtRelativeDeadline)
+    {
+        mdPeriods.store(0, std::memory_order_relaxed);
+        mdMisses.store(0, std::memory_order_relaxed);
+        mdConsecutiveMisses.store(0, std::memory_order_relaxed);
+        mdMaxConsecutiveMisses.store(0, std::memory_order_relaxed);
+        mdSkippedPeriods.store(0, std::memory_order_relaxed);
+        mdWorstOverrun.store(0, std::memory_order_relaxed);
+    }
+
+    DeadlineMonitor(const DeadlineMonitor&) = delete;
+    DeadlineMonitor& operator=(const DeadlineMonitor&) = delete;
+
+    /**
+     * @brief Check the current period against its deadline and apply
+     *        the overrun policy to the timer.
+     *
+     * @param[in,out] rtTimer Timer of the loop; its deadline() is the end
+     *                        of the current period.
+     *
+     * @return True if the deadline is met.
+     */
+    bool check(PeriodicTimer& rtTimer)
+    {
+        Nanos tNow;
+        getTime(rtTimer.sleepClock(), tNow);
+        return check(rtTimer, tNow);
+    }
+
+    /**
+     * @brief Same as above with the completion time given.
+     *
+     * @param[in,out] rtTimer Timer of the loop.
+     * @param[in] rtNow Work completion time in terms of rtTimer.sleepClock().
+     *
+     * @return True if the deadline is met.
+     */
+    bool check(PeriodicTimer& rtTimer, Nanos rtNow)
+    {
+        const auto dPeriod = mdPeriods.load(std::memory_order_relaxed);
+        mdPeriods.store(dPeriod + 1, std::memory_order_relaxed);
+
+        // The timer deadline is the start of the next period.
+        const auto tDeadline = (mtRelativeDeadline > Nanos()) ?
+            (rtTimer.deadline() - rtTimer.period() + mtRelativeDeadline) : rtTimer.deadline();
+        const auto tOverrun = rtNow - tDeadline;
+        if (tOverrun <= Nanos())
+        {
+            mdConsecutiveMisses.store(0, std::memory_order_relaxed);
+            return true;
+        }
+
+        const auto dConsecutive = mdConsecutiveMisses.load(std::memory_order_relaxed) + 1;
+        mdConsecutiveMisses.store(dConsecutive, std::memory_order_relaxed);
+        mdMisses.store(mdMisses.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+        if (dConsecutive > mdMaxConsecutiveMisses.load(std::memory_order_relaxed))
+        {
+            mdMaxConsecutiveMisses.store(dConsecutive, std::memory_order_relaxed);
+        }
+
+        if (tOverrun.count() > mdWorstOverrun.load(std::memory_order_relaxed))
+        {
+            mdWorstOverrun.store(tOverrun.count(), std::memory_order_relaxed);
+        }
+
+        auto eAction = mePolicy;
+        if (OverrunPolicy::Callback == eAction)
+        {
+            eAction = (nullptr != mpCallback) ?
+                mpCallback(DeadlineMiss {dPeriod, tOverrun, dConsecutive}, mpContext) : OverrunPolicy::CatchUp;
+        }
+
+        // Catching up needs nothing: the next deadlines are in the past
+        // already, so waitNext() returns at once until the loop is on time.
+        if (OverrunPolicy::Skip == eAction)
+        {
+            const auto dSkipped = rtTimer.skipMissed(rtNow);
+            mdSkippedPeriods.store(mdSkippedPeriods.load(std::memory_order_relaxed) + dSkipped,
+                    std::memory_order_relaxed);
+        }
+
+        return false;
+    }
+
+    uint64_t periods() const
+    {
+        return mdPeriods.load(std::memory_order_relaxed);
+    }
+
+    uint64_t misses() const
+    {
+        return mdMisses.load(std::memory_order_relaxed);
+    }
+
+    uint64_t consecutiveMisses() const
+    {
+        return mdConsecutiveMisses.load(std::memory_order_relaxed);
+    }
+
+    uint64_t maxConsecutiveMisses() const
+    {
+        return mdMaxConsecutiveMisses.load(std::memory_order_relaxed);
+    }
+
+    uint64_t skippedPeriods() const
+    {
+        return mdSkippedPeriods.load(std::memory_order_relaxed);
+    }
+
+    Nanos worstOverrun() const
+    {
+        return Nanos(mdWorstOverrun.load(std::memory_order_relaxed));
+    }
+
+    OverrunPolicy policy() const
+    {
+        return mePolicy;
+    }
+
+    /**
+     * @brief Log the counters.
+     *
+     * @param rpLabel Label to prepend the summary with.
+     */
+    void logSummary(const char* rpLabel) const
+    {
+        CMN_LOG_TRACE("%s: periods = %" PRIu64 ", missed = %" PRIu64 ", worst overrun = %" PRId64 " ns, "
+                "max consecutive misses = %" PRIu64 ", skipped periods = %" PRIu64 " (policy: %s)",
+                rpLabel, periods(), misses(), worstOverrun().count(), maxConsecutiveMisses(), skippedPeriods(),
+                overrunPolicyToString(mePolicy));
+    }
+
+private:
+    OverrunPolicy mePolicy;
+    OverrunCallback mpCallback;
+    void* mpContext;
+    Nanos mtRelativeDeadline;
+    std::atomic<uint64_t> mdPeriods;
+    std::atomic<uint64_t> mdMisses;
+    std::atomic<uint64_t> mdConsecutiveMisses;
+    std::atomic<uint64_t> mdMaxConsecutiveMisses;
+    std::atomic<uint64_t> mdSkippedPeriods;
+    std::atomic<int64_t> mdWorstOverrun;
+};
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstring>
+
+#include "common.h"
+#include "rt_time.h"
+
+namespace rt_time
+{
+class LatencyShard;
+
+/**
+ * @brief Fixed-memory log-linear latency histogram in the spirit of
+ *        HdrHistogram. Values below 2^SUB_BUCKET_BITS ns are counted
+ *        exactly; above that every power-of-two range is split into
+ *        2^(SUB_BUCKET_BITS - 1) linear sub-buckets, so every value is
+ *        kept with a relative error below 1 / 2^(SUB_BUCKET_BITS - 1)
+ *        (~1.6%). Recording is O(1): a couple of shifts, a count-leading-zeros
+ *        and an increment, with no allocation. Min, max and mean are exact.
+ */
+class LatencyHistogram
+{
+public:
+
+    // Linear resolution bits.
+    static constexpr uint32_t SUB_BUCKET_BITS = 7;
+
+    // Values above 2^MAX_VALUE_BITS ns (~18 minutes) are clamped.
+    static constexpr uint32_t MAX_VALUE_BITS = 40;
+
+    static constexpr uint32_t SUB_BUCKET_COUNT = 1u << SUB_BUCKET_BITS;
+    static constexpr uint32_t SUB_BUCKET_HALF_COUNT = SUB_BUCKET_COUNT / 2;
+    static constexpr uint64_t MAX_VALUE = (1ull << MAX_VALUE_BITS) - 1;
+
+    // Exact range + one half-sized range per power of two above it.
+    static constexpr size_t BUCKET_COUNT =
+        SUB_BUCKET_COUNT + (MAX_VALUE_BITS - SUB_BUCKET_BITS) * SUB_BUCKET_HALF_COUNT;
+
+    LatencyHistogram()
+    {
+        reset();
+    }
+
+    /**
+     * @brief Drop all the recorded values.
+     */
+    void reset()
+    {
+        std::memset(maCounts, 0, sizeof(maCounts));
+        mdCount = 0;
+        mdNegativeCount = 0;
+        mdSum = 0;
+        mdMin = INT64_MAX;
+        mdMax = INT64_MIN;
+    }
+
+    /**
+     * @brief Record a value. Negative values (e.g. an early wakeup)
+     *        go to the zero bucket but are accounted in min/mean exactly.
+     *
+     * @param rtValue Value to record.
+     */
+    void record(Nanos rtValue)
+    {
+        const int64_t dValue = rtValue.count();
+
+        mdMin = (dValue < mdMin) ? dValue : mdMin;
+        mdMax = (dValue > mdMax) ? dValue : mdMax;
+        mdSum += dValue;
+        ++mdCount;
+
+        if (dValue < 0)
+        {
+            ++mdNegativeCount;
+        }
+
+        ++maCounts[bucketOf(dValue)];
+    }
+
+    /**
+     * @brief Add all the values recorded by another histogram.
+     *
+     * @param rtOther Histogram to merge in.
+     */
+    void merge(const LatencyHistogram& rtOther)
+    {
+        for (size_t dIdx = 0; dIdx < BUCKET_COUNT; ++dIdx)
+        {
+            maCounts[dIdx] += rtOther.maCounts[dIdx];
+        }
+
+        mdCount += rtOther.mdCount;
+        mdNegativeCount += rtOther.mdNegativeCount;
+        mdSum += rtOther.mdSum;
+        mdMin = (rtOther.mdMin < mdMin) ? rtOther.mdMin : mdMin;
+        mdMax = (rtOther.mdMax > mdMax) ? rtOther.mdMax : mdMax;
+    }
+
+    uint64_t count() const { return mdCount; }
+    uint64_t negativeCount() const { return mdNegativeCount; }
+    Nanos min() const { return Nanos(mdCount > 0 ? mdMin : 0); }
+    Nanos max() const { return Nanos(mdCount > 0 ? mdMax : 0); }
+
+    double mean() const
+    {
+        return (mdCount > 0) ? static_cast<double>(mdSum) / static_cast<double>(mdCount) : 0.0;
+    }
+
+    /**
+     * @brief Get the value at the given percentile: the highest value
+     *        equivalent to the bucket the percentile falls into, capped
+     *        by the exact max.
+     *
+     * @param rdPercentile Percentile, [0, 100].
+     *
+     * @return Value at the percentile.
+     */
+    Nanos percentile(double rdPercentile) const
+    {
+        if (mdCount == 0)
+        {
+            return Nanos();
+        }
+
+        const double dClamped = (rdPercentile < 0.0) ? 0.0 : ((rdPercentile > 100.0) ? 100.0 : rdPercentile);
+        uint64_t dTarget = static_cast<uint64_t>(dClamped / 100.0 * static_cast<double>(mdCount) + 0.5);
+        dTarget = (dTarget == 0) ? 1 : dTarget;
+
+        uint64_t dSeen = 0;
+        for (size_t dIdx = 0; dIdx < BUCKET_COUNT; ++dIdx)
+        {
+            dSeen += maCounts[dIdx];
+            if (dSeen >= dTarget)
+            {
+                const auto dHighest = static_cast<int64_t>(highestEquivalent(dIdx));
+                return Nanos((dHighest < mdMax) ? dHighest : mdMax);
+            }
+        }
+
+        return Nanos(mdMax);
+    }
+
+    /**
+     * @brief Log the summary: count, min, max, mean and the tail percentiles.
+     *
+     * @param rpLabel Label to prepend the summary with.
+     */
+    void logSummary(const char* rpLabel) const
+    {
+        CMN_LOG_TRACE("%s: count = %" PRIu64 ", min = %" PRId64 " ns, max = %" PRId64 " ns, mean = %.1lf ns, "
+                "p50 = %" PRId64 " ns, p99 = %" PRId64 " ns, p99.9 = %" PRId64 " ns, p99.99 = %" PRId64 " ns",
+                rpLabel, count(), min().count(), max().count(), mean(),
+                percentile(50.0).count(), percentile(99.0).count(),
+                percentile(99.9).count(), percentile(99.99).count());
+    }
+
+    /**
+     * @brief Get the bucket index for a signed value: negative values
+     *        go to the zero bucket, too large ones are clamped.
+     */
+    static size_t bucketOf(int64_t rdValue)
+    {
+        const uint64_t dClamped = (rdValue < 0) ? 0 :
+            ((static_cast<uint64_t>(rdValue) > MAX_VALUE) ? MAX_VALUE : static_cast<uint64_t>(rdValue));
+        return indexOf(dClamped);
+    }
+
+    /**
+     * @brief Get the bucket index for a value, O(1).
+     */
+    static size_t indexOf(uint64_t rdValue)
+    {
+        if (rdValue < SUB_BUCKET_COUNT)
+        {
+            return static_cast<size_t>(rdValue);
+        }
+
+        // rdValue >> dShift falls into [SUB_BUCKET_HALF_COUNT, SUB_BUCKET_COUNT).
+        const uint32_t dMsb = 63 - static_cast<uint32_t>(__builtin_clzll(rdValue));
+        const uint32_t dShift = dMsb - SUB_BUCKET_BITS + 1;
+        const uint64_t dSub = (rdValue >> dShift) - SUB_BUCKET_HALF_COUNT;
+
+        return SUB_BUCKET_COUNT + (dShift - 1) * SUB_BUCKET_HALF_COUNT + static_cast<size_t>(dSub);
+    }
+
+    /**
+     * @brief Get the lowest value counted by the given bucket.
+     */
+    static uint64_t lowestEquivalent(size_t rdIndex)
+    {
+        if (rdIndex < SUB_BUCKET_COUNT)
+        {
+            return rdIndex;
+        }
+
+        const size_t dRel = rdIndex - SUB_BUCKET_COUNT;
+        const uint32_t dShift = static_cast<uint32_t>(dRel / SUB_BUCKET_HALF_COUNT) + 1;
+        const uint64_t dSub = dRel % SUB_BUCKET_HALF_COUNT + SUB_BUCKET_HALF_COUNT;
+        return dSub << dShift;
+    }
+
+    /**
+     * @brief Get the highest value counted by the given bucket.
+     */
+    static uint64_t highestEquivalent(size_t rdIndex)
+    {
+        if (rdIndex < SUB_BUCKET_COUNT)
+        {
+            return rdIndex;
+        }
+
+        const uint32_t dShift = static_cast<uint32_t>((rdIndex - SUB_BUCKET_COUNT) / SUB_BUCKET_HALF_COUNT) + 1;
+        return lowestEquivalent(rdIndex) + (1ull << dShift) - 1;
+    }
+
+    /**
+     * @brief Raw bucket counters, BUCKET_COUNT entries.
+     */
+    const uint64_t* counts() const
+    {
+        return maCounts;
+    }
+
+private:
+    // Shards fill the snapshots in directly.
+    friend class LatencyShard;
+
+    uint64_t maCounts[BUCKET_COUNT];
+    uint64_t mdCount;
+    uint64_t mdNegativeCount;
+    int64_t mdSum;
+    int64_t mdMin;
+    int64_t mdMax;
+};
+}
@@ -0,0 +1,330 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#include "error_codes.h"
+#include "latency_histogram.h"
+
+// Per-thread latency recording. Every writer thread owns a cache-line
+// aligned shard, so recording never contends with the other writers:
+// there are no RMW operations on shared data, only relaxed stores to
+// the shard the thread exclusively owns. A reader merges the shards
+// into a LatencyHistogram at any time without stopping the writers;
+// every shard is guarded by a seqlock, the writer just bumps
+// the sequence number around its update and never waits.
+
+namespace rt_time
+{
+constexpr size_t RECORDER_CACHE_LINE_SIZE = 64;
+
+// Number of attempts to take a consistent copy of a shard which is being
+// written to. After that the last copy is used as is: its counters are
+// never torn, but the totals may be off by the values recorded meanwhile.
+constexpr size_t SHARD_SNAPSHOT_ATTEMPTS = 16;
+
+// Number of recorders a thread remembers its shards for. Once exceeded,
+// the oldest mapping is forgotten and the thread claims a new shard
+// should it record into that recorder again.
+constexpr size_t MAX_RECORDERS_PER_THREAD = 4;
+
+/**
+ * @brief Single-writer latency histogram shard.
+ */
+class alignas(RECORDER_CACHE_LINE_SIZE) LatencyShard
+{
+public:
+
+    LatencyShard()
+    {
+        mdSequence.store(0, std::memory_order_relaxed);
+        mdCount.store(0, std::memory_order_relaxed);
+        mdNegativeCount.store(0, std::memory_order_relaxed);
+        mdSum.store(0, std::memory_order_relaxed);
+        mdMin.store(INT64_MAX, std::memory_order_relaxed);
+        mdMax.store(INT64_MIN, std::memory_order_relaxed);
+        for (auto& rdCount : maCounts)
+        {
+            rdCount.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    LatencyShard(const LatencyShard&) = delete;
+    LatencyShard& operator=(const LatencyShard&) = delete;
+
+    /**
+     * @brief Record a value. Must only be called by the shard owner.
+     *
+     * @param rtValue Value to record.
+     */
+    void record(Nanos rtValue)
+    {
+        const int64_t dValue = rtValue.count();
+        const auto dSeq = mdSequence.load(std::memory_order_relaxed);
+
+        // Odd sequence: the update is in progress.
+        mdSequence.store(dSeq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        auto& rdBucket = maCounts[LatencyHistogram::bucketOf(dValue)];
+        rdBucket.store(rdBucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        mdCount.store(mdCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        mdSum.store(mdSum.load(std::memory_order_relaxed) + dValue, std::memory_order_relaxed);
+
+        if (dValue < 0)
+        {
+            mdNegativeCount.store(mdNegativeCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        if (dValue < mdMin.load(std::memory_order_relaxed))
+        {
+            mdMin.store(dValue, std::memory_order_relaxed);
+        }
+
+        if (dValue > mdMax.load(std::memory_order_relaxed))
+        {
+            mdMax.store(dValue, std::memory_order_relaxed);
+        }
+
+        mdSequence.store(dSeq + 2, std::memory_order_release);
+    }
+
+    /**
+     * @brief Add the shard content to the histogram. Safe to call
+     *        concurrently with record().
+     *
+     * @param rtOutput Histogram to merge the shard into.
+     *
+     * @return True if the copy merged is consistent.
+     */
+    bool mergeInto(LatencyHistogram& rtOutput) const
+    {
+        LatencyHistogram tCopy;
+        bool bConsistent = false;
+
+        for (size_t dAttempt = 0; (dAttempt < SHARD_SNAPSHOT_ATTEMPTS) && not bConsistent; ++dAttempt)
+        {
+            const auto dSeqBefore = mdSequence.load(std::memory_order_acquire);
+
+            for (size_t dIdx = 0; dIdx < LatencyHistogram::BUCKET_COUNT; ++dIdx)
+            {
+                tCopy.maCounts[dIdx] = maCounts[dIdx].load(std::memory_order_relaxed);
+            }
+
+            tCopy.mdCount = mdCount.load(std::memory_order_relaxed);
+            tCopy.mdNegativeCount = mdNegativeCount.load(std::memory_order_relaxed);
+            tCopy.mdSum = mdSum.load(std::memory_order_relaxed);
+            tCopy.mdMin = mdMin.load(std::memory_order_relaxed);
+            tCopy.mdMax = mdMax.load(std::memory_order_relaxed);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const auto dSeqAfter = mdSequence.load(std::memory_order_relaxed);
+
+            bConsistent = ((dSeqBefore & 1) == 0) && (dSeqBefore == dSeqAfter);
+        }
+
+        rtOutput.merge(tCopy);
+        return bConsistent;
+    }
+
+private:
+    std::atomic<uint32_t> mdSequence;
+    std::atomic<uint64_t> mdCount;
+    std::atomic<uint64_t> mdNegativeCount;
+    std::atomic<int64_t> mdSum;
+    std::atomic<int64_t> mdMin;
+    std::atomic<int64_t> mdMax;
+    std::atomic<uint64_t> maCounts[LatencyHistogram::BUCKET_COUNT];
+};
+
+/**
+ * @brief Set of per-thread shards. The shards are allocated once in init();
+ *        a thread claims its shard on the first record() call.
+ */
+class LatencyRecorder
+{
+public:
+
+    LatencyRecorder() :
+        mpShards(nullptr),
+        mdShardCount(0),
+        mdId(nextRecorderId())
+    {
+        mdClaimed.store(0, std::memory_order_relaxed);
+        mdDropped.store(0, std::memory_order_relaxed);
+    }
+
+    ~LatencyRecorder()
+    {
+        release();
+    }
+
+    LatencyRecorder(const LatencyRecorder&) = delete;
+    LatencyRecorder& operator=(const LatencyRecorder&) = delete;
+
+    /**
+     * @brief Allocate the shards.
+     *
+     * @param rdShardCount Max number of writer threads.
+     *
+     * @return Error code.
+     */
+    cmn::ErrCode init(size_t rdShardCount)
+    {
+        if (mpShards != nullptr)
+        {
+            return cmn::ErrCode::ALREADY_ENABLED;
+        }
+
+        if (rdShardCount == 0)
+        {
+            return cmn::ErrCode::INVALID_ARGS;
+        }
+
+        // Plain new does not guarantee the over-alignment in C++11.
+        void* pMemory = nullptr;
+        if (0 != posix_memalign(&pMemory, RECORDER_CACHE_LINE_SIZE, rdShardCount * sizeof(LatencyShard)))
+        {
+            return cmn::ErrCode::GENERAL_ERR;
+        }
+
+        mpShards = static_cast<LatencyShard*>(pMemory);
+        for (size_t dIdx = 0; dIdx < rdShardCount; ++dIdx)
+        {
+            new (&mpShards[dIdx]) LatencyShard();
+        }
+
+        mdShardCount = rdShardCount;
+        mdClaimed.store(0, std::memory_order_relaxed);
+        mdDropped.store(0, std::memory_order_relaxed);
+        return cmn::ErrCode::OK;
+    }
+
+    /**
+     * @brief Get the calling thread's shard, claiming a free one if the thread
+     *        has not recorded anything yet. Lock-free.
+     *
+     * @return Shard, nullptr if all the shards are taken.
+     */
+    LatencyShard* localShard()
+    {
+        struct Slot
+        {
+            uint64_t dRecorderId;
+            LatencyShard* pShard;
+        };
+
+        thread_local Slot aSlots[MAX_RECORDERS_PER_THREAD] {};
+        thread_local size_t dNextSlot = 0;
+
+        for (const auto& rtSlot : aSlots)
+        {
+            if (rtSlot.dRecorderId == mdId)
+            {
+                return rtSlot.pShard;
+            }
+        }
+
+        const auto dIdx = mdClaimed.fetch_add(1, std::memory_order_relaxed);
+        if (dIdx >= mdShardCount)
+        {
+            return nullptr;
+        }
+
+        auto& rtSlot = aSlots[dNextSlot];
+        dNextSlot = (dNextSlot + 1) % MAX_RECORDERS_PER_THREAD;
+        rtSlot.dRecorderId = mdId;
+        rtSlot.pShard = &mpShards[dIdx];
+        return rtSlot.pShard;
+    }
+
+    /**
+     * @brief Record a value into the calling thread's shard.
+     *        Wait-free once the shard is claimed.
+     *
+     * @param rtValue Value to record.
+     */
+    void record(Nanos rtValue)
+    {
+        auto pShard = localShard();
+        if (pShard == nullptr)
+        {
+            mdDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        pShard->record(rtValue);
+    }
+
+    /**
+     * @brief Merge all the shards into the histogram while the writers
+     *        keep on recording.
+     *
+     * @param rtOutput Histogram to merge the shards into.
+     *
+     * @return True if every shard copy is consistent.
+     */
+    bool snapshot(LatencyHistogram& rtOutput) const
+    {
+        bool bConsistent = true;
+        const auto dClaimed = mdClaimed.load(std::memory_order_acquire);
+        const auto dCount = (dClaimed < mdShardCount) ? dClaimed : mdShardCount;
+
+        for (size_t dIdx = 0; dIdx < dCount; ++dIdx)
+        {
+            bConsistent = mpShards[dIdx].mergeInto(rtOutput) && bConsistent;
+        }
+
+        return bConsistent;
+    }
+
+    /**
+     * @brief Get the shard by index for the writers managing
+     *        the shard assignment on their own.
+     */
+    LatencyShard* shard(size_t rdIdx)
+    {
+        return (rdIdx < mdShardCount) ? &mpShards[rdIdx] : nullptr;
+    }
+
+    size_t size() const
+    {
+        return mdShardCount;
+    }
+
+    // Number of values lost because all the shards were taken.
+    uint64_t dropped() const
+    {
+        return mdDropped.load(std::memory_order_relaxed);
+    }
+
+private:
+
+    static uint64_t nextRecorderId()
+    {
+        // Zero marks a free per-thread slot.
+        static std::atomic<uint64_t> dNextId(1);
+        return dNextId.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release()
+    {
+        for (size_t dIdx = 0; dIdx < mdShardCount; ++dIdx)
+        {
+            mpShards[dIdx].~LatencyShard();
+        }
+
+        free(mpShards);
+        mpShards = nullptr;
+        mdShardCount = 0;
+    }
+
+    LatencyShard* mpShards;
+    size_t mdShardCount;
+    const uint64_t mdId;
+    alignas(RECORDER_CACHE_LINE_SIZE) std::atomic<size_t> mdClaimed;
+    alignas(RECORDER_CACHE_LINE_SIZE) std::atomic<uint64_t> mdDropped;
+};
+}
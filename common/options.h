@@ -0,0 +1,307 @@
+#pragma once
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "error_codes.h"
+
+// Command line options shared by the programs. Every option is bound to
+// a variable holding its default value and to a parse function converting
+// one value string, e.g. threading::parseCpuList() or rt_time::parseClockTypeId().
+// List options take comma (or custom separator) separated values and may be
+// repeated; the first occurrence replaces the defaults. The options are
+// given as "--name value", "--name=value" or "-c value" for the ones with
+// a short alias.
+
+namespace cmn
+{
+/**
+ * @brief Parse an unsigned decimal value.
+ *
+ * @param[in] rpValue Value string.
+ * @param[out] rdOutput Parsed value.
+ *
+ * @return Error code.
+ */
+inline ErrCode parseSize(const char* rpValue, size_t& rdOutput)
+{
+    char* pEnd = nullptr;
+    errno = 0;
+    const auto dValue = strtoull(rpValue, &pEnd, 10);
+    if ((pEnd == rpValue) || (*pEnd != '\0') || (errno != 0) || (rpValue[0] == '-'))
+    {
+        return ErrCode::INVALID_ARGS;
+    }
+
+    rdOutput = static_cast<size_t>(dValue);
+    return ErrCode::OK;
+}
+
+/**
+ * @brief Parse a signed decimal value.
+ *
+ * @param[in] rpValue Value string.
+ * @param[out] rdOutput Parsed value.
+ *
+ * @return Error code.
+ */
+inline ErrCode parseInt(const char* rpValue, int& rdOutput)
+{
+    char* pEnd = nullptr;
+    errno = 0;
+    const auto dValue = strtol(rpValue, &pEnd, 10);
+    if ((pEnd == rpValue) || (*pEnd != '\0') || (errno != 0) || (dValue < INT_MIN) || (dValue > INT_MAX))
+    {
+        return ErrCode::INVALID_ARGS;
+    }
+
+    rdOutput = static_cast<int>(dValue);
+    return ErrCode::OK;
+}
+
+/**
+ * @brief Take a string value (e.g. a file path) as is.
+ *
+ * @param[in] rpValue Value string.
+ * @param[out] rtOutput Value copy.
+ *
+ * @return Error code.
+ */
+inline ErrCode parseString(const char* rpValue, std::string& rtOutput)
+{
+    if (rpValue[0] == '\0')
+    {
+        return ErrCode::INVALID_ARGS;
+    }
+
+    rtOutput = rpValue;
+    return ErrCode::OK;
+}
+
+class OptionParser
+{
+public:
+
+    /**
+     * @brief Class constructor.
+     *
+     * @param[in] rpDescription Program description printed by --help.
+     */
+    explicit OptionParser(const char* rpDescription) :
+        mpDescription(rpDescription)
+    {}
+
+    // The list handlers refer back to the parser.
+    OptionParser(const OptionParser&) = delete;
+    OptionParser& operator=(const OptionParser&) = delete;
+
+    /**
+     * @brief Add a single-value option; the last occurrence wins.
+     *
+     * @param[in] rpName Long option name.
+     * @param[in] rcShort Short alias, '\0' if none.
+     * @param[in] rpHelp Help string.
+     * @param[in,out] rtTarget Variable holding the default value.
+     * @param[in] rpParse Value parse function.
+     */
+    template <typename T>
+    void add(const char* rpName, char rcShort, const char* rpHelp, T& rtTarget, ErrCode (*rpParse)(const char*, T&))
+    {
+        T* pTarget = &rtTarget;
+        mtOptions.push_back(Option {rpName, rcShort, rpHelp, true, false,
+                [pTarget, rpParse](const char* rpValue) { return rpParse(rpValue, *pTarget); }});
+    }
+
+    /**
+     * @brief Add a list option: the values are separated by rcSeparator,
+     *        repeated occurrences append to the list.
+     *
+     * @param[in] rpName Long option name.
+     * @param[in] rcShort Short alias, '\0' if none.
+     * @param[in] rpHelp Help string.
+     * @param[in,out] rtTarget List holding the default values.
+     * @param[in] rpParse Parse function for one list element.
+     * @param[in] rcSeparator Element separator.
+     */
+    template <typename T>
+    void addList(const char* rpName, char rcShort, const char* rpHelp, std::vector<T>& rtTarget,
+            ErrCode (*rpParse)(const char*, T&), char rcSeparator = ',')
+    {
+        auto pTarget = &rtTarget;
+        Option tOption {rpName, rcShort, rpHelp, true, false, nullptr};
+        const auto dIdx = mtOptions.size();
+
+        tOption.tHandler = [this, dIdx, pTarget, rpParse, rcSeparator](const char* rpValue)
+        {
+            // The defaults are replaced by the values given explicitly.
+            if (not mtOptions[dIdx].bSeen)
+            {
+                pTarget->clear();
+            }
+
+            std::string tValues(rpValue);
+            size_t dStart = 0;
+            while (dStart <= tValues.size())
+            {
+                auto dEnd = tValues.find(rcSeparator, dStart);
+                dEnd = (dEnd == std::string::npos) ? tValues.size() : dEnd;
+
+                T tElement {};
+                const auto tErr = rpParse(tValues.substr(dStart, dEnd - dStart).c_str(), tElement);
+                if (ErrCode::OK != tErr)
+                {
+                    return tErr;
+                }
+
+                pTarget->push_back(tElement);
+                dStart = dEnd + 1;
+            }
+
+            return ErrCode::OK;
+        };
+
+        mtOptions.push_back(tOption);
+    }
+
+    /**
+     * @brief Add an option without a value.
+     *
+     * @param[in] rpName Long option name.
+     * @param[in] rcShort Short alias, '\0' if none.
+     * @param[in] rpHelp Help string.
+     * @param[out] rbTarget Set to true if the option is given.
+     */
+    void addFlag(const char* rpName, char rcShort, const char* rpHelp, bool& rbTarget)
+    {
+        bool* pTarget = &rbTarget;
+        mtOptions.push_back(Option {rpName, rcShort, rpHelp, false, false,
+                [pTarget](const char*) { *pTarget = true; return ErrCode::OK; }});
+    }
+
+    /**
+     * @brief Parse the command line. Prints the usage on --help
+     *        or an error.
+     *
+     * @param[in] argc Arguments count.
+     * @param[in] argv Arguments.
+     *
+     * @return Error code; NOT_READY if the help was requested.
+     */
+    ErrCode parse(int argc, char* argv[])
+    {
+        for (int dArg = 1; dArg < argc; ++dArg)
+        {
+            const char* pArg = argv[dArg];
+
+            if ((0 == strcmp(pArg, "--help")) || (0 == strcmp(pArg, "-h")))
+            {
+                printUsage(argv[0]);
+                return ErrCode::NOT_READY;
+            }
+
+            const char* pInlineValue = nullptr;
+            auto pOption = find(pArg, pInlineValue);
+            if (nullptr == pOption)
+            {
+                CMN_LOG_ERROR("Unknown option: %s", pArg);
+                printUsage(argv[0]);
+                return ErrCode::INVALID_ARGS;
+            }
+
+            const char* pValue = pInlineValue;
+            if (pOption->bHasValue && (nullptr == pValue))
+            {
+                if ((dArg + 1) >= argc)
+                {
+                    CMN_LOG_ERROR("Option --%s needs a value", pOption->pName);
+                    return ErrCode::INVALID_ARGS;
+                }
+
+                pValue = argv[++dArg];
+            }
+
+            if (ErrCode::OK != pOption->tHandler(pValue))
+            {
+                CMN_LOG_ERROR("Invalid value for option --%s: %s", pOption->pName, (pValue != nullptr) ? pValue : "");
+                return ErrCode::INVALID_ARGS;
+            }
+
+            pOption->bSeen = true;
+        }
+
+        return ErrCode::OK;
+    }
+
+    void printUsage(const char* rpProgram) const
+    {
+        std::cout << mpDescription << std::endl << "Usage: " << rpProgram << " [options]" << std::endl;
+
+        for (const auto& rtOption : mtOptions)
+        {
+            std::cout << "  ";
+            if (rtOption.cShort != '\0')
+            {
+                std::cout << '-' << rtOption.cShort << ", ";
+            }
+
+            std::cout << "--" << rtOption.pName << (rtOption.bHasValue ? " <value>" : "") << std::endl
+                      << "        " << rtOption.pHelp << std::endl;
+        }
+    }
+
+private:
+
+    struct Option
+    {
+        const char* pName;
+        char cShort;
+        const char* pHelp;
+        bool bHasValue;
+        bool bSeen;
+        std::function<ErrCode(const char*)> tHandler;
+    };
+
+    Option* find(const char* rpArg, const char*& rpInlineValue)
+    {
+        rpInlineValue = nullptr;
+
+        if ((rpArg[0] == '-') && (rpArg[1] == '-'))
+        {
+            const char* pName = rpArg + 2;
+            const char* pEquals = strchr(pName, '=');
+            const size_t dLen = (nullptr != pEquals) ? static_cast<size_t>(pEquals - pName) : strlen(pName);
+
+            for (auto& rtOption : mtOptions)
+            {
+                if ((strlen(rtOption.pName) == dLen) && (0 == strncmp(rtOption.pName, pName, dLen)))
+                {
+                    rpInlineValue = (nullptr != pEquals) ? (pEquals + 1) : nullptr;
+                    return &rtOption;
+                }
+            }
+        }
+        else if ((rpArg[0] == '-') && (rpArg[1] != '\0') && (rpArg[2] == '\0'))
+        {
+            for (auto& rtOption : mtOptions)
+            {
+                if (rtOption.cShort == rpArg[1])
+                {
+                    return &rtOption;
+                }
+            }
+        }
+
+        return nullptr;
+    }
+
+    const char* mpDescription;
+    std::vector<Option> mtOptions;
+};
+}
@@ -0,0 +1,777 @@
+#pragma once
+
+#include <sys/syscall.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <strings.h>
+
+#include "common.h"
+#include "deadline_monitor.h"
+#include "latency_histogram.h"
+#include "rt_time.h"
+#include "threading.h"
+
+// Not exported by the older glibc headers.
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+
+namespace threading
+{
+/**
+ * @brief How the executive schedules the tasks.
+ */
+enum class ExecutivePolicy
+{
+    RateMonotonic,  // Partitioned fixed priority SCHED_FIFO, one CPU per task.
+    Edf             // Global SCHED_DEADLINE, the kernel runs the EDF.
+};
+
+/**
+ * @brief Schedulability test of the fixed priority (RateMonotonic) plan.
+ */
+enum class SchedulabilityTest
+{
+    UtilizationBound,   // Liu & Layland: U <= n * (2^(1/n) - 1), sufficient only.
+    ResponseTime        // Exact response time analysis.
+};
+
+inline const char* executivePolicyToString(ExecutivePolicy rePolicy)
+{
+    return (ExecutivePolicy::Edf == rePolicy) ? "edf" : "rm";
+}
+
+inline const char* schedulabilityTestToString(SchedulabilityTest reTest)
+{
+    return (SchedulabilityTest::ResponseTime == reTest) ? "rta" : "bound";
+}
+
+/**
+ * @brief Parse an executive policy name: rm or edf, case-insensitive.
+ *
+ * @param rpValue Policy name.
+ * @param reOutput Policy output.
+ *
+ * @return Status code.
+ */
+inline cmn::ErrCode parseExecutivePolicy(const char* rpValue, ExecutivePolicy& reOutput)
+{
+    if (0 == strcasecmp(rpValue, "rm"))
+    {
+        reOutput = ExecutivePolicy::RateMonotonic;
+    }
+    else if (0 == strcasecmp(rpValue, "edf"))
+    {
+        reOutput = ExecutivePolicy::Edf;
+    }
+    else
+    {
+        return cmn::ErrCode::INVALID_ARGS;
+    }
+
+    return cmn::ErrCode::OK;
+}
+
+/**
+ * @brief Parse a schedulability test name: bound or rta, case-insensitive.
+ *
+ * @param rpValue Test name.
+ * @param reOutput Test output.
+ *
+ * @return Status code.
+ */
+inline cmn::ErrCode parseSchedulabilityTest(const char* rpValue, SchedulabilityTest& reOutput)
+{
+    if (0 == strcasecmp(rpValue, "bound"))
+    {
+        reOutput = SchedulabilityTest::UtilizationBound;
+    }
+    else if (0 == strcasecmp(rpValue, "rta"))
+    {
+        reOutput = SchedulabilityTest::ResponseTime;
+    }
+    else
+    {
+        return cmn::ErrCode::INVALID_ARGS;
+    }
+
+    return cmn::ErrCode::OK;
+}
+
+// Job run once per period by a task thread.
+using TaskJob = void (*)(void* rpContext);
+
+/**
+ * @brief Periodic task parameters.
+ */
+struct PeriodicTaskSpec
+{
+    const char* pName;      // Must outlive the executive (logged asynchronously).
+    rt_time::Nanos tPeriod;
+    rt_time::Nanos tWcet;       // Worst case execution time of one job.
+    rt_time::Nanos tDeadline;   // Relative deadline, 0 - the period.
+    CpuIndex dCpu;          // CPU to pin to (RateMonotonic only), -1 - assigned by plan().
+    TaskJob pJob;
+    void* pContext;         // Passed to the job.
+    rt_time::OverrunCallback pOverrunCallback;  // Required by OverrunPolicy::Callback, nullptr otherwise.
+    void* pOverrunContext;  // Passed to the overrun callback.
+};
+
+/**
+ * @brief Where and how a task runs, filled in by Executive::plan().
+ */
+struct TaskPlan
+{
+    CpuIndex dCpu;                  // -1 - not pinned.
+    int dPriority;                  // SCHED_FIFO priority, 0 for EDF.
+    rt_time::Nanos tResponseBound;  // Worst case response time, 0 - not computed.
+    bool bSchedulable;
+};
+
+// The top SCHED_FIFO priority is left for the thread
+// which manages the tasks.
+constexpr size_t MAX_EXECUTIVE_TASKS = 98;
+
+// Tasks are released together this long after start(), once all the
+// threads are created.
+constexpr auto EXECUTIVE_RELEASE_DELAY = rt_time::Nanos::fromMsec(20);
+
+/**
+ * @brief Multi-task periodic executive. The tasks are registered with
+ *        addTask(), checked and mapped to the CPUs and priorities by
+ *        plan(), and run by start() until stop(), each on its own thread
+ *        with a PeriodicTimer and a DeadlineMonitor. All the tasks are
+ *        released at the same time, the critical instant of the analysis.
+ *
+ *        RateMonotonic: deadline monotonic priorities (the same as rate
+ *        monotonic when the deadline is the period), distinct per task,
+ *        partitioned onto the CPUs first fit by decreasing density, every
+ *        CPU checked with the test given. EDF: SCHED_DEADLINE with the
+ *        WCET as the runtime budget, global (the kernel refuses it for
+ *        threads with a restricted affinity), checked with the density
+ *        bound of global EDF. The kernel replenishes the budget on its own
+ *        period grid, not phase locked to the task timers, so a rare miss
+ *        is possible even for an admitted task set.
+ */
+class Executive
+{
+public:
+
+    /**
+     * @brief Class constructor.
+     *
+     * @param[in] rePolicy Scheduling policy of the tasks.
+     * @param[in] reTest Schedulability test (RateMonotonic only).
+     * @param[in] reClockTypeId Clock of the task timers.
+     * @param[in] reOverrunPolicy What a task does once a job overruns its period.
+     */
+    explicit Executive(ExecutivePolicy rePolicy = ExecutivePolicy::RateMonotonic,
+            SchedulabilityTest reTest = SchedulabilityTest::ResponseTime,
+            rt_time::ClockTypeId reClockTypeId = rt_time::ClockTypeId::Monotonic,
+            rt_time::OverrunPolicy reOverrunPolicy = rt_time::OverrunPolicy::CatchUp) :
+        mePolicy(rePolicy),
+        meTest(reTest),
+        meClock(reClockTypeId),
+        meOverrunPolicy(reOverrunPolicy)
+    {
+        mbStop.store(false, std::memory_order_relaxed);
+    }
+
+    Executive(const Executive&) = delete;
+    Executive& operator=(const Executive&) = delete;
+
+    /**
+     * @brief Destructor. Stops the tasks if still running.
+     */
+    ~Executive()
+    {
+        stop();
+    }
+
+    /**
+     * @brief Register a task; the plan must be made again afterwards.
+     *
+     * @param[in] rtSpec Task parameters.
+     *
+     * @return Error code.
+     */
+    cmn::ErrCode addTask(const PeriodicTaskSpec& rtSpec)
+    {
+        if (mbRunning)
+        {
+            return cmn::ErrCode::ALREADY_ENABLED;
+        }
+
+        if (mtTasks.size() >= MAX_EXECUTIVE_TASKS)
+        {
+            return cmn::ErrCode::OVERFLOW;
+        }
+
+        const auto tDeadline = (rtSpec.tDeadline > rt_time::Nanos()) ? rtSpec.tDeadline : rtSpec.tPeriod;
+        if ((nullptr == rtSpec.pName) || (nullptr == rtSpec.pJob) || (rtSpec.tWcet <= rt_time::Nanos()) ||
+                (rtSpec.tWcet > tDeadline) || (tDeadline > rtSpec.tPeriod))
+        {
+            CMN_LOG_ERROR("Invalid task %s: 0 < WCET <= deadline <= period is required",
+                    (nullptr == rtSpec.pName) ? "(null)" : rtSpec.pName);
+            return cmn::ErrCode::INVALID_ARGS;
+        }
+
+        if ((rt_time::OverrunPolicy::Callback == meOverrunPolicy) && (nullptr == rtSpec.pOverrunCallback))
+        {
+            CMN_LOG_ERROR("Task %s has no overrun callback for the callback overrun policy", rtSpec.pName);
+            return cmn::ErrCode::INVALID_ARGS;
+        }
+
+        std::unique_ptr<TaskRuntime> pTask(new TaskRuntime(*this, rtSpec, tDeadline));
+        mtTasks.push_back(std::move(pTask));
+        mbPlanned = false;
+        return cmn::ErrCode::OK;
+    }
+
+    /**
+     * @brief Run the schedulability test and map the tasks to the CPUs
+     *        and priorities.
+     *
+     * @param[in] rtCpuSet CPUs to run the tasks on, empty - the allowed ones.
+     *
+     * @return Error code: SCHED_FAILURE if the task set is not schedulable,
+     *         the plan is kept for logPlan() anyway.
+     */
+    cmn::ErrCode plan(const CpuSet& rtCpuSet = CpuSet {})
+    {
+        if (mbRunning)
+        {
+            return cmn::ErrCode::ALREADY_ENABLED;
+        }
+
+        if (mtTasks.empty())
+        {
+            return cmn::ErrCode::INVALID_ARGS;
+        }
+
+        mtCpus = rtCpuSet;
+        if (mtCpus.empty() && (cmn::ErrCode::OK != getAllowedCpus(mtCpus)))
+        {
+            return cmn::ErrCode::SCHED_FAILURE;
+        }
+
+        for (auto& pTask : mtTasks)
+        {
+            pTask->tPlan = TaskPlan {-1, 0, rt_time::Nanos(), false};
+        }
+
+        const auto tErr = (ExecutivePolicy::Edf == mePolicy) ? planEdf() : planFixedPriority();
+        if (cmn::ErrCode::OK != tErr)
+        {
+            return tErr;
+        }
+
+        mbPlanned = true;
+        for (const auto& pTask : mtTasks)
+        {
+            if (not pTask->tPlan.bSchedulable)
+            {
+                return cmn::ErrCode::SCHED_FAILURE;
+            }
+        }
+
+        return cmn::ErrCode::OK;
+    }
+
+    /**
+     * @brief Log the plan: every task and the verdict of the test.
+     */
+    void logPlan() const
+    {
+        double dUtilization = 0.0;
+        bool bSchedulable = true;
+        for (const auto& pTask : mtTasks)
+        {
+            const auto& rtSpec = pTask->tSpec;
+            const auto& rtPlan = pTask->tPlan;
+            dUtilization += utilizationOf(*pTask);
+            bSchedulable = bSchedulable && rtPlan.bSchedulable;
+
+            CMN_LOG_TRACE("Task %s: T = %" PRId64 " us, C = %" PRId64 " us, D = %" PRId64 " us, CPU %d, "
+                    "priority %d, response bound %" PRId64 " us, %s", rtSpec.pName, rtSpec.tPeriod.toUsec(),
+                    rtSpec.tWcet.toUsec(), pTask->tDeadline.toUsec(), rtPlan.dCpu, rtPlan.dPriority,
+                    rtPlan.tResponseBound.toUsec(), rtPlan.bSchedulable ? "schedulable" : "NOT SCHEDULABLE");
+        }
+
+        CMN_LOG_TRACE("Executive plan (%s, %s test): %zu tasks, utilization %.3lf on %zu CPUs, %s",
+                executivePolicyToString(mePolicy),
+                (ExecutivePolicy::Edf == mePolicy) ? "density" : schedulabilityTestToString(meTest),
+                mtTasks.size(), dUtilization, mtCpus.size(), bSchedulable ? "schedulable" : "NOT SCHEDULABLE");
+    }
+
+    /**
+     * @brief Create the task threads, each with its own policy, priority,
+     *        affinity and name, and release the tasks.
+     *
+     * @return Error code.
+     */
+    cmn::ErrCode start()
+    {
+        if (mbRunning)
+        {
+            return cmn::ErrCode::ALREADY_ENABLED;
+        }
+
+        if (not mbPlanned)
+        {
+            return cmn::ErrCode::NOT_READY;
+        }
+
+        rt_time::Nanos tNow;
+        if (cmn::ErrCode::OK != rt_time::getTime(rt_time::sleepClockFor(meClock), tNow))
+        {
+            return cmn::ErrCode::CLOCK_ERROR;
+        }
+
+        mtRelease = tNow + EXECUTIVE_RELEASE_DELAY;
+        mbStop.store(false, std::memory_order_relaxed);
+        mbRunning = true;
+
+        for (auto& pTask : mtTasks)
+        {
+            const auto tErr = startTask(*pTask);
+            if (cmn::ErrCode::OK != tErr)
+            {
+                stop();
+                return tErr;
+            }
+        }
+
+        return cmn::ErrCode::OK;
+    }
+
+    /**
+     * @brief Stop the tasks once their current job is done, join the threads.
+     *
+     * @return The first error of the tasks.
+     */
+    cmn::ErrCode stop()
+    {
+        if (not mbRunning)
+        {
+            return cmn::ErrCode::OK;
+        }
+
+        mbStop.store(true, std::memory_order_release);
+
+        auto tResult = cmn::ErrCode::OK;
+        for (auto& pTask : mtTasks)
+        {
+            if (pTask->bStarted)
+            {
+                pthread_join(pTask->tThread, nullptr);
+                pTask->bStarted = false;
+
+                if ((cmn::ErrCode::OK == tResult) && (cmn::ErrCode::OK != pTask->tResult))
+                {
+                    tResult = pTask->tResult;
+                }
+            }
+        }
+
+        mbRunning = false;
+        return tResult;
+    }
+
+    /**
+     * @brief Log the deadline counters and the response times of every task.
+     *        The tasks must be stopped.
+     */
+    void logSummary() const
+    {
+        for (const auto& pTask : mtTasks)
+        {
+            pTask->tDeadlines.logSummary(pTask->tSpec.pName);
+            pTask->tResponses.logSummary(pTask->tSpec.pName);
+        }
+    }
+
+    size_t size() const
+    {
+        return mtTasks.size();
+    }
+
+    const TaskPlan& taskPlan(size_t rdIdx) const
+    {
+        return mtTasks[rdIdx]->tPlan;
+    }
+
+    const rt_time::DeadlineMonitor& taskDeadlines(size_t rdIdx) const
+    {
+        return mtTasks[rdIdx]->tDeadlines;
+    }
+
+    const rt_time::LatencyHistogram& taskResponses(size_t rdIdx) const
+    {
+        return mtTasks[rdIdx]->tResponses;
+    }
+
+private:
+
+    // Per task state, stable in memory for the task thread.
+    struct TaskRuntime
+    {
+        TaskRuntime(Executive& rtOwner, const PeriodicTaskSpec& rtSpec, rt_time::Nanos rtDeadline) :
+            rOwner(rtOwner),
+            tSpec(rtSpec),
+            tDeadline(rtDeadline),
+            tPlan {-1, 0, rt_time::Nanos(), false},
+            tDeadlines(rtOwner.meOverrunPolicy, rtSpec.pOverrunCallback, rtSpec.pOverrunContext, rtDeadline),
+            tThread(),
+            bStarted(false),
+            tResult(cmn::ErrCode::NOT_READY)
+        {}
+
+        Executive& rOwner;
+        PeriodicTaskSpec tSpec;
+        rt_time::Nanos tDeadline;       // Relative deadline, never 0.
+        TaskPlan tPlan;
+        rt_time::DeadlineMonitor tDeadlines;
+        rt_time::LatencyHistogram tResponses;    // Release to completion of every job.
+        pthread_t tThread;
+        bool bStarted;
+        cmn::ErrCode tResult;
+    };
+
+    // Layout of the kernel struct sched_attr, not exported by glibc.
+    struct DeadlineSchedAttr
+    {
+        uint32_t dSize;
+        uint32_t dPolicy;
+        uint64_t dFlags;
+        int32_t dNice;
+        uint32_t dPriority;
+        uint64_t dRuntime;
+        uint64_t dDeadline;
+        uint64_t dPeriod;
+    };
+
+    static double utilizationOf(const TaskRuntime& rtTask)
+    {
+        return static_cast<double>(rtTask.tSpec.tWcet.count()) / static_cast<double>(rtTask.tSpec.tPeriod.count());
+    }
+
+    // Utilization against the deadline rather than the period,
+    // makes the utilization tests hold for D < T.
+    static double densityOf(const TaskRuntime& rtTask)
+    {
+        return static_cast<double>(rtTask.tSpec.tWcet.count()) / static_cast<double>(rtTask.tDeadline.count());
+    }
+
+    /**
+     * @brief Deadline monotonic priorities, then first fit partitioning:
+     *        the pinned tasks go first, the rest by decreasing density.
+     */
+    cmn::ErrCode planFixedPriority()
+    {
+        std::vector<TaskRuntime*> tOrder;
+        for (auto& pTask : mtTasks)
+        {
+            tOrder.push_back(pTask.get());
+        }
+
+        // Ties keep the registration order, so the plan is reproducible.
+        std::stable_sort(tOrder.begin(), tOrder.end(), [](const TaskRuntime* rpLhs, const TaskRuntime* rpRhs)
+                {
+                    return (rpLhs->tDeadline < rpRhs->tDeadline) ||
+                        ((rpLhs->tDeadline == rpRhs->tDeadline) && (rpLhs->tSpec.tPeriod < rpRhs->tSpec.tPeriod));
+                });
+
+        const int dTopPriority = sched_get_priority_max(SCHED_FIFO) - 1;
+        for (size_t dRank = 0; dRank < tOrder.size(); ++dRank)
+        {
+            tOrder[dRank]->tPlan.dPriority = dTopPriority - static_cast<int>(dRank);
+        }
+
+        for (auto& pTask : mtTasks)
+        {
+            if (pTask->tSpec.dCpu < 0)
+            {
+                continue;
+            }
+
+            if (not mtCpus.test(static_cast<size_t>(pTask->tSpec.dCpu)))
+            {
+                CMN_LOG_ERROR("Task %s is pinned to CPU %d which is not in the executive CPU set",
+                        pTask->tSpec.pName, pTask->tSpec.dCpu);
+                return cmn::ErrCode::INVALID_ARGS;
+            }
+
+            pTask->tPlan.dCpu = pTask->tSpec.dCpu;
+        }
+
+        std::stable_sort(tOrder.begin(), tOrder.end(), [](const TaskRuntime* rpLhs, const TaskRuntime* rpRhs)
+                {
+                    return densityOf(*rpLhs) > densityOf(*rpRhs);
+                });
+
+        for (auto* pTask : tOrder)
+        {
+            if (pTask->tSpec.dCpu >= 0)
+            {
+                continue;
+            }
+
+            bool bPlaced = false;
+            for (const auto dCpu : mtCpus)
+            {
+                pTask->tPlan.dCpu = static_cast<CpuIndex>(dCpu);
+                if (checkCpu(pTask->tPlan.dCpu))
+                {
+                    bPlaced = true;
+                    break;
+                }
+            }
+
+            // Fits nowhere: the least loaded CPU, reported by the final check.
+            if (not bPlaced)
+            {
+                pTask->tPlan.dCpu = leastLoadedCpu(pTask);
+            }
+        }
+
+        for (const auto dCpu : mtCpus)
+        {
+            checkCpu(static_cast<CpuIndex>(dCpu));
+        }
+
+        return cmn::ErrCode::OK;
+    }
+
+    /**
+     * @brief Global EDF, sufficient test (Goossens, Funk, Baruah) on densities:
+     *        sum <= m - (m - 1) * max for m CPUs; the uniprocessor EDF bound for m = 1.
+     */
+    cmn::ErrCode planEdf()
+    {
+        double dDensity = 0.0;
+        double dMaxDensity = 0.0;
+        for (const auto& pTask : mtTasks)
+        {
+            if (pTask->tSpec.dCpu >= 0)
+            {
+                CMN_LOG_TRACE("Task %s: CPU pinning is ignored by EDF, the tasks run on any CPU",
+                        pTask->tSpec.pName);
+            }
+
+            dDensity += densityOf(*pTask);
+            dMaxDensity = std::max(dMaxDensity, densityOf(*pTask));
+        }
+
+        const auto dCpus = static_cast<double>(mtCpus.size());
+        const bool bSchedulable = (dDensity <= dCpus - (dCpus - 1.0) * dMaxDensity);
+        for (auto& pTask : mtTasks)
+        {
+            pTask->tPlan = TaskPlan {-1, 0, pTask->tDeadline, bSchedulable};
+        }
+
+        return cmn::ErrCode::OK;
+    }
+
+    /**
+     * @brief Run the test over the tasks currently mapped to the CPU
+     *        and store the verdict in their plans.
+     *
+     * @param rdCpu CPU to check.
+     *
+     * @return True if all of its tasks are schedulable.
+     */
+    bool checkCpu(CpuIndex rdCpu)
+    {
+        std::vector<TaskRuntime*> tTasks;
+        for (auto& pTask : mtTasks)
+        {
+            if (pTask->tPlan.dCpu == rdCpu)
+            {
+                tTasks.push_back(pTask.get());
+            }
+        }
+
+        std::sort(tTasks.begin(), tTasks.end(), [](const TaskRuntime* rpLhs, const TaskRuntime* rpRhs)
+                {
+                    return rpLhs->tPlan.dPriority > rpRhs->tPlan.dPriority;
+                });
+
+        bool bSchedulable = true;
+        if (SchedulabilityTest::UtilizationBound == meTest)
+        {
+            double dDensity = 0.0;
+            for (const auto* pTask : tTasks)
+            {
+                dDensity += densityOf(*pTask);
+            }
+
+            const auto dCount = static_cast<double>(tTasks.size());
+            bSchedulable = (dDensity <= dCount * (std::pow(2.0, 1.0 / dCount) - 1.0));
+            for (auto* pTask : tTasks)
+            {
+                pTask->tPlan.tResponseBound = rt_time::Nanos();
+                pTask->tPlan.bSchedulable = bSchedulable;
+            }
+
+            return bSchedulable;
+        }
+
+        // R = C + sum over the higher priority tasks of ceil(R / Tj) * Cj,
+        // iterated to the fixed point or until past the deadline.
+        for (size_t dIdx = 0; dIdx < tTasks.size(); ++dIdx)
+        {
+            auto* pTask = tTasks[dIdx];
+            const auto dDeadline = pTask->tDeadline.count();
+            int64_t dResponse = pTask->tSpec.tWcet.count();
+            while (dResponse <= dDeadline)
+            {
+                int64_t dNext = pTask->tSpec.tWcet.count();
+                for (size_t dHigher = 0; dHigher < dIdx; ++dHigher)
+                {
+                    const auto dPeriod = tTasks[dHigher]->tSpec.tPeriod.count();
+                    dNext += ((dResponse + dPeriod - 1) / dPeriod) * tTasks[dHigher]->tSpec.tWcet.count();
+                }
+
+                if (dNext == dResponse)
+                {
+                    break;
+                }
+
+                dResponse = dNext;
+            }
+
+            pTask->tPlan.tResponseBound = rt_time::Nanos(dResponse);
+            pTask->tPlan.bSchedulable = (dResponse <= dDeadline);
+            bSchedulable = bSchedulable && pTask->tPlan.bSchedulable;
+        }
+
+        return bSchedulable;
+    }
+
+    CpuIndex leastLoadedCpu(const TaskRuntime* rpExcluded) const
+    {
+        CpuIndex dBest = static_cast<CpuIndex>(*mtCpus.begin());
+        double dBestLoad = -1.0;
+        for (const auto dCpu : mtCpus)
+        {
+            double dLoad = 0.0;
+            for (const auto& pTask : mtTasks)
+            {
+                if ((pTask.get() != rpExcluded) && (pTask->tPlan.dCpu == static_cast<CpuIndex>(dCpu)))
+                {
+                    dLoad += densityOf(*pTask);
+                }
+            }
+
+            if ((dBestLoad < 0.0) || (dLoad < dBestLoad))
+            {
+                dBest = static_cast<CpuIndex>(dCpu);
+                dBestLoad = dLoad;
+            }
+        }
+
+        return dBest;
+    }
+
+    cmn::ErrCode startTask(TaskRuntime& rtTask)
+    {
+        // EDF threads start as SCHED_OTHER, then switch themselves
+        // to SCHED_DEADLINE: pthread attributes can't carry it.
+        const bool bFixedPriority = (ExecutivePolicy::RateMonotonic == mePolicy);
+        const auto tSpec = ThreadSpec()
+            .policy(bFixedPriority ? SCHED_FIFO : SCHED_OTHER)
+            .priority(rtTask.tPlan.dPriority)
+            .cpu(bFixedPriority ? rtTask.tPlan.dCpu : -1)
+            .stackSize(DEFAULT_RT_STACK_SIZE)
+            .name(rtTask.tSpec.pName);
+
+        rtTask.tResult = cmn::ErrCode::NOT_READY;
+        const auto tErr = tSpec.create(rtTask.tThread, &Executive::taskRoutine, &rtTask);
+        rtTask.bStarted = (cmn::ErrCode::OK == tErr);
+        return tErr;
+    }
+
+    static cmn::ErrCode enterDeadlineScheduling(const TaskRuntime& rtTask)
+    {
+#ifdef SYS_sched_setattr
+        DeadlineSchedAttr tAttr {};
+        tAttr.dSize = sizeof(tAttr);
+        tAttr.dPolicy = SCHED_DEADLINE;
+        tAttr.dRuntime = static_cast<uint64_t>(rtTask.tSpec.tWcet.count());
+        tAttr.dDeadline = static_cast<uint64_t>(rtTask.tDeadline.count());
+        tAttr.dPeriod = static_cast<uint64_t>(rtTask.tSpec.tPeriod.count());
+
+        if (0 != syscall(SYS_sched_setattr, 0, &tAttr, 0))
+        {
+            CMN_LOG_ERROR("Task %s: sched_setattr(SCHED_DEADLINE) call failed with err %d (%s)",
+                    rtTask.tSpec.pName, errno, strerror(errno));
+            return (ENOSYS == errno) ? cmn::ErrCode::NOT_SUPPORTED : cmn::ErrCode::SCHED_FAILURE;
+        }
+
+        return cmn::ErrCode::OK;
+#else
+        CMN_LOG_ERROR("Task %s: SCHED_DEADLINE is not supported by this build", rtTask.tSpec.pName);
+        return cmn::ErrCode::NOT_SUPPORTED;
+#endif
+    }
+
+    static void* taskRoutine(void* rpArg)
+    {
+        auto& rtTask = *static_cast<TaskRuntime*>(rpArg);
+        auto& rtOwner = rtTask.rOwner;
+
+        if (ExecutivePolicy::Edf == rtOwner.mePolicy)
+        {
+            rtTask.tResult = enterDeadlineScheduling(rtTask);
+            if (cmn::ErrCode::OK != rtTask.tResult)
+            {
+                return nullptr;
+            }
+        }
+
+        rt_time::PeriodicTimer tTimer(rtOwner.meClock, rtTask.tSpec.tPeriod);
+        rtTask.tResult = tTimer.startAt(rtOwner.mtRelease);
+
+        while ((cmn::ErrCode::OK == rtTask.tResult) && (not rtOwner.mbStop.load(std::memory_order_acquire)))
+        {
+            size_t dSleepCount = 0;
+            rtTask.tResult = tTimer.waitNext(dSleepCount);
+            if (cmn::ErrCode::OK != rtTask.tResult)
+            {
+                break;
+            }
+
+            // Measured from the release, not from the wakeup,
+            // so the response time includes the wakeup latency.
+            const auto tRelease = tTimer.deadline() - tTimer.period();
+            rtTask.tSpec.pJob(rtTask.tSpec.pContext);
+
+            rt_time::Nanos tNow;
+            rt_time::getTime(tTimer.sleepClock(), tNow);
+            rtTask.tResponses.record(tNow - tRelease);
+            rtTask.tDeadlines.check(tTimer, tNow);
+        }
+
+        return nullptr;
+    }
+
+    ExecutivePolicy mePolicy;
+    SchedulabilityTest meTest;
+    rt_time::ClockTypeId meClock;
+    rt_time::OverrunPolicy meOverrunPolicy;
+    std::vector<std::unique_ptr<TaskRuntime>> mtTasks;
+    CpuSet mtCpus;
+    rt_time::Nanos mtRelease;
+    std::atomic<bool> mbStop;
+    bool mbPlanned = false;
+    bool mbRunning = false;
+};
+}
@@ -0,0 +1,518 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "error_codes.h"
+#include "rt_time.h"
+
+// Live telemetry of the running tests in a POSIX shared memory segment
+// (shm_open), to be watched by rt_top while the test goes on. The segment
+// holds a header and a fixed array of cache-line aligned slots; a test
+// thread claims a slot once and is its only writer, publishing the
+// counters after every iteration. Publishing is wait-free: a seqlock
+// guards every slot, the writer only bumps the sequence number around
+// relaxed stores and never waits for the readers. The readers retry
+// until they see an even and unchanged sequence number.
+
+namespace rt_telemetry
+{
+constexpr char TELEMETRY_MAGIC[8] = {'R', 'T', 'T', 'E', 'L', 'E', 'M', '1'};
+constexpr uint32_t TELEMETRY_VERSION = 1;
+constexpr size_t TELEMETRY_CACHE_LINE_SIZE = 64;
+
+constexpr auto DEFAULT_TELEMETRY_NAME = "/rt_telemetry";
+constexpr size_t DEFAULT_TELEMETRY_SLOTS = 64;
+constexpr size_t TELEMETRY_LABEL_LENGTH = 40;
+
+// Sleep count distribution: 0, 1, ... restarts; the last bucket
+// collects SLEEP_COUNT_BUCKETS - 1 restarts and more.
+constexpr size_t SLEEP_COUNT_BUCKETS = 8;
+
+// Number of attempts to take a consistent copy of a slot being written to.
+constexpr size_t TELEMETRY_SNAPSHOT_ATTEMPTS = 16;
+
+// The segment is shared between processes: the atomics must not be locks.
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "64-bit atomics must be lock-free");
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "32-bit atomics must be lock-free");
+
+enum class SlotState : uint32_t
+{
+    Free,
+    Running,
+    Done
+};
+
+/**
+ * @brief Consistent copy of a slot as seen by a reader.
+ */
+struct TelemetrySnapshot
+{
+    SlotState eState;
+    int32_t dTid;
+    int32_t dCpu;               // CPU of the last iteration.
+    char aLabel[TELEMETRY_LABEL_LENGTH];
+    uint64_t dIterations;
+    int64_t dLastError;         // Nanoseconds.
+    int64_t dMinError;
+    int64_t dMaxError;
+    int64_t dErrorSum;
+    uint64_t aSleepCounts[SLEEP_COUNT_BUCKETS];
+
+    double meanError() const
+    {
+        return (dIterations == 0) ? 0.0 : static_cast<double>(dErrorSum) / static_cast<double>(dIterations);
+    }
+};
+
+/**
+ * @brief Single-writer telemetry slot.
+ */
+class alignas(TELEMETRY_CACHE_LINE_SIZE) TelemetrySlot
+{
+public:
+
+    /**
+     * @brief Reset the counters; done by the claiming thread before
+     *        the slot state becomes Running.
+     *
+     * @param rpLabel Slot label, truncated to TELEMETRY_LABEL_LENGTH - 1.
+     */
+    void reset(const char* rpLabel)
+    {
+        mdSequence.store(0, std::memory_order_relaxed);
+        mdTid.store(static_cast<int32_t>(syscall(SYS_gettid)), std::memory_order_relaxed);
+        mdCpu.store(-1, std::memory_order_relaxed);
+        strncpy(maLabel, rpLabel, sizeof(maLabel) - 1);
+        maLabel[sizeof(maLabel) - 1] = '\0';
+        mdIterations.store(0, std::memory_order_relaxed);
+        mdLastError.store(0, std::memory_order_relaxed);
+        mdMinError.store(INT64_MAX, std::memory_order_relaxed);
+        mdMaxError.store(INT64_MIN, std::memory_order_relaxed);
+        mdErrorSum.store(0, std::memory_order_relaxed);
+        for (auto& rdCount : maSleepCounts)
+        {
+            rdCount.store(0, std::memory_order_relaxed);
+        }
+
+        // Publishes the label and the counters above.
+        mdState.store(static_cast<uint32_t>(SlotState::Running), std::memory_order_release);
+    }
+
+    /**
+     * @brief Publish one iteration. Must only be called by the slot owner.
+     *
+     * @param rtError Wakeup error of the iteration.
+     * @param rdSleepCount Sleep restarts of the iteration.
+     * @param rdCpu CPU the iteration ran on.
+     */
+    void publish(rt_time::Nanos rtError, size_t rdSleepCount, int32_t rdCpu)
+    {
+        const int64_t dError = rtError.count();
+        const auto dSeq = mdSequence.load(std::memory_order_relaxed);
+
+        // Odd sequence: the update is in progress.
+        mdSequence.store(dSeq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        mdCpu.store(rdCpu, std::memory_order_relaxed);
+        mdIterations.store(mdIterations.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        mdLastError.store(dError, std::memory_order_relaxed);
+        mdErrorSum.store(mdErrorSum.load(std::memory_order_relaxed) + dError, std::memory_order_relaxed);
+
+        if (dError < mdMinError.load(std::memory_order_relaxed))
+        {
+            mdMinError.store(dError, std::memory_order_relaxed);
+        }
+
+        if (dError > mdMaxError.load(std::memory_order_relaxed))
+        {
+            mdMaxError.store(dError, std::memory_order_relaxed);
+        }
+
+        auto& rdBucket = maSleepCounts[(rdSleepCount < SLEEP_COUNT_BUCKETS) ? rdSleepCount : SLEEP_COUNT_BUCKETS - 1];
+        rdBucket.store(rdBucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+        mdSequence.store(dSeq + 2, std::memory_order_release);
+    }
+
+    /**
+     * @brief Mark the slot as finished; the counters stay readable.
+     */
+    void finish()
+    {
+        mdState.store(static_cast<uint32_t>(SlotState::Done), std::memory_order_release);
+    }
+
+    /**
+     * @brief Copy the slot. Safe to call concurrently with publish(),
+     *        also from another process.
+     *
+     * @param rtOutput Copy.
+     *
+     * @return True if the copy is consistent.
+     */
+    bool snapshot(TelemetrySnapshot& rtOutput) const
+    {
+        rtOutput.eState = static_cast<SlotState>(mdState.load(std::memory_order_acquire));
+        if (SlotState::Free == rtOutput.eState)
+        {
+            return true;
+        }
+
+        rtOutput.dTid = mdTid.load(std::memory_order_relaxed);
+        memcpy(rtOutput.aLabel, maLabel, sizeof(rtOutput.aLabel));
+        rtOutput.aLabel[sizeof(rtOutput.aLabel) - 1] = '\0';
+
+        bool bConsistent = false;
+        for (size_t dAttempt = 0; (dAttempt < TELEMETRY_SNAPSHOT_ATTEMPTS) && not bConsistent; ++dAttempt)
+        {
+            const auto dSeqBefore = mdSequence.load(std::memory_order_acquire);
+
+            rtOutput.dCpu = mdCpu.load(std::memory_order_relaxed);
+            rtOutput.dIterations = mdIterations.load(std::memory_order_relaxed);
+            rtOutput.dLastError = mdLastError.load(std::memory_order_relaxed);
+            rtOutput.dMinError = mdMinError.load(std::memory_order_relaxed);
+            rtOutput.dMaxError = mdMaxError.load(std::memory_order_relaxed);
+            rtOutput.dErrorSum = mdErrorSum.load(std::memory_order_relaxed);
+            for (size_t dIdx = 0; dIdx < SLEEP_COUNT_BUCKETS; ++dIdx)
+            {
+                rtOutput.aSleepCounts[dIdx] = maSleepCounts[dIdx].load(std::memory_order_relaxed);
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const auto dSeqAfter = mdSequence.load(std::memory_order_relaxed);
+
+            bConsistent = ((dSeqBefore & 1) == 0) && (dSeqBefore == dSeqAfter);
+        }
+
+        return bConsistent;
+    }
+
+private:
+    std::atomic<uint32_t> mdSequence;
+    std::atomic<uint32_t> mdState;
+    std::atomic<int32_t> mdTid;
+    std::atomic<int32_t> mdCpu;
+    char maLabel[TELEMETRY_LABEL_LENGTH];
+    std::atomic<uint64_t> mdIterations;
+    std::atomic<int64_t> mdLastError;
+    std::atomic<int64_t> mdMinError;
+    std::atomic<int64_t> mdMaxError;
+    std::atomic<int64_t> mdErrorSum;
+    std::atomic<uint64_t> maSleepCounts[SLEEP_COUNT_BUCKETS];
+};
+
+struct alignas(TELEMETRY_CACHE_LINE_SIZE) TelemetryHeader
+{
+    char aMagic[8];
+    uint32_t dVersion;
+    uint32_t dSlotSize;
+    uint32_t dSlotCount;
+    int32_t dWriterPid;
+    std::atomic<uint32_t> dClaimed;   // Slots claimed, may exceed dSlotCount.
+};
+
+static_assert(sizeof(TelemetryHeader) == TELEMETRY_CACHE_LINE_SIZE, "The header takes one cache line");
+
+/**
+ * @brief Get the segment size for the given number of slots.
+ */
+constexpr size_t telemetrySize(size_t rdSlotCount)
+{
+    return sizeof(TelemetryHeader) + rdSlotCount * sizeof(TelemetrySlot);
+}
+
+/**
+ * @brief Check whether the segment writer is still running.
+ *
+ * @param rdPid Writer PID.
+ *
+ * @return True if the process exists, even if it cannot be signalled.
+ */
+inline bool isWriterAlive(pid_t rdPid)
+{
+    return (rdPid > 0) && ((0 == kill(rdPid, 0)) || (EPERM == errno));
+}
+
+/**
+ * @brief Writer side of the segment: creates it and hands the slots out.
+ *        The segment is left in place on exit, so the final counters
+ *        can still be read; the next open() reinitializes it once its
+ *        writer is gone. A segment of a running writer is never touched:
+ *        its slots are single-writer.
+ */
+class TelemetryPublisher
+{
+public:
+
+    TelemetryPublisher() :
+        mpHeader(nullptr),
+        mdSlotCount(0)
+    {}
+
+    ~TelemetryPublisher()
+    {
+        close();
+    }
+
+    TelemetryPublisher(const TelemetryPublisher&) = delete;
+    TelemetryPublisher& operator=(const TelemetryPublisher&) = delete;
+
+    /**
+     * @brief Create (or reinitialize a stale) segment and map it.
+     *
+     * @param[in] rpName Segment name, e.g. "/rt_telemetry".
+     * @param[in] rdSlotCount Max number of publishing threads.
+     *
+     * @return Error code: ALREADY_ENABLED if another running process
+     *         publishes to the segment.
+     */
+    cmn::ErrCode open(const char* rpName, size_t rdSlotCount = DEFAULT_TELEMETRY_SLOTS)
+    {
+        if (nullptr != mpHeader)
+        {
+            return cmn::ErrCode::ALREADY_ENABLED;
+        }
+
+        if (0 == rdSlotCount)
+        {
+            return cmn::ErrCode::INVALID_ARGS;
+        }
+
+        const int dFd = shm_open(rpName, O_RDWR | O_CREAT, 0644);
+        if (dFd < 0)
+        {
+            CMN_LOG_ERROR("Failed to open the telemetry segment %s: %d (%s)", rpName, errno, strerror(errno));
+            return cmn::ErrCode::GENERAL_ERR;
+        }
+
+        // The lock serializes the writers starting at the same time:
+        // the check of the current writer and the reinitialization
+        // are done by one of them at a time. Released by the close().
+        if (0 != flock(dFd, LOCK_EX))
+        {
+            CMN_LOG_ERROR("Failed to lock the telemetry segment %s: %d (%s)", rpName, errno, strerror(errno));
+            ::close(dFd);
+            return cmn::ErrCode::GENERAL_ERR;
+        }
+
+        const auto dWriterPid = currentWriter(dFd);
+        if (dWriterPid > 0)
+        {
+            CMN_LOG_ERROR("The telemetry segment %s is in use by the running process %d", rpName,
+                    static_cast<int>(dWriterPid));
+            ::close(dFd);
+            return cmn::ErrCode::ALREADY_ENABLED;
+        }
+
+        // The segment is new or stale. Truncate to zero first so a reader
+        // never sees the stale slots.
+        const auto dSize = telemetrySize(rdSlotCount);
+        void* pMapping = MAP_FAILED;
+        if ((0 == ftruncate(dFd, 0)) && (0 == ftruncate(dFd, static_cast<off_t>(dSize))))
+        {
+            pMapping = mmap(nullptr, dSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, dFd, 0);
+        }
+
+        ::close(dFd);
+
+        if (MAP_FAILED == pMapping)
+        {
+            CMN_LOG_ERROR("Failed to map the telemetry segment %s: %d (%s)", rpName, errno, strerror(errno));
+            return cmn::ErrCode::GENERAL_ERR;
+        }
+
+        // The zero-filled slots are Free, only the header is set up.
+        mpHeader = static_cast<TelemetryHeader*>(pMapping);
+        mpHeader->dVersion = TELEMETRY_VERSION;
+        mpHeader->dSlotSize = sizeof(TelemetrySlot);
+        mpHeader->dSlotCount = static_cast<uint32_t>(rdSlotCount);
+        mpHeader->dWriterPid = static_cast<int32_t>(getpid());
+        mpHeader->dClaimed.store(0, std::memory_order_relaxed);
+
+        // The magic goes last: readers check it first.
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(mpHeader->aMagic, TELEMETRY_MAGIC, sizeof(TELEMETRY_MAGIC));
+
+        mdSlotCount = rdSlotCount;
+        return cmn::ErrCode::OK;
+    }
+
+    /**
+     * @brief Claim a slot for the calling thread; it becomes
+     *        the only writer of the slot.
+     *
+     * @param[in] rpLabel Slot label shown by the readers.
+     *
+     * @return Slot, nullptr if all the slots are taken.
+     */
+    TelemetrySlot* claim(const char* rpLabel)
+    {
+        if (nullptr == mpHeader)
+        {
+            return nullptr;
+        }
+
+        const auto dIdx = mpHeader->dClaimed.fetch_add(1, std::memory_order_relaxed);
+        if (dIdx >= mdSlotCount)
+        {
+            return nullptr;
+        }
+
+        auto pSlot = reinterpret_cast<TelemetrySlot*>(mpHeader + 1) + dIdx;
+        pSlot->reset(rpLabel);
+        return pSlot;
+    }
+
+    void close()
+    {
+        if (nullptr != mpHeader)
+        {
+            munmap(mpHeader, telemetrySize(mdSlotCount));
+            mpHeader = nullptr;
+            mdSlotCount = 0;
+        }
+    }
+
+    bool isOpen() const
+    {
+        return nullptr != mpHeader;
+    }
+
+private:
+
+    /**
+     * @brief Get the writer of an initialized segment if it is still running.
+     *
+     * @param[in] rdFd Segment descriptor.
+     *
+     * @return Writer PID, 0 if the segment is new, stale or of an exited writer.
+     */
+    static pid_t currentWriter(int rdFd)
+    {
+        struct stat tStat {};
+        if ((0 != fstat(rdFd, &tStat)) || (static_cast<size_t>(tStat.st_size) < sizeof(TelemetryHeader)))
+        {
+            return 0;
+        }
+
+        const auto pMapping = mmap(nullptr, sizeof(TelemetryHeader), PROT_READ, MAP_SHARED, rdFd, 0);
+        if (MAP_FAILED == pMapping)
+        {
+            return 0;
+        }
+
+        const auto pHeader = static_cast<const TelemetryHeader*>(pMapping);
+        const auto dPid = static_cast<pid_t>(pHeader->dWriterPid);
+        const bool bInUse = (0 == memcmp(pHeader->aMagic, TELEMETRY_MAGIC, sizeof(TELEMETRY_MAGIC))) &&
+                (dPid != getpid()) && isWriterAlive(dPid);
+        munmap(pMapping, sizeof(TelemetryHeader));
+
+        return bInUse ? dPid : 0;
+    }
+
+    TelemetryHeader* mpHeader;
+    size_t mdSlotCount;
+};
+
+/**
+ * @brief Read-only view of the segment for the monitors.
+ */
+class TelemetryReader
+{
+public:
+
+    TelemetryReader() :
+        mpHeader(nullptr),
+        mdSize(0)
+    {}
+
+    ~TelemetryReader()
+    {
+        if (nullptr != mpHeader)
+        {
+            munmap(const_cast<TelemetryHeader*>(mpHeader), mdSize);
+        }
+    }
+
+    TelemetryReader(const TelemetryReader&) = delete;
+    TelemetryReader& operator=(const TelemetryReader&) = delete;
+
+    /**
+     * @brief Map the segment and validate its header.
+     *
+     * @param[in] rpName Segment name.
+     *
+     * @return Error code; NOT_READY if the segment is not there (yet).
+     */
+    cmn::ErrCode open(const char* rpName)
+    {
+        const int dFd = shm_open(rpName, O_RDONLY, 0);
+        if (dFd < 0)
+        {
+            return (ENOENT == errno) ? cmn::ErrCode::NOT_READY : cmn::ErrCode::GENERAL_ERR;
+        }
+
+        struct stat tStat {};
+        void* pMapping = MAP_FAILED;
+        if ((0 == fstat(dFd, &tStat)) && (static_cast<size_t>(tStat.st_size) >= sizeof(TelemetryHeader)))
+        {
+            mdSize = static_cast<size_t>(tStat.st_size);
+            pMapping = mmap(nullptr, mdSize, PROT_READ, MAP_SHARED, dFd, 0);
+        }
+
+        ::close(dFd);
+
+        if (MAP_FAILED == pMapping)
+        {
+            return cmn::ErrCode::NOT_READY;
+        }
+
+        mpHeader = static_cast<const TelemetryHeader*>(pMapping);
+        if ((0 != memcmp(mpHeader->aMagic, TELEMETRY_MAGIC, sizeof(TELEMETRY_MAGIC))) ||
+                (TELEMETRY_VERSION != mpHeader->dVersion) || (sizeof(TelemetrySlot) != mpHeader->dSlotSize) ||
+                (telemetrySize(mpHeader->dSlotCount) > mdSize))
+        {
+            CMN_LOG_ERROR("%s is not a telemetry segment or its version is not supported", rpName);
+            return cmn::ErrCode::NOT_SUPPORTED;
+        }
+
+        return cmn::ErrCode::OK;
+    }
+
+    /**
+     * @brief Number of slots claimed by the writers.
+     */
+    size_t size() const
+    {
+        const size_t dClaimed = mpHeader->dClaimed.load(std::memory_order_relaxed);
+        return (dClaimed < mpHeader->dSlotCount) ? dClaimed : mpHeader->dSlotCount;
+    }
+
+    const TelemetrySlot& slot(size_t rdIdx) const
+    {
+        return reinterpret_cast<const TelemetrySlot*>(mpHeader + 1)[rdIdx];
+    }
+
+    pid_t writerPid() const
+    {
+        return static_cast<pid_t>(mpHeader->dWriterPid);
+    }
+
+private:
+    const TelemetryHeader* mpHeader;
+    size_t mdSize;
+};
+}
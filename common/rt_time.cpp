@@ -0,0 +1,146 @@
+#include "rt_time.h"
+
+// Out-of-line part of rt_time.h, built into libcommon. getTime() stays
+// in the header: it sits between the samples of every measurement.
+
+namespace rt_time
+{
+const char* clockIdToString(ClockTypeId reClockTypeId)
+{
+    switch (reClockTypeId)
+    {
+        case ClockTypeId::RealTime:
+            return "RealTime";
+
+        case ClockTypeId::Monotonic:
+            return "Monotonic";
+
+        case ClockTypeId::MonotonicRaw:
+            return "MonotonicRaw";
+
+        case ClockTypeId::RealTimeCoarse:
+            return "RealTimeCoarse";
+
+        case ClockTypeId::MonotonicCoarse:
+            return "MonotonicCoarse";
+
+        case ClockTypeId::Tsc:
+            return "Tsc";
+
+        default:
+            // Add an assertion maybe?
+            return "Unknown Type";
+    }
+}
+
+cmn::ErrCode parseClockTypeId(const char* rpValue, ClockTypeId& reOutput)
+{
+    static const ClockTypeId aClocks[] = {ClockTypeId::RealTime, ClockTypeId::Monotonic, ClockTypeId::MonotonicRaw,
+                                          ClockTypeId::RealTimeCoarse, ClockTypeId::MonotonicCoarse, ClockTypeId::Tsc};
+
+    for (const auto eClock : aClocks)
+    {
+        if (0 == strcasecmp(rpValue, clockIdToString(eClock)))
+        {
+            reOutput = eClock;
+            return cmn::ErrCode::OK;
+        }
+    }
+
+    return cmn::ErrCode::INVALID_ARGS;
+}
+
+cmn::ErrCode parseNanos(const char* rpValue, Nanos& rtOutput)
+{
+    char* pEnd = nullptr;
+    errno = 0;
+    const long long dValue = strtoll(rpValue, &pEnd, 10);
+    if ((pEnd == rpValue) || (errno != 0))
+    {
+        return cmn::ErrCode::INVALID_ARGS;
+    }
+
+    const auto dCount = static_cast<int64_t>(dValue);
+    if (0 == strcmp(pEnd, "ns"))
+    {
+        rtOutput = Nanos(dCount);
+    }
+    else if ((0 == strcmp(pEnd, "us")) || (*pEnd == '\0'))
+    {
+        rtOutput = Nanos::fromUsec(dCount);
+    }
+    else if (0 == strcmp(pEnd, "ms"))
+    {
+        rtOutput = Nanos::fromMsec(dCount);
+    }
+    else if (0 == strcmp(pEnd, "s"))
+    {
+        rtOutput = Nanos::fromSeconds(dCount);
+    }
+    else
+    {
+        return cmn::ErrCode::INVALID_ARGS;
+    }
+
+    return cmn::ErrCode::OK;
+}
+
+double timeDiffInSeconds(const timespec& rtStart, const timespec& rtStop)
+{
+    // Subtract in integer nanoseconds first: converting the time points
+    // themselves to double loses the nanoseconds at epoch magnitudes.
+    const auto tDiff = Nanos::fromTimespec(rtStop) - Nanos::fromTimespec(rtStart);
+
+    // Double-check to prevent an overflow due to
+    // a design-time error.
+    assert(tDiff.count() >= 0);
+    return tDiff.toSeconds();
+}
+
+cmn::ErrCode timeDiffInTimespec(const timespec& rtStart, const timespec& rtStop, timespec& rtDiff,
+        bool rbIgnoreNegDelta)
+{
+    const auto tDiff = Nanos::fromTimespec(rtStop) - Nanos::fromTimespec(rtStart);
+    rtDiff = tDiff.toTimespec();
+
+    if ((tDiff.count() < 0) && not rbIgnoreNegDelta)
+    {
+        // The end point occurs earlier than the start.
+        CMN_LOG_ERROR("Negative time diff: %" PRId64 " ns", tDiff.count());
+        return cmn::ErrCode::OVERFLOW;
+    }
+
+    return cmn::ErrCode::OK;
+}
+
+cmn::ErrCode getClockResolution(ClockTypeId rtClockId, timespec& rtOutput)
+{
+    if (rtClockId == ClockTypeId::Tsc)
+    {
+        return tsc::getResolution(rtOutput);
+    }
+
+    // Need to use C-style cast since even reinterpret_cast does not
+    // work despite using enum class with a proper numeric base type,
+    // have no idea why. I feel shame for this.
+    if (0 != clock_getres((clockid_t) rtClockId, &rtOutput))
+    {
+        return cmn::ErrCode::CLOCK_ERROR;
+    }
+
+    return cmn::ErrCode::OK;
+}
+
+ClockTypeId sleepClockFor(ClockTypeId reClockTypeId)
+{
+    switch (reClockTypeId)
+    {
+        case ClockTypeId::RealTime:
+        case ClockTypeId::RealTimeCoarse:
+            return ClockTypeId::RealTime;
+
+        default:
+            return ClockTypeId::Monotonic;
+    }
+}
+}
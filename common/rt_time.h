@@ -1,12 +1,18 @@
 #pragma once
 
 #include <cassert>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 
 // A funny fact: timespec seems to appear since C11
 // however code in the examples
 // (at least http://ecee.colorado.edu/%7Eecen5623/ecen/ex/Linux/RT-Clock/)
 // is written in C89.
 
+#include <strings.h>
 #include <time.h>
 
 #include "common.h"
@@ -21,6 +27,9 @@
 #define NSEC_TO_SEC(x) ((double)(x)/(double)(NSEC_PER_SEC))
 // TODO: add the others.
 
+// CPU counter clock source.
+#include "tsc_clock.h"
+
 namespace rt_time
 {
 
@@ -33,7 +42,12 @@ enum ClockTypeId : clockid_t
     Monotonic = CLOCK_MONOTONIC,
     MonotonicRaw = CLOCK_MONOTONIC_RAW,
     RealTimeCoarse = CLOCK_REALTIME_COARSE,
-    MonotonicCoarse = CLOCK_MONOTONIC_COARSE
+    MonotonicCoarse = CLOCK_MONOTONIC_COARSE,
+
+    // Not a POSIX clock: the CPU counter (TSC/cntvct) calibrated against
+    // MonotonicRaw, see tsc_clock.h. Needs tsc::calibrate() to be called first.
+    // The value is far above the kernel's static clock IDs.
+    Tsc = 0x100
 };
 
 /**
@@ -43,30 +57,137 @@ enum ClockTypeId : clockid_t
  *
  * @return String-form type ID.
  */
-const char* clockIdToString(ClockTypeId reClockTypeId)
+const char* clockIdToString(ClockTypeId reClockTypeId);
+
+/**
+ * @brief Time span or time point in integer nanoseconds. Unlike the
+ *        double-based arithmetic it is exact at any epoch magnitude
+ *        (int64 covers +-292 years) and unlike timespec it needs no
+ *        rollover handling: add and subtract are plain integer ops,
+ *        the normalization into (tv_sec, 0 <= tv_nsec < NSEC_PER_SEC)
+ *        is done without branches on conversion only.
+ */
+class Nanos
 {
-    switch (reClockTypeId)
+public:
+
+    constexpr Nanos() :
+        mdValue(0)
+    {}
+
+    constexpr explicit Nanos(int64_t rdNsec) :
+        mdValue(rdNsec)
+    {}
+
+    static constexpr Nanos fromTimespec(const timespec& rtTime)
+    {
+        return Nanos(static_cast<int64_t>(rtTime.tv_sec) * NSEC_PER_SEC + rtTime.tv_nsec);
+    }
+
+    static constexpr Nanos fromSeconds(int64_t rdSec)
     {
-        case ClockTypeId::RealTime:
-            return "RealTime";
+        return Nanos(rdSec * NSEC_PER_SEC);
+    }
 
-        case ClockTypeId::Monotonic:
-            return "Monotonic";
+    static constexpr Nanos fromMsec(int64_t rdMsec)
+    {
+        return Nanos(rdMsec * NSEC_PER_MSEC);
+    }
 
-        case ClockTypeId::MonotonicRaw:
-            return "MonotonicRaw";
+    static constexpr Nanos fromUsec(int64_t rdUsec)
+    {
+        return Nanos(rdUsec * NSEC_PER_USEC);
+    }
 
-        case ClockTypeId::RealTimeCoarse:
-            return "RealTimeCoarse";
+    constexpr int64_t count() const
+    {
+        return mdValue;
+    }
 
-        case ClockTypeId::MonotonicCoarse:
-            return "MonotonicCoarse";
+    /**
+     * @brief Whole seconds, rounded towards minus infinity, so that
+     *        nsecPart() is never negative.
+     */
+    constexpr int64_t secPart() const
+    {
+        // (x >> 63) is -1 for a negative remainder and 0 otherwise.
+        return (mdValue / NSEC_PER_SEC) + ((mdValue % NSEC_PER_SEC) >> 63);
+    }
 
-        default:
-            // Add an assertion maybe?
-            return "Unknown Type";
+    /**
+     * @brief Nanoseconds within the second, [0, NSEC_PER_SEC).
+     */
+    constexpr int64_t nsecPart() const
+    {
+        return (mdValue % NSEC_PER_SEC) + (((mdValue % NSEC_PER_SEC) >> 63) & NSEC_PER_SEC);
     }
-}
+
+    constexpr timespec toTimespec() const
+    {
+        return timespec {static_cast<time_t>(secPart()), static_cast<long>(nsecPart())};
+    }
+
+    constexpr double toSeconds() const
+    {
+        return NSEC_TO_SEC(mdValue);
+    }
+
+    constexpr int64_t toMsec() const
+    {
+        return mdValue / NSEC_PER_MSEC;
+    }
+
+    constexpr int64_t toUsec() const
+    {
+        return mdValue / NSEC_PER_USEC;
+    }
+
+    constexpr Nanos operator+(const Nanos& rtOther) const { return Nanos(mdValue + rtOther.mdValue); }
+    constexpr Nanos operator-(const Nanos& rtOther) const { return Nanos(mdValue - rtOther.mdValue); }
+    constexpr Nanos operator-() const { return Nanos(-mdValue); }
+    constexpr Nanos operator*(int64_t rdFactor) const { return Nanos(mdValue * rdFactor); }
+    constexpr Nanos operator/(int64_t rdDivisor) const { return Nanos(mdValue / rdDivisor); }
+
+    Nanos& operator+=(const Nanos& rtOther) { mdValue += rtOther.mdValue; return *this; }
+    Nanos& operator-=(const Nanos& rtOther) { mdValue -= rtOther.mdValue; return *this; }
+
+    constexpr bool operator==(const Nanos& rtOther) const { return mdValue == rtOther.mdValue; }
+    constexpr bool operator!=(const Nanos& rtOther) const { return mdValue != rtOther.mdValue; }
+    constexpr bool operator<(const Nanos& rtOther) const { return mdValue < rtOther.mdValue; }
+    constexpr bool operator<=(const Nanos& rtOther) const { return mdValue <= rtOther.mdValue; }
+    constexpr bool operator>(const Nanos& rtOther) const { return mdValue > rtOther.mdValue; }
+    constexpr bool operator>=(const Nanos& rtOther) const { return mdValue >= rtOther.mdValue; }
+
+private:
+    int64_t mdValue;
+};
+
+static_assert(Nanos(-1).secPart() == -1 && Nanos(-1).nsecPart() == NSEC_PER_SEC - 1,
+        "Negative spans must normalize to a non-negative tv_nsec");
+static_assert(Nanos::fromTimespec(timespec {2, 999999999}).count() + 1 == Nanos::fromSeconds(3).count(),
+        "timespec conversion must be exact");
+
+/**
+ * @brief Parse a clock type name as returned by clockIdToString(),
+ *        case-insensitive.
+ *
+ * @param rpValue Clock name.
+ * @param reOutput Clock type ID output.
+ *
+ * @return Status code.
+ */
+cmn::ErrCode parseClockTypeId(const char* rpValue, ClockTypeId& reOutput);
+
+/**
+ * @brief Parse a time span: an integer with an optional ns, us, ms or s
+ *        suffix; microseconds if no suffix is given.
+ *
+ * @param rpValue Time span string, e.g. "10ms".
+ * @param rtOutput Time span output.
+ *
+ * @return Status code.
+ */
+cmn::ErrCode parseNanos(const char* rpValue, Nanos& rtOutput);
 
 /**
  * @brief Compute time points diff in seconds.
@@ -76,27 +197,16 @@ const char* clockIdToString(ClockTypeId reClockTypeId)
  *
  * @return Diff in seconds.
  */
-double timeDiffInSeconds(const timespec& rtStart, const timespec& rtStop)
-{
-    // Convert both start and end points to seconds.
-    const auto dDfStart = static_cast<double>(rtStart.tv_sec) +
-        NSEC_TO_SEC(rtStart.tv_nsec);
-    const auto dDfStop = static_cast<double>(rtStop.tv_sec) +
-        NSEC_TO_SEC(rtStop.tv_nsec);
-
-    // Double-check to prevent an overflow due to
-    // a design-time error.
-    assert(dDfStop >= dDfStart);
-    return dDfStop - dDfStart;
-}
+double timeDiffInSeconds(const timespec& rtStart, const timespec& rtStop);
 
 /**
  * @brief Compute time diff as a timespec structure.
  *
  * @param rtStart Start time point.
  * @param rtStop Stop time point.
- * @param rtDiff Diff output structure ref.
- * @param rbIgnoreNegDelta If set to true - ignore dDeltaNsec < 0 case - return OK instead
+ * @param rtDiff Diff output structure ref, normalized; if the stop point
+ *               occurs earlier than the start one tv_sec is negative.
+ * @param rbIgnoreNegDelta If set to true - ignore a negative diff - return OK instead
  *                         of printing an error and failing. For certain clock types this
  *                         case may actually happen and it is Ok.
  *                         In http://ecee.colorado.edu/%7Eecen5623/ecen/ex/Linux/RT-Clock/
@@ -106,79 +216,7 @@ double timeDiffInSeconds(const timespec& rtStart, const timespec& rtStop)
  * @return Status code.
  */
 cmn::ErrCode timeDiffInTimespec(const timespec& rtStart, const timespec& rtStop, timespec& rtDiff,
-        bool rbIgnoreNegDelta = false)
-{
-    // The original code http://ecee.colorado.edu/%7Eecen5623/ecen/ex/Linux/RT-Clock/
-    // uses int type but this is not a good approach since we do narrowing
-    // conversion in such a case and if we have a long time period we may get
-    // an overflow for tv_nsec. Let's use timespec's original types.
-
-    const long dDeltaSec = rtStop.tv_sec - rtStart.tv_sec;
-    long int dDeltaNsec = rtStop.tv_nsec - rtStart.tv_nsec;
-
-    if (dDeltaSec == 0)
-    {
-        if (dDeltaNsec < 0)
-        {
-            // The end point occurs earlier than the start.
-
-            if (not rbIgnoreNegDelta)
-            {
-                CMN_LOG_ERROR("Delta-Ns overflow: %ld (delta seconds == 0)", dDeltaNsec);
-                return cmn::ErrCode::OVERFLOW;
-            }
-
-            return cmn::ErrCode::OK;
-        }
-
-        // Case 1: the time span is less than a second.
-
-        // dDeltaNsec > NSEC_PER_SEC check may be redundant (?) since
-        // according to the spec tv_nsec may NOT exceed 1 second
-        // in case it is obtained with clock_gettime(); please
-        // see https://pubs.opengroup.org/onlinepubs/9699919799/functions/V2_chap02.html ,
-        // paragraph 2.8.5.
-        if (dDeltaNsec >= 0 && dDeltaNsec < NSEC_PER_SEC)
-        {
-            rtDiff.tv_sec = 0;
-            rtDiff.tv_nsec = dDeltaNsec;
-        }
-        else // dDeltaNsec > NSEC_PER_SEC - rollover, correct to +1 second.
-        {
-            // An overflow. Unlikely to happen in an average case - please see above.
-            // Assume that we have an overflow not more than 1 second ;-)
-            rtDiff.tv_sec = 1;
-            rtDiff.tv_nsec = dDeltaNsec - NSEC_PER_SEC;
-        }
-    }
-    else
-    {
-        // Case 2: more than one second span.
-        if (dDeltaNsec >= 0 && dDeltaNsec < NSEC_PER_SEC)
-        {
-            // The normal case.
-            rtDiff.tv_sec = dDeltaSec;
-            rtDiff.tv_nsec = dDeltaNsec;
-        }
-        else
-        {
-            if (dDeltaNsec > NSEC_PER_SEC) // One second rollover.
-            {
-                ++rtDiff.tv_sec;
-                rtDiff.tv_nsec = dDeltaNsec - NSEC_PER_SEC;
-            }
-            else
-            {
-                // May get here during DT error computation -
-                // a negative rollover, dDeltaNsec < NSEC_PER_SEC.
-                rtDiff.tv_sec = dDeltaSec - 1;
-                rtDiff.tv_nsec = dDeltaNsec + NSEC_PER_SEC;
-            }
-        }
-    }
-
-    return cmn::ErrCode::OK;
-}
+        bool rbIgnoreNegDelta = false);
 
 /**
  * @brief Get current time.
@@ -188,8 +226,13 @@ cmn::ErrCode timeDiffInTimespec(const timespec& rtStart, const timespec& rtStop,
  *
  * @return Status code.
  */
-cmn::ErrCode getTime(ClockTypeId rtClockId, timespec& rtOutput)
+inline cmn::ErrCode getTime(ClockTypeId rtClockId, timespec& rtOutput)
 {
+    if (rtClockId == ClockTypeId::Tsc)
+    {
+        return tsc::getTime(rtOutput);
+    }
+
     // Need to use C-style cast since even reinterpret_cast does not
     // work despite using enum class with a proper numeric base type,
     // have no idea why. I feel shame for this.
@@ -201,6 +244,22 @@ cmn::ErrCode getTime(ClockTypeId rtClockId, timespec& rtOutput)
     return cmn::ErrCode::OK;
 }
 
+/**
+ * @brief Get current time as integer nanoseconds.
+ *
+ * @param rtClockId Clock type ID.
+ * @param rtOutput Time point output ref.
+ *
+ * @return Status code.
+ */
+inline cmn::ErrCode getTime(ClockTypeId rtClockId, Nanos& rtOutput)
+{
+    timespec tNow {};
+    const auto tErr = getTime(rtClockId, tNow);
+    rtOutput = Nanos::fromTimespec(tNow);
+    return tErr;
+}
+
 /**
  * @brief Get clock resolution for the given clock type ID.
  *
@@ -209,17 +268,213 @@ cmn::ErrCode getTime(ClockTypeId rtClockId, timespec& rtOutput)
  *
  * @return Status code.
  */
-cmn::ErrCode getClockResolution(ClockTypeId rtClockId, timespec& rtOutput)
+cmn::ErrCode getClockResolution(ClockTypeId rtClockId, timespec& rtOutput);
+
+/**
+ * @brief Get the clock clock_nanosleep() can sleep on for the given clock
+ *        type: Linux does not sleep on MonotonicRaw and the coarse clocks,
+ *        so the corresponding full-resolution clock of the same kind is used.
+ *
+ * @param reClockTypeId Clock type ID.
+ *
+ * @return Clock type ID to sleep on.
+ */
+ClockTypeId sleepClockFor(ClockTypeId reClockTypeId);
+
+/**
+ * @brief Periodic timer sleeping to absolute deadlines with
+ *        clock_nanosleep(TIMER_ABSTIME). Every deadline is the previous one
+ *        plus the period, so neither the wakeup latency nor an EINTR restart
+ *        shifts the following periods: the jitter does not accumulate.
+ *        Optionally the last part of every period is busy-waited
+ *        instead of slept to cut the wakeup latency.
+ */
+class PeriodicTimer
 {
-    // Need to use C-style cast since even reinterpret_cast does not
-    // work despite using enum class with a proper numeric base type,
-    // have no idea why. I feel shame for this.
-    if (0 != clock_getres((clockid_t) rtClockId, &rtOutput))
+public:
+
+    /**
+     * @brief Class constructor.
+     *
+     * @param[in] reClockTypeId Clock the period is defined for, see sleepClockFor().
+     * @param[in] rtPeriod Timer period.
+     * @param[in] rtSpin Busy-wait tail length, 0 - no busy wait. Never
+     *                   shorter than the clock resolution if enabled.
+     */
+    PeriodicTimer(ClockTypeId reClockTypeId, Nanos rtPeriod, Nanos rtSpin = Nanos()) :
+        meSleepClock(sleepClockFor(reClockTypeId)),
+        mtPeriod(rtPeriod),
+        mtSpin(rtSpin)
+    {}
+
+    /**
+     * @brief Arm the timer: the first deadline is one period from now.
+     *
+     * @return Status code.
+     */
+    cmn::ErrCode start()
     {
-        return cmn::ErrCode::CLOCK_ERROR;
+        Nanos tNow;
+        if (getTime(meSleepClock, tNow) != cmn::ErrCode::OK)
+        {
+            return cmn::ErrCode::CLOCK_ERROR;
+        }
+
+        return startAt(tNow + mtPeriod);
     }
 
-    return cmn::ErrCode::OK;
-}
+    /**
+     * @brief Arm the timer with the given first deadline, e.g. a release
+     *        time shared by several timers to keep them in phase.
+     *
+     * @param[in] rtFirstDeadline First deadline in terms of sleepClock().
+     *
+     * @return Status code.
+     */
+    cmn::ErrCode startAt(Nanos rtFirstDeadline)
+    {
+        if (mtPeriod <= Nanos())
+        {
+            return cmn::ErrCode::INVALID_ARGS;
+        }
+
+        if (mtSpin > Nanos())
+        {
+            // Spinning for less than the clock resolution can't be told
+            // apart from not spinning at all.
+            timespec tResolution {};
+            if (getClockResolution(meSleepClock, tResolution) != cmn::ErrCode::OK)
+            {
+                return cmn::ErrCode::CLOCK_ERROR;
+            }
+
+            const auto tResolutionNs = Nanos::fromTimespec(tResolution);
+            if (mtSpin < tResolutionNs)
+            {
+                mtSpin = tResolutionNs;
+            }
+        }
+
+        mtDeadline = rtFirstDeadline;
+        return cmn::ErrCode::OK;
+    }
+
+    /**
+     * @brief Sleep until the current deadline, then advance it by one period.
+     *
+     * @param[out] rdSleepCount Number of clock_nanosleep() calls interrupted
+     *                          by a signal and restarted.
+     * @param[in] rdMaxSleepCount Max. restarts; when reached the timer stops
+     *                            sleeping and returns early unless the spin
+     *                            tail is enabled and waits for the deadline.
+     *
+     * @return Status code.
+     */
+    cmn::ErrCode waitNext(size_t& rdSleepCount, size_t rdMaxSleepCount = static_cast<size_t>(-1))
+    {
+        rdSleepCount = 0;
+
+        const timespec tWakeup = (mtDeadline - mtSpin).toTimespec();
+
+        while (true)
+        {
+            const auto dRc = clock_nanosleep((clockid_t) meSleepClock, TIMER_ABSTIME, &tWakeup, nullptr);
+            if (dRc == 0)
+            {
+                break;
+            }
+            else if (dRc != EINTR)
+            {
+                CMN_LOG_ERROR("clock_nanosleep() call failed with err code %d", dRc);
+                return cmn::ErrCode::CLOCK_ERROR;
+            }
+
+            // The deadline is absolute: restarting does not add any error.
+            if (++rdSleepCount >= rdMaxSleepCount)
+            {
+                break;
+            }
+        }
+
+        // Sample the wakeup time; with the spin tail enabled the last
+        // sample of the busy-wait loop is the wakeup time.
+        do
+        {
+            if (getTime(meSleepClock, mtLastWakeup) != cmn::ErrCode::OK)
+            {
+                return cmn::ErrCode::CLOCK_ERROR;
+            }
+        }
+        while ((mtSpin > Nanos()) && (mtLastWakeup < mtDeadline));
+
+        mtLastDeadline = mtDeadline;
+        mtDeadline += mtPeriod;
+        return cmn::ErrCode::OK;
+    }
+
+    /**
+     * @brief Get how late the last waitNext() woke up relative to its deadline.
+     *
+     * @return Lateness; negative if woken up early.
+     */
+    Nanos lastLateness() const
+    {
+        return mtLastWakeup - mtLastDeadline;
+    }
+
+    /**
+     * @brief Get the next deadline in terms of sleepClock().
+     *
+     * @return Deadline time point.
+     */
+    Nanos deadline() const
+    {
+        return mtDeadline;
+    }
+
+    /**
+     * @brief Get the clock the timer actually sleeps on.
+     *
+     * @return Clock type ID.
+     */
+    ClockTypeId sleepClock() const
+    {
+        return meSleepClock;
+    }
+
+    Nanos period() const
+    {
+        return mtPeriod;
+    }
+
+    /**
+     * @brief Drop the periods whose deadlines have already passed: the next
+     *        deadline becomes the first one after rtNow, still on the
+     *        original period grid.
+     *
+     * @param[in] rtNow Current time in terms of sleepClock().
+     *
+     * @return Number of periods skipped.
+     */
+    uint64_t skipMissed(Nanos rtNow)
+    {
+        if (rtNow < mtDeadline)
+        {
+            return 0;
+        }
+
+        const auto dSkipped = static_cast<uint64_t>((rtNow - mtDeadline).count() / mtPeriod.count()) + 1;
+        mtDeadline += mtPeriod * static_cast<int64_t>(dSkipped);
+        return dSkipped;
+    }
+
+private:
+    ClockTypeId meSleepClock;
+    Nanos mtPeriod;
+    Nanos mtSpin;
+    Nanos mtDeadline;
+    Nanos mtLastDeadline;
+    Nanos mtLastWakeup;
+};
 
 }
@@ -0,0 +1,309 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "error_codes.h"
+
+// Binary trace of timing samples. The samples are fixed-width records
+// stored in a ring inside a memory-mapped file: recording is a couple of
+// stores into the page cache, no formatting and no syscalls at all, so
+// millions of samples can be captured without perturbing the measurement.
+// Once the ring is full the oldest records are overwritten. The file is
+// decoded offline, see week2/assignment2/trace_decode.cpp.
+//
+// File layout: TraceHeader, then dCapacity TraceRecord slots. Record
+// number N (counting from 0 since the trace start) is in slot N % dCapacity.
+// The writer fills the slot first and then publishes it by a release store
+// of dWritten, so a reader acquiring dWritten sees every record counted.
+
+namespace rt_trace
+{
+constexpr char TRACE_MAGIC[8] = {'R', 'T', 'T', 'R', 'A', 'C', 'E', '1'};
+constexpr uint32_t TRACE_VERSION = 2;   // 2: the run index and the period in every record.
+constexpr size_t DEFAULT_TRACE_CAPACITY = 1024 * 1024;
+
+struct TraceRecord
+{
+    uint16_t dClockId;     // rt_time::ClockTypeId.
+    uint16_t dSleepCount;  // EINTR restarts of the sleep, saturated.
+    uint32_t dRun;         // Test run the sample belongs to, e.g. in a test matrix.
+    uint64_t dIteration;
+    int64_t dPeriod;       // Requested period, nanoseconds.
+    int64_t dStart;        // Nanoseconds on the dClockId timeline.
+    int64_t dStop;
+    int64_t dError;        // Wakeup error (lateness), nanoseconds.
+};
+
+static_assert(sizeof(TraceRecord) == 48, "The record layout is a file format");
+
+struct TraceHeader
+{
+    char aMagic[8];
+    uint32_t dVersion;
+    uint32_t dRecordSize;
+    uint64_t dCapacity;               // Ring size in records.
+    std::atomic<uint64_t> dWritten;   // Records written and published since the start.
+    uint64_t aReserved[4];
+};
+
+static_assert(sizeof(TraceHeader) == 64, "The header layout is a file format");
+
+/**
+ * @brief Get the file size for the given ring capacity.
+ */
+constexpr size_t traceFileSize(size_t rdCapacity)
+{
+    return sizeof(TraceHeader) + rdCapacity * sizeof(TraceRecord);
+}
+
+/**
+ * @brief Trace file writer. record() is wait-free; it is not thread-safe,
+ *        the samples of one trace must come from one thread at a time.
+ */
+class TraceWriter
+{
+public:
+
+    TraceWriter() :
+        mpHeader(nullptr),
+        mpRecords(nullptr),
+        mdCapacity(0),
+        mdWritten(0)
+    {}
+
+    ~TraceWriter()
+    {
+        close();
+    }
+
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    /**
+     * @brief Create (or truncate) the trace file and map it.
+     *        The mapping is prefaulted here, not in the RT loop.
+     *
+     * @param[in] rpPath Trace file path.
+     * @param[in] rdCapacity Ring size in records.
+     *
+     * @return Error code.
+     */
+    cmn::ErrCode open(const char* rpPath, size_t rdCapacity = DEFAULT_TRACE_CAPACITY)
+    {
+        if (nullptr != mpHeader)
+        {
+            return cmn::ErrCode::ALREADY_ENABLED;
+        }
+
+        if (0 == rdCapacity)
+        {
+            return cmn::ErrCode::INVALID_ARGS;
+        }
+
+        const int dFd = ::open(rpPath, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (dFd < 0)
+        {
+            CMN_LOG_ERROR("Failed to open the trace file %s: %d (%s)", rpPath, errno, strerror(errno));
+            return cmn::ErrCode::GENERAL_ERR;
+        }
+
+        const auto dSize = traceFileSize(rdCapacity);
+        void* pMapping = MAP_FAILED;
+        if (0 == ftruncate(dFd, static_cast<off_t>(dSize)))
+        {
+            pMapping = mmap(nullptr, dSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, dFd, 0);
+        }
+
+        // The mapping keeps the file referenced.
+        ::close(dFd);
+
+        if (MAP_FAILED == pMapping)
+        {
+            CMN_LOG_ERROR("Failed to map the trace file %s: %d (%s)", rpPath, errno, strerror(errno));
+            return cmn::ErrCode::GENERAL_ERR;
+        }
+
+        mpHeader = static_cast<TraceHeader*>(pMapping);
+        memcpy(mpHeader->aMagic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+        mpHeader->dVersion = TRACE_VERSION;
+        mpHeader->dRecordSize = sizeof(TraceRecord);
+        mpHeader->dCapacity = rdCapacity;
+        mpHeader->dWritten.store(0, std::memory_order_relaxed);
+
+        mpRecords = reinterpret_cast<TraceRecord*>(mpHeader + 1);
+        mdCapacity = rdCapacity;
+        mdWritten = 0;
+        return cmn::ErrCode::OK;
+    }
+
+    /**
+     * @brief Append a sample, overwriting the oldest one if the ring is full.
+     */
+    void record(uint32_t rdClockId, uint32_t rdRun, uint64_t rdIteration, int64_t rdPeriod, int64_t rdStart,
+            int64_t rdStop, int64_t rdError, uint32_t rdSleepCount)
+    {
+        const auto dSleepCount = static_cast<uint16_t>((rdSleepCount < UINT16_MAX) ? rdSleepCount : UINT16_MAX);
+        mpRecords[mdWritten % mdCapacity] = TraceRecord {static_cast<uint16_t>(rdClockId), dSleepCount, rdRun,
+                                                         rdIteration, rdPeriod, rdStart, rdStop, rdError};
+        mpHeader->dWritten.store(++mdWritten, std::memory_order_release);
+    }
+
+    /**
+     * @brief Unmap the file. The data is written back by the kernel;
+     *        no flush is needed for the other processes to see it.
+     */
+    void close()
+    {
+        if (nullptr != mpHeader)
+        {
+            munmap(mpHeader, traceFileSize(mdCapacity));
+            mpHeader = nullptr;
+            mpRecords = nullptr;
+            mdCapacity = 0;
+        }
+    }
+
+    bool isOpen() const
+    {
+        return nullptr != mpHeader;
+    }
+
+private:
+    TraceHeader* mpHeader;
+    TraceRecord* mpRecords;
+    size_t mdCapacity;
+    uint64_t mdWritten;   // Local copy of TraceHeader::dWritten, only this writer changes it.
+};
+
+/**
+ * @brief Read-only trace file view for the decoders. The record counter
+ *        is read once by open() and refresh(), so the indices stay stable
+ *        while a live writer goes on appending. Every record of the snapshot
+ *        is complete, but a live writer which wraps the ring overwrites
+ *        the oldest ones meanwhile: decode the full rings offline.
+ */
+class TraceReader
+{
+public:
+
+    TraceReader() :
+        mpHeader(nullptr),
+        mdSize(0),
+        mdWritten(0),
+        mdFirst(0),
+        mdCount(0)
+    {}
+
+    ~TraceReader()
+    {
+        if (nullptr != mpHeader)
+        {
+            munmap(const_cast<TraceHeader*>(mpHeader), mdSize);
+        }
+    }
+
+    TraceReader(const TraceReader&) = delete;
+    TraceReader& operator=(const TraceReader&) = delete;
+
+    /**
+     * @brief Map the trace file and validate its header.
+     *
+     * @param[in] rpPath Trace file path.
+     *
+     * @return Error code.
+     */
+    cmn::ErrCode open(const char* rpPath)
+    {
+        const int dFd = ::open(rpPath, O_RDONLY | O_CLOEXEC);
+        if (dFd < 0)
+        {
+            CMN_LOG_ERROR("Failed to open the trace file %s: %d (%s)", rpPath, errno, strerror(errno));
+            return cmn::ErrCode::GENERAL_ERR;
+        }
+
+        struct stat tStat {};
+        void* pMapping = MAP_FAILED;
+        if ((0 == fstat(dFd, &tStat)) && (static_cast<size_t>(tStat.st_size) >= sizeof(TraceHeader)))
+        {
+            mdSize = static_cast<size_t>(tStat.st_size);
+            pMapping = mmap(nullptr, mdSize, PROT_READ, MAP_SHARED, dFd, 0);
+        }
+
+        ::close(dFd);
+
+        if (MAP_FAILED == pMapping)
+        {
+            CMN_LOG_ERROR("Failed to map the trace file %s", rpPath);
+            return cmn::ErrCode::GENERAL_ERR;
+        }
+
+        mpHeader = static_cast<const TraceHeader*>(pMapping);
+        if ((0 != memcmp(mpHeader->aMagic, TRACE_MAGIC, sizeof(TRACE_MAGIC))) ||
+                (TRACE_VERSION != mpHeader->dVersion) || (sizeof(TraceRecord) != mpHeader->dRecordSize) ||
+                (0 == mpHeader->dCapacity) || (traceFileSize(mpHeader->dCapacity) > mdSize))
+        {
+            CMN_LOG_ERROR("%s is not a trace file or its version is not supported", rpPath);
+            return cmn::ErrCode::NOT_SUPPORTED;
+        }
+
+        refresh();
+        return cmn::ErrCode::OK;
+    }
+
+    /**
+     * @brief Take a new snapshot of the record counter, e.g. to pick up
+     *        the records appended since. size(), lost() and the indices change.
+     */
+    void refresh()
+    {
+        const uint64_t dCapacity = mpHeader->dCapacity;
+        mdWritten = mpHeader->dWritten.load(std::memory_order_acquire);
+        mdCount = (mdWritten < dCapacity) ? mdWritten : dCapacity;
+        mdFirst = (mdWritten - mdCount) % dCapacity;
+    }
+
+    /**
+     * @brief Number of records available in the snapshot: the ones not overwritten yet.
+     */
+    size_t size() const
+    {
+        return static_cast<size_t>(mdCount);
+    }
+
+    /**
+     * @brief Number of records overwritten before the snapshot because the ring was full.
+     */
+    uint64_t lost() const
+    {
+        return mdWritten - mdCount;
+    }
+
+    /**
+     * @brief Get a record, the oldest one available first.
+     *
+     * @param[in] rdIdx Record index, [0, size()).
+     */
+    const TraceRecord& operator[](size_t rdIdx) const
+    {
+        const auto pRecords = reinterpret_cast<const TraceRecord*>(mpHeader + 1);
+        const auto dSlot = mdFirst + rdIdx;
+        return pRecords[(dSlot < mpHeader->dCapacity) ? dSlot : (dSlot - mpHeader->dCapacity)];
+    }
+
+private:
+    const TraceHeader* mpHeader;
+    size_t mdSize;
+    uint64_t mdWritten;   // Snapshot of TraceHeader::dWritten.
+    uint64_t mdFirst;     // Ring slot of the oldest record in the snapshot.
+    uint64_t mdCount;     // Records available in the snapshot.
+};
+}
@@ -2,67 +2,114 @@
 
 #include <cassert>
 #include <cstdio>
-#include <vector>
-#include <string>
+#include <cstring>
 
 #include <stdarg.h>
 
 namespace str_utils
 {
 
+// Size of the fixed buffers the formatting functions below work with,
+// including the terminating zero. Longer messages are truncated.
+constexpr size_t MAX_FORMAT_LENGTH = 512;
+
+// Marker put at the end of a truncated string.
+constexpr char TRUNCATION_MARKER[] = "...";
+
 /**
- * @brief Create a string formatted using given format tamplate and va_list args.
+ * @brief Compile-time format string check. The function is never
+ *        defined and should only be "called" in an unevaluated context,
+ *        e.g. sizeof(checkFormat(...)), so the compiler validates the
+ *        arguments against the format as it does for printf().
  *
  * @param rpFormat Format string.
+ * @param ... Values to be formatted.
+ *
+ * @return Nothing, it just needs a complete type.
+ */
+int checkFormat(const char* rpFormat, ...) __attribute__((format(printf, 1, 2)));
+
+/**
+ * @brief Format a string using given format template and va_list args
+ *        into the caller-supplied buffer. Never allocates; if the output
+ *        does not fit the buffer it is truncated and the truncation
+ *        is marked with TRUNCATION_MARKER.
+ *
+ * @param rpOut Output buffer.
+ * @param rdOutSize Output buffer size including the terminating zero.
+ * @param rpFormat Format string.
  * @param rtVarArgs va_list with the values to be formatted.
  *
- * @return Formatted string.
+ * @return Length of the string placed into the buffer.
  */
-std::string format_va(const char* rpFormat, va_list& rtVarArgs)
+inline size_t formatTo_va(char* rpOut, size_t rdOutSize, const char* rpFormat, va_list& rtVarArgs)
 {
     assert(rpFormat != nullptr);
+    assert(rpOut != nullptr);
 
-    constexpr size_t MAX_RESIZE_ATTEMPTS = 3;
-    int dBufLen = 0;
-    size_t dAttempt = 0;;
-
-    std::vector<char> tFmtBuffer(256); // Initial "guess"-like buffer size.
-
-    do
+    if (rdOutSize == 0)
     {
-        dBufLen = std::vsnprintf(tFmtBuffer.data(), tFmtBuffer.size(), rpFormat, rtVarArgs);
-        if (dBufLen != -1)
-        {
-            break;
-        }
+        return 0;
+    }
 
-        ++dAttempt;
-        assert(dAttempt < MAX_RESIZE_ATTEMPTS);
-
-        // Not enough space allocated. Increase the size twice and try again.
-        tFmtBuffer.resize(tFmtBuffer.size() * 2);
+    const int dLen = std::vsnprintf(rpOut, rdOutSize, rpFormat, rtVarArgs);
+    if (dLen < 0)
+    {
+        // Encoding error; return an empty string rather than garbage.
+        rpOut[0] = '\0';
+        return 0;
+    }
 
-    } while(true);
+    if (static_cast<size_t>(dLen) < rdOutSize)
+    {
+        return static_cast<size_t>(dLen);
+    }
 
-    tFmtBuffer[dBufLen] = '\0';
+    // vsnprintf() has already zero-terminated the truncated output;
+    // overwrite its tail with the marker if there is enough room for it.
+    const size_t dWritten = rdOutSize - 1;
+    constexpr size_t MARKER_LEN = sizeof(TRUNCATION_MARKER) - 1;
+    if (dWritten >= MARKER_LEN)
+    {
+        std::memcpy(rpOut + dWritten - MARKER_LEN, TRUNCATION_MARKER, MARKER_LEN);
+    }
 
-    return std::string(reinterpret_cast<const char*>(tFmtBuffer.data()));
+    return dWritten;
 }
 
 /**
- * @brief Format string using printf()-like approach.
+ * @brief Format a string using printf()-like approach into the
+ *        caller-supplied buffer. The format string is checked
+ *        at compile time.
  *
+ * @param rpOut Output buffer.
+ * @param rdOutSize Output buffer size including the terminating zero.
  * @param rpFormat Format string.
  * @param ... Values to be formatted.
  *
- * @return Formatted string.
+ * @return Length of the string placed into the buffer.
  */
-std::string format(const char* rpFormat, ...)
+size_t formatTo(char* rpOut, size_t rdOutSize, const char* rpFormat, ...) __attribute__((format(printf, 3, 4)));
+
+inline size_t formatTo(char* rpOut, size_t rdOutSize, const char* rpFormat, ...)
 {
     va_list tArgs;
     va_start(tArgs, rpFormat);
-    auto tRet = str_utils::format_va(rpFormat, tArgs);
+    const auto dLen = str_utils::formatTo_va(rpOut, rdOutSize, rpFormat, tArgs);
     va_end(tArgs);
-    return tRet;
+    return dLen;
+}
+
+/**
+ * @brief Get the calling thread's formatting buffer, MAX_FORMAT_LENGTH bytes.
+ *        The buffer is reused by every call on the same thread, so its
+ *        content is only valid until the next formatting done with it.
+ *
+ * @return Buffer pointer.
+ */
+inline char* threadBuffer()
+{
+    thread_local char aBuffer[MAX_FORMAT_LENGTH];
+    return aBuffer;
 }
 }
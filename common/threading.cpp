@@ -0,0 +1,35 @@
+#include "threading.h"
+
+// Out-of-line part of threading.h, built into libcommon.
+
+namespace threading
+{
+cmn::ErrCode adjustScheduler(const CpuSet& rtCpuSet, SchedPolicy rtNewPolicy, pthread_attr_t& rtAdjustedAttr, bool rbVerbose)
+{
+    if (rbVerbose)
+    {
+        CMN_LOG_TRACE("Initial sched policy %s", getSchedulerPolicyStr(getCurrThreadSchedulerPolicy()));
+    }
+
+    // The CPU set goes to the attributes only: the calling thread
+    // keeps its affinity, it gets the policy and the max priority.
+    const auto tErr = ThreadSpec().policy(rtNewPolicy).cpus(rtCpuSet).makeAttr(rtAdjustedAttr);
+    if (cmn::ErrCode::OK != tErr)
+    {
+        return tErr;
+    }
+
+    const auto tSelfErr = ThreadSpec().policy(rtNewPolicy).applyToCurrentThread();
+    if (cmn::ErrCode::OK != tSelfErr)
+    {
+        return tSelfErr;
+    }
+
+    if (rbVerbose)
+    {
+        CMN_LOG_TRACE("Adjusted sched policy %s", getSchedulerPolicyStr(getCurrThreadSchedulerPolicy()));
+    }
+
+    return cmn::ErrCode::OK;
+}
+}
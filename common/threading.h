@@ -1,28 +1,316 @@
 #pragma once
 
+#include <alloca.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <pthread.h>
 #include <sched.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <linux/futex.h>
+#include <linux/mempolicy.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <initializer_list>
+#include <iterator>
+#include <mutex>
 #include <set>
+#include <vector>
 
+#include "common.h"
 #include "error_codes.h"
 
 namespace threading
 {
 using SchedPolicy = int;
-using CpuSet = std::set<size_t>;
 using CpuIndex = int;
 
 /**
- * @brief Get PID (= thread ID) for the calling thread.
+ * @brief Set of CPU indices up to CPU_SETSIZE, a bitset laid out exactly
+ *        as cpu_set_t: set/test are O(1), size() is a popcount, the
+ *        iteration skips to the next set bit with ctz, and native()
+ *        passes the bits to the affinity calls without any conversion.
+ *        Nothing is allocated, so copies are cheap and RT-safe.
+ */
+class CpuSet
+{
+public:
+    using Word = unsigned long;     // __cpu_mask of glibc.
+
+    static constexpr size_t WORD_BITS = sizeof(Word) * CHAR_BIT;
+    static constexpr size_t CAPACITY = CPU_SETSIZE;
+    static constexpr size_t WORD_COUNT = CAPACITY / WORD_BITS;
+
+    /**
+     * @brief Forward iterator over the CPUs in the set, in ascending order.
+     */
+    class Iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = size_t;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const size_t*;
+        using reference = size_t;
+
+        constexpr Iterator(const CpuSet* rpSet, size_t rdWord, Word rdBits) :
+            mpSet(rpSet),
+            mdWord(rdWord),
+            mdBits(rdBits)
+        {}
+
+        size_t operator*() const
+        {
+            return mdWord * WORD_BITS + static_cast<size_t>(__builtin_ctzl(mdBits));
+        }
+
+        Iterator& operator++()
+        {
+            // Drop the lowest set bit, move on to the next non-empty word.
+            mdBits &= mdBits - 1;
+            while ((mdBits == 0) && (++mdWord < WORD_COUNT))
+            {
+                mdBits = mpSet->maWords[mdWord];
+            }
+
+            return *this;
+        }
+
+        bool operator==(const Iterator& rtOther) const
+        {
+            return (mdWord == rtOther.mdWord) && (mdBits == rtOther.mdBits);
+        }
+
+        bool operator!=(const Iterator& rtOther) const
+        {
+            return not (*this == rtOther);
+        }
+
+    private:
+        const CpuSet* mpSet;
+        size_t mdWord;
+        Word mdBits;    // Bits of the current word not visited yet.
+    };
+
+    constexpr CpuSet() :
+        maWords {}
+    {}
+
+    CpuSet(std::initializer_list<size_t> rtCpus) :
+        maWords {}
+    {
+        for (const auto dCpu : rtCpus)
+        {
+            insert(dCpu);
+        }
+    }
+
+    /**
+     * @brief Take the CPUs of a native mask.
+     */
+    explicit CpuSet(const cpu_set_t& rtMask)
+    {
+        memcpy(maWords, &rtMask, sizeof(maWords));
+    }
+
+    /**
+     * @brief Add a CPU; the indices past CAPACITY are ignored.
+     */
+    void insert(size_t rdCpu)
+    {
+        if (rdCpu < CAPACITY)
+        {
+            maWords[rdCpu / WORD_BITS] |= Word(1) << (rdCpu % WORD_BITS);
+        }
+    }
+
+    /**
+     * @brief Add the CPUs from rdFirst to rdLast inclusive, a word at a time.
+     */
+    void insertRange(size_t rdFirst, size_t rdLast)
+    {
+        rdLast = std::min(rdLast, CAPACITY - 1);
+        while (rdFirst <= rdLast)
+        {
+            const size_t dBit = rdFirst % WORD_BITS;
+            const size_t dCount = std::min(WORD_BITS - dBit, rdLast - rdFirst + 1);
+            const Word dMask = (dCount == WORD_BITS) ? ~Word(0) : (((Word(1) << dCount) - 1) << dBit);
+            maWords[rdFirst / WORD_BITS] |= dMask;
+            rdFirst += dCount;
+        }
+    }
+
+    void erase(size_t rdCpu)
+    {
+        if (rdCpu < CAPACITY)
+        {
+            maWords[rdCpu / WORD_BITS] &= ~(Word(1) << (rdCpu % WORD_BITS));
+        }
+    }
+
+    constexpr bool test(size_t rdCpu) const
+    {
+        return (rdCpu < CAPACITY) && (((maWords[rdCpu / WORD_BITS] >> (rdCpu % WORD_BITS)) & 1) != 0);
+    }
+
+    void clear()
+    {
+        memset(maWords, 0, sizeof(maWords));
+    }
+
+    bool empty() const
+    {
+        for (const auto dWord : maWords)
+        {
+            if (dWord != 0)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Get the number of CPUs in the set.
+     */
+    size_t size() const
+    {
+        size_t dCount = 0;
+        for (const auto dWord : maWords)
+        {
+            dCount += static_cast<size_t>(__builtin_popcountl(dWord));
+        }
+
+        return dCount;
+    }
+
+    /**
+     * @brief Get the number of CPUs in the set below the given one,
+     *        i.e. the position of the CPU in the iteration order.
+     */
+    size_t rank(size_t rdCpu) const
+    {
+        rdCpu = std::min(rdCpu, static_cast<size_t>(CAPACITY));
+        size_t dCount = 0;
+        for (size_t dWord = 0; dWord < rdCpu / WORD_BITS; ++dWord)
+        {
+            dCount += static_cast<size_t>(__builtin_popcountl(maWords[dWord]));
+        }
+
+        if ((rdCpu % WORD_BITS) != 0)
+        {
+            const Word dBelow = (Word(1) << (rdCpu % WORD_BITS)) - 1;
+            dCount += static_cast<size_t>(__builtin_popcountl(maWords[rdCpu / WORD_BITS] & dBelow));
+        }
+
+        return dCount;
+    }
+
+    /**
+     * @brief Get the lowest CPU; the set must not be empty.
+     */
+    size_t first() const
+    {
+        return *begin();
+    }
+
+    /**
+     * @brief Get the highest CPU; the set must not be empty.
+     */
+    size_t last() const
+    {
+        for (size_t dWord = WORD_COUNT; dWord-- > 0; )
+        {
+            if (maWords[dWord] != 0)
+            {
+                return dWord * WORD_BITS + (WORD_BITS - 1) - static_cast<size_t>(__builtin_clzl(maWords[dWord]));
+            }
+        }
+
+        return 0;
+    }
+
+    Iterator begin() const
+    {
+        for (size_t dWord = 0; dWord < WORD_COUNT; ++dWord)
+        {
+            if (maWords[dWord] != 0)
+            {
+                return Iterator(this, dWord, maWords[dWord]);
+            }
+        }
+
+        return end();
+    }
+
+    Iterator end() const
+    {
+        return Iterator(this, WORD_COUNT, 0);
+    }
+
+    bool operator==(const CpuSet& rtOther) const
+    {
+        return 0 == memcmp(maWords, rtOther.maWords, sizeof(maWords));
+    }
+
+    bool operator!=(const CpuSet& rtOther) const
+    {
+        return not (*this == rtOther);
+    }
+
+    /**
+     * @brief Get the set as the mask taken by sched_setaffinity() and
+     *        pthread_(attr_)setaffinity_np(), sized nativeSize().
+     */
+    const cpu_set_t* native() const
+    {
+        return reinterpret_cast<const cpu_set_t*>(maWords);
+    }
+
+    cpu_set_t* native()
+    {
+        return reinterpret_cast<cpu_set_t*>(maWords);
+    }
+
+    static constexpr size_t nativeSize()
+    {
+        return sizeof(cpu_set_t);
+    }
+
+private:
+    Word maWords[WORD_COUNT];
+};
+
+static_assert(sizeof(CpuSet) == sizeof(cpu_set_t), "CpuSet must have the cpu_set_t layout");
+static_assert(not CpuSet().test(0), "An empty CpuSet has no CPUs");
+
+/**
+ * @brief Get the kernel thread ID of the calling thread, the PID
+ *        for the main thread only.
  *
- * @return PID.
+ * @return Thread ID.
  */
-pid_t myThreadId()
+inline pid_t myThreadId()
 {
-    return getpid();
+    return static_cast<pid_t>(syscall(SYS_gettid));
 }
 
 /**
@@ -31,11 +319,187 @@ pid_t myThreadId()
  *
  * @return CPU index.
  */
-CpuIndex myCpu()
+inline CpuIndex myCpu()
 {
     return sched_getcpu();
 }
 
+/**
+ * @brief Physical location of a logical CPU.
+ */
+struct CpuLocation
+{
+    int dCore;    // Core ID within the package; SMT siblings share it.
+    int dPackage; // Physical package (socket) ID.
+    int dNode;    // NUMA node ID.
+};
+
+/**
+ * @brief Read a single integer value from a sysfs file.
+ *
+ * @param rpPath File path.
+ * @param rdDefault Value to return if the file cannot be read.
+ *
+ * @return The value read or the default one.
+ */
+inline int readSysfsInt(const char* rpPath, int rdDefault)
+{
+    FILE* pFile = fopen(rpPath, "r");
+    if (nullptr == pFile)
+    {
+        return rdDefault;
+    }
+
+    int dValue = rdDefault;
+    if (1 != fscanf(pFile, "%d", &dValue))
+    {
+        dValue = rdDefault;
+    }
+
+    fclose(pFile);
+    return dValue;
+}
+
+/**
+ * @brief Get the physical location of the given CPU from sysfs.
+ *        If the information is not available (e.g. no sysfs in a
+ *        container) all CPUs are reported as distinct cores of package 0
+ *        and node 0.
+ *
+ * @param rdCpu CPU index.
+ *
+ * @return CPU location.
+ */
+inline CpuLocation getCpuLocation(CpuIndex rdCpu)
+{
+    char aPath[128];
+    CpuLocation tLocation {rdCpu, 0, 0};
+
+    snprintf(aPath, sizeof(aPath), "/sys/devices/system/cpu/cpu%d/topology/core_id", rdCpu);
+    tLocation.dCore = readSysfsInt(aPath, rdCpu);
+
+    snprintf(aPath, sizeof(aPath), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", rdCpu);
+    tLocation.dPackage = readSysfsInt(aPath, 0);
+
+    // The node is exposed as a "nodeN" link in the CPU directory.
+    snprintf(aPath, sizeof(aPath), "/sys/devices/system/cpu/cpu%d", rdCpu);
+    DIR* pDir = opendir(aPath);
+    if (nullptr != pDir)
+    {
+        while (const dirent* pEntry = readdir(pDir))
+        {
+            if ((0 == strncmp(pEntry->d_name, "node", 4)) && (0 != isdigit(pEntry->d_name[4])))
+            {
+                tLocation.dNode = atoi(pEntry->d_name + 4);
+                break;
+            }
+        }
+
+        closedir(pDir);
+    }
+
+    return tLocation;
+}
+
+/**
+ * @brief Snapshot of the calling thread's scheduling counters.
+ */
+struct SchedSample
+{
+    CpuIndex dCpu;                  // CPU the thread is running on.
+    int64_t dVoluntarySwitches;     // Blocked or yielded.
+    int64_t dInvoluntarySwitches;   // Preempted.
+    int64_t dRunTimeNs;             // Time spent on a CPU, -1 if unknown.
+    int64_t dRunDelayNs;            // Time spent runnable in a run queue, -1 if unknown.
+};
+
+/**
+ * @brief Scheduling events of a thread between two samples.
+ */
+struct SchedEvents
+{
+    CpuIndex dStartCpu;
+    CpuIndex dEndCpu;
+    int64_t dVoluntarySwitches;
+    int64_t dInvoluntarySwitches;
+    int64_t dRunDelayNs;            // -1 if schedstat is not available.
+
+    bool migrated() const
+    {
+        return dStartCpu != dEndCpu;
+    }
+};
+
+/**
+ * @brief Sample the calling thread's CPU, context switch counters
+ *        (getrusage(RUSAGE_THREAD)) and run/wait times (schedstat).
+ *        Uses plain syscalls and a stack buffer only, so it may be
+ *        called from the RT threads: no allocation is done.
+ *
+ * @param[out] rtOutput Sample.
+ *
+ * @return Error code.
+ */
+inline cmn::ErrCode sampleScheduling(SchedSample& rtOutput)
+{
+    rtOutput.dCpu = myCpu();
+
+    rusage tUsage {};
+    if (0 != getrusage(RUSAGE_THREAD, &tUsage))
+    {
+        return cmn::ErrCode::GENERAL_ERR;
+    }
+
+    rtOutput.dVoluntarySwitches = tUsage.ru_nvcsw;
+    rtOutput.dInvoluntarySwitches = tUsage.ru_nivcsw;
+
+    // "<run time ns> <run queue wait ns> <timeslices>", the kernel
+    // needs CONFIG_SCHED_INFO for it.
+    rtOutput.dRunTimeNs = -1;
+    rtOutput.dRunDelayNs = -1;
+
+    const int dFd = open("/proc/thread-self/schedstat", O_RDONLY | O_CLOEXEC);
+    if (dFd >= 0)
+    {
+        char aBuffer[96];
+        const auto dSize = read(dFd, aBuffer, sizeof(aBuffer) - 1);
+        close(dFd);
+
+        if (dSize > 0)
+        {
+            aBuffer[dSize] = '\0';
+            char* pEnd = nullptr;
+            const auto dRunTime = strtoll(aBuffer, &pEnd, 10);
+            char* pDelayEnd = nullptr;
+            const auto dRunDelay = strtoll(pEnd, &pDelayEnd, 10);
+            if ((pEnd != aBuffer) && (pDelayEnd != pEnd))
+            {
+                rtOutput.dRunTimeNs = dRunTime;
+                rtOutput.dRunDelayNs = dRunDelay;
+            }
+        }
+    }
+
+    return cmn::ErrCode::OK;
+}
+
+/**
+ * @brief Get the scheduling events between two samples of the same thread.
+ *
+ * @param rtStart Earlier sample.
+ * @param rtEnd Later sample.
+ *
+ * @return Events.
+ */
+inline SchedEvents schedEventsBetween(const SchedSample& rtStart, const SchedSample& rtEnd)
+{
+    const bool bDelayKnown = (rtStart.dRunDelayNs >= 0) && (rtEnd.dRunDelayNs >= 0);
+    return SchedEvents {rtStart.dCpu, rtEnd.dCpu,
+            rtEnd.dVoluntarySwitches - rtStart.dVoluntarySwitches,
+            rtEnd.dInvoluntarySwitches - rtStart.dInvoluntarySwitches,
+            bDelayKnown ? (rtEnd.dRunDelayNs - rtStart.dRunDelayNs) : -1};
+}
+
 /**
  * @brief Get current scheduling policy for the given thread.
  *
@@ -43,7 +507,7 @@ CpuIndex myCpu()
  *
  * @return Scheduling policy code.
  */
-SchedPolicy getSchedulerPolicy(pid_t rtPid)
+inline SchedPolicy getSchedulerPolicy(pid_t rtPid)
 {
     return sched_getscheduler(rtPid);
 }
@@ -55,7 +519,7 @@ SchedPolicy getSchedulerPolicy(pid_t rtPid)
  *
  * @return Scheduling policy code.
  */
-SchedPolicy getCurrThreadSchedulerPolicy()
+inline SchedPolicy getCurrThreadSchedulerPolicy()
 {
     return getSchedulerPolicy(myThreadId());
 }
@@ -67,7 +531,7 @@ SchedPolicy getCurrThreadSchedulerPolicy()
  *
  * @return Name of the policy represented as a string.
  */
-const char* getSchedulerPolicyStr(SchedPolicy rdSchedPolicy)
+inline const char* getSchedulerPolicyStr(SchedPolicy rdSchedPolicy)
 {
     switch (rdSchedPolicy)
     {
@@ -85,64 +549,2107 @@ const char* getSchedulerPolicyStr(SchedPolicy rdSchedPolicy)
 }
 
 /**
- * @brief Adjust scheduler according to the given params.
- *        Also sets the max priority for the given
- *        scheduling policy.
+ * @brief Parse a scheduling policy name: SCHED_FIFO, SCHED_RR, SCHED_OTHER,
+ *        SCHED_BATCH, SCHED_IDLE; the "SCHED_" prefix is optional.
  *
- * @param[in] rtCpuSet CPU set to be used (cores indices).
- * @param[in] rtNewPolicy New scheduling policy to apply.
- * @param[out] rtAdjustedAttr Thread attributes initialized after scheduler adjusting
- *                            to be passed to future pthread_create calls.
- * @param[in] rbVerbose If true - print debug output.
+ * @param[in] rpValue Policy name.
+ * @param[out] rdOutput Policy code.
  *
  * @return Error code.
  */
-cmn::ErrCode adjustScheduler(const CpuSet& rtCpuSet, SchedPolicy rtNewPolicy, pthread_attr_t& rtAdjustedAttr, bool rbVerbose = false)
+inline cmn::ErrCode parseSchedPolicy(const char* rpValue, SchedPolicy& rdOutput)
 {
-    if (rbVerbose)
+    static const struct
+    {
+        const char* pName;
+        SchedPolicy dPolicy;
+    } aPolicies[] = {{"FIFO", SCHED_FIFO}, {"RR", SCHED_RR}, {"OTHER", SCHED_OTHER},
+                     {"BATCH", SCHED_BATCH}, {"IDLE", SCHED_IDLE}};
+
+    const char* pName = (0 == strncasecmp(rpValue, "SCHED_", 6)) ? (rpValue + 6) : rpValue;
+    for (const auto& rtPolicy : aPolicies)
     {
-        CMN_LOG_TRACE("Initial sched policy %s", getSchedulerPolicyStr(getCurrThreadSchedulerPolicy()));
+        if (0 == strcasecmp(pName, rtPolicy.pName))
+        {
+            rdOutput = rtPolicy.dPolicy;
+            return cmn::ErrCode::OK;
+        }
     }
 
-    pthread_attr_init(&rtAdjustedAttr);
+    return cmn::ErrCode::INVALID_ARGS;
+}
 
-    // Do not inherit parent thread's schedulting attributes
-    // since we're setting them explicitly.
-    RET_ON_ERR(pthread_attr_setinheritsched(&rtAdjustedAttr, PTHREAD_EXPLICIT_SCHED),
-            "pthread_attr_setinheritsched call failed with err ");
-    RET_ON_ERR(pthread_attr_setschedpolicy(&rtAdjustedAttr, rtNewPolicy),
-            "pthread_attr_setschedpolicy call failed with err ");
+/**
+ * @brief Parse a CPU list like "0,2-3". "all" or an empty string give
+ *        an empty set, i.e. the currently active CPU set is kept.
+ *
+ * @param[in] rpValue CPU list.
+ * @param[out] rtOutput Parsed CPU set.
+ *
+ * @return Error code.
+ */
+inline cmn::ErrCode parseCpuList(const char* rpValue, CpuSet& rtOutput)
+{
+    rtOutput.clear();
 
-    // If no CPU indices given - do not alter the currently active CPU set.
-    if (!rtCpuSet.empty())
+    if (0 == strcmp(rpValue, "all"))
     {
-        cpu_set_t tActualCpuSet {};
-        CPU_ZERO(&tActualCpuSet);
+        return cmn::ErrCode::OK;
+    }
 
-        // Iterate through the input set and push
-        // the CPU indices to the actually used set.
-        for (const auto dCpuIndex : rtCpuSet)
+    const char* pCursor = rpValue;
+    while (*pCursor != '\0')
+    {
+        char* pEnd = nullptr;
+        const auto dFirst = strtoul(pCursor, &pEnd, 10);
+        if ((pEnd == pCursor) || (dFirst >= CPU_SETSIZE))
         {
-            CPU_SET(dCpuIndex, &tActualCpuSet);
+            return cmn::ErrCode::INVALID_ARGS;
         }
 
-        RET_ON_ERR(pthread_attr_setaffinity_np(&rtAdjustedAttr, sizeof(rtAdjustedAttr), &tActualCpuSet),
-                "Failed to set affinity with err ");
+        auto dLast = dFirst;
+        if (*pEnd == '-')
+        {
+            pCursor = pEnd + 1;
+            dLast = strtoul(pCursor, &pEnd, 10);
+            if ((pEnd == pCursor) || (dLast >= CPU_SETSIZE) || (dLast < dFirst))
+            {
+                return cmn::ErrCode::INVALID_ARGS;
+            }
+        }
+
+        rtOutput.insertRange(dFirst, dLast);
+
+        if (*pEnd == ',')
+        {
+            ++pEnd;
+        }
+        else if (*pEnd != '\0')
+        {
+            return cmn::ErrCode::INVALID_ARGS;
+        }
+
+        pCursor = pEnd;
     }
 
-    sched_param tSchedParam {};
-    tSchedParam.sched_priority = sched_get_priority_max(rtNewPolicy);
+    return cmn::ErrCode::OK;
+}
 
-    RET_ON_ERR(sched_setscheduler(myThreadId(), rtNewPolicy, &tSchedParam),
-            "Failed to set scheduling policy, err ");
-    RET_ON_ERR(pthread_attr_setschedparam(&rtAdjustedAttr, &tSchedParam),
-            "Failed to set sched param, err ");
+/**
+ * @brief Print a CPU set as a list, the reverse of parseCpuList().
+ *
+ * @param[in] rtCpuSet CPU set.
+ * @param[out] rpOut Output buffer.
+ * @param[in] rdOutSize Output buffer size.
+ *
+ * @return Output buffer.
+ */
+inline const char* cpuSetToString(const CpuSet& rtCpuSet, char* rpOut, size_t rdOutSize)
+{
+    if (rtCpuSet.empty())
+    {
+        str_utils::formatTo(rpOut, rdOutSize, "all");
+        return rpOut;
+    }
 
-    if (rbVerbose)
+    size_t dLen = 0;
+    rpOut[0] = '\0';
+    for (auto tIt = rtCpuSet.begin(); (tIt != rtCpuSet.end()) && (dLen < rdOutSize); )
     {
-        CMN_LOG_TRACE("Adjusted sched policy %s", getSchedulerPolicyStr(getCurrThreadSchedulerPolicy()));
+        // Collapse the consecutive CPUs into ranges.
+        const auto dFirst = *tIt;
+        auto dLast = dFirst;
+        while ((++tIt != rtCpuSet.end()) && (*tIt == dLast + 1))
+        {
+            dLast = *tIt;
+        }
+
+        const char* pSeparator = (dLen == 0) ? "" : ",";
+        dLen += (dFirst == dLast) ?
+            str_utils::formatTo(rpOut + dLen, rdOutSize - dLen, "%s%zu", pSeparator, dFirst) :
+            str_utils::formatTo(rpOut + dLen, rdOutSize - dLen, "%s%zu-%zu", pSeparator, dFirst, dLast);
     }
 
-    return cmn::ErrCode::OK;
+    return rpOut;
 }
+
+/**
+ * @brief Dynamically sized affinity mask (CPU_ALLOC), to read the masks
+ *        of the machines with more CPUs than a fixed cpu_set_t holds.
+ */
+class CpuMask
+{
+public:
+
+    CpuMask() = default;
+
+    CpuMask(const CpuMask& rtOther) = delete;
+    CpuMask& operator=(const CpuMask& rtOther) = delete;
+
+    ~CpuMask()
+    {
+        if (nullptr != mpMask)
+        {
+            CPU_FREE(mpMask);
+        }
+    }
+
+    /**
+     * @brief Allocate an empty mask for the given number of CPUs.
+     *
+     * @param[in] rdCpus Number of CPUs the mask must hold.
+     *
+     * @return Error code.
+     */
+    cmn::ErrCode allocate(size_t rdCpus)
+    {
+        if (nullptr != mpMask)
+        {
+            CPU_FREE(mpMask);
+        }
+
+        mdCpus = (rdCpus == 0) ? 1 : rdCpus;
+        mpMask = CPU_ALLOC(mdCpus);
+        if (nullptr == mpMask)
+        {
+            mdCpus = 0;
+            return cmn::ErrCode::GENERAL_ERR;
+        }
+
+        CPU_ZERO_S(size(), mpMask);
+        return cmn::ErrCode::OK;
+    }
+
+    /**
+     * @brief Allocate the mask for the highest CPU of the set and fill it in.
+     *
+     * @param[in] rtCpuSet CPUs to set.
+     *
+     * @return Error code.
+     */
+    cmn::ErrCode assign(const CpuSet& rtCpuSet)
+    {
+        const auto tErr = allocate(rtCpuSet.empty() ? 1 : (rtCpuSet.last() + 1));
+        if (cmn::ErrCode::OK != tErr)
+        {
+            return tErr;
+        }
+
+        for (const auto dCpu : rtCpuSet)
+        {
+            CPU_SET_S(dCpu, size(), mpMask);
+        }
+
+        return cmn::ErrCode::OK;
+    }
+
+    /**
+     * @brief Get the CPUs set in the mask.
+     *
+     * @param[out] rtOutput CPU set.
+     */
+    void toCpuSet(CpuSet& rtOutput) const
+    {
+        rtOutput.clear();
+        for (size_t dCpu = 0; dCpu < size() * CHAR_BIT; ++dCpu)
+        {
+            if (CPU_ISSET_S(dCpu, size(), mpMask))
+            {
+                rtOutput.insert(dCpu);
+            }
+        }
+    }
+
+    cpu_set_t* data() const
+    {
+        return mpMask;
+    }
+
+    // Mask size in bytes, as the *_S macros and the affinity calls take it.
+    size_t size() const
+    {
+        return (nullptr == mpMask) ? 0 : CPU_ALLOC_SIZE(mdCpus);
+    }
+
+private:
+    cpu_set_t* mpMask = nullptr;
+    size_t mdCpus = 0;
+};
+
+/**
+ * @brief Get the number of CPUs configured on the machine, online or not.
+ *
+ * @return Number of CPUs.
+ */
+inline size_t configuredCpuCount()
+{
+    const auto dCount = sysconf(_SC_NPROCESSORS_CONF);
+    return (dCount > 0) ? static_cast<size_t>(dCount) : 1;
+}
+
+// Default prepareRealtimeProcess() reserves.
+constexpr size_t DEFAULT_STACK_PREFAULT = 512 * 1024;
+constexpr size_t DEFAULT_HEAP_PREFAULT = 8 * 1024 * 1024;
+
+// Do not touch /dev/cpu_dma_latency.
+constexpr int CPU_DMA_LATENCY_DEFAULT = -1;
+
+/**
+ * @brief Prefault the given amount of the calling thread's stack.
+ *        Kept out of line so the alloca() frame is gone on return.
+ */
+__attribute__((noinline)) inline void prefaultStack(size_t rdSize)
+{
+    const auto dPageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    volatile char* pStack = static_cast<volatile char*>(alloca(rdSize));
+
+    for (size_t dOffset = 0; dOffset < rdSize; dOffset += dPageSize)
+    {
+        pStack[dOffset] = 0;
+    }
+}
+
+/**
+ * @brief Prepare the process for RT work so page faults do not show up
+ *        as latency spikes: lock the current and the future memory,
+ *        keep the freed heap memory instead of returning it to the kernel,
+ *        prefault a stack and a heap reserve. Optionally ask the kernel
+ *        to keep the CPUs out of the deep C-states via /dev/cpu_dma_latency;
+ *        the request stays active until the process exits.
+ *        Should be called once at the start of main(), before
+ *        adjustScheduler() and before any thread is spawned.
+ *
+ * @param[in] rdStackReserve Bytes of the main thread stack to prefault.
+ * @param[in] rdHeapReserve Bytes of heap to prefault and keep for malloc().
+ * @param[in] rdDmaLatencyUsec Max. CPU wakeup latency in microseconds, e.g. 0
+ *                             to disable the C-states; negative - do not change.
+ * @param[in] rbVerbose If true - print debug output.
+ *
+ * @return Error code.
+ */
+inline cmn::ErrCode prepareRealtimeProcess(size_t rdStackReserve = DEFAULT_STACK_PREFAULT,
+        size_t rdHeapReserve = DEFAULT_HEAP_PREFAULT, int rdDmaLatencyUsec = CPU_DMA_LATENCY_DEFAULT,
+        bool rbVerbose = false)
+{
+    // Never give the heap back (trim) and never serve malloc() with
+    // separate mmap() calls: either would fault again on the next use.
+    // A single arena makes the other threads use the prefaulted one too.
+    if ((1 != mallopt(M_TRIM_THRESHOLD, -1)) || (1 != mallopt(M_MMAP_MAX, 0)) || (1 != mallopt(M_ARENA_MAX, 1)))
+    {
+        CMN_LOG_ERROR("mallopt() call failed");
+        return cmn::ErrCode::GENERAL_ERR;
+    }
+
+    // mlockall() returns -1, the reason is in errno.
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    {
+        CMN_LOG_ERROR("mlockall call failed: %d (%s)", errno, strerror(errno));
+        return cmn::ErrCode::GENERAL_ERR;
+    }
+
+    prefaultStack(rdStackReserve);
+
+    if (rdHeapReserve > 0)
+    {
+        // Touch every page so the reserve is faulted in even
+        // if the kernel does not populate the locked mappings.
+        const auto dPageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        auto pHeap = static_cast<volatile char*>(malloc(rdHeapReserve));
+        if (nullptr == pHeap)
+        {
+            CMN_LOG_ERROR("Failed to allocate the heap reserve of %zu bytes", rdHeapReserve);
+            return cmn::ErrCode::GENERAL_ERR;
+        }
+
+        for (size_t dOffset = 0; dOffset < rdHeapReserve; dOffset += dPageSize)
+        {
+            pHeap[dOffset] = 0;
+        }
+
+        // Stays in the arena since trimming is disabled.
+        free(const_cast<char*>(pHeap));
+    }
+
+    if (rdDmaLatencyUsec >= 0)
+    {
+        // The descriptor must stay open while the process runs,
+        // the kernel drops the request on close.
+        static int dDmaLatencyFd = -1;
+        if (dDmaLatencyFd < 0)
+        {
+            dDmaLatencyFd = open("/dev/cpu_dma_latency", O_WRONLY | O_CLOEXEC);
+        }
+
+        const int32_t dValue = rdDmaLatencyUsec;
+        if ((dDmaLatencyFd < 0) || (static_cast<ssize_t>(sizeof(dValue)) != write(dDmaLatencyFd, &dValue, sizeof(dValue))))
+        {
+            CMN_LOG_ERROR("Failed to set /dev/cpu_dma_latency: %d (%s)", errno, strerror(errno));
+            return cmn::ErrCode::GENERAL_ERR;
+        }
+    }
+
+    if (rbVerbose)
+    {
+        CMN_LOG_TRACE("Memory locked, %zu bytes of stack and %zu bytes of heap prefaulted, CPU DMA latency %d us",
+                rdStackReserve, rdHeapReserve, rdDmaLatencyUsec);
+    }
+
+    return cmn::ErrCode::OK;
+}
+
+/**
+ * @brief Get the CPUs the calling thread is allowed to run on.
+ *
+ * @param[out] rtOutput CPU set.
+ *
+ * @return Error code.
+ */
+inline cmn::ErrCode getAllowedCpus(CpuSet& rtOutput)
+{
+    // The kernel mask may be larger than the configured CPU count
+    // suggests: grow the buffer until the kernel accepts it.
+    CpuMask tAllowed;
+    for (size_t dCpus = configuredCpuCount(); ; dCpus *= 2)
+    {
+        if (cmn::ErrCode::OK != tAllowed.allocate(dCpus))
+        {
+            return cmn::ErrCode::GENERAL_ERR;
+        }
+
+        if (0 == sched_getaffinity(0, tAllowed.size(), tAllowed.data()))
+        {
+            break;
+        }
+
+        if ((EINVAL != errno) || (dCpus > (1u << 20)))
+        {
+            CMN_LOG_ERROR("sched_getaffinity call failed with err %d", errno);
+            return cmn::ErrCode::SCHED_FAILURE;
+        }
+    }
+
+    tAllowed.toCpuSet(rtOutput);
+    return cmn::ErrCode::OK;
+}
+
+/**
+ * @brief Read a CPU list sysfs file, e.g. "0-3,8".
+ *
+ * @param rpPath File path.
+ * @param rtOutput CPU set, empty if the file cannot be read.
+ *
+ * @return True if the file has been read.
+ */
+inline bool readSysfsCpuList(const char* rpPath, CpuSet& rtOutput)
+{
+    rtOutput.clear();
+
+    FILE* pFile = fopen(rpPath, "r");
+    if (nullptr == pFile)
+    {
+        return false;
+    }
+
+    char aList[1024] = {};
+    const bool bRead = (nullptr != fgets(aList, sizeof(aList), pFile));
+    fclose(pFile);
+
+    aList[strcspn(aList, "\n")] = '\0';
+    return bRead && (cmn::ErrCode::OK == parseCpuList(aList, rtOutput)) && not rtOutput.empty();
+}
+
+/**
+ * @brief Where a logical CPU is in the machine.
+ */
+struct CpuTopology
+{
+    CpuIndex dCpu;      // -1 - not present.
+    int dCore;          // Physical core: the lowest CPU of its SMT siblings.
+    int dSmtRank;       // Position among the SMT siblings, 0 for the first one.
+    int dLlc;           // Last level cache: the lowest CPU sharing it.
+    int dPackage;       // Physical package (socket) ID.
+    int dNode;          // NUMA node ID.
+};
+
+/**
+ * @brief CPU topology of the machine: cores, SMT siblings, last level
+ *        cache groups and NUMA nodes, read from sysfs. Missing sysfs
+ *        entries (e.g. in a container) make every CPU a core of its own
+ *        with its own LLC on node 0.
+ */
+class Topology
+{
+public:
+
+    /**
+     * @brief Get the topology of the machine, discovered on the first call.
+     *
+     * @return Topology.
+     */
+    static const Topology& system()
+    {
+        static const Topology tSystem = []()
+            {
+                Topology tTopology;
+                tTopology.discover();
+                return tTopology;
+            }();
+
+        return tSystem;
+    }
+
+    /**
+     * @brief Read the topology of the online CPUs.
+     *
+     * @return Error code.
+     */
+    cmn::ErrCode discover()
+    {
+        mtCpus.clear();
+        mtInfo.clear();
+
+        if (not readSysfsCpuList("/sys/devices/system/cpu/online", mtCpus) &&
+                (cmn::ErrCode::OK != getAllowedCpus(mtCpus)))
+        {
+            return cmn::ErrCode::SCHED_FAILURE;
+        }
+
+        mtInfo.resize(mtCpus.last() + 1, CpuTopology {-1, -1, 0, -1, 0, 0});
+        char aPath[128];
+        for (const auto dCpu : mtCpus)
+        {
+            const auto tLocation = getCpuLocation(static_cast<CpuIndex>(dCpu));
+            auto& rtInfo = mtInfo[dCpu];
+            rtInfo = CpuTopology {static_cast<CpuIndex>(dCpu), static_cast<int>(dCpu), 0,
+                    static_cast<int>(dCpu), tLocation.dPackage, tLocation.dNode};
+
+            CpuSet tSiblings;
+            snprintf(aPath, sizeof(aPath), "/sys/devices/system/cpu/cpu%zu/topology/thread_siblings_list", dCpu);
+            if (readSysfsCpuList(aPath, tSiblings))
+            {
+                rtInfo.dCore = static_cast<int>(tSiblings.first());
+                rtInfo.dSmtRank = static_cast<int>(tSiblings.rank(dCpu));
+            }
+
+            // The last level cache is the highest level data or unified one.
+            int dTopLevel = 0;
+            for (int dIndex = 0; ; ++dIndex)
+            {
+                snprintf(aPath, sizeof(aPath), "/sys/devices/system/cpu/cpu%zu/cache/index%d/level", dCpu, dIndex);
+                const int dLevel = readSysfsInt(aPath, -1);
+                if (dLevel < 0)
+                {
+                    break;
+                }
+
+                char aType[32] = {};
+                snprintf(aPath, sizeof(aPath), "/sys/devices/system/cpu/cpu%zu/cache/index%d/type", dCpu, dIndex);
+                FILE* pType = fopen(aPath, "r");
+                const bool bInstruction = (nullptr != pType) && (nullptr != fgets(aType, sizeof(aType), pType)) &&
+                    (0 == strncmp(aType, "Instruction", 11));
+                if (nullptr != pType)
+                {
+                    fclose(pType);
+                }
+
+                CpuSet tShared;
+                snprintf(aPath, sizeof(aPath), "/sys/devices/system/cpu/cpu%zu/cache/index%d/shared_cpu_list",
+                        dCpu, dIndex);
+                if (not bInstruction && (dLevel > dTopLevel) && readSysfsCpuList(aPath, tShared))
+                {
+                    dTopLevel = dLevel;
+                    rtInfo.dLlc = static_cast<int>(tShared.first());
+                }
+            }
+        }
+
+        return cmn::ErrCode::OK;
+    }
+
+    const CpuSet& cpus() const
+    {
+        return mtCpus;
+    }
+
+    /**
+     * @brief Get the topology of a CPU.
+     *
+     * @param rdCpu CPU index.
+     *
+     * @return CPU topology, nullptr if the CPU is not online.
+     */
+    const CpuTopology* cpu(CpuIndex rdCpu) const
+    {
+        return ((rdCpu >= 0) && (static_cast<size_t>(rdCpu) < mtInfo.size()) && (mtInfo[rdCpu].dCpu >= 0)) ?
+            &mtInfo[rdCpu] : nullptr;
+    }
+
+    /**
+     * @brief Get the NUMA node of a CPU.
+     *
+     * @return Node ID, -1 if the CPU is unknown.
+     */
+    int nodeOf(CpuIndex rdCpu) const
+    {
+        const auto pInfo = cpu(rdCpu);
+        return (nullptr == pInfo) ? -1 : pInfo->dNode;
+    }
+
+    size_t coreCount() const
+    {
+        return countDistinct(&CpuTopology::dCore);
+    }
+
+    size_t llcCount() const
+    {
+        return countDistinct(&CpuTopology::dLlc);
+    }
+
+    size_t nodeCount() const
+    {
+        return countDistinct(&CpuTopology::dNode);
+    }
+
+    /**
+     * @brief Get the CPUs of a NUMA node.
+     */
+    CpuSet nodeCpus(int rdNode) const
+    {
+        return select(&CpuTopology::dNode, rdNode);
+    }
+
+    /**
+     * @brief Get the SMT siblings of a CPU, the CPU itself included.
+     */
+    CpuSet siblingsOf(CpuIndex rdCpu) const
+    {
+        const auto pInfo = cpu(rdCpu);
+        return (nullptr == pInfo) ? CpuSet {} : select(&CpuTopology::dCore, pInfo->dCore);
+    }
+
+    /**
+     * @brief Get the CPUs sharing the last level cache with a CPU, the CPU itself included.
+     */
+    CpuSet llcCpus(CpuIndex rdCpu) const
+    {
+        const auto pInfo = cpu(rdCpu);
+        return (nullptr == pInfo) ? CpuSet {} : select(&CpuTopology::dLlc, pInfo->dLlc);
+    }
+
+    /**
+     * @brief Get the distance between two CPUs: 0 - the same core (or
+     *        unknown), 1 - the same LLC, 2 - the same node, 3 - remote.
+     */
+    int distance(CpuIndex rdFirst, CpuIndex rdSecond) const
+    {
+        const auto pFirst = cpu(rdFirst);
+        const auto pSecond = cpu(rdSecond);
+        if ((nullptr == pFirst) || (nullptr == pSecond) || (pFirst->dCore == pSecond->dCore))
+        {
+            return 0;
+        }
+
+        if (pFirst->dLlc == pSecond->dLlc)
+        {
+            return 1;
+        }
+
+        return (pFirst->dNode == pSecond->dNode) ? 2 : 3;
+    }
+
+    /**
+     * @brief Order the CPUs to place the threads on: one CPU of every
+     *        physical core first, the SMT siblings after all the cores,
+     *        so N threads take N distinct cores where possible.
+     *
+     * @param rtCpuSet CPUs to order, empty - all the online ones.
+     *
+     * @return CPU indices in the placement order.
+     */
+    std::vector<CpuIndex> placementOrder(const CpuSet& rtCpuSet = CpuSet {}) const
+    {
+        std::vector<CpuIndex> tOrder;
+        for (const auto dCpu : (rtCpuSet.empty() ? mtCpus : rtCpuSet))
+        {
+            tOrder.push_back(static_cast<CpuIndex>(dCpu));
+        }
+
+        std::stable_sort(tOrder.begin(), tOrder.end(), [this](CpuIndex rdLhs, CpuIndex rdRhs)
+                {
+                    const auto pLhs = cpu(rdLhs);
+                    const auto pRhs = cpu(rdRhs);
+                    return ((nullptr == pLhs) ? 0 : pLhs->dSmtRank) < ((nullptr == pRhs) ? 0 : pRhs->dSmtRank);
+                });
+
+        return tOrder;
+    }
+
+    /**
+     * @brief Log the summary: CPUs, cores, LLC groups and nodes.
+     */
+    void logSummary() const
+    {
+        CMN_LOG_TRACE("Topology: %zu CPUs, %zu cores, %zu LLC groups, %zu NUMA nodes",
+                mtCpus.size(), coreCount(), llcCount(), nodeCount());
+    }
+
+private:
+
+    size_t countDistinct(int CpuTopology::* rpField) const
+    {
+        std::set<int> tValues;
+        for (const auto dCpu : mtCpus)
+        {
+            tValues.insert(mtInfo[dCpu].*rpField);
+        }
+
+        return tValues.size();
+    }
+
+    CpuSet select(int CpuTopology::* rpField, int rdValue) const
+    {
+        CpuSet tOutput;
+        for (const auto dCpu : mtCpus)
+        {
+            if (mtInfo[dCpu].*rpField == rdValue)
+            {
+                tOutput.insert(dCpu);
+            }
+        }
+
+        return tOutput;
+    }
+
+    CpuSet mtCpus;
+    std::vector<CpuTopology> mtInfo;    // Indexed by CPU.
+};
+
+/**
+ * @brief Move the pages of a memory range to a NUMA node and keep the
+ *        future ones there (mbind(MPOL_PREFERRED, MPOL_MF_MOVE) without
+ *        libnuma). Pages already faulted in, e.g. by mlockall(), are
+ *        moved, so the placement does not depend on who touched them first.
+ *
+ * @param rpAddr Range start, rounded down to the page.
+ * @param rdSize Range size.
+ * @param rdNode Node ID, negative - leave the range as is.
+ *
+ * @return Error code; NOT_SUPPORTED if the kernel does not allow it.
+ *         A single node machine has nothing to move, the call succeeds.
+ */
+inline cmn::ErrCode bindToNode(void* rpAddr, size_t rdSize, int rdNode)
+{
+    if ((rdNode < 0) || (Topology::system().nodeCount() <= 1) || (rdSize == 0))
+    {
+        return cmn::ErrCode::OK;
+    }
+
+    const auto dPageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    const auto dStart = reinterpret_cast<uintptr_t>(rpAddr) & ~(dPageSize - 1);
+    const auto dEnd = reinterpret_cast<uintptr_t>(rpAddr) + rdSize;
+
+    constexpr size_t dMaskBits = sizeof(unsigned long) * CHAR_BIT;
+    std::vector<unsigned long> tNodeMask(static_cast<size_t>(rdNode) / dMaskBits + 1, 0);
+    tNodeMask[static_cast<size_t>(rdNode) / dMaskBits] |= 1UL << (static_cast<size_t>(rdNode) % dMaskBits);
+
+    if (0 != syscall(SYS_mbind, dStart, dEnd - dStart, MPOL_PREFERRED, tNodeMask.data(),
+                tNodeMask.size() * dMaskBits + 1, MPOL_MF_MOVE))
+    {
+        return cmn::ErrCode::NOT_SUPPORTED;
+    }
+
+    return cmn::ErrCode::OK;
+}
+
+/**
+ * @brief Allocate zeroed memory on a NUMA node: fresh pages, bound to
+ *        the node, touched and so backed before the call returns.
+ *        Free with freeOnNode().
+ *
+ * @param rdSize Size in bytes; the memory is page aligned.
+ * @param rdNode Node ID, negative - the node of the calling thread.
+ *
+ * @return Memory or nullptr on failure.
+ */
+inline void* allocateOnNode(size_t rdSize, int rdNode)
+{
+    void* pMem = mmap(nullptr, rdSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == pMem)
+    {
+        CMN_LOG_ERROR("Failed to map %zu bytes on node %d, errno %d", rdSize, rdNode, errno);
+        return nullptr;
+    }
+
+    // Not fatal: without the binding the memory is local to the caller.
+    bindToNode(pMem, rdSize, rdNode);
+
+    const auto dPageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    auto pBytes = static_cast<volatile unsigned char*>(pMem);
+    for (size_t dOffset = 0; dOffset < rdSize; dOffset += dPageSize)
+    {
+        pBytes[dOffset] = 0;
+    }
+
+    return pMem;
+}
+
+/**
+ * @brief Free the memory returned by allocateOnNode().
+ *
+ * @param rpMem Memory.
+ * @param rdSize Size given to allocateOnNode().
+ */
+inline void freeOnNode(void* rpMem, size_t rdSize)
+{
+    if (nullptr != rpMem)
+    {
+        munmap(rpMem, rdSize);
+    }
+}
+
+// Thread names are limited by the kernel to 15 characters.
+constexpr size_t THREAD_NAME_LENGTH = 16;
+
+/**
+ * @brief Scheduling attributes of one thread, builder style:
+ *
+ *        ThreadSpec().policy(SCHED_FIFO).priority(80).cpu(2).name("ctl").create(tThread, &routine, pArg);
+ *
+ *        Without policy() the thread inherits the scheduling of its
+ *        creator; without cpus() it inherits the affinity. The affinity
+ *        mask is sized for the highest CPU given, so any CPU count works.
+ */
+class ThreadSpec
+{
+public:
+
+    /**
+     * @brief Set the scheduling policy; the priority defaults to
+     *        the max one of the policy.
+     */
+    ThreadSpec& policy(SchedPolicy rdPolicy)
+    {
+        mbExplicitSched = true;
+        mdPolicy = rdPolicy;
+        return *this;
+    }
+
+    /**
+     * @brief Set the priority, see sched_get_priority_min/max() for the range.
+     */
+    ThreadSpec& priority(int rdPriority)
+    {
+        mdPriority = rdPriority;
+        return *this;
+    }
+
+    /**
+     * @brief Allow the thread to run on the given CPUs only,
+     *        an empty set - inherit the affinity.
+     */
+    ThreadSpec& cpus(const CpuSet& rtCpuSet)
+    {
+        mtCpus = rtCpuSet;
+        return *this;
+    }
+
+    /**
+     * @brief Pin the thread to one CPU, a negative index - inherit the affinity.
+     */
+    ThreadSpec& cpu(CpuIndex rdCpu)
+    {
+        mtCpus.clear();
+        if (rdCpu >= 0)
+        {
+            mtCpus.insert(static_cast<size_t>(rdCpu));
+        }
+
+        return *this;
+    }
+
+    /**
+     * @brief Set the stack size, 0 - the default one.
+     */
+    ThreadSpec& stackSize(size_t rdSize)
+    {
+        mdStackSize = rdSize;
+        return *this;
+    }
+
+    /**
+     * @brief Run the thread on a preallocated stack, e.g. from a StackPool.
+     */
+    ThreadSpec& stack(void* rpStack, size_t rdSize)
+    {
+        mpStack = rpStack;
+        mdStackSize = rdSize;
+        return *this;
+    }
+
+    /**
+     * @brief Set the thread name shown by ps/top, truncated to 15 characters.
+     */
+    ThreadSpec& name(const char* rpName)
+    {
+        str_utils::formatTo(maName, sizeof(maName), "%s", (nullptr == rpName) ? "" : rpName);
+        return *this;
+    }
+
+    SchedPolicy schedPolicy() const
+    {
+        return mdPolicy;
+    }
+
+    /**
+     * @brief Get the priority to apply: the one given or the max one of the policy.
+     */
+    int schedPriority() const
+    {
+        if (mdPriority >= 0)
+        {
+            return mdPriority;
+        }
+
+        return ((SCHED_FIFO == mdPolicy) || (SCHED_RR == mdPolicy)) ? sched_get_priority_max(mdPolicy) : 0;
+    }
+
+    const CpuSet& cpuSet() const
+    {
+        return mtCpus;
+    }
+
+    /**
+     * @brief Build the pthread attributes.
+     *
+     * @param[out] rtAttr Attributes to initialize; must be destroyed by the caller.
+     *
+     * @return Error code.
+     */
+    cmn::ErrCode makeAttr(pthread_attr_t& rtAttr) const
+    {
+        pthread_attr_init(&rtAttr);
+
+        if (mbExplicitSched)
+        {
+            sched_param tSchedParam {};
+            tSchedParam.sched_priority = schedPriority();
+
+            // Do not inherit parent thread's schedulting attributes
+            // since we're setting them explicitly.
+            RET_ON_ERR(pthread_attr_setinheritsched(&rtAttr, PTHREAD_EXPLICIT_SCHED),
+                    "pthread_attr_setinheritsched call failed with err ");
+            RET_ON_ERR(pthread_attr_setschedpolicy(&rtAttr, mdPolicy),
+                    "pthread_attr_setschedpolicy call failed with err ");
+            RET_ON_ERR(pthread_attr_setschedparam(&rtAttr, &tSchedParam),
+                    "Failed to set sched param, err ");
+        }
+
+        if (!mtCpus.empty())
+        {
+            // The mask is copied into the attributes.
+            RET_ON_ERR(pthread_attr_setaffinity_np(&rtAttr, CpuSet::nativeSize(), mtCpus.native()),
+                    "Failed to set affinity with err ");
+        }
+
+        if (nullptr != mpStack)
+        {
+            RET_ON_ERR(pthread_attr_setstack(&rtAttr, mpStack, mdStackSize), "Failed to set stack, err ");
+        }
+        else if (mdStackSize != 0)
+        {
+            RET_ON_ERR(pthread_attr_setstacksize(&rtAttr, mdStackSize), "Failed to set stack size, err ");
+        }
+
+        return cmn::ErrCode::OK;
+    }
+
+    /**
+     * @brief Create a thread with these attributes.
+     *
+     * @param[out] rtThread Thread handle.
+     * @param[in] rpRoutine Thread routine.
+     * @param[in] rpArg Thread routine argument.
+     *
+     * @return Error code.
+     */
+    cmn::ErrCode create(pthread_t& rtThread, void* (*rpRoutine)(void*), void* rpArg) const
+    {
+        pthread_attr_t tAttr;
+        auto tErr = makeAttr(tAttr);
+        if (cmn::ErrCode::OK == tErr)
+        {
+            const auto dErr = pthread_create(&rtThread, &tAttr, rpRoutine, rpArg);
+            if (dErr != 0)
+            {
+                // The spec is often a temporary, gone before the async log would
+                // format a %s pointer into maName: this record is formatted in place.
+                logNotify(LogSeverity::ERROR, __FILE__, __LINE__, "Failed to create thread %s, err %d", maName, dErr);
+                tErr = cmn::ErrCode::PTHREAD_ERR;
+            }
+            else if (maName[0] != '\0')
+            {
+                pthread_setname_np(rtThread, maName);
+            }
+        }
+
+        pthread_attr_destroy(&tAttr);
+        return tErr;
+    }
+
+    /**
+     * @brief Apply the attributes to the calling thread (the stack is ignored).
+     *
+     * @return Error code.
+     */
+    cmn::ErrCode applyToCurrentThread() const
+    {
+        if (mbExplicitSched)
+        {
+            sched_param tSchedParam {};
+            tSchedParam.sched_priority = schedPriority();
+
+            // pthread_setschedparam() affects the calling thread only,
+            // unlike sched_setscheduler(getpid()) which targets the main one.
+            RET_ON_ERR(pthread_setschedparam(pthread_self(), mdPolicy, &tSchedParam),
+                    "Failed to set scheduling policy, err ");
+        }
+
+        if (!mtCpus.empty())
+        {
+            RET_ON_ERR(pthread_setaffinity_np(pthread_self(), CpuSet::nativeSize(), mtCpus.native()),
+                    "Failed to set affinity with err ");
+        }
+
+        if (maName[0] != '\0')
+        {
+            pthread_setname_np(pthread_self(), maName);
+        }
+
+        return cmn::ErrCode::OK;
+    }
+
+private:
+    bool mbExplicitSched = false;
+    SchedPolicy mdPolicy = SCHED_OTHER;
+    int mdPriority = -1;            // -1 - the max one of the policy.
+    CpuSet mtCpus;
+    size_t mdStackSize = 0;
+    void* mpStack = nullptr;
+    char maName[THREAD_NAME_LENGTH] = {};
+};
+
+/**
+ * @brief Adjust scheduler according to the given params.
+ *        Also sets the max priority for the given
+ *        scheduling policy.
+ *
+ * @param[in] rtCpuSet CPU set to be used (cores indices).
+ * @param[in] rtNewPolicy New scheduling policy to apply.
+ * @param[out] rtAdjustedAttr Thread attributes initialized after scheduler adjusting
+ *                            to be passed to future pthread_create calls.
+ * @param[in] rbVerbose If true - print debug output.
+ *
+ * @return Error code.
+ */
+cmn::ErrCode adjustScheduler(const CpuSet& rtCpuSet, SchedPolicy rtNewPolicy, pthread_attr_t& rtAdjustedAttr, bool rbVerbose = false);
+
+/**
+ * @brief Make a copy of the given thread attributes: inheritance, policy,
+ *        priority, affinity and stack size. pthread_attr_t can't be copied
+ *        by value safely since glibc keeps the affinity mask by pointer.
+ *
+ * @param[in] rtSrcAttr Attributes to copy.
+ * @param[out] rtDstAttr Attributes to initialize; must be destroyed by the caller.
+ * @param[in] rdCpu If non-negative - pin to this CPU instead of the source affinity.
+ *
+ * @return Error code.
+ */
+inline cmn::ErrCode cloneThreadAttr(const pthread_attr_t& rtSrcAttr, pthread_attr_t& rtDstAttr, CpuIndex rdCpu = -1)
+{
+    int dInherit = PTHREAD_INHERIT_SCHED;
+    int dPolicy = SCHED_OTHER;
+    sched_param tParam {};
+    size_t dStackSize = 0;
+
+    pthread_attr_getinheritsched(&rtSrcAttr, &dInherit);
+    pthread_attr_getschedpolicy(&rtSrcAttr, &dPolicy);
+    pthread_attr_getschedparam(&rtSrcAttr, &tParam);
+    pthread_attr_getstacksize(&rtSrcAttr, &dStackSize);
+
+    pthread_attr_init(&rtDstAttr);
+    RET_ON_ERR(pthread_attr_setinheritsched(&rtDstAttr, dInherit),
+            "pthread_attr_setinheritsched call failed with err ");
+    RET_ON_ERR(pthread_attr_setschedpolicy(&rtDstAttr, dPolicy),
+            "pthread_attr_setschedpolicy call failed with err ");
+    RET_ON_ERR(pthread_attr_setschedparam(&rtDstAttr, &tParam),
+            "Failed to set sched param, err ");
+    RET_ON_ERR(pthread_attr_setstacksize(&rtDstAttr, dStackSize),
+            "Failed to set stack size, err ");
+
+    // glibc reports all the mask bits set for an attr without an affinity:
+    // such a mask is not copied, so the thread inherits the creator's one
+    // (taskset, cpuset) rather than escaping to every CPU.
+    CpuMask tCpuMask;
+    if (rdCpu >= 0)
+    {
+        const CpuSet tCpuSet {static_cast<size_t>(rdCpu)};
+        RET_ON_ERR(pthread_attr_setaffinity_np(&rtDstAttr, CpuSet::nativeSize(), tCpuSet.native()),
+                "Failed to set affinity with err ");
+    }
+    else if ((cmn::ErrCode::OK == tCpuMask.allocate(configuredCpuCount())) &&
+            (0 == pthread_attr_getaffinity_np(&rtSrcAttr, tCpuMask.size(), tCpuMask.data())) &&
+            (CPU_COUNT_S(tCpuMask.size(), tCpuMask.data()) > 0) &&
+            (static_cast<size_t>(CPU_COUNT_S(tCpuMask.size(), tCpuMask.data())) < tCpuMask.size() * CHAR_BIT))
+    {
+        RET_ON_ERR(pthread_attr_setaffinity_np(&rtDstAttr, tCpuMask.size(), tCpuMask.data()),
+                "Failed to set affinity with err ");
+    }
+
+    return cmn::ErrCode::OK;
+}
+
+/**
+ * @brief Priority inheritance mutex: a SCHED_FIFO owner preempted by
+ *        a middle priority thread is boosted to the priority of the
+ *        highest waiter, so the waiter is not blocked unboundedly.
+ *        The uncontended lock and unlock stay in user space, the
+ *        contended ones go through FUTEX_LOCK_PI / FUTEX_UNLOCK_PI.
+ *        Meets BasicLockable, so std::lock_guard, std::unique_lock and
+ *        std::condition_variable_any take it.
+ */
+class PiMutex
+{
+public:
+
+    PiMutex()
+    {
+        pthread_mutexattr_t tAttr;
+        pthread_mutexattr_init(&tAttr);
+
+        const auto dErr = pthread_mutexattr_setprotocol(&tAttr, PTHREAD_PRIO_INHERIT);
+        if (0 != dErr)
+        {
+            CMN_LOG_ERROR("No priority inheritance mutexes, err %d: falling back to a plain mutex", dErr);
+        }
+
+        pthread_mutex_init(&mtMutex, &tAttr);
+        pthread_mutexattr_destroy(&tAttr);
+    }
+
+    ~PiMutex()
+    {
+        pthread_mutex_destroy(&mtMutex);
+    }
+
+    PiMutex(const PiMutex& rtOther) = delete;
+    PiMutex& operator=(const PiMutex& rtOther) = delete;
+
+    void lock()
+    {
+        pthread_mutex_lock(&mtMutex);
+    }
+
+    bool try_lock()
+    {
+        return 0 == pthread_mutex_trylock(&mtMutex);
+    }
+
+    void unlock()
+    {
+        pthread_mutex_unlock(&mtMutex);
+    }
+
+    pthread_mutex_t* native()
+    {
+        return &mtMutex;
+    }
+
+private:
+    pthread_mutex_t mtMutex;
+};
+
+// Default stack size for the pooled RT threads. Much smaller than the
+// 8 MB glibc default so the whole stack can be prefaulted and locked.
+constexpr size_t DEFAULT_RT_STACK_SIZE = 256 * 1024;
+
+constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+/**
+ * @brief StackPool::init() flags.
+ */
+enum StackPoolFlags : unsigned
+{
+    STACK_POOL_DEFAULT = 0,
+    STACK_POOL_HUGE_PAGES = 1 << 0, // Try MAP_HUGETLB, fall back to transparent huge pages.
+    STACK_POOL_LOCK = 1 << 1        // mlock() the stacks after prefaulting.
+};
+
+/**
+ * @brief Pool of pre-allocated thread stacks. All the stacks live in
+ *        a single mapping created and prefaulted by init(), so creating
+ *        a thread on a pooled stack does neither mmap() nor page faults.
+ *        Without huge pages every stack is preceded by a guard page.
+ */
+class StackPool
+{
+public:
+
+    StackPool() = default;
+
+    StackPool(const StackPool& rtOther) = delete;
+    StackPool& operator=(const StackPool& rtOther) = delete;
+
+    /**
+     * @brief Destructor. The threads using the stacks must be joined by now.
+     */
+    ~StackPool()
+    {
+        if (nullptr != mpRegion)
+        {
+            munmap(mpRegion, mdRegionSize);
+        }
+    }
+
+    /**
+     * @brief Map, prefault and optionally lock the stacks.
+     *
+     * @param[in] rdNumStacks Number of stacks.
+     * @param[in] rdStackSize Size of a single stack, rounded up to the page size.
+     * @param[in] rdFlags StackPoolFlags combination.
+     *
+     * @return Error code.
+     */
+    cmn::ErrCode init(size_t rdNumStacks, size_t rdStackSize = DEFAULT_RT_STACK_SIZE, unsigned rdFlags = STACK_POOL_LOCK)
+    {
+        if (nullptr != mpRegion)
+        {
+            return cmn::ErrCode::ALREADY_ENABLED;
+        }
+
+        if ((rdNumStacks == 0) || (rdStackSize < static_cast<size_t>(PTHREAD_STACK_MIN)))
+        {
+            return cmn::ErrCode::INVALID_ARGS;
+        }
+
+        const size_t dPageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        const bool bHugePages = (rdFlags & STACK_POOL_HUGE_PAGES) != 0;
+        const size_t dGranularity = bHugePages ? HUGE_PAGE_SIZE : dPageSize;
+
+        mdStackSize = (rdStackSize + dGranularity - 1) / dGranularity * dGranularity;
+        mdGuardSize = bHugePages ? 0 : dPageSize;
+        mdRegionSize = (mdStackSize + mdGuardSize) * rdNumStacks;
+
+        void* pRegion = MAP_FAILED;
+        if (bHugePages)
+        {
+            pRegion = mmap(nullptr, mdRegionSize, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        }
+
+        if (MAP_FAILED == pRegion)
+        {
+            pRegion = mmap(nullptr, mdRegionSize, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_POPULATE, -1, 0);
+            if (MAP_FAILED == pRegion)
+            {
+                CMN_LOG_ERROR("Failed to map %zu bytes for the stack pool, errno %d", mdRegionSize, errno);
+                return cmn::ErrCode::GENERAL_ERR;
+            }
+
+            if (bHugePages)
+            {
+                // No reserved huge pages: let THP back the stacks if possible.
+                madvise(pRegion, mdRegionSize, MADV_HUGEPAGE);
+            }
+        }
+
+        mpRegion = static_cast<unsigned char*>(pRegion);
+        mtFree.reserve(rdNumStacks);
+
+        for (size_t dIdx = 0; dIdx < rdNumStacks; ++dIdx)
+        {
+            unsigned char* pSlot = mpRegion + dIdx * (mdStackSize + mdGuardSize);
+            unsigned char* pStack = pSlot + mdGuardSize;
+
+            // The stacks grow down, so the guard page is placed below each one.
+            if ((mdGuardSize > 0) && (0 != mprotect(pSlot, mdGuardSize, PROT_NONE)))
+            {
+                CMN_LOG_ERROR("Failed to protect a stack guard page, errno %d", errno);
+            }
+
+            // MAP_POPULATE is only a hint: touch every page to be sure.
+            for (size_t dOffset = 0; dOffset < mdStackSize; dOffset += dPageSize)
+            {
+                pStack[dOffset] = 0;
+            }
+
+            if (((rdFlags & STACK_POOL_LOCK) != 0) && (0 != mlock(pStack, mdStackSize)))
+            {
+                // Not fatal: the stack is prefaulted anyway, it just may be swapped out.
+                CMN_LOG_ERROR("Failed to lock a pooled stack, errno %d", errno);
+            }
+
+            mtFree.push_back(pStack);
+        }
+
+        return cmn::ErrCode::OK;
+    }
+
+    /**
+     * @brief Take a free stack.
+     *
+     * @return Stack base (lowest address) or nullptr if none left.
+     */
+    void* acquire()
+    {
+        std::lock_guard<PiMutex> tGuard(mtLock);
+        if (mtFree.empty())
+        {
+            return nullptr;
+        }
+
+        void* pStack = mtFree.back();
+        mtFree.pop_back();
+        return pStack;
+    }
+
+    /**
+     * @brief Return a stack to the pool once its thread is joined.
+     *
+     * @param[in] rpStack Stack previously returned by acquire().
+     */
+    void release(void* rpStack)
+    {
+        std::lock_guard<PiMutex> tGuard(mtLock);
+        mtFree.push_back(rpStack);
+    }
+
+    /**
+     * @brief Get the size of a single stack.
+     *
+     * @return Stack size in bytes.
+     */
+    size_t stackSize() const
+    {
+        return mdStackSize;
+    }
+
+private:
+    PiMutex mtLock;     // Taken by the RT threads spawning others.
+    std::vector<void*> mtFree;
+    unsigned char* mpRegion = nullptr;
+    size_t mdRegionSize = 0;
+    size_t mdStackSize = 0;
+    size_t mdGuardSize = 0;
+};
+
+/**
+ * @brief A thread spawned by spawnBatch().
+ */
+struct SpawnEntry
+{
+    void* pArg = nullptr;  // [in] Thread routine argument.
+    CpuIndex dCpu = -1;    // [in] If non-negative - pin the thread to this CPU.
+    pthread_t tThread {};   // [out] Thread handle.
+    void* pStack = nullptr; // [out] Pooled stack used by the thread, if any.
+    bool bSpawned = false;  // [out] Set once the thread has been created.
+};
+
+/**
+ * @brief Spawn a batch of threads running the same routine. If a stack
+ *        pool is given every thread runs on a pooled prefaulted stack,
+ *        so spawning does no mmap() and the threads do not page fault
+ *        on their stacks. The attributes for all the threads are built
+ *        before the first one is created.
+ *
+ * @param[in] rtBaseAttr Attributes to create the threads with (e.g. adjustScheduler() output).
+ * @param[in] rpStacks Stack pool or nullptr to use the default stacks.
+ * @param[in] rpRoutine Thread routine.
+ * @param[in,out] rpEntries Threads to spawn.
+ * @param[in] rdCount Number of the entries.
+ * @param[in] rpName If given - the threads are named <name>-<entry index>.
+ *
+ * @return Error code. On failure the threads spawned so far are left running,
+ *         see SpawnEntry::bSpawned.
+ */
+inline cmn::ErrCode spawnBatch(const pthread_attr_t& rtBaseAttr, StackPool* rpStacks, void* (*rpRoutine)(void*),
+        SpawnEntry* rpEntries, size_t rdCount, const char* rpName = nullptr)
+{
+    std::vector<pthread_attr_t> tAttrs(rdCount);
+    cmn::ErrCode tErr = cmn::ErrCode::OK;
+    size_t dPrepared = 0;
+
+    for (; dPrepared < rdCount; ++dPrepared)
+    {
+        auto& rtEntry = rpEntries[dPrepared];
+        rtEntry.pStack = nullptr;
+        rtEntry.bSpawned = false;
+
+        tErr = cloneThreadAttr(rtBaseAttr, tAttrs[dPrepared], rtEntry.dCpu);
+        if (cmn::ErrCode::OK != tErr)
+        {
+            pthread_attr_destroy(&tAttrs[dPrepared]);
+            break;
+        }
+
+        if (nullptr != rpStacks)
+        {
+            rtEntry.pStack = rpStacks->acquire();
+            if ((nullptr == rtEntry.pStack) ||
+                    (0 != pthread_attr_setstack(&tAttrs[dPrepared], rtEntry.pStack, rpStacks->stackSize())))
+            {
+                CMN_LOG_ERROR("No pooled stack for thread %zu", dPrepared);
+                if (nullptr != rtEntry.pStack)
+                {
+                    rpStacks->release(rtEntry.pStack);
+                    rtEntry.pStack = nullptr;
+                }
+
+                pthread_attr_destroy(&tAttrs[dPrepared]);
+                tErr = cmn::ErrCode::OVERFLOW;
+                break;
+            }
+
+            // The pool stacks are prefaulted by the creator: move the
+            // stack of a pinned thread to the node of its CPU.
+            bindToNode(rtEntry.pStack, rpStacks->stackSize(), Topology::system().nodeOf(rtEntry.dCpu));
+        }
+    }
+
+    size_t dSpawned = 0;
+    if (cmn::ErrCode::OK == tErr)
+    {
+        for (; dSpawned < rdCount; ++dSpawned)
+        {
+            const auto dErr = pthread_create(&rpEntries[dSpawned].tThread, &tAttrs[dSpawned], rpRoutine,
+                    rpEntries[dSpawned].pArg);
+            if (dErr != 0)
+            {
+                CMN_LOG_ERROR("Failed to spawn thread %zu of the batch, err %d", dSpawned, dErr);
+                tErr = cmn::ErrCode::PTHREAD_ERR;
+                break;
+            }
+
+            rpEntries[dSpawned].bSpawned = true;
+
+            if (nullptr != rpName)
+            {
+                char aName[THREAD_NAME_LENGTH];
+                str_utils::formatTo(aName, sizeof(aName), "%s-%zu", rpName, dSpawned);
+                pthread_setname_np(rpEntries[dSpawned].tThread, aName);
+            }
+        }
+    }
+
+    for (size_t dIdx = 0; dIdx < dPrepared; ++dIdx)
+    {
+        pthread_attr_destroy(&tAttrs[dIdx]);
+
+        // Stacks of the threads which were not created go back to the pool.
+        if ((dIdx >= dSpawned) && (nullptr != rpEntries[dIdx].pStack))
+        {
+            rpStacks->release(rpEntries[dIdx].pStack);
+            rpEntries[dIdx].pStack = nullptr;
+        }
+    }
+
+    return tErr;
+}
+
+/**
+ * @brief Join the threads spawned by spawnBatch() and return their stacks to the pool.
+ *        The entries not spawned are skipped.
+ *
+ * @param[in] rpStacks Stack pool given to spawnBatch() or nullptr.
+ * @param[in,out] rpEntries Spawned threads.
+ * @param[in] rdCount Number of the entries.
+ */
+inline void joinBatch(StackPool* rpStacks, SpawnEntry* rpEntries, size_t rdCount)
+{
+    for (size_t dIdx = 0; dIdx < rdCount; ++dIdx)
+    {
+        auto& rtEntry = rpEntries[dIdx];
+        if (not rtEntry.bSpawned)
+        {
+            continue;
+        }
+
+        pthread_join(rtEntry.tThread, nullptr);
+        rtEntry.bSpawned = false;
+
+        if ((nullptr != rpStacks) && (nullptr != rtEntry.pStack))
+        {
+            rpStacks->release(rtEntry.pStack);
+            rtEntry.pStack = nullptr;
+        }
+    }
+}
+
+// Time a waiter spins on a futex word before it blocks in the kernel:
+// about a futex wake-up round trip, so a release on its way from another
+// CPU is caught without a syscall and the spin never costs more than
+// the sleep it saves. Converted to pause rounds once per process, the
+// pause latency differs from ~10 to ~150 cycles between the cores.
+constexpr int64_t FUTEX_SPIN_BUDGET_NS = 2000;
+
+// Spin rounds cap for the cores where the pause is (almost) free.
+constexpr size_t FUTEX_SPIN_ROUNDS_MAX = 20000;
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "The futex word must be a plain 32-bit integer");
+
+/**
+ * @brief Tell the CPU the caller is spinning: saves power and
+ *        lets the SMT sibling run.
+ */
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__ARM_ARCH_7A__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+/**
+ * @brief Measure the pause rounds fitting in FUTEX_SPIN_BUDGET_NS on the
+ *        calling core. None on a single CPU, where the releasing thread
+ *        cannot run while the waiter spins.
+ *
+ * @return Spin rounds.
+ */
+inline size_t calibrateSpinRounds()
+{
+    constexpr size_t CALIBRATION_ROUNDS = 1000;
+
+    if (sysconf(_SC_NPROCESSORS_ONLN) <= 1)
+    {
+        return 0;
+    }
+
+    timespec tStart {};
+    timespec tEnd {};
+    clock_gettime(CLOCK_MONOTONIC_RAW, &tStart);
+    for (size_t dRound = 0; dRound < CALIBRATION_ROUNDS; ++dRound)
+    {
+        cpuRelax();
+    }
+    clock_gettime(CLOCK_MONOTONIC_RAW, &tEnd);
+
+    const int64_t dElapsed = (tEnd.tv_sec - tStart.tv_sec) * 1000000000LL + (tEnd.tv_nsec - tStart.tv_nsec);
+    if (dElapsed <= 0)
+    {
+        return static_cast<size_t>(FUTEX_SPIN_ROUNDS_MAX);
+    }
+
+    const auto dRounds = static_cast<size_t>(FUTEX_SPIN_BUDGET_NS * static_cast<int64_t>(CALIBRATION_ROUNDS) / dElapsed);
+    return std::max(static_cast<size_t>(1), std::min(dRounds, static_cast<size_t>(FUTEX_SPIN_ROUNDS_MAX)));
+}
+
+inline std::atomic<size_t>& futexSpinRoundsSetting()
+{
+    static std::atomic<size_t> dRounds {calibrateSpinRounds()};
+    return dRounds;
+}
+
+/**
+ * @brief Get the spin rounds before blocking, calibrated on the first call.
+ *
+ * @return Spin rounds.
+ */
+inline size_t futexSpinRounds()
+{
+    return futexSpinRoundsSetting().load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Override the calibrated spin rounds, e.g. 0 to always block at once.
+ *
+ * @param[in] rdRounds Spin rounds.
+ */
+inline void setFutexSpinRounds(size_t rdRounds)
+{
+    futexSpinRoundsSetting().store(rdRounds, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Block while the futex word holds the value given. Returns on
+ *        a wake-up, a signal or if the word has changed already, so the
+ *        caller re-checks its condition.
+ *
+ * @param[in] rtWord Futex word.
+ * @param[in] rdValue Value to sleep on.
+ */
+inline void futexWait(const std::atomic<uint32_t>& rtWord, uint32_t rdValue)
+{
+    syscall(SYS_futex, reinterpret_cast<const uint32_t*>(&rtWord), FUTEX_WAIT_PRIVATE, rdValue, nullptr, nullptr, 0);
+}
+
+/**
+ * @brief Wake the threads blocked on the futex word.
+ *
+ * @param[in] rtWord Futex word.
+ * @param[in] rdCount Number of threads to wake, INT_MAX - all of them.
+ */
+inline void futexWake(const std::atomic<uint32_t>& rtWord, int rdCount)
+{
+    syscall(SYS_futex, reinterpret_cast<const uint32_t*>(&rtWord), FUTEX_WAKE_PRIVATE, rdCount, nullptr, nullptr, 0);
+}
+
+/**
+ * @brief Wait until the futex word differs from the value given:
+ *        spin for futexSpinRounds(), then block.
+ *
+ * @param[in] rtWord Futex word.
+ * @param[in] rdValue Value to wait on.
+ */
+inline void futexWaitWhile(const std::atomic<uint32_t>& rtWord, uint32_t rdValue)
+{
+    for (size_t dRound = futexSpinRounds(); dRound > 0; --dRound)
+    {
+        if (rtWord.load(std::memory_order_acquire) != rdValue)
+        {
+            return;
+        }
+
+        cpuRelax();
+    }
+
+    while (rtWord.load(std::memory_order_acquire) == rdValue)
+    {
+        futexWait(rtWord, rdValue);
+    }
+}
+
+/**
+ * @brief Reusable barrier: arriveAndWait() blocks until the number of
+ *        parties given has arrived, then all of them are released at
+ *        once. The waiters spin first and then sleep on the futex, the
+ *        last party to arrive wakes them with a single syscall.
+ */
+class StartBarrier
+{
+public:
+
+    /**
+     * @brief Class constructor.
+     *
+     * @param[in] rdParties Number of parties to wait for, see reset().
+     */
+    explicit StartBarrier(size_t rdParties = 0) :
+        mdParties(rdParties),
+        mdArrived(0),
+        mdGeneration(0)
+    {}
+
+    StartBarrier(const StartBarrier& rtOther) = delete;
+    StartBarrier& operator=(const StartBarrier& rtOther) = delete;
+
+    /**
+     * @brief Set the number of parties, no party may be waiting.
+     *
+     * @param[in] rdParties Number of parties.
+     */
+    void reset(size_t rdParties)
+    {
+        mdParties = rdParties;
+        mdArrived.store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Arrive and wait for the other parties.
+     *
+     * @return True for the party which arrived last and released the others.
+     */
+    bool arriveAndWait()
+    {
+        // Taken before the arrival: the generation cannot move on before it.
+        const auto dGeneration = mdGeneration.load(std::memory_order_acquire);
+        if (arrive(1))
+        {
+            return true;
+        }
+
+        futexWaitWhile(mdGeneration, dGeneration);
+        return false;
+    }
+
+    /**
+     * @brief Arrive without waiting, e.g. for the parties which
+     *        will never come because they failed to start.
+     *
+     * @param[in] rdCount Number of parties arriving.
+     *
+     * @return True if this arrival has released the barrier.
+     */
+    bool arrive(size_t rdCount)
+    {
+        if ((mdArrived.fetch_add(rdCount, std::memory_order_acq_rel) + rdCount) < mdParties)
+        {
+            return false;
+        }
+
+        // Ready for the next round before anybody is released into it.
+        mdArrived.store(0, std::memory_order_relaxed);
+        mdGeneration.fetch_add(1, std::memory_order_release);
+        futexWake(mdGeneration, INT_MAX);
+        return true;
+    }
+
+private:
+    size_t mdParties;
+    std::atomic<size_t> mdArrived;
+    std::atomic<uint32_t> mdGeneration;    // Futex word, bumped on every release.
+};
+
+/**
+ * @brief Count-down latch: wait() blocks until countDown()
+ *        is called the number of times given to the constructor.
+ *        countDown() is a single atomic decrement, the waiters spin
+ *        and then sleep on the futex until the last one wakes them.
+ */
+class Latch
+{
+public:
+
+    /**
+     * @brief Class constructor.
+     *
+     * @param[in] rdCount Number of countDown() calls to wait for.
+     */
+    explicit Latch(size_t rdCount) :
+        mdCount(rdCount),
+        mdReleased((rdCount == 0) ? 1 : 0)
+    {}
+
+    Latch(const Latch& rtOther) = delete;
+    Latch& operator=(const Latch& rtOther) = delete;
+
+    /**
+     * @brief Decrement the counter, release the waiters once it reaches zero.
+     */
+    void countDown()
+    {
+        auto dCount = mdCount.load(std::memory_order_relaxed);
+        while ((dCount > 0) &&
+                not mdCount.compare_exchange_weak(dCount, dCount - 1, std::memory_order_acq_rel,
+                    std::memory_order_relaxed))
+        {
+        }
+
+        if (dCount == 1)
+        {
+            mdReleased.store(1, std::memory_order_release);
+            futexWake(mdReleased, INT_MAX);
+        }
+    }
+
+    /**
+     * @brief Block until the counter reaches zero.
+     */
+    void wait() const
+    {
+        futexWaitWhile(mdReleased, 0);
+    }
+
+    /**
+     * @brief Check the counter without blocking.
+     *
+     * @return True if the counter has reached zero.
+     */
+    bool tryWait() const
+    {
+        return mdReleased.load(std::memory_order_acquire) != 0;
+    }
+
+private:
+    std::atomic<size_t> mdCount;
+    std::atomic<uint32_t> mdReleased;    // Futex word, 1 once the counter is zero.
+};
+
+/**
+ * @brief Manual-reset event: wait() returns once set() is called and
+ *        keeps returning until reset(). The waiters spin and then sleep
+ *        on the futex, set() makes the wake syscall only if some of them
+ *        sleep.
+ */
+class Event
+{
+public:
+
+    Event() = default;
+
+    Event(const Event& rtOther) = delete;
+    Event& operator=(const Event& rtOther) = delete;
+
+    /**
+     * @brief Set the event and release all the waiters.
+     */
+    void set()
+    {
+        if (SLEEPERS == mdState.exchange(SET, std::memory_order_release))
+        {
+            futexWake(mdState, INT_MAX);
+        }
+    }
+
+    /**
+     * @brief Clear the event, the next wait() blocks.
+     */
+    void reset()
+    {
+        uint32_t dExpected = SET;
+        mdState.compare_exchange_strong(dExpected, CLEAR, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Block until the event is set.
+     */
+    void wait()
+    {
+        for (size_t dRound = futexSpinRounds(); dRound > 0; --dRound)
+        {
+            if (isSet())
+            {
+                return;
+            }
+
+            cpuRelax();
+        }
+
+        while (true)
+        {
+            uint32_t dState = mdState.load(std::memory_order_acquire);
+            if (SET == dState)
+            {
+                return;
+            }
+
+            // Announce the sleeper, so set() knows it has to wake.
+            if ((CLEAR == dState) &&
+                    not mdState.compare_exchange_weak(dState, SLEEPERS, std::memory_order_acquire))
+            {
+                continue;
+            }
+
+            futexWait(mdState, SLEEPERS);
+        }
+    }
+
+    bool isSet() const
+    {
+        return SET == mdState.load(std::memory_order_acquire);
+    }
+
+private:
+    static constexpr uint32_t CLEAR = 0;
+    static constexpr uint32_t SET = 1;
+    static constexpr uint32_t SLEEPERS = 2;  // Clear, some waiter sleeps on the futex.
+
+    std::atomic<uint32_t> mdState {CLEAR};
+};
+
+/**
+ * @brief Counting semaphore: wait() takes a unit, blocking until post()
+ *        gives one. The uncontended paths are a single CAS or atomic add,
+ *        post() makes the wake syscall only if some waiter sleeps.
+ */
+class Semaphore
+{
+public:
+
+    /**
+     * @brief Class constructor.
+     *
+     * @param[in] rdInitial Units available up front.
+     */
+    explicit Semaphore(uint32_t rdInitial = 0) :
+        mdCount(rdInitial),
+        mdSleepers(0)
+    {}
+
+    Semaphore(const Semaphore& rtOther) = delete;
+    Semaphore& operator=(const Semaphore& rtOther) = delete;
+
+    /**
+     * @brief Give a unit, wake a sleeping waiter if any.
+     */
+    void post()
+    {
+        // Both seq_cst: either the waiter sees the unit or we see the waiter.
+        mdCount.fetch_add(1, std::memory_order_seq_cst);
+        if (mdSleepers.load(std::memory_order_seq_cst) > 0)
+        {
+            futexWake(mdCount, 1);
+        }
+    }
+
+    /**
+     * @brief Take a unit if one is available.
+     *
+     * @return True if taken.
+     */
+    bool tryWait()
+    {
+        auto dCount = mdCount.load(std::memory_order_relaxed);
+        while (dCount > 0)
+        {
+            if (mdCount.compare_exchange_weak(dCount, dCount - 1, std::memory_order_acquire,
+                        std::memory_order_relaxed))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * @brief Take a unit, spin and then block until one is available.
+     */
+    void wait()
+    {
+        for (size_t dRound = futexSpinRounds(); dRound > 0; --dRound)
+        {
+            if (tryWait())
+            {
+                return;
+            }
+
+            cpuRelax();
+        }
+
+        mdSleepers.fetch_add(1, std::memory_order_seq_cst);
+        while (not tryWait())
+        {
+            futexWait(mdCount, 0);
+        }
+        mdSleepers.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    uint32_t value() const
+    {
+        return mdCount.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint32_t> mdCount;       // Futex word, the units available.
+    std::atomic<uint32_t> mdSleepers;    // Waiters about to block or blocked.
+};
+
+/**
+ * @brief Get the default number of pool workers for the given CPU set:
+ *        one worker per core in the set or per online core if the set is empty.
+ *
+ * @param[in] rtCpuSet CPU set the workers are going to run on.
+ *
+ * @return Number of workers.
+ */
+inline size_t defaultPoolSize(const CpuSet& rtCpuSet)
+{
+    if (!rtCpuSet.empty())
+    {
+        return rtCpuSet.size();
+    }
+
+    const auto dOnline = sysconf(_SC_NPROCESSORS_ONLN);
+    return (dOnline > 0) ? static_cast<size_t>(dOnline) : 1;
+}
+
+/**
+ * @brief Fixed-size pool of worker threads executing submitted jobs
+ *        in FIFO order. The workers are created once by start() with the
+ *        given attributes (e.g. the ones produced by adjustScheduler()),
+ *        so the jobs do not pay for thread creation and teardown.
+ */
+class ThreadPool
+{
+public:
+
+    // Job entry point, the same shape as a pthread routine but
+    // without a return value.
+    using JobFunc = void (*)(void* rpArg);
+
+    ThreadPool() = default;
+
+    ThreadPool(const ThreadPool& rtOther) = delete;
+    ThreadPool& operator=(const ThreadPool& rtOther) = delete;
+
+    /**
+     * @brief Destructor. Completes the queued jobs and joins the workers.
+     */
+    ~ThreadPool()
+    {
+        stop();
+    }
+
+    /**
+     * @brief Create the worker threads. Returns once all of them are
+     *        running, the workers are released together.
+     *
+     * @param[in] rtWorkerAttr Attributes to create the workers with.
+     * @param[in] rdNumWorkers Number of workers, see defaultPoolSize().
+     * @param[in] rpStacks Optional pool of prefaulted stacks for the workers.
+     * @param[in] rtCpuSet CPUs to pin the workers to in Topology::placementOrder(),
+     *                     so each worker and its stack stay on one node.
+     *                     If empty - the affinity of the attributes is kept.
+     *
+     * @return Error code.
+     */
+    cmn::ErrCode start(const pthread_attr_t& rtWorkerAttr, size_t rdNumWorkers, StackPool* rpStacks = nullptr,
+            const CpuSet& rtCpuSet = CpuSet {})
+    {
+        if (!mtWorkers.empty())
+        {
+            return cmn::ErrCode::ALREADY_ENABLED;
+        }
+
+        if (rdNumWorkers == 0)
+        {
+            return cmn::ErrCode::INVALID_ARGS;
+        }
+
+        mbStop = false;
+        mpStacks = rpStacks;
+
+        // The workers and this thread: no job runs before all the workers are up.
+        mtStartBarrier.reset(rdNumWorkers + 1);
+
+        const auto tCpus = Topology::system().placementOrder(rtCpuSet);
+        std::vector<SpawnEntry> tWorkers(rdNumWorkers);
+        for (size_t dIdx = 0; dIdx < tWorkers.size(); ++dIdx)
+        {
+            tWorkers[dIdx].pArg = this;
+            tWorkers[dIdx].dCpu = rtCpuSet.empty() ? -1 : tCpus[dIdx % tCpus.size()];
+        }
+
+        const auto tErr = spawnBatch(rtWorkerAttr, mpStacks, &ThreadPool::workerFunc, tWorkers.data(), tWorkers.size(),
+                "pool");
+
+        // Keep the workers which have been started so stop() could join them.
+        for (const auto& rtWorker : tWorkers)
+        {
+            if (rtWorker.bSpawned)
+            {
+                mtWorkers.push_back(rtWorker);
+            }
+        }
+
+        // Stand in for the workers which have not been created and release all at once.
+        mtStartBarrier.arrive(rdNumWorkers - mtWorkers.size());
+        mtStartBarrier.arriveAndWait();
+
+        if (cmn::ErrCode::OK != tErr)
+        {
+            stop();
+            return tErr;
+        }
+
+        return cmn::ErrCode::OK;
+    }
+
+    /**
+     * @brief Queue a job for execution.
+     *
+     * @param[in] rpFunc Job function.
+     * @param[in] rpArg Argument passed to the job function.
+     *
+     * @return Error code.
+     */
+    cmn::ErrCode submit(JobFunc rpFunc, void* rpArg)
+    {
+        {
+            std::lock_guard<PiMutex> tGuard(mtLock);
+            if (mtWorkers.empty() || mbStop)
+            {
+                return cmn::ErrCode::NOT_READY;
+            }
+
+            mtJobs.push_back(Job {rpFunc, rpArg});
+        }
+
+        mtJobAvailable.notify_one();
+        return cmn::ErrCode::OK;
+    }
+
+    /**
+     * @brief Complete all the queued jobs and join the workers.
+     *
+     * @return Error code.
+     */
+    cmn::ErrCode stop()
+    {
+        {
+            std::lock_guard<PiMutex> tGuard(mtLock);
+            if (mtWorkers.empty())
+            {
+                return cmn::ErrCode::NOT_ENABLED;
+            }
+
+            mbStop = true;
+        }
+
+        mtJobAvailable.notify_all();
+        joinBatch(mpStacks, mtWorkers.data(), mtWorkers.size());
+
+        mtWorkers.clear();
+        return cmn::ErrCode::OK;
+    }
+
+    /**
+     * @brief Get the number of the worker threads.
+     *
+     * @return Number of workers.
+     */
+    size_t size() const
+    {
+        return mtWorkers.size();
+    }
+
+private:
+
+    struct Job
+    {
+        JobFunc pFunc;
+        void* pArg;
+    };
+
+    static void* workerFunc(void* rpPool)
+    {
+        auto pPool = static_cast<ThreadPool*>(rpPool);
+        pPool->mtStartBarrier.arriveAndWait();
+
+        while (true)
+        {
+            Job tJob;
+
+            {
+                std::unique_lock<PiMutex> tGuard(pPool->mtLock);
+                pPool->mtJobAvailable.wait(tGuard, [pPool]() { return pPool->mbStop || !pPool->mtJobs.empty(); });
+
+                // Leave only when there is nothing left to do.
+                if (pPool->mtJobs.empty())
+                {
+                    break;
+                }
+
+                tJob = pPool->mtJobs.front();
+                pPool->mtJobs.pop_front();
+            }
+
+            tJob.pFunc(tJob.pArg);
+        }
+
+        return nullptr;
+    }
+
+    // The workers run at RT priorities: a worker preempted while holding
+    // the queue lock is boosted instead of blocking the others.
+    PiMutex mtLock;
+    std::condition_variable_any mtJobAvailable;
+    std::deque<Job> mtJobs;
+    std::vector<SpawnEntry> mtWorkers;
+    StackPool* mpStacks = nullptr;
+    StartBarrier mtStartBarrier;
+    bool mbStop = false;
+};
 }
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <cstdint>
+
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#include "error_codes.h"
+
+// Units definitions, see rt_time.h
+#ifndef NSEC_PER_SEC
+#define NSEC_PER_SEC  (1000000000)
+#endif
+
+// CPU cycle counter based clock source: the invariant TSC on x86 and
+// the generic timer virtual counter (cntvct) on ARM. Reading it costs
+// a few nanoseconds and never falls back to a syscall the way
+// clock_gettime() may do on some kernels and VMs. The counter is
+// calibrated against CLOCK_MONOTONIC_RAW once and converted with
+// a fixed-point multiply/shift, so the TSC time points share
+// the MonotonicRaw timeline.
+
+namespace rt_time
+{
+namespace tsc
+{
+// Default calibration interval. Longer is more precise: the error is
+// roughly the clock read jitter divided by the interval.
+constexpr long DEFAULT_CALIBRATION_NSEC = 50 * 1000 * 1000;
+
+// Number of reads to pick the tightest (raw, counter, raw) bracket from.
+constexpr size_t CALIBRATION_SAMPLES = 32;
+
+/**
+ * @brief Counter-to-nanoseconds conversion parameters:
+ *        ns = dBaseNsec + ((ticks - dBaseTicks) * dMult) >> dShift.
+ */
+struct Calibration
+{
+    uint64_t dBaseTicks;
+    int64_t dBaseNsec;     // MonotonicRaw time of dBaseTicks.
+    uint32_t dMult;
+    uint32_t dShift;
+    uint64_t dFrequencyHz;
+    bool bCalibrated;
+};
+
+inline Calibration& calibration()
+{
+    static Calibration tCalibration {};
+    return tCalibration;
+}
+
+/**
+ * @brief Check whether the platform has a usable constant-rate counter.
+ *
+ * @return True if supported.
+ */
+inline bool isSupported()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    // CPUID.80000007H:EDX[8] - invariant TSC: constant rate
+    // in all ACPI P-, C- and T-states.
+    unsigned int dEax = 0;
+    unsigned int dEbx = 0;
+    unsigned int dEcx = 0;
+    unsigned int dEdx = 0;
+    if (0 == __get_cpuid(0x80000007, &dEax, &dEbx, &dEcx, &dEdx))
+    {
+        return false;
+    }
+
+    return (dEdx & (1u << 8)) != 0;
+#elif defined(__aarch64__) || defined(__ARM_ARCH_7A__)
+    // The generic timer counter is constant-rate by the architecture.
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Read the raw counter.
+ *
+ * @return Counter value.
+ */
+inline uint64_t readTicks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    // rdtscp waits for the preceding instructions to complete,
+    // so the sample is not taken "too early".
+    unsigned int dAux = 0;
+    return __rdtscp(&dAux);
+#elif defined(__aarch64__)
+    uint64_t dTicks = 0;
+    asm volatile("isb\n\tmrs %0, cntvct_el0" : "=r"(dTicks) :: "memory");
+    return dTicks;
+#elif defined(__ARM_ARCH_7A__)
+    uint64_t dTicks = 0;
+    asm volatile("isb\n\tmrrc p15, 1, %Q0, %R0, c14" : "=r"(dTicks) :: "memory");
+    return dTicks;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief 64x32-bit multiply with a right shift not overflowing for any
+ *        64-bit input (the same trick as the kernel's mul_u64_u32_shr()),
+ *        without relying on 128-bit integers which 32-bit ARM lacks.
+ */
+inline uint64_t mulShift(uint64_t rdValue, uint32_t rdMult, uint32_t rdShift)
+{
+    const uint64_t dLow = (rdValue & 0xffffffffull) * rdMult;
+    const uint64_t dHigh = (rdValue >> 32) * rdMult;
+    return (dHigh << (32 - rdShift)) + (dLow >> rdShift);
+}
+
+inline int64_t monotonicRawNsec()
+{
+    timespec tNow {};
+    clock_gettime(CLOCK_MONOTONIC_RAW, &tNow);
+    return static_cast<int64_t>(tNow.tv_sec) * NSEC_PER_SEC + tNow.tv_nsec;
+}
+
+/**
+ * @brief Take a (MonotonicRaw, counter) pair: the counter read is bracketed
+ *        by two clock reads and the tightest bracket out of several
+ *        attempts is used.
+ */
+inline void samplePair(int64_t& rdNsec, uint64_t& rdTicks)
+{
+    int64_t dBestSpan = INT64_MAX;
+
+    for (size_t dIdx = 0; dIdx < CALIBRATION_SAMPLES; ++dIdx)
+    {
+        const auto dBefore = monotonicRawNsec();
+        const auto dTicks = readTicks();
+        const auto dAfter = monotonicRawNsec();
+
+        if ((dAfter - dBefore) < dBestSpan)
+        {
+            dBestSpan = dAfter - dBefore;
+            rdNsec = dBefore + dBestSpan / 2;
+            rdTicks = dTicks;
+        }
+    }
+}
+
+/**
+ * @brief Calibrate the counter against MonotonicRaw. Blocks the caller
+ *        for the given interval, should be done once at startup.
+ *
+ * @param rdIntervalNsec Calibration interval.
+ *
+ * @return Status code.
+ */
+inline cmn::ErrCode calibrate(long rdIntervalNsec = DEFAULT_CALIBRATION_NSEC)
+{
+    if (not isSupported())
+    {
+        return cmn::ErrCode::NOT_SUPPORTED;
+    }
+
+    int64_t dStartNsec = 0;
+    uint64_t dStartTicks = 0;
+    samplePair(dStartNsec, dStartTicks);
+
+    const timespec tInterval {rdIntervalNsec / NSEC_PER_SEC, rdIntervalNsec % NSEC_PER_SEC};
+    nanosleep(&tInterval, nullptr);
+
+    int64_t dStopNsec = 0;
+    uint64_t dStopTicks = 0;
+    samplePair(dStopNsec, dStopTicks);
+
+    const auto dElapsedNsec = dStopNsec - dStartNsec;
+    const auto dElapsedTicks = dStopTicks - dStartTicks;
+    if ((dElapsedNsec <= 0) || (dElapsedTicks == 0))
+    {
+        return cmn::ErrCode::CLOCK_ERROR;
+    }
+
+    // Pick the largest shift keeping the multiplier 32-bit:
+    // mult = ns_per_tick * 2^shift.
+    const double dNsecPerTick = static_cast<double>(dElapsedNsec) / static_cast<double>(dElapsedTicks);
+    uint32_t dShift = 32;
+    while ((dShift > 0) && ((dNsecPerTick * static_cast<double>(1ull << dShift)) >= 4294967295.0))
+    {
+        --dShift;
+    }
+
+    auto& rtCalibration = calibration();
+    rtCalibration.dBaseTicks = dStopTicks;
+    rtCalibration.dBaseNsec = dStopNsec;
+    rtCalibration.dMult = static_cast<uint32_t>(dNsecPerTick * static_cast<double>(1ull << dShift) + 0.5);
+    rtCalibration.dShift = dShift;
+    rtCalibration.dFrequencyHz = static_cast<uint64_t>(1e9 / dNsecPerTick + 0.5);
+    rtCalibration.bCalibrated = true;
+
+    return cmn::ErrCode::OK;
+}
+
+/**
+ * @brief Convert a counter value to MonotonicRaw-based nanoseconds.
+ *
+ * @param rdTicks Counter value.
+ *
+ * @return Nanoseconds.
+ */
+inline int64_t ticksToNsec(uint64_t rdTicks)
+{
+    const auto& rtCalibration = calibration();
+
+    // The counter may be a bit behind the base on another core.
+    if (rdTicks >= rtCalibration.dBaseTicks)
+    {
+        return rtCalibration.dBaseNsec +
+            static_cast<int64_t>(mulShift(rdTicks - rtCalibration.dBaseTicks, rtCalibration.dMult, rtCalibration.dShift));
+    }
+
+    return rtCalibration.dBaseNsec -
+        static_cast<int64_t>(mulShift(rtCalibration.dBaseTicks - rdTicks, rtCalibration.dMult, rtCalibration.dShift));
+}
+
+/**
+ * @brief Get current time from the counter.
+ *
+ * @param rtOutput Time container output ref.
+ *
+ * @return Status code.
+ */
+inline cmn::ErrCode getTime(timespec& rtOutput)
+{
+    if (not calibration().bCalibrated)
+    {
+        return cmn::ErrCode::NOT_READY;
+    }
+
+    const auto dNsec = ticksToNsec(readTicks());
+    rtOutput.tv_sec = static_cast<time_t>(dNsec / NSEC_PER_SEC);
+    rtOutput.tv_nsec = static_cast<long>(dNsec % NSEC_PER_SEC);
+    return cmn::ErrCode::OK;
+}
+
+/**
+ * @brief Get the counter resolution, i.e. one tick rounded up
+ *        to a nanosecond.
+ *
+ * @param rtOutput Resolution output container ref.
+ *
+ * @return Status code.
+ */
+inline cmn::ErrCode getResolution(timespec& rtOutput)
+{
+    const auto& rtCalibration = calibration();
+    if (not rtCalibration.bCalibrated)
+    {
+        return cmn::ErrCode::NOT_READY;
+    }
+
+    rtOutput.tv_sec = 0;
+    rtOutput.tv_nsec = static_cast<long>((NSEC_PER_SEC + rtCalibration.dFrequencyHz - 1) / rtCalibration.dFrequencyHz);
+    return cmn::ErrCode::OK;
+}
+}
+}
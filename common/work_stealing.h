@@ -0,0 +1,547 @@
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "error_codes.h"
+#include "threading.h"
+
+namespace threading
+{
+// Number of job slots in every worker deque; must be a power of two.
+constexpr size_t WS_DEQUE_CAPACITY = 1024;
+
+// Number of unsuccessful steal rounds before an idle worker parks.
+constexpr size_t WS_STEAL_ROUNDS_BEFORE_PARK = 64;
+
+constexpr size_t WS_CACHE_LINE_SIZE = 64;
+
+static_assert((WS_DEQUE_CAPACITY & (WS_DEQUE_CAPACITY - 1)) == 0, "Deque capacity must be a power of two");
+
+/**
+ * @brief Fixed-capacity Chase-Lev work-stealing deque.
+ *        The owner pushes and pops at the bottom, thieves steal
+ *        from the top. The implementation follows "Correct and
+ *        Efficient Work-Stealing for Weak Memory Models" (Le et al.).
+ */
+class WsDeque
+{
+public:
+
+    using JobFunc = ThreadPool::JobFunc;
+
+    WsDeque()
+    {
+        mdTop.store(0, std::memory_order_relaxed);
+        mdBottom.store(0, std::memory_order_relaxed);
+    }
+
+    WsDeque(const WsDeque& rtOther) = delete;
+    WsDeque& operator=(const WsDeque& rtOther) = delete;
+
+    /**
+     * @brief Push a job to the bottom. Owner thread only.
+     *
+     * @return False if the deque is full.
+     */
+    bool push(JobFunc rpFunc, void* rpArg)
+    {
+        const auto dBottom = mdBottom.load(std::memory_order_relaxed);
+        const auto dTop = mdTop.load(std::memory_order_acquire);
+        if ((dBottom - dTop) >= static_cast<int64_t>(WS_DEQUE_CAPACITY))
+        {
+            return false;
+        }
+
+        auto& rtSlot = maSlots[dBottom & (WS_DEQUE_CAPACITY - 1)];
+        rtSlot.pFunc.store(rpFunc, std::memory_order_relaxed);
+        rtSlot.pArg.store(rpArg, std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_release);
+        mdBottom.store(dBottom + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * @brief Pop a job from the bottom (LIFO). Owner thread only.
+     *
+     * @return False if the deque is empty or the last job has been stolen.
+     */
+    bool pop(JobFunc& rpFunc, void*& rpArg)
+    {
+        const auto dBottom = mdBottom.load(std::memory_order_relaxed) - 1;
+        mdBottom.store(dBottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto dTop = mdTop.load(std::memory_order_relaxed);
+
+        if (dTop > dBottom)
+        {
+            // Empty.
+            mdBottom.store(dBottom + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        const auto& rtSlot = maSlots[dBottom & (WS_DEQUE_CAPACITY - 1)];
+        rpFunc = rtSlot.pFunc.load(std::memory_order_relaxed);
+        rpArg = rtSlot.pArg.load(std::memory_order_relaxed);
+
+        if (dTop == dBottom)
+        {
+            // The last job: race against the thieves for it.
+            const bool bWon = mdTop.compare_exchange_strong(dTop, dTop + 1,
+                    std::memory_order_seq_cst, std::memory_order_relaxed);
+            mdBottom.store(dBottom + 1, std::memory_order_relaxed);
+            return bWon;
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Steal a job from the top (FIFO). Any thread.
+     *
+     * @return False if the deque is empty or another thread won the race.
+     */
+    bool steal(JobFunc& rpFunc, void*& rpArg)
+    {
+        auto dTop = mdTop.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const auto dBottom = mdBottom.load(std::memory_order_acquire);
+
+        if (dTop >= dBottom)
+        {
+            return false;
+        }
+
+        const auto& rtSlot = maSlots[dTop & (WS_DEQUE_CAPACITY - 1)];
+        rpFunc = rtSlot.pFunc.load(std::memory_order_relaxed);
+        rpArg = rtSlot.pArg.load(std::memory_order_relaxed);
+
+        return mdTop.compare_exchange_strong(dTop, dTop + 1,
+                std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+private:
+
+    struct Slot
+    {
+        std::atomic<JobFunc> pFunc;
+        std::atomic<void*> pArg;
+    };
+
+    // Thieves hammer mdTop while the owner works with mdBottom:
+    // keep them in separate cache lines.
+    alignas(WS_CACHE_LINE_SIZE) std::atomic<int64_t> mdTop;
+    alignas(WS_CACHE_LINE_SIZE) std::atomic<int64_t> mdBottom;
+    alignas(WS_CACHE_LINE_SIZE) Slot maSlots[WS_DEQUE_CAPACITY];
+};
+
+/**
+ * @brief Work-stealing scheduler. Every worker owns a Chase-Lev deque
+ *        and is pinned to its own CPU from the given CpuSet. A job
+ *        submitted from a worker (e.g. a fan-out root job) goes to that
+ *        worker's deque, jobs submitted from outside go to a shared
+ *        injection queue. Idle workers steal from the other deques,
+ *        trying the workers on the same core first, then the ones on
+ *        the same NUMA node and only then the remote ones.
+ */
+class WorkStealingScheduler
+{
+public:
+
+    using JobFunc = ThreadPool::JobFunc;
+
+    WorkStealingScheduler() = default;
+
+    WorkStealingScheduler(const WorkStealingScheduler& rtOther) = delete;
+    WorkStealingScheduler& operator=(const WorkStealingScheduler& rtOther) = delete;
+
+    /**
+     * @brief Destructor. Completes the queued jobs and joins the workers.
+     */
+    ~WorkStealingScheduler()
+    {
+        stop();
+    }
+
+    /**
+     * @brief Create and pin the workers. Returns once all of them are
+     *        running, the workers are released together.
+     *
+     * @param[in] rtBaseAttr Attributes to take the scheduling policy and
+     *                       priority from (e.g. adjustScheduler() output);
+     *                       the affinity is set per worker.
+     * @param[in] rtCpuSet CPUs to pin the workers to, one CPU per worker
+     *                     round-robin. If empty - the workers are not pinned.
+     * @param[in] rdNumWorkers Number of workers; 0 means defaultPoolSize(rtCpuSet).
+     * @param[in] rpStacks Optional pool of prefaulted stacks for the workers.
+     *
+     * @return Error code.
+     */
+    cmn::ErrCode start(const pthread_attr_t& rtBaseAttr, const CpuSet& rtCpuSet, size_t rdNumWorkers = 0,
+            StackPool* rpStacks = nullptr)
+    {
+        // Set until stop(): submit() and stop() test the flag, not the workers.
+        if (mbStarted.exchange(true, std::memory_order_acq_rel))
+        {
+            return cmn::ErrCode::ALREADY_ENABLED;
+        }
+
+        const size_t dNumWorkers = (rdNumWorkers != 0) ? rdNumWorkers : defaultPoolSize(rtCpuSet);
+        // Distinct physical cores first, the SMT siblings last.
+        const auto tCpus = Topology::system().placementOrder(rtCpuSet);
+
+        mbStop.store(false, std::memory_order_relaxed);
+        mdPending.store(0, std::memory_order_relaxed);
+
+        for (size_t dIdx = 0; dIdx < dNumWorkers; ++dIdx)
+        {
+            const CpuIndex dCpu = rtCpuSet.empty() ? -1 : tCpus[dIdx % tCpus.size()];
+            auto pWorker = allocWorker(dCpu);
+            if (nullptr == pWorker)
+            {
+                stop();
+                return cmn::ErrCode::GENERAL_ERR;
+            }
+
+            pWorker->pOwner = this;
+            pWorker->dIndex = dIdx;
+            pWorker->dCpu = dCpu;
+            mtWorkers.push_back(pWorker);
+        }
+
+        buildVictimLists();
+
+        std::vector<SpawnEntry> tSpawn(mtWorkers.size());
+        for (size_t dIdx = 0; dIdx < mtWorkers.size(); ++dIdx)
+        {
+            tSpawn[dIdx].pArg = mtWorkers[dIdx];
+            tSpawn[dIdx].dCpu = mtWorkers[dIdx]->dCpu;
+        }
+
+        // The workers and this thread: no job runs before all the workers are up.
+        mtStartBarrier.reset(mtWorkers.size() + 1);
+
+        mpStacks = rpStacks;
+        const auto tErr = spawnBatch(rtBaseAttr, mpStacks, &WorkStealingScheduler::workerFunc, tSpawn.data(),
+                tSpawn.size(), "ws");
+
+        size_t dSpawned = 0;
+        for (size_t dIdx = 0; dIdx < mtWorkers.size(); ++dIdx)
+        {
+            mtWorkers[dIdx]->tSpawn = tSpawn[dIdx];
+            dSpawned += tSpawn[dIdx].bSpawned ? 1 : 0;
+        }
+
+        // Stand in for the workers which have not been created and release all at once.
+        mtStartBarrier.arrive(mtWorkers.size() - dSpawned);
+        mtStartBarrier.arriveAndWait();
+
+        if (cmn::ErrCode::OK != tErr)
+        {
+            CMN_LOG_ERROR("Failed to spawn the work-stealing workers, err %d", static_cast<int>(tErr));
+            stop();
+            return tErr;
+        }
+
+        return cmn::ErrCode::OK;
+    }
+
+    /**
+     * @brief Queue a job. Called from a worker of this scheduler the job is
+     *        pushed to the worker's own deque, otherwise to the injection queue.
+     *
+     * @param[in] rpFunc Job function.
+     * @param[in] rpArg Argument passed to the job function.
+     *
+     * @return Error code.
+     */
+    cmn::ErrCode submit(JobFunc rpFunc, void* rpArg)
+    {
+        if (not mbStarted.load(std::memory_order_acquire) || mbStop.load(std::memory_order_acquire))
+        {
+            return cmn::ErrCode::NOT_READY;
+        }
+
+        // Account the job before publishing it so a worker taking it
+        // right away never drives the counter below zero.
+        mdPending.fetch_add(1, std::memory_order_seq_cst);
+
+        auto pSelf = currentWorker();
+        const bool bQueuedLocally = (nullptr != pSelf) && (pSelf->pOwner == this) && pSelf->tDeque.push(rpFunc, rpArg);
+
+        if (not bQueuedLocally)
+        {
+            std::lock_guard<PiMutex> tGuard(mtInjectionLock);
+            mtInjected.push_back(Job {rpFunc, rpArg});
+        }
+
+        // The job is published: a worker which failed to find it
+        // before the bump does not sleep, see park().
+        mdWakeSeq.fetch_add(1, std::memory_order_seq_cst);
+        if (mdSleeping.load(std::memory_order_seq_cst) > 0)
+        {
+            std::lock_guard<PiMutex> tGuard(mtParkLock);
+            mtWorkAvailable.notify_one();
+        }
+
+        return cmn::ErrCode::OK;
+    }
+
+    /**
+     * @brief Complete all the queued jobs and join the workers.
+     *
+     * @return Error code.
+     */
+    cmn::ErrCode stop()
+    {
+        if (not mbStarted.exchange(false, std::memory_order_acq_rel))
+        {
+            return cmn::ErrCode::NOT_ENABLED;
+        }
+
+        {
+            std::lock_guard<PiMutex> tGuard(mtParkLock);
+            mbStop.store(true, std::memory_order_seq_cst);
+        }
+        mtWorkAvailable.notify_all();
+
+        // All joined before any is freed: the running ones still steal
+        // from the deques of the others.
+        for (auto pWorker : mtWorkers)
+        {
+            joinBatch(mpStacks, &pWorker->tSpawn, 1);
+        }
+
+        for (auto pWorker : mtWorkers)
+        {
+            freeWorker(pWorker);
+        }
+
+        mtWorkers.clear();
+        return cmn::ErrCode::OK;
+    }
+
+    /**
+     * @brief Get the number of the worker threads.
+     *
+     * @return Number of workers.
+     */
+    size_t size() const
+    {
+        return mtWorkers.size();
+    }
+
+private:
+
+    struct Job
+    {
+        JobFunc pFunc;
+        void* pArg;
+    };
+
+    struct Worker
+    {
+        WsDeque tDeque;
+        WorkStealingScheduler* pOwner = nullptr;
+        size_t dIndex = 0;
+        CpuIndex dCpu = -1;
+        SpawnEntry tSpawn;
+        std::vector<size_t> tVictims; // Other workers ordered by the distance.
+    };
+
+    static Worker*& currentWorker()
+    {
+        thread_local Worker* pWorker = nullptr;
+        return pWorker;
+    }
+
+    // Workers are cache-line aligned (WsDeque is) so plain new can't be used in C++11.
+    /**
+     * @brief Allocate a worker, its deque included, on the node of its
+     *        CPU; page aligned, so the cache line alignment holds as well.
+     */
+    static Worker* allocWorker(CpuIndex rdCpu)
+    {
+        void* pMem = allocateOnNode(sizeof(Worker), Topology::system().nodeOf(rdCpu));
+        if (nullptr == pMem)
+        {
+            return nullptr;
+        }
+
+        return new (pMem) Worker;
+    }
+
+    static void freeWorker(Worker* rpWorker)
+    {
+        rpWorker->~Worker();
+        freeOnNode(rpWorker, sizeof(Worker));
+    }
+
+    /**
+     * @brief Get the steal distance between two CPUs, see Topology::distance():
+     *        the same core (or unpinned), the same LLC, the same node, remote.
+     */
+    static int cpuDistance(CpuIndex rdFirst, CpuIndex rdSecond)
+    {
+        return Topology::system().distance(rdFirst, rdSecond);
+    }
+
+    void buildVictimLists()
+    {
+        for (auto pWorker : mtWorkers)
+        {
+            std::vector<std::pair<int, size_t>> tRanked;
+            for (auto pOther : mtWorkers)
+            {
+                if (pOther != pWorker)
+                {
+                    tRanked.emplace_back(cpuDistance(pWorker->dCpu, pOther->dCpu), pOther->dIndex);
+                }
+            }
+
+            // Stable sort by distance; within the same distance start right
+            // after the worker itself so the thieves do not all pick worker 0.
+            const size_t dCount = mtWorkers.size();
+            const size_t dSelf = pWorker->dIndex;
+            std::stable_sort(tRanked.begin(), tRanked.end(),
+                    [dCount, dSelf](const std::pair<int, size_t>& rtLeft, const std::pair<int, size_t>& rtRight)
+                    {
+                        if (rtLeft.first != rtRight.first)
+                        {
+                            return rtLeft.first < rtRight.first;
+                        }
+
+                        return ((rtLeft.second + dCount - dSelf) % dCount) < ((rtRight.second + dCount - dSelf) % dCount);
+                    });
+
+            for (const auto& rtEntry : tRanked)
+            {
+                pWorker->tVictims.push_back(rtEntry.second);
+            }
+        }
+    }
+
+    bool takeInjected(Job& rtJob)
+    {
+        std::lock_guard<PiMutex> tGuard(mtInjectionLock);
+        if (mtInjected.empty())
+        {
+            return false;
+        }
+
+        rtJob = mtInjected.front();
+        mtInjected.pop_front();
+        return true;
+    }
+
+    bool findJob(Worker& rtSelf, Job& rtJob)
+    {
+        if (rtSelf.tDeque.pop(rtJob.pFunc, rtJob.pArg) || takeInjected(rtJob))
+        {
+            return true;
+        }
+
+        for (const auto dVictim : rtSelf.tVictims)
+        {
+            if (mtWorkers[dVictim]->tDeque.steal(rtJob.pFunc, rtJob.pArg))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * @brief Sleep until a job is submitted after the given wake sequence
+     *        number was read or the scheduler stops. Not on the pending
+     *        count: a job queued but taken by another worker meanwhile
+     *        keeps it positive and would never let the worker sleep.
+     *
+     * @param[in] rdWakeSeq mdWakeSeq read before the last findJob().
+     */
+    void park(uint64_t rdWakeSeq)
+    {
+        std::unique_lock<PiMutex> tGuard(mtParkLock);
+        mdSleeping.fetch_add(1, std::memory_order_seq_cst);
+        mtWorkAvailable.wait(tGuard, [this, rdWakeSeq]()
+                {
+                    return (mdWakeSeq.load(std::memory_order_seq_cst) != rdWakeSeq) ||
+                        mbStop.load(std::memory_order_seq_cst);
+                });
+        mdSleeping.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    static void* workerFunc(void* rpWorker)
+    {
+        auto pSelf = static_cast<Worker*>(rpWorker);
+        auto pScheduler = pSelf->pOwner;
+        currentWorker() = pSelf;
+        pScheduler->mtStartBarrier.arriveAndWait();
+
+        size_t dIdleRounds = 0;
+        Job tJob {};
+
+        while (true)
+        {
+            const auto dWakeSeq = pScheduler->mdWakeSeq.load(std::memory_order_seq_cst);
+            if (pScheduler->findJob(*pSelf, tJob))
+            {
+                pScheduler->mdPending.fetch_sub(1, std::memory_order_seq_cst);
+                dIdleRounds = 0;
+                tJob.pFunc(tJob.pArg);
+                continue;
+            }
+
+            if (pScheduler->mdPending.load(std::memory_order_seq_cst) > 0)
+            {
+                // A job is queued but has not been published to us yet
+                // (or another worker is about to take it): retry.
+                if (++dIdleRounds < WS_STEAL_ROUNDS_BEFORE_PARK)
+                {
+                    sched_yield();
+                    continue;
+                }
+            }
+            else if (pScheduler->mbStop.load(std::memory_order_seq_cst))
+            {
+                break;
+            }
+
+            // Every job submitted after the sequence number was read wakes us.
+            dIdleRounds = 0;
+            pScheduler->park(dWakeSeq);
+        }
+
+        currentWorker() = nullptr;
+        return nullptr;
+    }
+
+    std::vector<Worker*> mtWorkers;
+    StackPool* mpStacks = nullptr;
+    StartBarrier mtStartBarrier;
+
+    // Priority inheritance locks: the workers run at RT priorities.
+    PiMutex mtInjectionLock;
+    std::deque<Job> mtInjected;
+
+    PiMutex mtParkLock;
+    std::condition_variable_any mtWorkAvailable;
+    std::atomic<size_t> mdPending {0};  // Jobs queued but not taken yet.
+    std::atomic<size_t> mdSleeping {0}; // Parked workers.
+    std::atomic<uint64_t> mdWakeSeq {0}; // Bumped by every submit(), see park().
+    std::atomic<bool> mbStarted {false};
+    std::atomic<bool> mbStop {false};
+};
+}
@@ -55,7 +55,7 @@ ErrCode spawnWorkerThread(pthread_t& rtEntry)
 int main(int argc, char* argv[])
 {
     const auto tSyslogErr = prepareSyslog(SYSLOG_LABEL);
-    Finally tSyslogGuard([]()
+    const auto tSyslogGuard = makeScopeGuard([]()
             {
                 // Close Syslog instance upon exit.
                 // Should be called at all times since openlog()
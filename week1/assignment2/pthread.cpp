@@ -1,4 +1,4 @@
-#include <array>
+#include <cinttypes>
 #include <utility>
 
 #include <errno.h>
@@ -8,72 +8,119 @@
 #include "common.h"
 using namespace cmn;
 
+// Scheduler control, CPU info and
+// some other threading-related stuff.
+#include "threading.h"
+
+// Command line options.
+#include "options.h"
+
+using namespace threading;
+
+// Cache-line padded task slots.
+#include "arena.h"
+
+// Time control and the per-thread latency recorders.
+#include "rt_time.h"
+#include "latency_recorder.h"
+
+using namespace rt_time;
+
+// Synthetic CPU load kernels.
+#include "cpu_load.h"
+
+using namespace cpu_load;
+
 struct ThreadArgs
 {
     size_t dThreadIdx;
+    Latch* pDoneLatch;           // Signalled once the task is complete.
+    LatencyRecorder* pRecorder;  // Collects submit-to-start latencies.
+    const LoadJob* pJob;         // Kernel work, nullptr - the sum up to the index.
+    Nanos tSubmitTime;           // MonotonicRaw time the task was queued at.
+    Nanos tRunTime;              // Time the workload took.
+    uint64_t dWork;              // Workload size, in the kernel units.
+    size_t dResult;              // Written by the task.
 };
 
-// Thread entry object to keep both a thread handle
-// and the corresponding args structure together.
-using ThreadEntry = std::pair<ThreadArgs, pthread_t>;
-
 namespace
 {
 constexpr auto SYSLOG_LABEL = "[COURSE:1][ASSIGNMENT:2]";
 
 // Start value for thread index passed in the args.
 constexpr size_t THREADS_START_IDX = 1;
-constexpr size_t NUM_THREADS = 128;
+constexpr size_t DEFAULT_NUM_THREADS = 128;
 
-// Global thread objects container:
-// a pair of thread args struct and pthread handle.
-using ThreadsArray = std::array<ThreadEntry, NUM_THREADS>;
+// Global task args container, sized from the command line. The tasks
+// are executed by the pool workers so no per-task thread handle is needed.
+// Every task gets its own cache lines: the workers writing the results
+// of the neighbouring tasks never contend for a line.
+using ThreadsArray = PaddedSlots<ThreadArgs>;
 ThreadsArray aThreads;
 }
 
 /**
- * @brief Create and run worker threads. The number of
- *        threads to spawn is defined by NUM_THREADS.
+ * @brief Submit the worker tasks to the thread pool. The number of
+ *        tasks to run is defined by the aThreads size.
+ *
+ * @param[in] rtPool Thread pool to run the tasks.
+ * @param[in] rtDoneLatch Latch to be signalled by every completed task.
+ * @param[in] rtRecorder Recorder for the tasks queueing latencies.
+ * @param[in] rpJob Kernel work of every task, nullptr - the sum up to the task index.
  *
  * @return Error code.
  */
-ErrCode spawnThreads()
+ErrCode spawnThreads(ThreadPool& rtPool, Latch& rtDoneLatch, LatencyRecorder& rtRecorder, const LoadJob* rpJob)
 {
-    // Default attrs, zero-initialized.
-    pthread_attr_t tDefaultAttr {};
-    pthread_attr_init(&tDefaultAttr);
-
     size_t dIdx = THREADS_START_IDX;
 
-    // Spawn the threads one by one.
-    for (auto& tEntry : aThreads)
+    // Submit the tasks one by one.
+    for (size_t dSlot = 0; dSlot < aThreads.size(); ++dSlot)
     {
-        tEntry.first.dThreadIdx = dIdx++;
-        const auto dErr = pthread_create(&tEntry.second, // pthread handle.
-                                         &tDefaultAttr,
-
-                                         // Thread func.
-                                         [](void* pThreadParams) -> void*
-                                         {
-                                             const auto dIdx = reinterpret_cast<ThreadArgs*>(pThreadParams)->dThreadIdx;
-                                             size_t dSum = 0;
-
-                                             // Synthetic workload: sum the numbers from 1 to thread IDX.
-                                             for (size_t i = 1; i < (dIdx + 1); ++i)
-                                             {
-                                                 dSum += i;
-                                             }
-                                             syslog(LOG_DEBUG, "Thread idx=%zu, sum[1..%zu]=%zu", dIdx, dIdx, dSum);
-                                             pthread_exit(nullptr);
-
-                                             // No need to return - nullptr seems to be returned implicitly.
-                                         },
-
-                                         // Thread args object pointer.
-                                         reinterpret_cast<void*>(&tEntry.first));
-        if (dErr != 0)
+        auto& tArgs = aThreads[dSlot];
+        tArgs.dThreadIdx = dIdx++;
+        tArgs.pDoneLatch = &rtDoneLatch;
+        tArgs.pRecorder = &rtRecorder;
+        tArgs.pJob = rpJob;
+        getTime(ClockTypeId::MonotonicRaw, tArgs.tSubmitTime);
+        const auto tErr = rtPool.submit(
+                                        // Task func.
+                                        [](void* pThreadParams)
+                                        {
+                                            auto pArgs = reinterpret_cast<ThreadArgs*>(pThreadParams);
+                                            const auto dIdx = pArgs->dThreadIdx;
+
+                                            // Every worker records into its own shard.
+                                            Nanos tStartTime;
+                                            getTime(ClockTypeId::MonotonicRaw, tStartTime);
+                                            pArgs->pRecorder->record(tStartTime - pArgs->tSubmitTime);
+
+                                            // Accumulate in a register, the slot is written once.
+                                            uint64_t dSum = 0;
+                                            if (nullptr == pArgs->pJob)
+                                            {
+                                                // Synthetic workload: sum the numbers from 1 to thread IDX.
+                                                dSum = sumTo(dIdx);
+                                                pArgs->dWork = dIdx;
+                                            }
+                                            else
+                                            {
+                                                pArgs->dWork = pArgs->pJob->run(dIdx, dSum);
+                                            }
+
+                                            Nanos tEndTime;
+                                            getTime(ClockTypeId::MonotonicRaw, tEndTime);
+                                            pArgs->tRunTime = tEndTime - tStartTime;
+                                            syslog(LOG_DEBUG, "Thread idx=%zu, result=%" PRIu64, dIdx, dSum);
+                                            pArgs->dResult = dSum;
+                                            pArgs->pDoneLatch->countDown();
+                                        },
+
+                                        // Task args object pointer.
+                                        reinterpret_cast<void*>(&tArgs));
+        if (tErr != ErrCode::OK)
         {
-            std::cerr << "Failed to create thread" << tEntry.first.dThreadIdx << " error: " << dErr;
+            std::cerr << "Failed to submit task " << tArgs.dThreadIdx << " error: " << static_cast<int>(tErr);
             return ErrCode::PTHREAD_ERR;
         }
     }
@@ -81,11 +128,32 @@ ErrCode spawnThreads()
     return ErrCode::OK;
 }
 
+/**
+ * @brief Log the throughput of the timed tasks: the total over the run
+ *        and the run time distribution of the tasks.
+ *
+ * @param[in] rtJob Job of every task.
+ * @param[in] rtElapsed Time from the pool start to the last task done.
+ */
+void logJobSummary(const LoadJob& rtJob, Nanos rtElapsed)
+{
+    uint64_t dWork = 0;
+    LatencyHistogram tRunTime;
+    for (size_t dSlot = 0; dSlot < aThreads.size(); ++dSlot)
+    {
+        dWork += aThreads[dSlot].dWork;
+        tRunTime.record(aThreads[dSlot].tRunTime);
+    }
+
+    CMN_LOG_TRACE("Kernel: %s, %zu units per task, throughput: %.4g %s/s", loadKernelToString(rtJob.eKernel),
+            rtJob.dUnits, LoadResult {dWork, rtElapsed}.throughput(), loadKernelUnit(rtJob.eKernel));
+    tRunTime.logSummary("Task run time");
+}
 
 int main(int argc, char* argv[])
 {
     const auto tSyslogErr = prepareSyslog(SYSLOG_LABEL);
-    Finally tSyslogGuard([]()
+    const auto tSyslogGuard = makeScopeGuard([]()
             {
                 // Close Syslog instance upon exit.
                 // Should be called at all times since openlog()
@@ -93,17 +161,100 @@ int main(int argc, char* argv[])
                 closelog();
             });
 
+    size_t dNumThreads = DEFAULT_NUM_THREADS;
+    size_t dPoolSize = defaultPoolSize(CpuSet {});
+    LoadKernel eKernel = LoadKernel::Scalar;
+    Nanos tJobDuration;
+
+    OptionParser tOptions("Thread pool demo: every task sums the numbers up to its index"
+            " or runs a CPU load kernel for the given time.");
+    tOptions.add("threads", 'n', "Number of tasks to run (default: 128)", dNumThreads, &parseSize);
+    tOptions.add("workers", 'w', "Number of pool workers (default: one per core)", dPoolSize, &parseSize);
+    tOptions.add("kernel", 'k', "Load kernel of the timed tasks: scalar, vector, stream, chase (default: scalar)",
+            eKernel, &parseLoadKernel);
+    tOptions.add("job", 'j', "Run time of every task with ns/us/ms/s suffix, microseconds if none;"
+            " 0 - the sum up to the task index (default: 0)", tJobDuration, &parseNanos);
+
+    const auto tOptionsErr = tOptions.parse(argc, argv);
+    if ((ErrCode::OK != tOptionsErr) || (dNumThreads == 0) || (dPoolSize == 0))
+    {
+        exit((ErrCode::NOT_READY == tOptionsErr) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    // Lock and prefault the memory before any thread is spawned.
+    if (ErrCode::OK != prepareRealtimeProcess())
+    {
+        exit(EXIT_FAILURE);
+    }
 
-    // Check the Syslog status code and spawn the worker threds.
-    if ((ErrCode::OK != tSyslogErr) || (ErrCode::OK != spawnThreads()))
+    // The kernel data is shared by all the tasks, the job is calibrated
+    // on the main thread.
+    LoadSet tLoadSet;
+    LoadJob tJob {};
+    if (tJobDuration > Nanos())
+    {
+        if (ErrCode::OK != tLoadSet.init(loadKernelRegions(eKernel)))
+        {
+            exit(EXIT_FAILURE);
+        }
+
+        tJob = LoadJob::calibrate(eKernel, tLoadSet, tJobDuration);
+    }
+
+    Arena tArena;
+    if ((ErrCode::OK != tArena.init(ThreadsArray::bytesFor(dNumThreads))) ||
+            (ErrCode::OK != aThreads.init(tArena, dNumThreads)))
     {
         exit(EXIT_FAILURE);
     }
 
-    // Wait for completion for all the threads spawned above.
-    for (const auto& tEntry : aThreads)
+    // Default attrs, zero-initialized. The pool workers are
+    // created once and then reused by all the tasks.
+    pthread_attr_t tDefaultAttr {};
+    pthread_attr_init(&tDefaultAttr);
+
+    ThreadPool tPool;
+    Latch tDoneLatch(dNumThreads);
+    LatencyRecorder tRecorder;
+
+    if ((ErrCode::OK != tSyslogErr) || (ErrCode::OK != tRecorder.init(dPoolSize)))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    // The pool start returns once all the workers are running,
+    // they are released together by its start barrier.
+    Nanos tSpawnTime;
+    Nanos tStartedTime;
+    Nanos tDoneTime;
+    getTime(ClockTypeId::MonotonicRaw, tSpawnTime);
+    if (ErrCode::OK != tPool.start(tDefaultAttr, dPoolSize))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    getTime(ClockTypeId::MonotonicRaw, tStartedTime);
+    if (ErrCode::OK != spawnThreads(tPool, tDoneLatch, tRecorder, (tJobDuration > Nanos()) ? &tJob : nullptr))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    // Wait for completion for all the tasks submitted above.
+    tDoneLatch.wait();
+    getTime(ClockTypeId::MonotonicRaw, tDoneTime);
+    tPool.stop();
+
+    CMN_LOG_TRACE("Workers: %zu, tasks: %zu, spawn to all started: %" PRId64 " ns, all started to all done: %"
+            PRId64 " ns", dPoolSize, dNumThreads, (tStartedTime - tSpawnTime).count(),
+            (tDoneTime - tStartedTime).count());
+
+    LatencyHistogram tQueueLatency;
+    tRecorder.snapshot(tQueueLatency);
+    tQueueLatency.logSummary("Task queueing latency");
+
+    if (tJobDuration > Nanos())
     {
-        pthread_join(tEntry.second, nullptr);
+        logJobSummary(tJob, tDoneTime - tStartedTime);
     }
 
     std::cout << "TEST COMPLETE" << std::endl;
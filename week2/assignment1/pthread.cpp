@@ -1,4 +1,4 @@
-#include <array>
+#include <cinttypes>
 #include <utility>
 
 #include <errno.h>
@@ -12,8 +12,26 @@
 // some other threading-related stuff.
 #include "threading.h"
 
+// Work-stealing scheduler running the worker tasks.
+#include "work_stealing.h"
+
+// Cache-line padded task slots.
+#include "arena.h"
+
+// Time control and the per-thread latency recorders.
+#include "rt_time.h"
+#include "latency_recorder.h"
+
+// Synthetic CPU load kernels.
+#include "cpu_load.h"
+
+// Command line options.
+#include "options.h"
+
 using namespace cmn;
 using namespace threading;
+using namespace rt_time;
+using namespace cpu_load;
 
 namespace
 {
@@ -21,63 +39,120 @@ constexpr auto SYSLOG_LABEL = "[COURSE:1][ASSIGNMENT:3]";
 
 // Start value for thread index passed in the args.
 constexpr size_t THREADS_START_IDX = 1;
-constexpr size_t NUM_THREADS = 128;
+constexpr size_t DEFAULT_NUM_THREADS = 128;
 
 struct ThreadArgs
 {
     size_t dThreadIdx;
+    Latch* pDoneLatch;           // Signalled once the task is complete.
+    LatencyRecorder* pRecorder;  // Collects submit-to-start latencies.
+    LatencyRecorder* pRunDelayRecorder;  // Collects run-queue waits while running.
+    const LoadJob* pJob;         // Kernel work, nullptr - the sum up to the index.
+    Nanos tSubmitTime;           // MonotonicRaw time the task was queued at.
+    Nanos tRunTime;              // Time the workload took.
+    uint64_t dWork;              // Workload size, in the kernel units.
+    SchedEvents tSchedEvents;    // Migrations and context switches while running.
+    size_t dResult;              // Written by the task.
 };
 
-// Thread entry object to keep both a thread handle
-// and the corresponding args structure together.
-using ThreadEntry = std::pair<ThreadArgs, pthread_t>;
-using ThreadsArray = std::array<ThreadEntry, NUM_THREADS>;
+// Task args container, sized from the command line. The tasks are
+// executed by the pool workers so no per-task thread handle is needed.
+// Every task gets its own cache lines: the workers writing the results
+// of the neighbouring tasks never contend for a line.
+using ThreadsArray = PaddedSlots<ThreadArgs>;
 }
 
 
 /**
- * @brief Create and run worker threads. The number of
- *        threads to spawn is defined by NUM_THREADS.
+ * @brief Submit the worker tasks to the scheduler. The number of
+ *        tasks to run is defined by the tasks array size. Called from the fan-out
+ *        root job, so the tasks land in the root worker's deque and the
+ *        other workers steal them from there.
  *
- * @param[in] rtWorkerThreadsAttr Thread attributes structure.
- * @param[in] rpThreadsArray Pointer to ThreadEntry array to hold worker threads entries.
+ * @param[in] rtScheduler Scheduler to run the tasks.
+ * @param[in] rpThreadsArray Pointer to ThreadArgs array to hold the tasks args.
+ * @param[in] rtDoneLatch Latch to be signalled by every completed task.
+ * @param[in] rtRecorder Recorder for the tasks queueing latencies.
+ * @param[in] rtRunDelayRecorder Recorder for the run-queue waits of the running tasks.
+ * @param[in] rpJob Kernel work of every task, nullptr - the sum up to the task index.
  *
  * @return Error code.
  */
-ErrCode spawnThreads(pthread_attr_t& rtWorkerThreadsAttr, ThreadsArray* rpThreadsArray)
+ErrCode spawnThreads(WorkStealingScheduler& rtScheduler, ThreadsArray* rpThreadsArray, Latch& rtDoneLatch,
+        LatencyRecorder& rtRecorder, LatencyRecorder& rtRunDelayRecorder, const LoadJob* rpJob)
 {
     size_t dIdx = THREADS_START_IDX;
 
-    // Spawn the threads one by one.
-    for (auto& tEntry : *rpThreadsArray)
+    // Submit the tasks one by one.
+    for (size_t dSlot = 0; dSlot < rpThreadsArray->size(); ++dSlot)
     {
-        tEntry.first.dThreadIdx = dIdx++;
-        const auto dErr = pthread_create(&tEntry.second, // pthread handle.
-                                         &rtWorkerThreadsAttr,
-
-                                         // Thread func.
-                                         [](void* pThreadParams) -> void*
-                                         {
-                                             const auto dIdx = reinterpret_cast<ThreadArgs*>(pThreadParams)->dThreadIdx;
-                                             size_t dSum = 0;
-
-                                             // Synthetic workload: sum the numbers from 1 to thread IDX.
-                                             // I do not use any kind of pregression sum formulas intentionally.
-                                             for (size_t i = 1; i < (dIdx + 1); ++i)
-                                             {
-                                                 dSum += i;
-                                             }
-                                             syslog(LOG_DEBUG, "Thread idx=%zu, sum[1..%zu]=%zu Running on core : %d", dIdx, dIdx, dSum, myCpu());
-                                             pthread_exit(nullptr);
+        auto& tArgs = (*rpThreadsArray)[dSlot];
+        tArgs.dThreadIdx = dIdx++;
+        tArgs.pDoneLatch = &rtDoneLatch;
+        tArgs.pRecorder = &rtRecorder;
+        tArgs.pRunDelayRecorder = &rtRunDelayRecorder;
+        tArgs.pJob = rpJob;
+        getTime(ClockTypeId::MonotonicRaw, tArgs.tSubmitTime);
+        const auto tErr = rtScheduler.submit(
+                                        // Task func.
+                                        [](void* pThreadParams)
+                                        {
+                                            auto pArgs = reinterpret_cast<ThreadArgs*>(pThreadParams);
+                                            const auto dIdx = pArgs->dThreadIdx;
+
+                                            // Every worker records into its own shard.
+                                            Nanos tStartTime;
+                                            getTime(ClockTypeId::MonotonicRaw, tStartTime);
+                                            pArgs->pRecorder->record(tStartTime - pArgs->tSubmitTime);
+
+                                            // CPU, context switches and run-queue wait at the task
+                                            // start; compared with the same at the end.
+                                            SchedSample tStartSample {};
+                                            sampleScheduling(tStartSample);
+
+                                            // Accumulate in a register, the slot is written once.
+                                            uint64_t dSum = 0;
+                                            if (nullptr == pArgs->pJob)
+                                            {
+                                                // Synthetic workload: sum the numbers from 1 to thread IDX.
+                                                // I do not use any kind of pregression sum formulas intentionally.
+                                                dSum = sumTo(dIdx);
+                                                pArgs->dWork = dIdx;
+                                            }
+                                            else
+                                            {
+                                                pArgs->dWork = pArgs->pJob->run(dIdx, dSum);
+                                            }
+
+                                            Nanos tEndTime;
+                                            getTime(ClockTypeId::MonotonicRaw, tEndTime);
+                                            pArgs->tRunTime = tEndTime - tStartTime;
+                                            syslog(LOG_DEBUG, "Thread idx=%zu, result=%" PRIu64 " Running on core : %d", dIdx, dSum, myCpu());
+                                            pArgs->dResult = dSum;
+
+                                            SchedSample tEndSample {};
+                                            sampleScheduling(tEndSample);
+                                            pArgs->tSchedEvents = schedEventsBetween(tStartSample, tEndSample);
+                                            if (pArgs->tSchedEvents.dRunDelayNs >= 0)
+                                            {
+                                                pArgs->pRunDelayRecorder->record(Nanos(pArgs->tSchedEvents.dRunDelayNs));
+                                            }
+
+                                            pArgs->pDoneLatch->countDown();
+                                        },
+
+                                        // Task args object pointer.
+                                        reinterpret_cast<void*>(&tArgs));
+        if (tErr != ErrCode::OK)
+        {
+            std::cerr << "Failed to submit task " << tArgs.dThreadIdx << " error: " << static_cast<int>(tErr) << std::endl;
 
-                                             // No need to return - nullptr seems to be returned implicitly.
-                                         },
+            // Release the waiter for the tasks which will never run.
+            for (size_t dLeft = tArgs.dThreadIdx; dLeft < (THREADS_START_IDX + rpThreadsArray->size()); ++dLeft)
+            {
+                rtDoneLatch.countDown();
+            }
 
-                                         // Thread args object pointer.
-                                         reinterpret_cast<void*>(&tEntry.first));
-        if (dErr != 0)
-        {
-            std::cerr << "Failed to create thread " << tEntry.first.dThreadIdx << " error: " << dErr << " : " << strerror(dErr) << std::endl;
             return ErrCode::PTHREAD_ERR;
         }
     }
@@ -88,13 +163,18 @@ ErrCode spawnThreads(pthread_attr_t& rtWorkerThreadsAttr, ThreadsArray* rpThread
 // Thread args structure for the starter thread.
 struct StarterThreadArgs
 {
-    pthread_attr_t tThreadAttr;  // Thread attrs to be used for the starter thread
-                                 // itself and for the child threads spawned by it.
-    ThreadsArray* aThreadsArray; // Pointer to the child threads entries array.
+    pthread_attr_t tThreadAttr;           // Thread attrs to be used for the starter thread.
+    WorkStealingScheduler* pScheduler;    // Scheduler to run the worker tasks on.
+    ThreadsArray* aThreadsArray;          // Pointer to the tasks args array.
+    Latch* pDoneLatch;                    // Signalled by every completed task.
+    LatencyRecorder* pRecorder;           // Per-worker queueing latency shards.
+    LatencyRecorder* pRunDelayRecorder;   // Per-worker run-queue wait shards.
+    const LoadJob* pJob;                  // Kernel work of every task, nullptr - the sum.
 };
 
 /**
- * @brief Spawn the starter thread which cheates all the worker ones.
+ * @brief Spawn the starter thread which submits the fan-out root job
+ *        to the scheduler. The completion is signalled by the done latch.
  *
  * @param[in] rtStarterArgs Starter thread args.
  * @param[out] rtStarterThreadId Starter thread ID.
@@ -109,18 +189,30 @@ ErrCode makeStarterThread(StarterThreadArgs& rtStarterArgs, pthread_t& rtStarter
                                      {
                                          std::cout << "The starter thread is running on CPU " << myCpu() << std::endl;
 
-                                         auto pThreadsAttr = static_cast<StarterThreadArgs*>(rpThreadParams);
-                                         const auto tErr = spawnThreads(pThreadsAttr->tThreadAttr, pThreadsAttr->aThreadsArray);
+                                         auto pStarterArgs = static_cast<StarterThreadArgs*>(rpThreadParams);
+
+                                         // The root job runs on a worker and fans the tasks out.
+                                         const auto tErr = pStarterArgs->pScheduler->submit(
+                                                 [](void* rpRootParams)
+                                                 {
+                                                     auto pArgs = static_cast<StarterThreadArgs*>(rpRootParams);
+                                                     const auto tSpawnErr = spawnThreads(*pArgs->pScheduler, pArgs->aThreadsArray,
+                                                             *pArgs->pDoneLatch, *pArgs->pRecorder, *pArgs->pRunDelayRecorder, pArgs->pJob);
+                                                     if (ErrCode::OK != tSpawnErr)
+                                                     {
+                                                         std::cerr << "Cannot spawn the worker threads, err " << static_cast<int>(tSpawnErr) << std::endl;
+                                                     }
+                                                 },
+                                                 rpThreadParams);
+
                                          if (ErrCode::OK != tErr)
                                          {
-                                             std::cerr << "Cannot spawn the worker threads, err " << static_cast<int>(tErr) << std::endl;
-                                         }
-                                         else
-                                         {
-                                             // Wait for completion for all the worker threads spawned above.
-                                             for (const auto& tEntry : *pThreadsAttr->aThreadsArray)
+                                             std::cerr << "Cannot submit the fan-out job, err " << static_cast<int>(tErr) << std::endl;
+
+                                             // Release the waiter for the tasks which will never run.
+                                             for (size_t dLeft = 0; dLeft < pStarterArgs->aThreadsArray->size(); ++dLeft)
                                              {
-                                                 pthread_join(tEntry.second, nullptr);
+                                                 pStarterArgs->pDoneLatch->countDown();
                                              }
                                          }
 
@@ -139,10 +231,33 @@ ErrCode makeStarterThread(StarterThreadArgs& rtStarterArgs, pthread_t& rtStarter
     return ErrCode::OK;
 }
 
+/**
+ * @brief Log the throughput of the timed tasks: the total over the run
+ *        and the run time distribution of the tasks.
+ *
+ * @param[in] rtThreadsArray Completed tasks args.
+ * @param[in] rtJob Job of every task.
+ * @param[in] rtElapsed Time from the scheduler start to the last task done.
+ */
+void logJobSummary(const ThreadsArray& rtThreadsArray, const LoadJob& rtJob, Nanos rtElapsed)
+{
+    uint64_t dWork = 0;
+    LatencyHistogram tRunTime;
+    for (size_t dSlot = 0; dSlot < rtThreadsArray.size(); ++dSlot)
+    {
+        dWork += rtThreadsArray[dSlot].dWork;
+        tRunTime.record(rtThreadsArray[dSlot].tRunTime);
+    }
+
+    CMN_LOG_TRACE("Kernel: %s, %zu units per task, throughput: %.4g %s/s", loadKernelToString(rtJob.eKernel),
+            rtJob.dUnits, LoadResult {dWork, rtElapsed}.throughput(), loadKernelUnit(rtJob.eKernel));
+    tRunTime.logSummary("Task run time");
+}
+
 int main(int argc, char* argv[])
 {
     const auto tSyslogErr = prepareSyslog(SYSLOG_LABEL);
-    Finally tSyslogGuard([]()
+    const auto tSyslogGuard = makeScopeGuard([]()
             {
                 // Close Syslog instance upon exit.
                 // Should be called at all times since openlog()
@@ -150,39 +265,177 @@ int main(int argc, char* argv[])
                 closelog();
             });
 
+    // All the allowed cores by default, one worker pinned to each,
+    // so the tasks spread over the machine. Give e.g. -c 3 to run
+    // everything on the fourth core as the original example did.
     CpuSet tCpuSet;
+    SchedPolicy tSchedPolicy = SCHED_FIFO;
+    size_t dNumThreads = DEFAULT_NUM_THREADS;
+    LoadKernel eKernel = LoadKernel::Scalar;
+    Nanos tJobDuration;
+
+    OptionParser tOptions("Work-stealing fan-out demo: every task sums the numbers up to its index"
+            " or runs a CPU load kernel for the given time.");
+    tOptions.add("threads", 'n', "Number of tasks to run (default: 128)", dNumThreads, &parseSize);
+    tOptions.add("cpus", 'c', "CPU list to run the workers on, e.g. 0-3; 'all' - every allowed CPU (default: all)",
+            tCpuSet, &parseCpuList);
+    tOptions.add("policy", 'P', "Scheduling policy: FIFO, RR, OTHER, BATCH, IDLE (default: FIFO)",
+            tSchedPolicy, &parseSchedPolicy);
+    tOptions.add("kernel", 'k', "Load kernel of the timed tasks: scalar, vector, stream, chase (default: scalar)",
+            eKernel, &parseLoadKernel);
+    tOptions.add("job", 'j', "Run time of every task with ns/us/ms/s suffix, microseconds if none;"
+            " 0 - the sum up to the task index (default: 0)", tJobDuration, &parseNanos);
+
+    const auto tOptionsErr = tOptions.parse(argc, argv);
+    if ((ErrCode::OK != tOptionsErr) || (dNumThreads == 0))
+    {
+        exit((ErrCode::NOT_READY == tOptionsErr) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if (tCpuSet.empty() && (ErrCode::OK != getAllowedCpus(tCpuSet)))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    // The workers are placed on distinct physical cores first,
+    // each with its state on the NUMA node of its core.
+    Topology::system().logSummary();
+
+    // Lock and prefault the memory before any thread is spawned.
+    if (ErrCode::OK != prepareRealtimeProcess())
+    {
+        exit(EXIT_FAILURE);
+    }
 
-    // Add just one core idx to the set: 3 (the fourth one
-    // starting from zero), just as the example suggests.
-    // All the new threads should be executed on this
-    // core only.
-    tCpuSet.insert(3);
+    // The kernel data is shared by all the tasks, the job is calibrated
+    // on the main thread before it is moved to the RT scheduling.
+    LoadSet tLoadSet;
+    LoadJob tJob {};
+    if (tJobDuration > Nanos())
+    {
+        if (ErrCode::OK != tLoadSet.init(loadKernelRegions(eKernel)))
+        {
+            exit(EXIT_FAILURE);
+        }
+
+        tJob = LoadJob::calibrate(eKernel, tLoadSet, tJobDuration);
+    }
 
     pthread_attr_t tWorkerThreadsAttr {};
 
     // Adjust scheduler params including CPU cores set, priority (implicitly the max one is used)
     // and scheduling policy.
-    if (ErrCode::OK != adjustScheduler(tCpuSet, SCHED_FIFO, tWorkerThreadsAttr, true /* verbose mode */))
+    if (ErrCode::OK != adjustScheduler(tCpuSet, tSchedPolicy, tWorkerThreadsAttr, true /* verbose mode */))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    // The workers are created once with the adjusted attributes,
+    // one worker pinned to each core in the CPU set. Their stacks are
+    // allocated, prefaulted and locked up front so the RT workers
+    // neither mmap() nor page fault on them.
+    StackPool tStacks;
+    if (ErrCode::OK != tStacks.init(defaultPoolSize(tCpuSet)))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    WorkStealingScheduler tScheduler;
+    Arena tArena;
+    ThreadsArray aThreads; // The container for the worker tasks args.
+    if ((ErrCode::OK != tArena.init(ThreadsArray::bytesFor(dNumThreads))) ||
+            (ErrCode::OK != aThreads.init(tArena, dNumThreads)))
     {
         exit(EXIT_FAILURE);
     }
 
-    ThreadsArray aThreads; // The container for the worker threads entries.
+    Latch tDoneLatch(dNumThreads);
+    LatencyRecorder tRecorder;
+    LatencyRecorder tRunDelayRecorder;
     StarterThreadArgs tStarterThreadArgs;
 
     tStarterThreadArgs.tThreadAttr = tWorkerThreadsAttr;
+    tStarterThreadArgs.pScheduler = &tScheduler;
     tStarterThreadArgs.aThreadsArray = &aThreads;
+    tStarterThreadArgs.pDoneLatch = &tDoneLatch;
+    tStarterThreadArgs.pRecorder = &tRecorder;
+    tStarterThreadArgs.pRunDelayRecorder = &tRunDelayRecorder;
+    tStarterThreadArgs.pJob = (tJobDuration > Nanos()) ? &tJob : nullptr;
     pthread_t tStarterThread;
 
-    // Check the Syslog status code and spawn the worker threds.
     if ((ErrCode::OK != tSyslogErr) ||
-            (ErrCode::OK != makeStarterThread(tStarterThreadArgs, tStarterThread)))
+            (ErrCode::OK != tRecorder.init(defaultPoolSize(tCpuSet))) ||
+            (ErrCode::OK != tRunDelayRecorder.init(defaultPoolSize(tCpuSet))))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    // The scheduler start returns once all the workers are running,
+    // they are released together by its start barrier.
+    Nanos tSpawnTime;
+    Nanos tStartedTime;
+    Nanos tDoneTime;
+    getTime(ClockTypeId::MonotonicRaw, tSpawnTime);
+    if (ErrCode::OK != tScheduler.start(tWorkerThreadsAttr, tCpuSet, 0, &tStacks))
     {
         exit(EXIT_FAILURE);
     }
 
-    // Wait for the starter thread and the worker threads to join.
+    getTime(ClockTypeId::MonotonicRaw, tStartedTime);
+    if (ErrCode::OK != makeStarterThread(tStarterThreadArgs, tStarterThread))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    // The last task to complete releases the latch, no join is on the way.
+    tDoneLatch.wait();
+    getTime(ClockTypeId::MonotonicRaw, tDoneTime);
     pthread_join(tStarterThread, nullptr);
+    tScheduler.stop();
+
+    CMN_LOG_TRACE("Workers: %zu, tasks: %zu, spawn to all started: %" PRId64 " ns, all started to all done: %"
+            PRId64 " ns", defaultPoolSize(tCpuSet), dNumThreads, (tStartedTime - tSpawnTime).count(),
+            (tDoneTime - tStartedTime).count());
+
+    LatencyHistogram tQueueLatency;
+    tRecorder.snapshot(tQueueLatency);
+    tQueueLatency.logSummary("Task queueing latency");
+
+    if (tJobDuration > Nanos())
+    {
+        logJobSummary(aThreads, tJob, tDoneTime - tStartedTime);
+    }
+
+    // With the affinity and an RT policy in place no task should
+    // migrate, run elsewhere or get preempted.
+    size_t dMigrated = 0;
+    size_t dOutside = 0;
+    int64_t dVoluntarySwitches = 0;
+    int64_t dInvoluntarySwitches = 0;
+    for (size_t dSlot = 0; dSlot < aThreads.size(); ++dSlot)
+    {
+        const auto& rtEvents = aThreads[dSlot].tSchedEvents;
+        dMigrated += rtEvents.migrated() ? 1 : 0;
+        dOutside += (not tCpuSet.empty() && (not tCpuSet.test(rtEvents.dStartCpu) ||
+                    not tCpuSet.test(rtEvents.dEndCpu))) ? 1 : 0;
+        dVoluntarySwitches += rtEvents.dVoluntarySwitches;
+        dInvoluntarySwitches += rtEvents.dInvoluntarySwitches;
+    }
+
+    CMN_LOG_TRACE("Tasks: %zu, migrated while running: %zu, ran outside the CPU set: %zu, "
+            "voluntary switches: %" PRId64 ", involuntary switches: %" PRId64,
+            aThreads.size(), dMigrated, dOutside, dVoluntarySwitches, dInvoluntarySwitches);
+
+    LatencyHistogram tRunDelay;
+    tRunDelayRecorder.snapshot(tRunDelay);
+    if (0 == tRunDelay.count())
+    {
+        CMN_LOG_TRACE("Task run-queue wait: not available, the kernel has no schedstat");
+    }
+    else
+    {
+        tRunDelay.logSummary("Task run-queue wait");
+    }
 
     std::cout << "TEST COMPLETE" << std::endl;
     exit(EXIT_SUCCESS);
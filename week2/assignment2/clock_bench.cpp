@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <vector>
+
+#include <sched.h>
+#include <time.h>
+
+// Common header which contains Syslog helpers
+// and some other auxiliary stuff.
+#include "common.h"
+
+// Scheduler control, CPU info and
+// some other threading-related stuff.
+#include "threading.h"
+
+// Time control, conversion macros etc.
+#include "rt_time.h"
+
+// Fixed-memory latency histogram.
+#include "latency_histogram.h"
+
+// Command line options.
+#include "options.h"
+
+using namespace cmn;
+using namespace threading;
+using namespace rt_time;
+
+// Clock source comparison: for every clock the read cost, the promised
+// and the observed resolution, the backward steps and the sleep error
+// measured with that clock. The results are printed as one CSV table
+// to pick the clock per platform.
+
+namespace
+{
+constexpr size_t DEFAULT_READS = 2000000;
+constexpr size_t DEFAULT_SLEEPS = 200;
+
+struct ClockResult
+{
+    ClockTypeId eClock;
+    double dReadCost;          // Nanoseconds per getTime() call.
+    Nanos tResolution;         // As reported by getClockResolution().
+    Nanos tObservedStep;       // The smallest non-zero step between two reads.
+    size_t dBackwardSteps;     // Reads returning less than the previous one.
+    LatencyHistogram tSleepError;
+};
+}
+
+/**
+ * @brief Read the clock back to back: the cost per read, the smallest
+ *        step and the monotonicity violations.
+ *
+ * @param rtResult Clock result to fill in.
+ * @param rdReads Number of reads.
+ *
+ * @return Error code.
+ */
+ErrCode measureReads(ClockResult& rtResult, size_t rdReads)
+{
+    Nanos tBegin;
+    Nanos tEnd;
+    Nanos tPrev;
+    Nanos tNow;
+    int64_t dMinStep = INT64_MAX;
+    size_t dBackward = 0;
+
+    if ((ErrCode::OK != getTime(ClockTypeId::MonotonicRaw, tBegin)) ||
+            (ErrCode::OK != getTime(rtResult.eClock, tPrev)))
+    {
+        return ErrCode::CLOCK_ERROR;
+    }
+
+    for (size_t dIdx = 0; dIdx < rdReads; ++dIdx)
+    {
+        getTime(rtResult.eClock, tNow);
+
+        const auto dStep = (tNow - tPrev).count();
+        if (dStep < 0)
+        {
+            ++dBackward;
+        }
+        else if ((dStep > 0) && (dStep < dMinStep))
+        {
+            dMinStep = dStep;
+        }
+
+        tPrev = tNow;
+    }
+
+    if (ErrCode::OK != getTime(ClockTypeId::MonotonicRaw, tEnd))
+    {
+        return ErrCode::CLOCK_ERROR;
+    }
+
+    rtResult.dReadCost = static_cast<double>((tEnd - tBegin).count()) / static_cast<double>(rdReads);
+    rtResult.tObservedStep = Nanos((dMinStep == INT64_MAX) ? 0 : dMinStep);
+    rtResult.dBackwardSteps = dBackward;
+    return ErrCode::OK;
+}
+
+/**
+ * @brief Sleep for the period on the clock the kernel can sleep on and
+ *        measure the sleep with the clock under test: the error includes
+ *        the granularity of the measuring clock.
+ *
+ * @param rtResult Clock result to fill in.
+ * @param rdSleeps Number of sleeps.
+ * @param rtPeriod Sleep period.
+ *
+ * @return Error code.
+ */
+ErrCode measureSleeps(ClockResult& rtResult, size_t rdSleeps, Nanos rtPeriod)
+{
+    const auto eSleepClock = sleepClockFor(rtResult.eClock);
+    const auto tPeriod = rtPeriod.toTimespec();
+
+    for (size_t dIdx = 0; dIdx < rdSleeps; ++dIdx)
+    {
+        Nanos tStart;
+        Nanos tStop;
+        if (ErrCode::OK != getTime(rtResult.eClock, tStart))
+        {
+            return ErrCode::CLOCK_ERROR;
+        }
+
+        // Relative sleep; an EINTR restart would add an error, so it is reported.
+        const auto dRc = clock_nanosleep((clockid_t) eSleepClock, 0, &tPeriod, nullptr);
+        if (0 != dRc)
+        {
+            CMN_LOG_ERROR("clock_nanosleep() call failed with err code %d", dRc);
+            return ErrCode::CLOCK_ERROR;
+        }
+
+        if (ErrCode::OK != getTime(rtResult.eClock, tStop))
+        {
+            return ErrCode::CLOCK_ERROR;
+        }
+
+        rtResult.tSleepError.record(tStop - tStart - rtPeriod);
+    }
+
+    return ErrCode::OK;
+}
+
+/**
+ * @brief Pin the calling thread to the CPUs, so all the clocks are read
+ *        on the same core (the TSC offsets may differ between cores).
+ *
+ * @param rtCpuSet CPUs, empty - leave the affinity as is.
+ *
+ * @return Error code.
+ */
+ErrCode pinToCpus(const CpuSet& rtCpuSet)
+{
+    if (ErrCode::OK != ThreadSpec().cpus(rtCpuSet).applyToCurrentThread())
+    {
+        CMN_LOG_ERROR("Failed to set the CPU affinity");
+        return ErrCode::SCHED_FAILURE;
+    }
+
+    return ErrCode::OK;
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<ClockTypeId> tClocks {ClockTypeId::RealTime, ClockTypeId::Monotonic, ClockTypeId::MonotonicRaw,
+                                      ClockTypeId::RealTimeCoarse, ClockTypeId::MonotonicCoarse, ClockTypeId::Tsc};
+    size_t dReads = DEFAULT_READS;
+    size_t dSleeps = DEFAULT_SLEEPS;
+    Nanos tPeriod = Nanos::fromMsec(1);
+    CpuSet tCpuSet;
+
+    OptionParser tOptions("Clock source comparison: read cost, resolution, monotonicity and sleep error"
+            " of every clock, printed as a CSV table.");
+    tOptions.addList("clock", 'k', "Clocks: RealTime, Monotonic, MonotonicRaw, RealTimeCoarse, MonotonicCoarse, Tsc"
+            " (default: all, Tsc if supported)", tClocks, &parseClockTypeId);
+    tOptions.add("reads", 'n', "Back to back reads per clock (default: 2000000)", dReads, &parseSize);
+    tOptions.add("sleeps", 's', "Sleeps per clock, 0 - skip the sleep test (default: 200)", dSleeps, &parseSize);
+    tOptions.add("period", 'i', "Sleep period with ns/us/ms/s suffix, microseconds if none (default: 1ms)",
+            tPeriod, &parseNanos);
+    tOptions.add("cpus", 'c', "CPU list to run on, e.g. 0; 'all' - any CPU (default: all)", tCpuSet, &parseCpuList);
+
+    const auto tOptionsErr = tOptions.parse(argc, argv);
+    if (ErrCode::OK != tOptionsErr)
+    {
+        exit((ErrCode::NOT_READY == tOptionsErr) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if ((dReads == 0) || (tPeriod <= Nanos()) || (ErrCode::OK != pinToCpus(tCpuSet)))
+    {
+        CMN_LOG_ERROR("Invalid reads count, period or CPU list");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("clock,reads,read_ns,resolution_ns,observed_step_ns,backward_steps,sleeps,sleep_period_ns,"
+            "sleep_error_min_ns,sleep_error_mean_ns,sleep_error_p99_ns,sleep_error_max_ns\n");
+
+    // The TSC is calibrated once, ahead of the measurements,
+    // and skipped with a trace message where there is none.
+    const bool bTscRequested = (tClocks.end() != std::find(tClocks.begin(), tClocks.end(), ClockTypeId::Tsc));
+    const bool bTscReady = bTscRequested && (ErrCode::OK == tsc::calibrate());
+    if (bTscRequested && not bTscReady)
+    {
+        CMN_LOG_TRACE("The TSC clock is not supported on this machine, skipped");
+    }
+
+    bool bFailed = false;
+    for (const auto eClock : tClocks)
+    {
+        if ((ClockTypeId::Tsc == eClock) && not bTscReady)
+        {
+            continue;
+        }
+
+        ClockResult tResult {eClock, 0.0, Nanos(), Nanos(), 0, LatencyHistogram()};
+
+        timespec tResolution {};
+        if ((ErrCode::OK != getClockResolution(eClock, tResolution)) ||
+                (ErrCode::OK != measureReads(tResult, dReads)) ||
+                (ErrCode::OK != measureSleeps(tResult, dSleeps, tPeriod)))
+        {
+            CMN_LOG_ERROR("Failed to measure the %s clock", clockIdToString(eClock));
+            bFailed = true;
+            continue;
+        }
+
+        tResult.tResolution = Nanos::fromTimespec(tResolution);
+
+        const auto& rtSleep = tResult.tSleepError;
+        printf("%s,%zu,%.2lf,%" PRId64 ",%" PRId64 ",%zu,%zu,%" PRId64 ",%" PRId64 ",%.1lf,%" PRId64 ",%" PRId64 "\n",
+                clockIdToString(eClock), dReads, tResult.dReadCost, tResult.tResolution.count(),
+                tResult.tObservedStep.count(), tResult.dBackwardSteps, dSleeps, tPeriod.count(),
+                (dSleeps == 0) ? 0 : rtSleep.min().count(), rtSleep.mean(),
+                rtSleep.percentile(99.0).count(), (dSleeps == 0) ? 0 : rtSleep.max().count());
+        fflush(stdout);
+    }
+
+    exit(bFailed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,290 @@
+#include <vector>
+
+#include <errno.h>
+#include <string.h>
+
+// Common header which contains Syslog helpers
+// and some other auxiliary stuff.
+#include "common.h"
+
+// Scheduler control, CPU info and
+// some other threading-related stuff.
+#include "threading.h"
+
+// Time control, conversion macros etc.
+#include "rt_time.h"
+
+// Per-thread latency histograms.
+#include "latency_recorder.h"
+
+// Command line options.
+#include "options.h"
+
+using namespace cmn;
+using namespace threading;
+using namespace rt_time;
+using namespace str_utils;
+
+// Cyclictest-style wakeup latency benchmark: one measurement thread
+// per CPU, every thread pinned to its CPU with its own SCHED_FIFO
+// priority, sleeping to absolute deadlines one period apart and
+// recording how late it wakes up. The per-core histograms show
+// the difference between the kernel configurations (PREEMPT_RT
+// vs. stock) and the cores (e.g. the ones handling IRQs).
+
+namespace
+{
+constexpr auto SYSLOG_LABEL = "[COURSE:1][CYCLICTEST]";
+
+constexpr long DEFAULT_PERIOD_USEC = 1000;
+constexpr size_t DEFAULT_LOOPS = 10000;
+
+// The clock cyclictest uses by default.
+constexpr ClockTypeId MEASUREMENT_CLOCK = ClockTypeId::Monotonic;
+
+struct Options
+{
+    CpuSet tCpus;          // CPUs to measure on, all the allowed ones if empty.
+    Nanos tPeriod;         // Wakeup period.
+    size_t dLoops;         // Wakeups per thread.
+    int dPriority;         // Priority of the first thread, the next ones get one less.
+    int dDmaLatencyUsec;   // /dev/cpu_dma_latency value, negative - not set.
+};
+
+struct MeasurementArgs
+{
+    CpuIndex dCpu;
+    int dPriority;
+    const Options* pOptions;
+    LatencyShard* pShard;  // Cache-line aligned, owned by this thread only.
+    ErrCode tResult;
+};
+}
+
+ErrCode parseOptions(int argc, char* argv[], Options& rtOptions)
+{
+    rtOptions.tPeriod = Nanos::fromUsec(DEFAULT_PERIOD_USEC);
+    rtOptions.dLoops = DEFAULT_LOOPS;
+    rtOptions.dPriority = sched_get_priority_max(SCHED_FIFO) - 1;
+    rtOptions.dDmaLatencyUsec = CPU_DMA_LATENCY_DEFAULT;
+
+    OptionParser tParser("Cyclictest-style wakeup latency benchmark: one SCHED_FIFO thread per CPU.");
+    tParser.add("cpus", 'c', "CPU list, e.g. 0,2-3 (default: all the CPUs the process may run on)",
+            rtOptions.tCpus, &parseCpuList);
+    tParser.add("interval", 'i', "Wakeup period with ns/us/ms/s suffix, microseconds if none (default: 1000)",
+            rtOptions.tPeriod, &parseNanos);
+    tParser.add("loops", 'l', "Number of wakeups per thread (default: 10000)", rtOptions.dLoops, &parseSize);
+    tParser.add("priority", 'p', "SCHED_FIFO priority of the first thread, the next ones get one less"
+            " (default: max - 1)", rtOptions.dPriority, &parseInt);
+    tParser.add("dma-latency", 'L', "Value for /dev/cpu_dma_latency in microseconds, e.g. 0 (default: not set)",
+            rtOptions.dDmaLatencyUsec, &parseInt);
+
+    const auto tErr = tParser.parse(argc, argv);
+    if (ErrCode::OK != tErr)
+    {
+        return tErr;
+    }
+
+    if ((rtOptions.tPeriod <= Nanos()) || (rtOptions.dLoops == 0) ||
+            (rtOptions.dPriority < sched_get_priority_min(SCHED_FIFO)) ||
+            (rtOptions.dPriority > sched_get_priority_max(SCHED_FIFO)))
+    {
+        CMN_LOG_ERROR("Invalid period, loops or priority");
+        return ErrCode::INVALID_ARGS;
+    }
+
+    // Default to every CPU the process is allowed to run on.
+    return rtOptions.tCpus.empty() ? getAllowedCpus(rtOptions.tCpus) : ErrCode::OK;
+}
+
+/**
+ * @brief Measurement thread: wake up every period and record the
+ *        wakeup latency, i.e. the lateness against the absolute deadline.
+ *        No busy-wait tail: it is the kernel latency being measured.
+ */
+void* measurementThread(void* rpArgs)
+{
+    auto pArgs = static_cast<MeasurementArgs*>(rpArgs);
+    const auto pOptions = pArgs->pOptions;
+
+    async_log::attachThread();
+    CMN_LOG_TRACE("Measurement thread for CPU %d running on CPU %d, priority %d",
+            pArgs->dCpu, myCpu(), pArgs->dPriority);
+
+    PeriodicTimer tTimer(MEASUREMENT_CLOCK, pOptions->tPeriod);
+    if (tTimer.start() != ErrCode::OK)
+    {
+        pArgs->tResult = ErrCode::CLOCK_ERROR;
+        return nullptr;
+    }
+
+    for (size_t dIdx = 0; dIdx < pOptions->dLoops; ++dIdx)
+    {
+        size_t dSleepCount = 0;
+        if (tTimer.waitNext(dSleepCount) != ErrCode::OK)
+        {
+            pArgs->tResult = ErrCode::CLOCK_ERROR;
+            return nullptr;
+        }
+
+        pArgs->pShard->record(tTimer.lastLateness());
+    }
+
+    pArgs->tResult = ErrCode::OK;
+    return nullptr;
+}
+
+/**
+ * @brief Spawn one measurement thread per CPU: pinned to the CPU, with the
+ *        scheduling attributes from rtBaseAttr and a distinct priority.
+ *
+ * @param[in] rtBaseAttr Attributes from adjustScheduler().
+ * @param[in,out] rtArgs Per-thread args, one per CPU.
+ * @param[out] rtThreads Spawned thread handles.
+ *
+ * @return Error code.
+ */
+ErrCode spawnMeasurementThreads(const pthread_attr_t& rtBaseAttr, std::vector<MeasurementArgs>& rtArgs,
+        std::vector<pthread_t>& rtThreads)
+{
+    for (auto& rtArg : rtArgs)
+    {
+        pthread_attr_t tAttr {};
+        auto tErr = cloneThreadAttr(rtBaseAttr, tAttr, rtArg.dCpu);
+
+        sched_param tParam {};
+        tParam.sched_priority = rtArg.dPriority;
+        if ((ErrCode::OK == tErr) && (0 != pthread_attr_setschedparam(&tAttr, &tParam)))
+        {
+            tErr = ErrCode::SCHED_FAILURE;
+        }
+
+        pthread_t tThread {};
+        if (ErrCode::OK == tErr)
+        {
+            const auto dErr = pthread_create(&tThread, &tAttr, &measurementThread, &rtArg);
+            if (dErr != 0)
+            {
+                CMN_LOG_ERROR("Failed to spawn the thread for CPU %d: %d (%s)", rtArg.dCpu, dErr, strerror(dErr));
+                tErr = ErrCode::PTHREAD_ERR;
+            }
+        }
+
+        pthread_attr_destroy(&tAttr);
+        if (ErrCode::OK != tErr)
+        {
+            return tErr;
+        }
+
+        rtThreads.push_back(tThread);
+    }
+
+    return ErrCode::OK;
+}
+
+int main(int argc, char* argv[])
+{
+    const auto tSyslogErr = prepareSyslog(SYSLOG_LABEL);
+    const auto tSyslogGuard = makeScopeGuard([]()
+            {
+                // Close Syslog instance upon exit.
+                // Should be called at all times since openlog()
+                // always succeeds.
+                closelog();
+            });
+
+    Options tOptions {};
+    const auto tOptionsErr = parseOptions(argc, argv, tOptions);
+    if (ErrCode::OK != tOptionsErr)
+    {
+        exit((ErrCode::NOT_READY == tOptionsErr) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    // Lock and prefault the memory before any thread is spawned.
+    if (ErrCode::OK != prepareRealtimeProcess(DEFAULT_STACK_PREFAULT, DEFAULT_HEAP_PREFAULT,
+                tOptions.dDmaLatencyUsec, true /* verbose mode */))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    // The measurement threads only queue the log records.
+    if ((ErrCode::OK != tSyslogErr) || (ErrCode::OK != startAsyncLogging()))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_attr_t tBaseAttr {};
+    if (ErrCode::OK != adjustScheduler(tOptions.tCpus, SCHED_FIFO, tBaseAttr, true /* verbose mode */))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    LatencyRecorder tRecorder;
+    if (ErrCode::OK != tRecorder.init(tOptions.tCpus.size()))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    // One thread per CPU, the priorities descend from the given one.
+    std::vector<MeasurementArgs> tArgs;
+    const auto dMinPriority = sched_get_priority_min(SCHED_FIFO);
+    for (const auto dCpu : tOptions.tCpus)
+    {
+        const auto dIdx = tArgs.size();
+        const auto dPriority = tOptions.dPriority - static_cast<int>(dIdx);
+
+        tArgs.push_back(MeasurementArgs {static_cast<CpuIndex>(dCpu),
+                (dPriority > dMinPriority) ? dPriority : dMinPriority,
+                &tOptions, tRecorder.shard(dIdx), ErrCode::NOT_READY});
+    }
+
+    CMN_LOG_TRACE("Measuring %zu CPUs, period %" PRId64 " us, %zu loops",
+            tArgs.size(), tOptions.tPeriod.toUsec(), tOptions.dLoops);
+
+    std::vector<pthread_t> tThreads;
+    const auto tSpawnErr = spawnMeasurementThreads(tBaseAttr, tArgs, tThreads);
+
+    for (auto& rtThread : tThreads)
+    {
+        pthread_join(rtThread, nullptr);
+    }
+
+    pthread_attr_destroy(&tBaseAttr);
+
+    if (ErrCode::OK != tSpawnErr)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    // The measurement is over: flush the queued records and log the
+    // summaries in place, the per-core labels below are stack buffers
+    // which the asynchronous log (keeping %s as pointers) cannot take.
+    stopAsyncLogging();
+
+    // Per-core histograms, then all the cores together.
+    bool bFailed = false;
+    LatencyHistogram tTotal;
+    for (size_t dIdx = 0; dIdx < tArgs.size(); ++dIdx)
+    {
+        const auto& rtArg = tArgs[dIdx];
+        if (ErrCode::OK != rtArg.tResult)
+        {
+            CMN_LOG_ERROR("Measurement on CPU %d failed with code %d", rtArg.dCpu, static_cast<int>(rtArg.tResult));
+            bFailed = true;
+            continue;
+        }
+
+        LatencyHistogram tCore;
+        rtArg.pShard->mergeInto(tCore);
+        tTotal.merge(tCore);
+
+        char aLabel[64];
+        formatTo(aLabel, sizeof(aLabel), "CPU %d (priority %d) wakeup latency", rtArg.dCpu, rtArg.dPriority);
+        tCore.logSummary(aLabel);
+    }
+
+    tTotal.logSummary("All CPUs wakeup latency");
+
+    CMN_LOG_TRACE("TEST COMPLETE");
+    exit(bFailed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
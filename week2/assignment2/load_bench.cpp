@@ -0,0 +1,292 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <vector>
+
+// Common header which contains Syslog helpers
+// and some other auxiliary stuff.
+#include "common.h"
+
+// Scheduler control, CPU info and
+// some other threading-related stuff.
+#include "threading.h"
+
+// Time control, conversion macros etc.
+#include "rt_time.h"
+
+// Synthetic CPU load kernels.
+#include "cpu_load.h"
+
+// Command line options.
+#include "options.h"
+
+using namespace cmn;
+using namespace threading;
+using namespace rt_time;
+using namespace cpu_load;
+
+// CPU load kernels throughput benchmark. Every kernel is run for the
+// same duration on 1, 2, 4, ... threads up to the CPU count, the threads
+// spread over the CPUs in the Topology::placementOrder() and released
+// together. The per-thread and the aggregate throughput and the scaling
+// efficiency against the single thread are printed as one CSV table:
+// the compute-bound kernels should scale with the cores, the memory-bound
+// ones stop at the memory bandwidth or latency limit.
+
+namespace
+{
+constexpr int64_t DEFAULT_DURATION_MS = 200;
+constexpr size_t DEFAULT_FOOTPRINT_MIB = DEFAULT_LOAD_FOOTPRINT / (1024 * 1024);
+
+struct LoadArgs
+{
+    size_t dThreadIdx;
+    LoadKernel eKernel;
+    const LoadSet* pSet;
+    size_t dSliceUnits;
+    Nanos tDuration;
+    StartBarrier* pStartBarrier;
+    LoadResult tResult;
+};
+
+void* loadRoutine(void* rpArgs)
+{
+    auto pArgs = static_cast<LoadArgs*>(rpArgs);
+    auto tCursor = cursorFor(*pArgs->pSet, pArgs->dThreadIdx);
+
+    pArgs->pStartBarrier->arriveAndWait();
+    pArgs->tResult = runFor(pArgs->eKernel, *pArgs->pSet, tCursor, pArgs->dSliceUnits, pArgs->tDuration);
+
+    // Keeps the kernel results alive.
+    asm volatile("" : : "r"(tCursor.dChecksum));
+    return nullptr;
+}
+
+// Kernel data per NUMA node, built on the first use.
+class LoadSets
+{
+public:
+
+    LoadSets(unsigned rdRegions, size_t rdFootprint) :
+        mdRegions(rdRegions),
+        mdFootprint(rdFootprint)
+    {}
+
+    const LoadSet* forNode(int rdNode)
+    {
+        auto& pSet = mtSets[rdNode];
+        if (!pSet)
+        {
+            pSet.reset(new LoadSet());
+            if (ErrCode::OK != pSet->init(mdRegions, mdFootprint, rdNode))
+            {
+                CMN_LOG_ERROR("Failed to allocate %zu bytes of the load data on node %d", mdFootprint, rdNode);
+                mtSets.erase(rdNode);
+                return nullptr;
+            }
+        }
+
+        return pSet.get();
+    }
+
+private:
+    unsigned mdRegions;     // LoadRegions of the kernels to run.
+    size_t mdFootprint;
+    std::map<int, std::unique_ptr<LoadSet>> mtSets;
+};
+}
+
+/**
+ * @brief Run the kernel on the given number of threads and print the row.
+ *
+ * @param[in] rtArgs Arguments of every thread: the kernel, the slice and the duration.
+ * @param[in] rtCpus CPUs in the placement order, the first rdThreads are used.
+ * @param[in] rtCpuSet All the CPUs: the affinity of the unpinned threads, which must
+ *                     not inherit the main thread's calibration CPU.
+ * @param[in] rdThreads Number of threads.
+ * @param[in] rbPinned If true - pin every thread to its CPU.
+ * @param[in] rdPolicy Scheduling policy of the threads.
+ * @param[in,out] rtSets Kernel data per node.
+ * @param[in,out] rdSingleThroughput Single-thread throughput: set by the 1-thread run,
+ *                                   the base of the efficiency of the others.
+ *
+ * @return Error code.
+ */
+ErrCode benchThreads(const LoadArgs& rtArgs, const std::vector<CpuIndex>& rtCpus, const CpuSet& rtCpuSet,
+        size_t rdThreads, bool rbPinned, SchedPolicy rdPolicy, LoadSets& rtSets, double& rdSingleThroughput)
+{
+    StartBarrier tStartBarrier(rdThreads + 1);
+    std::vector<LoadArgs> tArgs(rdThreads, rtArgs);
+    std::vector<pthread_t> tThreads(rdThreads);
+
+    for (size_t dIdx = 0; dIdx < rdThreads; ++dIdx)
+    {
+        const auto dCpu = rbPinned ? rtCpus[dIdx] : -1;
+        tArgs[dIdx].dThreadIdx = dIdx;
+        tArgs[dIdx].pSet = rtSets.forNode(rbPinned ? Topology::system().nodeOf(dCpu) : -1);
+        tArgs[dIdx].pStartBarrier = &tStartBarrier;
+        if (nullptr == tArgs[dIdx].pSet)
+        {
+            return ErrCode::GENERAL_ERR;
+        }
+    }
+
+    size_t dCreated = 0;
+    ErrCode tErr = ErrCode::OK;
+    for (; dCreated < rdThreads; ++dCreated)
+    {
+        char aName[THREAD_NAME_LENGTH];
+        str_utils::formatTo(aName, sizeof(aName), "load-%zu", dCreated);
+
+        ThreadSpec tSpec;
+        tSpec.policy(rdPolicy).name(aName);
+        if (rbPinned)
+        {
+            tSpec.cpu(rtCpus[dCreated]);
+        }
+        else
+        {
+            tSpec.cpus(rtCpuSet);
+        }
+
+        tErr = tSpec.create(tThreads[dCreated], &loadRoutine, &tArgs[dCreated]);
+        if (ErrCode::OK != tErr)
+        {
+            CMN_LOG_ERROR("Failed to create the load thread %zu", dCreated);
+            break;
+        }
+    }
+
+    // Stand in for the threads which failed to start, so the others run and exit.
+    tStartBarrier.arrive(rdThreads - dCreated);
+    tStartBarrier.arriveAndWait();
+
+    for (size_t dIdx = 0; dIdx < dCreated; ++dIdx)
+    {
+        pthread_join(tThreads[dIdx], nullptr);
+    }
+
+    if (ErrCode::OK != tErr)
+    {
+        return tErr;
+    }
+
+    double dMin = tArgs[0].tResult.throughput();
+    double dMax = dMin;
+    double dTotal = 0.0;
+    for (const auto& rtThreadArgs : tArgs)
+    {
+        const auto dThroughput = rtThreadArgs.tResult.throughput();
+        dMin = std::min(dMin, dThroughput);
+        dMax = std::max(dMax, dThroughput);
+        dTotal += dThroughput;
+    }
+
+    if (rdThreads == 1)
+    {
+        rdSingleThroughput = dTotal;
+    }
+
+    const auto dEfficiency = (rdSingleThroughput > 0.0) ?
+            (dTotal / (static_cast<double>(rdThreads) * rdSingleThroughput)) : 0.0;
+
+    printf("%s,%s,%zu,%d,%s,%.4g,%.4g,%.4g,%.4g,%.3lf\n", loadKernelToString(rtArgs.eKernel),
+            loadKernelUnit(rtArgs.eKernel), rdThreads, rbPinned ? 1 : 0, getSchedulerPolicyStr(rdPolicy), dMin,
+            dTotal / static_cast<double>(rdThreads), dMax, dTotal, dEfficiency);
+    fflush(stdout);
+    return ErrCode::OK;
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<LoadKernel> tKernels {LoadKernel::Scalar, LoadKernel::Vector, LoadKernel::Stream,
+                                      LoadKernel::Chase};
+    CpuSet tCpuSet;
+    SchedPolicy tSchedPolicy = SCHED_OTHER;
+    Nanos tDuration = Nanos::fromMsec(DEFAULT_DURATION_MS);
+    size_t dFootprintMib = DEFAULT_FOOTPRINT_MIB;
+    bool bUnpinned = false;
+
+    OptionParser tOptions("CPU load kernels benchmark: per-thread and aggregate throughput of every kernel"
+            " on 1, 2, 4, ... threads over the CPU set, printed as a CSV table.");
+    tOptions.addList("kernel", 'k', "Kernels: scalar, vector, stream, chase (default: all)", tKernels,
+            &parseLoadKernel);
+    tOptions.add("cpus", 'c', "CPU list, e.g. 0-3; 'all' - the allowed CPUs (default: all)", tCpuSet,
+            &parseCpuList);
+    tOptions.add("policy", 'P', "Scheduling policy: FIFO, RR, OTHER, BATCH, IDLE (default: OTHER)",
+            tSchedPolicy, &parseSchedPolicy);
+    tOptions.add("duration", 'd', "Run time per kernel and thread count with ns/us/ms/s suffix,"
+            " microseconds if none (default: 200ms)", tDuration, &parseNanos);
+    tOptions.add("footprint", 'm', "Stream and chase buffer size in MiB (default: 64)", dFootprintMib,
+            &parseSize);
+    tOptions.addFlag("unpinned", 'u', "Leave the thread placement to the scheduler", bUnpinned);
+
+    const auto tOptionsErr = tOptions.parse(argc, argv);
+    if (ErrCode::OK != tOptionsErr)
+    {
+        exit((ErrCode::NOT_READY == tOptionsErr) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if ((tDuration <= Nanos()) || (dFootprintMib == 0))
+    {
+        CMN_LOG_ERROR("The duration and the footprint must be positive");
+        exit(EXIT_FAILURE);
+    }
+
+    if (tCpuSet.empty() && (ErrCode::OK != getAllowedCpus(tCpuSet)))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    // The kernels are calibrated on the first CPU of the set.
+    const auto tCpus = Topology::system().placementOrder(tCpuSet);
+    if (ErrCode::OK != ThreadSpec().cpu(tCpus[0]).name("load-main").applyToCurrentThread())
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    std::vector<size_t> tThreadCounts;
+    for (size_t dThreads = 1; dThreads < tCpus.size(); dThreads *= 2)
+    {
+        tThreadCounts.push_back(dThreads);
+    }
+
+    tThreadCounts.push_back(tCpus.size());
+
+    unsigned dRegions = LOAD_REGION_NONE;
+    for (const auto eKernel : tKernels)
+    {
+        dRegions |= loadKernelRegions(eKernel);
+    }
+
+    LoadSets tSets(dRegions, dFootprintMib * 1024 * 1024);
+    const auto pCalibrationSet = tSets.forNode(Topology::system().nodeOf(tCpus[0]));
+    if (nullptr == pCalibrationSet)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    printf("# cpus = %zu, footprint = %zu MiB, duration = %" PRId64 " ms\n", tCpus.size(), dFootprintMib,
+            tDuration.toMsec());
+    printf("kernel,unit,threads,pinned,policy,min_per_thread,mean_per_thread,max_per_thread,aggregate,efficiency\n");
+
+    for (const auto eKernel : tKernels)
+    {
+        const LoadArgs tArgs {0, eKernel, nullptr, calibrateSlice(eKernel, *pCalibrationSet), tDuration, nullptr,
+                              LoadResult {0, Nanos()}};
+
+        double dSingleThroughput = 0.0;
+        for (const auto dThreads : tThreadCounts)
+        {
+            if (ErrCode::OK != benchThreads(tArgs, tCpus, tCpuSet, dThreads, !bUnpinned, tSchedPolicy, tSets,
+                    dSingleThroughput))
+            {
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -1,5 +1,6 @@
-#include <array>
+#include <string>
 #include <utility>
+#include <vector>
 
 #include <errno.h>
 #include <string.h>
@@ -15,6 +16,21 @@
 // Time control, conversion macros etc.
 #include "rt_time.h"
 
+// Fixed-memory latency histogram.
+#include "latency_histogram.h"
+
+// Command line options.
+#include "options.h"
+
+// Binary trace of the samples.
+#include "rt_trace.h"
+
+// Live counters for rt_top.
+#include "rt_telemetry.h"
+
+// Deadline miss detection.
+#include "deadline_monitor.h"
+
 using namespace cmn;
 using namespace threading;
 using namespace rt_time;
@@ -23,6 +39,29 @@ using namespace str_utils;
 namespace
 {
 constexpr auto SYSLOG_LABEL = "[COURSE:1][ASSIGNMENT:4]";
+
+// One delay test run parameters.
+struct DelayTestConfig
+{
+    ClockTypeId eClock;      // Clock to measure with.
+    Nanos tPeriod;           // Sleep period.
+    Nanos tSpin;             // Busy-wait tail, 0 - sleep only.
+    size_t dIterations;      // Number of periods to measure.
+    size_t dMaxSleepCount;   // Max. EINTR restarts per period.
+    bool bSummaryOnly;       // Do not log every iteration.
+    Nanos tWork;             // Busy work per period, to simulate a control loop.
+    OverrunPolicy eOverrunPolicy;  // What to do once the work overruns the period.
+    rt_trace::TraceWriter* pTrace;  // Raw samples sink, nullptr - no trace.
+    rt_telemetry::TelemetryPublisher* pTelemetry;  // Live counters, nullptr - none.
+    char aLabel[rt_telemetry::TELEMETRY_LABEL_LENGTH];  // Run name shown by rt_top.
+    uint32_t dRun;           // Run number in the test matrix, stored in the trace.
+};
+
+struct TestThreadArgs
+{
+    DelayTestConfig tConfig;
+    ErrCode tResult;
+};
 }
 
 
@@ -30,36 +69,68 @@ constexpr auto SYSLOG_LABEL = "[COURSE:1][ASSIGNMENT:4]";
  * @brief Compute and print test results.
  *
  * @param reClockTypeId Clock ID used for the test.
- * @param rtStart Test start time point.
- * @param rtStop Test stop time point.
  * @param rtDiff Start-stop poits diff.
  * @param rtError Error value between the requested sleep time and the actual one.
  */
-void endDelayTest(ClockTypeId reClockTypeId, const timespec& rtStart, const timespec& rtStop,
-        const timespec& rtDiff, const timespec& rtError)
+void endDelayTest(ClockTypeId reClockTypeId, Nanos rtDiff, Nanos rtError)
 {
-    const auto dRealDt = timeDiffInSeconds(rtStart, rtStop);
+    const auto tDiff = rtDiff.toTimespec();
+    const auto tError = rtError.toTimespec();
 
     CMN_LOG_TRACE("%s clock DT seconds = %ld, msec = %ld, usec = %ld, nsec = %ld, sec = %6.9lf",
-            clockIdToString(reClockTypeId), rtDiff.tv_sec, rtDiff.tv_nsec / NSEC_PER_MSEC,
-            rtDiff.tv_nsec / NSEC_PER_USEC, rtDiff.tv_nsec, dRealDt);
+            clockIdToString(reClockTypeId), tDiff.tv_sec, tDiff.tv_nsec / NSEC_PER_MSEC,
+            tDiff.tv_nsec / NSEC_PER_USEC, tDiff.tv_nsec, rtDiff.toSeconds());
 
     CMN_LOG_TRACE("%s clock delay error seconds = %ld, nanoseconds = %ld, ms. = %ld",
-            clockIdToString(reClockTypeId), rtError.tv_sec, rtError.tv_nsec, rtError.tv_nsec / NSEC_PER_MSEC);
+            clockIdToString(reClockTypeId), tError.tv_sec, tError.tv_nsec, tError.tv_nsec / NSEC_PER_MSEC);
 }
 
 /**
- * @brief Nanosleep delay test logic. Try to sleep for tSleepRequested time
- *        and then compute error value between the actual sleeped time and the
- *        requested one. Perform the same actions TEST_ITERATIONS times to
- *        get some statistic data.
+ * @brief Overrun callback of the delay test: report the miss and
+ *        resume on time if the loop keeps missing.
  *
- * @param reClockTypeId Clock type ID to use for the test.
+ * @return Policy to apply.
+ */
+OverrunPolicy onDeadlineMiss(const DeadlineMiss& rtMiss, void*)
+{
+    CMN_LOG_ERROR("Deadline missed in period %" PRIu64 " by %" PRId64 " ns, %" PRIu64 " in a row",
+            rtMiss.dPeriod, rtMiss.tOverrun.count(), rtMiss.dConsecutive);
+    return (rtMiss.dConsecutive > 1) ? OverrunPolicy::Skip : OverrunPolicy::CatchUp;
+}
+
+/**
+ * @brief Busy-wait to simulate the work of a period.
+ *
+ * @param reClockTypeId Clock to measure the work with.
+ * @param rtWork Work duration.
+ */
+void simulateWork(ClockTypeId reClockTypeId, Nanos rtWork)
+{
+    Nanos tStart;
+    Nanos tNow;
+    getTime(reClockTypeId, tStart);
+    do
+    {
+        getTime(reClockTypeId, tNow);
+    }
+    while ((tNow - tStart) < rtWork);
+}
+
+/**
+ * @brief Periodic sleep delay test logic. Sleep to absolute deadlines
+ *        TEST_SLEEP_TIME apart and then compute the interval between two
+ *        consecutive wakeups and the wakeup error (lateness against the
+ *        deadline). Perform the same actions the configured number of times
+ *        to get some statistic data: both values are recorded into
+ *        histograms which are summarized once the test is over.
+ *
+ * @param rtConfig Test parameters.
  *
  * @return Status code.
  */
-ErrCode delayTest(ClockTypeId reClockTypeId)
+ErrCode delayTest(const DelayTestConfig& rtConfig)
 {
+    const auto reClockTypeId = rtConfig.eClock;
     const bool bIgnoreNegDeltaErrs = reClockTypeId != ClockTypeId::MonotonicRaw;
 
     timespec tClockResolution {};
@@ -74,119 +145,137 @@ ErrCode delayTest(ClockTypeId reClockTypeId)
             (tClockResolution.tv_nsec / NSEC_PER_USEC),
             tClockResolution.tv_nsec);
 
-    constexpr size_t MAX_SLEEP_COUNT = 3;
-    constexpr size_t TEST_ITERATIONS = 100;
-    constexpr size_t TEST_SLEEP_SECONDS = 0;
-    constexpr size_t TEST_SLEEP_NANOSECONDS = NSEC_PER_MSEC * 10;
+    Nanos tRtcStartTime;
+    Nanos tRtcStopTime;
 
-    timespec tRtcStartTime {};
-    timespec tRtcStopTime {};
-    timespec tRtcDiff {};
-    timespec tDelayError {};
+    // Absolute deadlines: the error of one iteration does not leak into
+    // the next ones as it did with the relative nanosleep() re-arming.
+    // Busy-waiting the last microseconds of every period cuts the wakeup latency.
+    PeriodicTimer tTimer(reClockTypeId, rtConfig.tPeriod, rtConfig.tSpin);
 
-    timespec tSleepTime {};
-    timespec tSleepRequested {};
-    timespec tRemainingTime {};
+    // Every period's work (the measurements and the logging) must be
+    // done before the next period starts.
+    DeadlineMonitor tDeadlines(rtConfig.eOverrunPolicy, &onDeadlineMiss);
 
-    for (size_t dIdx = 0; dIdx < TEST_ITERATIONS; ++dIdx)
-    {
-        CMN_LOG_TRACE("Test %u", dIdx);
+    // Recording is O(1) and does not allocate, so it is safe in the loop.
+    LatencyHistogram tIntervalHistogram;
+    LatencyHistogram tErrorHistogram;
 
-        tSleepTime.tv_sec = TEST_SLEEP_SECONDS;
-        tSleepTime.tv_nsec = TEST_SLEEP_NANOSECONDS;
+    // Claimed once here; publishing in the loop is wait-free.
+    auto pTelemetry = (nullptr != rtConfig.pTelemetry) ? rtConfig.pTelemetry->claim(rtConfig.aLabel) : nullptr;
+    const auto tTelemetryGuard = makeScopeGuard([pTelemetry]()
+            {
+                if (nullptr != pTelemetry)
+                {
+                    pTelemetry->finish();
+                }
+            });
 
-        tSleepRequested.tv_sec = tSleepTime.tv_sec;
-        tSleepRequested.tv_nsec = tSleepTime.tv_nsec;
+    if ((getTime(reClockTypeId, tRtcStartTime) != ErrCode::OK) || (tTimer.start() != ErrCode::OK))
+    {
+        CMN_LOG_ERROR("Failed to start the periodic timer");
+        return ErrCode::TEST_FAILED;
+    }
 
-        if (getTime(reClockTypeId, tRtcStartTime) != ErrCode::OK)
+    for (size_t dIdx = 0; dIdx < rtConfig.dIterations; ++dIdx)
+    {
+        if (not rtConfig.bSummaryOnly)
         {
-            CMN_LOG_ERROR("Failed to get RTC start time for iteration %u", dIdx);
-            return ErrCode::TEST_FAILED;
+            CMN_LOG_TRACE("Test %zu", dIdx);
         }
 
+        // Number of sleep restarts after EINTR; it should depend on
+        // the scheduling policy and the signals the thread gets.
         size_t dSleepCount = 0;
+        if (tTimer.waitNext(dSleepCount, rtConfig.dMaxSleepCount) != ErrCode::OK)
+        {
+            CMN_LOG_ERROR("Periodic wait failed for iteration %zu", dIdx);
+            return ErrCode::TEST_FAILED;
+        }
 
-        do
+        if (getTime(reClockTypeId, tRtcStopTime) != ErrCode::OK)
         {
-            const auto dRc = nanosleep(&tSleepTime, &tRemainingTime);
-            if (dRc == 0)
-            {
-                // nanosleep call succeeded and we sleeped for tSleepTime
-                // without any time left for another attempt; tRemainingTime
-                // equals 0 in this case.
-                break;
-            }
-            else if (dRc != EINTR)
-            {
-                CMN_LOG_ERROR("nanosleep() call failed with err code %d", dRc);
-                return ErrCode::TEST_FAILED;
-            }
+            CMN_LOG_ERROR("Failed to get RTC stop time for iteration %zu", dIdx);
+            return ErrCode::TEST_FAILED;
+        }
 
-            // If we got here it means that EINTR was returned from nanosleep()
-            // call and our thread was woken up by the scheduler. This is a normal
-            // behavior for nanosleep so we need to check how much remaining time
-            // left. Clock resolution should matter: with better resolution we
-            // should have smaller sleep error diff between the requested time
-            // and the actual one.
+        // The interval between two consecutive wakeups. It may only
+        // be negative for the clocks which are not monotonic.
+        const auto tRtcDiff = tRtcStopTime - tRtcStartTime;
+        if ((tRtcDiff < Nanos()) && not bIgnoreNegDeltaErrs)
+        {
+            CMN_LOG_ERROR("Negative start-stop diff: %" PRId64 " ns", tRtcDiff.count());
+            return ErrCode::OVERFLOW;
+        }
 
-            tSleepTime.tv_sec = tRemainingTime.tv_sec;
-            tSleepTime.tv_nsec = tRemainingTime.tv_nsec;
+        // Wakeup error against the absolute deadline.
+        const auto tRtcError = tTimer.lastLateness();
+        tIntervalHistogram.record(tRtcDiff);
+        tErrorHistogram.record(tRtcError);
 
-            ++dSleepCount;
+        // A couple of stores into the mapped file: no syscall, no formatting.
+        if (nullptr != rtConfig.pTrace)
+        {
+            rtConfig.pTrace->record(static_cast<uint32_t>(reClockTypeId), rtConfig.dRun, dIdx,
+                    rtConfig.tPeriod.count(), tRtcStartTime.count(), tRtcStopTime.count(), tRtcError.count(),
+                    static_cast<uint32_t>(dSleepCount));
         }
-        while (((tRemainingTime.tv_sec > 0) || (tRemainingTime.tv_nsec > 0))
-                && (dSleepCount < MAX_SLEEP_COUNT));
 
-        if (getTime(reClockTypeId, tRtcStopTime) != ErrCode::OK)
+        if (nullptr != pTelemetry)
         {
-            CMN_LOG_ERROR("Failed to get RTC stop time for iteration %u", dIdx);
-            return ErrCode::TEST_FAILED;
+            pTelemetry->publish(tRtcError, dSleepCount, myCpu());
         }
 
-        auto tErr = timeDiffInTimespec(tRtcStartTime, tRtcStopTime, tRtcDiff, bIgnoreNegDeltaErrs);
-        if (tErr != ErrCode::OK && not bIgnoreNegDeltaErrs)
+        if (not rtConfig.bSummaryOnly)
         {
-            CMN_LOG_ERROR("Failed to compute start-stop diff, err %d", tErr);
-            return tErr;
+            endDelayTest(reClockTypeId, tRtcDiff, tRtcError);
+
+            // It would be also nice to know how much iterations it took to sleep for the required
+            // time span; it should depend on clock resolution and scheduling policy I guess.
+            CMN_LOG_TRACE("Sleep count: %zu", dSleepCount);
         }
 
-        tErr = timeDiffInTimespec(tSleepRequested, tRtcDiff, tDelayError, bIgnoreNegDeltaErrs);
-        if (tErr != ErrCode::OK && not bIgnoreNegDeltaErrs)
+        if (rtConfig.tWork > Nanos())
         {
-            CMN_LOG_ERROR("Failed to compute sleep error diff, err %d", tErr);
-            return tErr;
+            simulateWork(tTimer.sleepClock(), rtConfig.tWork);
         }
 
-        endDelayTest(reClockTypeId, tRtcStartTime, tRtcStopTime, tRtcDiff, tDelayError);
-
-        // It would be also nice to know how much iterations it took to sleep for the required
-        // time span; it should depend on clock resolution and scheduling policy I guess.
-        CMN_LOG_TRACE("Sleep count: %u", dSleepCount);
+        tDeadlines.check(tTimer);
+        tRtcStartTime = tRtcStopTime;
     }
 
+    tIntervalHistogram.logSummary("Wakeup interval");
+    tErrorHistogram.logSummary("Wakeup error");
+    tDeadlines.logSummary("Deadlines");
+
     return ErrCode::OK;
 }
 
-ErrCode makeTestThread(pthread_attr_t& rtThreadAttr, pthread_t& rtThreadId)
+ErrCode makeTestThread(pthread_attr_t& rtThreadAttr, pthread_t& rtThreadId, TestThreadArgs& rtArgs)
 {
     const auto dErr = pthread_create(&rtThreadId,
                                      &rtThreadAttr,
-                                     [](void*) -> void*
+                                     [](void* rpArgs) -> void*
                                      {
+                                         // Register the log ring before the measurements start
+                                         // so the first CMN_LOG_... call does not allocate.
+                                         async_log::attachThread();
+
                                          // Most notable difference in results is between
                                          // ClockTypeId::MonotonicRaw and ClockTypeId::MonotonicCoarse,
                                          // the latter has worse resolution and sleep DT error may reach
                                          // 2 milliseconds.
-                                         const auto tRetCode = delayTest(ClockTypeId::MonotonicRaw);
-                                         if (tRetCode != ErrCode::OK)
+                                         auto pArgs = static_cast<TestThreadArgs*>(rpArgs);
+                                         pArgs->tResult = delayTest(pArgs->tConfig);
+                                         if (pArgs->tResult != ErrCode::OK)
                                          {
-                                             CMN_LOG_ERROR("Test failed with code %d", tRetCode);
+                                             CMN_LOG_ERROR("Test failed with code %d", static_cast<int>(pArgs->tResult));
                                          }
                                          pthread_exit(nullptr);
                                      },
 
                                      // Thread args object pointer.
-                                     nullptr);
+                                     &rtArgs);
 
     if (dErr != 0)
     {
@@ -197,10 +286,45 @@ ErrCode makeTestThread(pthread_attr_t& rtThreadAttr, pthread_t& rtThreadId)
     return ErrCode::OK;
 }
 
+/**
+ * @brief Run one delay test in a thread with the given scheduling params.
+ *
+ * @param rtConfig Test parameters.
+ * @param rtCpuSet CPU set to run the test thread on, empty - any CPU.
+ * @param rdPolicy Scheduling policy of the test thread.
+ *
+ * @return Status code.
+ */
+ErrCode runDelayTest(const DelayTestConfig& rtConfig, const CpuSet& rtCpuSet, SchedPolicy rdPolicy)
+{
+    pthread_attr_t tWorkerThreadsAttr {};
+
+    // Adjust scheduler params including CPU cores set, priority (implicitly the max one is used)
+    // and scheduling policy.
+    // There is a possibility to play with different scheduling policies to observe different
+    // numbers for DT errors and sleep iterations.
+    if (ErrCode::OK != adjustScheduler(rtCpuSet, rdPolicy, tWorkerThreadsAttr, true /* verbose mode */))
+    {
+        return ErrCode::SCHED_FAILURE;
+    }
+
+    TestThreadArgs tArgs {rtConfig, ErrCode::NOT_READY};
+    pthread_t tTestThread;
+    auto tErr = makeTestThread(tWorkerThreadsAttr, tTestThread, tArgs);
+    if (ErrCode::OK == tErr)
+    {
+        pthread_join(tTestThread, nullptr);
+        tErr = tArgs.tResult;
+    }
+
+    pthread_attr_destroy(&tWorkerThreadsAttr);
+    return tErr;
+}
+
 int main(int argc, char* argv[])
 {
     const auto tSyslogErr = prepareSyslog(SYSLOG_LABEL);
-    Finally tSyslogGuard([]()
+    const auto tSyslogGuard = makeScopeGuard([]()
             {
                 // Close Syslog instance upon exit.
                 // Should be called at all times since openlog()
@@ -208,32 +332,152 @@ int main(int argc, char* argv[])
                 closelog();
             });
 
-    // Create an empty CPU set to use the default params
-    // in adjustScheduler() and use any of available CPUs.
-    CpuSet tCpuSet {};
-    pthread_attr_t tWorkerThreadsAttr {};
+    // Every list option adds a dimension to the test matrix:
+    // all the combinations are run one after another.
+    std::vector<ClockTypeId> tClocks {ClockTypeId::MonotonicRaw};
+    std::vector<Nanos> tPeriods {Nanos::fromMsec(10)};
+    std::vector<SchedPolicy> tPolicies {SCHED_FIFO};
+
+    // An empty CPU set means the default params
+    // in adjustScheduler(), i.e. any of available CPUs.
+    std::vector<CpuSet> tCpuSets {CpuSet {}};
+
+    DelayTestConfig tConfig {ClockTypeId::MonotonicRaw, Nanos(), Nanos::fromUsec(50), 100, 3, false, Nanos(),
+            OverrunPolicy::CatchUp, nullptr, nullptr, {}, 0};
+    int dDmaLatencyUsec = CPU_DMA_LATENCY_DEFAULT;
+    std::string tTracePath;
+    size_t dTraceCapacity = rt_trace::DEFAULT_TRACE_CAPACITY;
+    std::string tTelemetryName;
+
+    OptionParser tOptions("POSIX clock periodic sleep delay test. List options make a test matrix: "
+            "every combination of clock, period, policy and CPU set is run.");
+    tOptions.addList("clock", 'k', "Clocks: RealTime, Monotonic, MonotonicRaw, RealTimeCoarse, MonotonicCoarse, Tsc"
+            " (default: MonotonicRaw)", tClocks, &parseClockTypeId);
+    tOptions.addList("period", 'i', "Sleep periods with ns/us/ms/s suffix, microseconds if none (default: 10ms)",
+            tPeriods, &parseNanos);
+    tOptions.addList("policy", 'P', "Scheduling policies: FIFO, RR, OTHER, BATCH, IDLE (default: FIFO)",
+            tPolicies, &parseSchedPolicy);
+    tOptions.addList("cpus", 'c', "CPU sets separated with ':', e.g. 0-1:3; 'all' - any CPU (default: all)",
+            tCpuSets, &parseCpuList, ':');
+    tOptions.add("iterations", 'n', "Periods per test (default: 100)", tConfig.dIterations, &parseSize);
+    tOptions.add("max-sleep-count", 'm', "Max. EINTR sleep restarts per period (default: 3)",
+            tConfig.dMaxSleepCount, &parseSize);
+    tOptions.add("spin", 's', "Busy-wait tail of every period, 0 - none (default: 50us)", tConfig.tSpin, &parseNanos);
+    tOptions.add("work", 'w', "Busy work per period to simulate a control loop, 0 - none (default: 0)",
+            tConfig.tWork, &parseNanos);
+    tOptions.add("overrun", 'O', "Overrun policy: catch-up, skip, callback (default: catch-up)",
+            tConfig.eOverrunPolicy, &parseOverrunPolicy);
+    tOptions.addFlag("summary-only", 'q', "Log the histograms only, not every iteration", tConfig.bSummaryOnly);
+    tOptions.add("dma-latency", 'L', "Value for /dev/cpu_dma_latency in microseconds, e.g. 0 (default: not set)",
+            dDmaLatencyUsec, &parseInt);
+    tOptions.add("trace", 't', "Write every sample to this binary trace file, see trace_decode (default: none)",
+            tTracePath, &parseString);
+    tOptions.add("trace-capacity", '\0', "Trace ring size in samples, the oldest ones are overwritten"
+            " (default: 1048576)", dTraceCapacity, &parseSize);
+    tOptions.add("telemetry", 'T', "Publish live counters to this shared memory segment for rt_top,"
+            " e.g. /rt_telemetry (default: none)", tTelemetryName, &parseString);
+
+    const auto tOptionsErr = tOptions.parse(argc, argv);
+    if (ErrCode::OK != tOptionsErr)
+    {
+        exit((ErrCode::NOT_READY == tOptionsErr) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
 
-    // Adjust scheduler params including CPU cores set, priority (implicitly the max one is used)
-    // and scheduling policy.
-    // There is a possibility to play with different scheduling policies to observe different
-    // numbers for DT errors and sleep iterations.
-    SchedPolicy tSchedPolicy = SCHED_FIFO;
-    if (ErrCode::OK != adjustScheduler(tCpuSet, tSchedPolicy, tWorkerThreadsAttr, true /* verbose mode */))
+    // Mapped (and prefaulted) before the memory is locked, so it is locked too.
+    rt_trace::TraceWriter tTrace;
+    if (not tTracePath.empty())
     {
-        exit(EXIT_FAILURE);
+        if (ErrCode::OK != tTrace.open(tTracePath.c_str(), dTraceCapacity))
+        {
+            exit(EXIT_FAILURE);
+        }
+
+        tConfig.pTrace = &tTrace;
+    }
+
+    // One slot per run of the matrix.
+    rt_telemetry::TelemetryPublisher tTelemetry;
+    if (not tTelemetryName.empty())
+    {
+        if (ErrCode::OK != tTelemetry.open(tTelemetryName.c_str(), tClocks.size() * tPeriods.size() *
+                    tPolicies.size() * tCpuSets.size()))
+        {
+            exit(EXIT_FAILURE);
+        }
+
+        tConfig.pTelemetry = &tTelemetry;
     }
 
-    pthread_t tStarterThread;
+    // Lock and prefault the memory before any thread is spawned.
+    if (ErrCode::OK != prepareRealtimeProcess(DEFAULT_STACK_PREFAULT, DEFAULT_HEAP_PREFAULT, dDmaLatencyUsec,
+                true /* verbose mode */))
+    {
+        exit(EXIT_FAILURE);
+    }
 
-    // Check the Syslog status code and spawn the worker threds.
-    if ((ErrCode::OK != tSyslogErr) ||
-            (ErrCode::OK != makeTestThread(tWorkerThreadsAttr, tStarterThread)))
+    // Keep formatting and output away from the measurement loop: the test
+    // thread only queues the log records, a non-RT thread prints them.
+    if ((ErrCode::OK != tSyslogErr) || (ErrCode::OK != startAsyncLogging()))
     {
         exit(EXIT_FAILURE);
     }
 
-    // Wait for the starter thread and the worker threads to join.
-    pthread_join(tStarterThread, nullptr);
+    for (const auto eClock : tClocks)
+    {
+        if ((ClockTypeId::Tsc == eClock) && (ErrCode::OK != tsc::calibrate()))
+        {
+            CMN_LOG_ERROR("The TSC clock is not supported on this machine");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    const size_t dRuns = tClocks.size() * tPeriods.size() * tPolicies.size() * tCpuSets.size();
+    size_t dRun = 0;
+    size_t dFailed = 0;
+
+    // The asynchronous log keeps the %s arguments as pointers only,
+    // so the CPU set names must live until the log is flushed at exit.
+    std::vector<std::string> tCpuSetNames;
+    for (const auto& rtCpuSet : tCpuSets)
+    {
+        char aCpus[64];
+        tCpuSetNames.push_back(cpuSetToString(rtCpuSet, aCpus, sizeof(aCpus)));
+    }
+
+    for (size_t dCpuSet = 0; dCpuSet < tCpuSets.size(); ++dCpuSet)
+    {
+        const auto& rtCpuSet = tCpuSets[dCpuSet];
+        for (const auto dPolicy : tPolicies)
+        {
+            for (const auto eClock : tClocks)
+            {
+                for (const auto tPeriod : tPeriods)
+                {
+                    tConfig.eClock = eClock;
+                    tConfig.tPeriod = tPeriod;
+                    formatTo(tConfig.aLabel, sizeof(tConfig.aLabel), "%s %" PRId64 "us %s CPUs %s",
+                            clockIdToString(eClock), tPeriod.toUsec(), getSchedulerPolicyStr(dPolicy),
+                            tCpuSetNames[dCpuSet].c_str());
+
+                    tConfig.dRun = static_cast<uint32_t>(++dRun);
+                    CMN_LOG_TRACE("Run %zu/%zu: clock = %s, period = %" PRId64 " us, policy = %s, CPUs = %s",
+                            dRun, dRuns, clockIdToString(eClock), tPeriod.toUsec(),
+                            getSchedulerPolicyStr(dPolicy), tCpuSetNames[dCpuSet].c_str());
+
+                    if (ErrCode::OK != runDelayTest(tConfig, rtCpuSet, dPolicy))
+                    {
+                        ++dFailed;
+                    }
+                }
+            }
+        }
+    }
+
+    if (dFailed != 0)
+    {
+        CMN_LOG_ERROR("%zu of %zu runs failed", dFailed, dRuns);
+        exit(EXIT_FAILURE);
+    }
 
     CMN_LOG_TRACE("TEST COMPLETE");
     exit(EXIT_SUCCESS);
@@ -0,0 +1,245 @@
+#include <cinttypes>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+// Common header which contains Syslog helpers
+// and some other auxiliary stuff.
+#include "common.h"
+
+// Scheduler control, CPU info and
+// some other threading-related stuff.
+#include "threading.h"
+
+// Time control, conversion macros etc.
+#include "rt_time.h"
+
+// Command line options.
+#include "options.h"
+
+// Deadline miss detection.
+#include "deadline_monitor.h"
+
+// Periodic task executive.
+#include "rt_executive.h"
+
+using namespace cmn;
+using namespace threading;
+using namespace rt_time;
+
+// Periodic task set demo: the tasks are checked for schedulability,
+// mapped to SCHED_FIFO priorities and CPUs (rate monotonic) or to
+// SCHED_DEADLINE (EDF) and run for the given time. Every job burns its
+// share of the WCET on the CPU, the deadline misses and the response
+// times are logged per task at the end.
+
+namespace
+{
+constexpr auto SYSLOG_LABEL = "[COURSE:1][EXECUTIVE]";
+
+// One --task option value.
+struct DemoTask
+{
+    std::string tName;
+    Nanos tPeriod;
+    Nanos tWcet;
+    Nanos tDeadline;
+    CpuIndex dCpu;
+    Nanos tBusy;        // CPU time burnt by every job.
+};
+}
+
+/**
+ * @brief Parse a task given as name:period:wcet[:deadline[:cpu]],
+ *        the times with ns/us/ms/s suffix.
+ *
+ * @param rpValue Task string.
+ * @param rtOutput Task output.
+ *
+ * @return Status code.
+ */
+ErrCode parseDemoTask(const char* rpValue, DemoTask& rtOutput)
+{
+    std::vector<std::string> tFields;
+    std::string tValue(rpValue);
+    size_t dStart = 0;
+    while (dStart <= tValue.size())
+    {
+        auto dEnd = tValue.find(':', dStart);
+        dEnd = (dEnd == std::string::npos) ? tValue.size() : dEnd;
+        tFields.push_back(tValue.substr(dStart, dEnd - dStart));
+        dStart = dEnd + 1;
+    }
+
+    if ((tFields.size() < 3) || (tFields.size() > 5) || tFields[0].empty())
+    {
+        return ErrCode::INVALID_ARGS;
+    }
+
+    rtOutput = DemoTask {tFields[0], Nanos(), Nanos(), Nanos(), -1, Nanos()};
+    if ((ErrCode::OK != parseNanos(tFields[1].c_str(), rtOutput.tPeriod)) ||
+            (ErrCode::OK != parseNanos(tFields[2].c_str(), rtOutput.tWcet)) ||
+            ((tFields.size() > 3) && (ErrCode::OK != parseNanos(tFields[3].c_str(), rtOutput.tDeadline))) ||
+            ((tFields.size() > 4) && (ErrCode::OK != parseInt(tFields[4].c_str(), rtOutput.dCpu))))
+    {
+        return ErrCode::INVALID_ARGS;
+    }
+
+    return ErrCode::OK;
+}
+
+/**
+ * @brief Task job: burn the given CPU time of the calling thread, so
+ *        preemption does not shorten the job.
+ *
+ * @param rpContext DemoTask of the job.
+ */
+void burnCpu(void* rpContext)
+{
+    const auto tBusy = static_cast<const DemoTask*>(rpContext)->tBusy;
+
+    timespec tStart {};
+    timespec tNow {};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tStart);
+    do
+    {
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tNow);
+    }
+    while ((Nanos::fromTimespec(tNow) - Nanos::fromTimespec(tStart)) < tBusy);
+}
+
+/**
+ * @brief Overrun callback of the tasks: report the miss and resume on
+ *        the period grid if the task keeps missing.
+ *
+ * @param rtMiss Miss details.
+ * @param rpContext DemoTask of the missing job.
+ *
+ * @return Policy to apply.
+ */
+OverrunPolicy onDeadlineMiss(const DeadlineMiss& rtMiss, void* rpContext)
+{
+    CMN_LOG_ERROR("Task %s missed the deadline in period %" PRIu64 " by %" PRId64 " ns, %" PRIu64 " in a row",
+            static_cast<const DemoTask*>(rpContext)->tName.c_str(), rtMiss.dPeriod, rtMiss.tOverrun.count(),
+            rtMiss.dConsecutive);
+    return (rtMiss.dConsecutive > 1) ? OverrunPolicy::Skip : OverrunPolicy::CatchUp;
+}
+
+void sleepFor(Nanos rtInterval)
+{
+    auto tSleep = rtInterval.toTimespec();
+    while ((0 != nanosleep(&tSleep, &tSleep)) && (EINTR == errno))
+    {
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const auto tSyslogErr = prepareSyslog(SYSLOG_LABEL);
+    const auto tSyslogGuard = makeScopeGuard([]()
+            {
+                closelog();
+            });
+
+    std::vector<DemoTask> tTasks {
+        DemoTask {"t10", Nanos::fromMsec(10), Nanos::fromMsec(2), Nanos(), -1, Nanos()},
+        DemoTask {"t20", Nanos::fromMsec(20), Nanos::fromMsec(4), Nanos(), -1, Nanos()},
+        DemoTask {"t40", Nanos::fromMsec(40), Nanos::fromMsec(8), Nanos(), -1, Nanos()}};
+    ExecutivePolicy ePolicy = ExecutivePolicy::RateMonotonic;
+    SchedulabilityTest eTest = SchedulabilityTest::ResponseTime;
+    OverrunPolicy eOverrunPolicy = OverrunPolicy::CatchUp;
+    CpuSet tCpuSet;
+    Nanos tDuration = Nanos::fromSeconds(2);
+    size_t dLoadPercent = 50;
+    bool bForce = false;
+
+    OptionParser tOptions("Periodic task executive: rate monotonic (SCHED_FIFO) or EDF (SCHED_DEADLINE)"
+            " scheduling of a task set after a schedulability test.");
+    tOptions.addList("task", 'k', "Tasks as name:period:wcet[:deadline[:cpu]], e.g. ctl:10ms:2ms:5ms:0"
+            " (default: t10:10ms:2ms,t20:20ms:4ms,t40:40ms:8ms)", tTasks, &parseDemoTask);
+    tOptions.add("policy", 'p', "Scheduling: rm, edf (default: rm)", ePolicy, &parseExecutivePolicy);
+    tOptions.add("test", 't', "Schedulability test for rm: bound, rta (default: rta)", eTest,
+            &parseSchedulabilityTest);
+    tOptions.add("cpus", 'c', "CPU list to run the tasks on, e.g. 0-1; 'all' - any CPU (default: all)",
+            tCpuSet, &parseCpuList);
+    tOptions.add("duration", 'd', "Run time with ns/us/ms/s suffix, microseconds if none (default: 2s)",
+            tDuration, &parseNanos);
+    tOptions.add("load", 'l', "Share of the WCET every job burns, percent (default: 50)", dLoadPercent, &parseSize);
+    tOptions.add("overrun", 'O', "Overrun policy: catch-up, skip, callback - skip once a task misses twice in a row"
+            " (default: catch-up)", eOverrunPolicy, &parseOverrunPolicy);
+    tOptions.addFlag("force", 'f', "Run the task set even if the test fails", bForce);
+
+    const auto tOptionsErr = tOptions.parse(argc, argv);
+    if (ErrCode::OK != tOptionsErr)
+    {
+        exit((ErrCode::NOT_READY == tOptionsErr) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if ((tDuration <= Nanos()) || (dLoadPercent > 200))
+    {
+        CMN_LOG_ERROR("The duration must be positive and the load at most 200%%");
+        exit(EXIT_FAILURE);
+    }
+
+    // The specs point into tTasks, which must not change from here on.
+    Executive tExecutive(ePolicy, eTest, ClockTypeId::Monotonic, eOverrunPolicy);
+    for (auto& rtTask : tTasks)
+    {
+        rtTask.tBusy = Nanos(rtTask.tWcet.count() * static_cast<int64_t>(dLoadPercent) / 100);
+        if (ErrCode::OK != tExecutive.addTask(PeriodicTaskSpec {rtTask.tName.c_str(), rtTask.tPeriod, rtTask.tWcet,
+                    rtTask.tDeadline, rtTask.dCpu, &burnCpu, &rtTask, &onDeadlineMiss, &rtTask}))
+        {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (ErrCode::OK != prepareRealtimeProcess(DEFAULT_STACK_PREFAULT, DEFAULT_HEAP_PREFAULT,
+                CPU_DMA_LATENCY_DEFAULT, true /* verbose mode */))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    if ((ErrCode::OK != tSyslogErr) || (ErrCode::OK != startAsyncLogging()))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    const auto tPlanErr = tExecutive.plan(tCpuSet);
+    tExecutive.logPlan();
+    if ((ErrCode::OK != tPlanErr) && not ((ErrCode::SCHED_FAILURE == tPlanErr) && bForce))
+    {
+        CMN_LOG_ERROR("The task set is not schedulable, see --force");
+        exit(EXIT_FAILURE);
+    }
+
+    // The main thread takes the top priority to manage the tasks.
+    if ((ErrCode::OK != ThreadSpec().policy(SCHED_FIFO).name("executive").applyToCurrentThread()) ||
+            (ErrCode::OK != tExecutive.start()))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    sleepFor(tDuration + EXECUTIVE_RELEASE_DELAY);
+
+    const auto tRunErr = tExecutive.stop();
+    tExecutive.logSummary();
+
+    uint64_t dMisses = 0;
+    for (size_t dIdx = 0; dIdx < tExecutive.size(); ++dIdx)
+    {
+        dMisses += tExecutive.taskDeadlines(dIdx).misses();
+    }
+
+    if (ErrCode::OK != tRunErr)
+    {
+        CMN_LOG_ERROR("The task set failed to run");
+        exit(EXIT_FAILURE);
+    }
+
+    CMN_LOG_TRACE("TEST COMPLETE: %" PRIu64 " deadline misses", dMisses);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,162 @@
+#include <cinttypes>
+#include <csignal>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <time.h>
+
+// Common header which contains Syslog helpers
+// and some other auxiliary stuff.
+#include "common.h"
+
+// Time control, conversion macros etc.
+#include "rt_time.h"
+
+// Command line options.
+#include "options.h"
+
+// Live counters published by the tests.
+#include "rt_telemetry.h"
+
+using namespace cmn;
+using namespace rt_time;
+using namespace rt_telemetry;
+
+// top-like live monitor of the tests publishing their counters to a
+// telemetry segment (posix_clock --telemetry). Only reads the shared
+// memory, so watching a test does not disturb it: no syscall, lock
+// or signal ever reaches the test threads.
+
+namespace
+{
+const char* slotStateToString(SlotState reState)
+{
+    switch (reState)
+    {
+        case SlotState::Running:
+            return "RUN";
+        case SlotState::Done:
+            return "DONE";
+        default:
+            return "INIT";
+    }
+}
+
+/**
+ * @brief Print one refresh of the table.
+ *
+ * @param rtReader Telemetry segment.
+ * @param rtPrevIterations Iterations seen by the previous refresh, per slot.
+ * @param rtInterval Time since the previous refresh.
+ */
+void printTable(const TelemetryReader& rtReader, std::vector<uint64_t>& rtPrevIterations, Nanos rtInterval)
+{
+    printf("%4s %7s %3s %4s %10s %8s %9s %9s %9s %11s  %-31s %s\n", "SLOT", "TID", "CPU", "STAT", "ITER",
+            "RATE/s", "LAST(ns)", "MIN(ns)", "MAX(ns)", "MEAN(ns)", "SLEEP RESTARTS 0/1/2/.../7+", "LABEL");
+
+    rtPrevIterations.resize(rtReader.size(), 0);
+    for (size_t dIdx = 0; dIdx < rtReader.size(); ++dIdx)
+    {
+        TelemetrySnapshot tSnapshot {};
+        const bool bConsistent = rtReader.slot(dIdx).snapshot(tSnapshot);
+        if (SlotState::Free == tSnapshot.eState)
+        {
+            printf("%4zu %7s\n", dIdx, "-");
+            continue;
+        }
+
+        const double dRate = static_cast<double>(tSnapshot.dIterations - rtPrevIterations[dIdx]) /
+            rtInterval.toSeconds();
+        rtPrevIterations[dIdx] = tSnapshot.dIterations;
+
+        char aSleeps[64];
+        size_t dLength = 0;
+        for (size_t dBucket = 0; dBucket < SLEEP_COUNT_BUCKETS; ++dBucket)
+        {
+            dLength += str_utils::formatTo(aSleeps + dLength, sizeof(aSleeps) - dLength, "%s%" PRIu64,
+                    (dBucket == 0) ? "" : "/", tSnapshot.aSleepCounts[dBucket]);
+        }
+
+        const bool bEmpty = (tSnapshot.dIterations == 0);
+        printf("%4zu %7d %3d %4s %10" PRIu64 " %8.1lf %9" PRId64 " %9" PRId64 " %9" PRId64 " %11.1lf  %-31s %s%s\n",
+                dIdx, tSnapshot.dTid, tSnapshot.dCpu, slotStateToString(tSnapshot.eState), tSnapshot.dIterations,
+                dRate, tSnapshot.dLastError, bEmpty ? 0 : tSnapshot.dMinError, bEmpty ? 0 : tSnapshot.dMaxError,
+                tSnapshot.meanError(), aSleeps, tSnapshot.aLabel, bConsistent ? "" : " (torn)");
+    }
+
+    fflush(stdout);
+}
+
+void sleepFor(Nanos rtInterval)
+{
+    auto tSleep = rtInterval.toTimespec();
+    while ((0 != nanosleep(&tSleep, &tSleep)) && (EINTR == errno))
+    {
+    }
+}
+}
+
+int main(int argc, char* argv[])
+{
+    std::string tName = DEFAULT_TELEMETRY_NAME;
+    Nanos tInterval = Nanos::fromMsec(1000);
+    size_t dRefreshes = 0;
+    bool bPlain = false;
+
+    OptionParser tOptions("Live monitor of the tests publishing to a telemetry segment (posix_clock --telemetry).");
+    tOptions.add("name", 'N', "Shared memory segment name (default: /rt_telemetry)", tName, &parseString);
+    tOptions.add("interval", 'i', "Refresh period with ns/us/ms/s suffix, microseconds if none (default: 1s)",
+            tInterval, &parseNanos);
+    tOptions.add("count", 'n', "Number of refreshes, 0 - until the test exits (default: 0)", dRefreshes, &parseSize);
+    tOptions.addFlag("plain", 'p', "Do not clear the screen, append every refresh", bPlain);
+
+    const auto tOptionsErr = tOptions.parse(argc, argv);
+    if (ErrCode::OK != tOptionsErr)
+    {
+        exit((ErrCode::NOT_READY == tOptionsErr) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if (tInterval <= Nanos())
+    {
+        CMN_LOG_ERROR("The refresh period must be positive");
+        exit(EXIT_FAILURE);
+    }
+
+    // Wait for the test to create the segment.
+    TelemetryReader tReader;
+    ErrCode tErr;
+    while (ErrCode::NOT_READY == (tErr = tReader.open(tName.c_str())))
+    {
+        sleepFor(tInterval);
+    }
+
+    if (ErrCode::OK != tErr)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    std::vector<uint64_t> tPrevIterations;
+    for (size_t dRefresh = 0; (dRefreshes == 0) || (dRefresh < dRefreshes); ++dRefresh)
+    {
+        // The last table is printed once the writer is gone.
+        const bool bWriterAlive = isWriterAlive(tReader.writerPid());
+
+        if (not bPlain)
+        {
+            printf("\033[H\033[2J");
+        }
+
+        printf("%s: writer pid %d (%s)\n", tName.c_str(), tReader.writerPid(), bWriterAlive ? "running" : "exited");
+        printTable(tReader, tPrevIterations, tInterval);
+
+        if (not bWriterAlive)
+        {
+            break;
+        }
+
+        sleepFor(tInterval);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,328 @@
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <mutex>
+
+#include <time.h>
+
+// Common header which contains Syslog helpers
+// and some other auxiliary stuff.
+#include "common.h"
+
+// Scheduler control, CPU info and
+// some other threading-related stuff.
+#include "threading.h"
+
+// Time control, conversion macros etc.
+#include "rt_time.h"
+
+// Fixed-memory latency histogram.
+#include "latency_histogram.h"
+
+// Command line options.
+#include "options.h"
+
+using namespace cmn;
+using namespace threading;
+using namespace rt_time;
+
+// Synchronization primitives microbenchmark. Uncontended: the cost of
+// lock + unlock, set + wait + reset and post + wait on one thread, timed
+// in batches. Contended handoff: the time from the release by one thread
+// to the return from the blocking call in the other one, for the
+// ping-pong over events and semaphores and for a mutex unlocked while
+// the peer is blocked in lock(). Printed as one CSV table.
+
+namespace
+{
+constexpr size_t DEFAULT_OPS = 1000000;
+constexpr size_t DEFAULT_HANDOFFS = 20000;
+
+// Uncontended ops per timed batch: amortizes the clock reads.
+constexpr size_t OPS_PER_BATCH = 100;
+
+// How long the mutex owner holds the lock, so the peer is blocked
+// in lock() by the time it is released.
+constexpr int64_t MUTEX_HOLD_NS = 20000;
+
+// State shared by the handoff threads. The release time is written by
+// the releasing thread right before the release and read by the peer
+// right after it returns, the handoff primitive orders the two.
+struct Handoff
+{
+    size_t dRounds;
+    Semaphore tPing;
+    Semaphore tPong;
+    Event tPingEvent;
+    Event tPongEvent;
+    std::mutex tMutex;
+    PiMutex tPiMutex;
+    Semaphore tLocked;              // The owner has taken the mutex.
+    std::atomic<int64_t> dReleaseTime {0};
+    LatencyHistogram tLatency;      // Filled by the peer.
+};
+
+using PeerFunc = void (*)(Handoff& rtHandoff);
+}
+
+inline int64_t nowNs()
+{
+    timespec tNow {};
+    clock_gettime(CLOCK_MONOTONIC_RAW, &tNow);
+    return Nanos::fromTimespec(tNow).count();
+}
+
+/**
+ * @brief Print one CSV row with the histogram percentiles.
+ *
+ * @param rpPrimitive Primitive name.
+ * @param rpMode uncontended or handoff.
+ * @param rtHistogram Per-op costs or handoff latencies.
+ */
+void printRow(const char* rpPrimitive, const char* rpMode, const LatencyHistogram& rtHistogram)
+{
+    printf("%s,%s,%" PRIu64 ",%" PRId64 ",%.1lf,%" PRId64 ",%" PRId64 ",%" PRId64 "\n", rpPrimitive, rpMode,
+            rtHistogram.count(), rtHistogram.min().count(), rtHistogram.mean(),
+            rtHistogram.percentile(50.0).count(), rtHistogram.percentile(99.0).count(), rtHistogram.max().count());
+    fflush(stdout);
+}
+
+/**
+ * @brief Time the op in batches on the calling thread, record the mean
+ *        cost of every batch.
+ *
+ * @param rpPrimitive Primitive name.
+ * @param rdOps Number of ops.
+ * @param rtOp Op to run.
+ */
+template <typename Op>
+void benchUncontended(const char* rpPrimitive, size_t rdOps, Op rtOp)
+{
+    LatencyHistogram tCost;
+    for (size_t dDone = 0; dDone < rdOps; dDone += OPS_PER_BATCH)
+    {
+        const auto dStart = nowNs();
+        for (size_t dIdx = 0; dIdx < OPS_PER_BATCH; ++dIdx)
+        {
+            rtOp();
+        }
+
+        tCost.record(Nanos((nowNs() - dStart) / static_cast<int64_t>(OPS_PER_BATCH)));
+    }
+
+    printRow(rpPrimitive, "uncontended", tCost);
+}
+
+// The ping-pong: the main thread releases the peer and waits for its
+// answer, the peer records the latency of every release.
+void semaphorePeer(Handoff& rtHandoff)
+{
+    for (size_t dRound = 0; dRound < rtHandoff.dRounds; ++dRound)
+    {
+        rtHandoff.tPing.wait();
+        rtHandoff.tLatency.record(Nanos(nowNs() - rtHandoff.dReleaseTime.load(std::memory_order_relaxed)));
+        rtHandoff.tPong.post();
+    }
+}
+
+void semaphoreMain(Handoff& rtHandoff)
+{
+    for (size_t dRound = 0; dRound < rtHandoff.dRounds; ++dRound)
+    {
+        rtHandoff.dReleaseTime.store(nowNs(), std::memory_order_relaxed);
+        rtHandoff.tPing.post();
+        rtHandoff.tPong.wait();
+    }
+}
+
+void eventPeer(Handoff& rtHandoff)
+{
+    for (size_t dRound = 0; dRound < rtHandoff.dRounds; ++dRound)
+    {
+        rtHandoff.tPingEvent.wait();
+        rtHandoff.tLatency.record(Nanos(nowNs() - rtHandoff.dReleaseTime.load(std::memory_order_relaxed)));
+        rtHandoff.tPingEvent.reset();
+        rtHandoff.tPongEvent.set();
+    }
+}
+
+void eventMain(Handoff& rtHandoff)
+{
+    for (size_t dRound = 0; dRound < rtHandoff.dRounds; ++dRound)
+    {
+        rtHandoff.dReleaseTime.store(nowNs(), std::memory_order_relaxed);
+        rtHandoff.tPingEvent.set();
+        rtHandoff.tPongEvent.wait();
+        rtHandoff.tPongEvent.reset();
+    }
+}
+
+// The main thread takes the mutex, lets the peer block on it and
+// releases it; the peer records the time to its lock() return.
+template <typename Mutex>
+void mutexPeer(Handoff& rtHandoff, Mutex& rtMutex)
+{
+    for (size_t dRound = 0; dRound < rtHandoff.dRounds; ++dRound)
+    {
+        rtHandoff.tLocked.wait();
+        rtMutex.lock();
+        rtHandoff.tLatency.record(Nanos(nowNs() - rtHandoff.dReleaseTime.load(std::memory_order_relaxed)));
+        rtMutex.unlock();
+        rtHandoff.tPong.post();
+    }
+}
+
+template <typename Mutex>
+void mutexMain(Handoff& rtHandoff, Mutex& rtMutex)
+{
+    for (size_t dRound = 0; dRound < rtHandoff.dRounds; ++dRound)
+    {
+        rtMutex.lock();
+        rtHandoff.tLocked.post();
+
+        // Sleep rather than spin, so the peer gets to lock() on a single CPU too.
+        const auto tHold = Nanos(MUTEX_HOLD_NS).toTimespec();
+        nanosleep(&tHold, nullptr);
+
+        rtHandoff.dReleaseTime.store(nowNs(), std::memory_order_relaxed);
+        rtMutex.unlock();
+        rtHandoff.tPong.wait();
+    }
+}
+
+void stdMutexPeer(Handoff& rtHandoff)
+{
+    mutexPeer(rtHandoff, rtHandoff.tMutex);
+}
+
+void stdMutexMain(Handoff& rtHandoff)
+{
+    mutexMain(rtHandoff, rtHandoff.tMutex);
+}
+
+void piMutexPeer(Handoff& rtHandoff)
+{
+    mutexPeer(rtHandoff, rtHandoff.tPiMutex);
+}
+
+void piMutexMain(Handoff& rtHandoff)
+{
+    mutexMain(rtHandoff, rtHandoff.tPiMutex);
+}
+
+struct PeerArgs
+{
+    Handoff* pHandoff;
+    PeerFunc pFunc;
+};
+
+/**
+ * @brief Run one handoff benchmark: the peer on its own thread with
+ *        the spec given, the main side on the calling thread.
+ *
+ * @param rpPrimitive Primitive name.
+ * @param rdRounds Number of handoffs.
+ * @param rtPeerSpec Peer thread spec.
+ * @param rpMain Main side.
+ * @param rpPeer Peer side.
+ *
+ * @return Error code.
+ */
+ErrCode benchHandoff(const char* rpPrimitive, size_t rdRounds, const ThreadSpec& rtPeerSpec, PeerFunc rpMain,
+        PeerFunc rpPeer)
+{
+    Handoff tHandoff;
+    tHandoff.dRounds = rdRounds;
+
+    PeerArgs tArgs {&tHandoff, rpPeer};
+    pthread_t tPeer;
+    const auto tErr = rtPeerSpec.create(tPeer,
+            [](void* rpArgs) -> void*
+            {
+                auto pArgs = static_cast<PeerArgs*>(rpArgs);
+                pArgs->pFunc(*pArgs->pHandoff);
+                return nullptr;
+            },
+            &tArgs);
+    if (ErrCode::OK != tErr)
+    {
+        CMN_LOG_ERROR("Failed to create the %s peer thread", rpPrimitive);
+        return tErr;
+    }
+
+    rpMain(tHandoff);
+    pthread_join(tPeer, nullptr);
+
+    printRow(rpPrimitive, "handoff", tHandoff.tLatency);
+    return ErrCode::OK;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t dOps = DEFAULT_OPS;
+    size_t dHandoffs = DEFAULT_HANDOFFS;
+    CpuSet tCpuSet;
+    SchedPolicy tSchedPolicy = SCHED_FIFO;
+    size_t dSpinRounds = futexSpinRounds();
+
+    OptionParser tOptions("Synchronization primitives benchmark: uncontended cost and contended handoff latency"
+            " of the mutexes, events and semaphores, printed as a CSV table.");
+    tOptions.add("ops", 'n', "Uncontended ops per primitive (default: 1000000)", dOps, &parseSize);
+    tOptions.add("handoffs", 'k', "Handoffs per primitive (default: 20000)", dHandoffs, &parseSize);
+    tOptions.add("cpus", 'c', "CPU list for the two threads, e.g. 0-1; 'all' - any CPU (default: all)",
+            tCpuSet, &parseCpuList);
+    tOptions.add("policy", 'P', "Scheduling policy: FIFO, RR, OTHER, BATCH, IDLE (default: FIFO)",
+            tSchedPolicy, &parseSchedPolicy);
+    tOptions.add("spin", 's', "Spin rounds before blocking (default: calibrated for this CPU)", dSpinRounds,
+            &parseSize);
+
+    const auto tOptionsErr = tOptions.parse(argc, argv);
+    if (ErrCode::OK != tOptionsErr)
+    {
+        exit((ErrCode::NOT_READY == tOptionsErr) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if ((dOps == 0) || (dHandoffs == 0))
+    {
+        CMN_LOG_ERROR("The ops and the handoffs must be positive");
+        exit(EXIT_FAILURE);
+    }
+
+    setFutexSpinRounds(dSpinRounds);
+
+    // The main side on the first CPU of the set, the peer on the second
+    // one if any; both at the same priority.
+    const auto tCpus = Topology::system().placementOrder(tCpuSet);
+    const CpuIndex dMainCpu = tCpuSet.empty() ? -1 : tCpus[0];
+    const CpuIndex dPeerCpu = tCpuSet.empty() ? -1 : tCpus[1 % tCpus.size()];
+    const auto tPeerSpec = ThreadSpec().policy(tSchedPolicy).cpu(dPeerCpu).name("sync-peer");
+
+    if ((ErrCode::OK != prepareRealtimeProcess()) ||
+            (ErrCode::OK != ThreadSpec().policy(tSchedPolicy).cpu(dMainCpu).name("sync-main").applyToCurrentThread()))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    printf("# spin rounds = %zu, main cpu = %d, peer cpu = %d\n", futexSpinRounds(), dMainCpu, dPeerCpu);
+    printf("primitive,mode,count,min_ns,mean_ns,p50_ns,p99_ns,max_ns\n");
+
+    std::mutex tMutex;
+    PiMutex tPiMutex;
+    Event tEvent;
+    Semaphore tSemaphore;
+
+    benchUncontended("std::mutex", dOps, [&tMutex]() { tMutex.lock(); tMutex.unlock(); });
+    benchUncontended("PiMutex", dOps, [&tPiMutex]() { tPiMutex.lock(); tPiMutex.unlock(); });
+    benchUncontended("Event", dOps, [&tEvent]() { tEvent.set(); tEvent.wait(); tEvent.reset(); });
+    benchUncontended("Semaphore", dOps, [&tSemaphore]() { tSemaphore.post(); tSemaphore.wait(); });
+
+    if ((ErrCode::OK != benchHandoff("Semaphore", dHandoffs, tPeerSpec, &semaphoreMain, &semaphorePeer)) ||
+            (ErrCode::OK != benchHandoff("Event", dHandoffs, tPeerSpec, &eventMain, &eventPeer)) ||
+            (ErrCode::OK != benchHandoff("std::mutex", dHandoffs, tPeerSpec, &stdMutexMain, &stdMutexPeer)) ||
+            (ErrCode::OK != benchHandoff("PiMutex", dHandoffs, tPeerSpec, &piMutexMain, &piMutexPeer)))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    exit(EXIT_SUCCESS);
+}
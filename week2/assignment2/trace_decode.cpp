@@ -0,0 +1,353 @@
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <string.h>
+#include <strings.h>
+
+// Common header which contains Syslog helpers
+// and some other auxiliary stuff.
+#include "common.h"
+
+// Time control, conversion macros etc.
+#include "rt_time.h"
+
+// Fixed-memory latency histogram.
+#include "latency_histogram.h"
+
+// Command line options.
+#include "options.h"
+
+// Binary trace of the samples.
+#include "rt_trace.h"
+
+// Vectorized statistics kernels.
+#include "batch_stats.h"
+
+using namespace cmn;
+using namespace rt_time;
+using namespace rt_trace;
+using namespace batch_stats;
+
+// Offline decoder for the binary traces written by posix_clock --trace.
+// Prints the raw samples as CSV or the per-run histogram summaries of
+// the wakeup error, the interval between two wakeups and its error
+// against the run's period. --check-simd runs the batch kernels on the
+// trace data and compares them with the scalar ones.
+
+namespace
+{
+enum class OutputFormat
+{
+    Csv,
+    Summary
+};
+
+// Samples of one test run, SoA for the batch kernels.
+struct RunColumns
+{
+    uint32_t dClockId;
+    int64_t dPeriod;
+    std::vector<int64_t> tStart;
+    std::vector<int64_t> tStop;
+    std::vector<int64_t> tError;
+};
+
+// Outputs of the batch kernels over one run's samples.
+struct KernelOutputs
+{
+    std::vector<int64_t> tNanos;
+    std::vector<int64_t> tInterval;
+    std::vector<int64_t> tPeriodErrors;
+    SampleStats tErrorStats;
+    SampleStats tIntervalStats;
+};
+
+// Relative variance difference allowed between the kernels:
+// they sum the squares in a different order.
+constexpr double MAX_VARIANCE_DIFF = 1e-9;
+}
+
+ErrCode parseOutputFormat(const char* rpValue, OutputFormat& reOutput)
+{
+    if (0 == strcasecmp(rpValue, "csv"))
+    {
+        reOutput = OutputFormat::Csv;
+    }
+    else if (0 == strcasecmp(rpValue, "summary"))
+    {
+        reOutput = OutputFormat::Summary;
+    }
+    else
+    {
+        return ErrCode::INVALID_ARGS;
+    }
+
+    return ErrCode::OK;
+}
+
+/**
+ * @brief Print every sample available, the oldest one first.
+ *
+ * @param rtTrace Trace to decode.
+ */
+void printCsv(const TraceReader& rtTrace)
+{
+    printf("run,clock,period_ns,iteration,start_ns,stop_ns,error_ns,sleep_count\n");
+
+    for (size_t dIdx = 0; dIdx < rtTrace.size(); ++dIdx)
+    {
+        const auto& rtRecord = rtTrace[dIdx];
+        printf("%" PRIu32 ",%s,%" PRId64 ",%" PRIu64 ",%" PRId64 ",%" PRId64 ",%" PRId64 ",%u\n", rtRecord.dRun,
+                clockIdToString(static_cast<ClockTypeId>(rtRecord.dClockId)), rtRecord.dPeriod,
+                rtRecord.dIteration, rtRecord.dStart, rtRecord.dStop, rtRecord.dError,
+                static_cast<unsigned>(rtRecord.dSleepCount));
+    }
+}
+
+/**
+ * @brief Split the trace into the per-run columns.
+ *
+ * @param[in] rtTrace Trace to decode.
+ * @param[out] rtRuns Columns per run index.
+ */
+void collectColumns(const TraceReader& rtTrace, std::map<uint32_t, RunColumns>& rtRuns)
+{
+    for (size_t dIdx = 0; dIdx < rtTrace.size(); ++dIdx)
+    {
+        const auto& rtRecord = rtTrace[dIdx];
+        auto& rtColumns = rtRuns[rtRecord.dRun];
+        rtColumns.dClockId = rtRecord.dClockId;
+        rtColumns.dPeriod = rtRecord.dPeriod;
+        rtColumns.tStart.push_back(rtRecord.dStart);
+        rtColumns.tStop.push_back(rtRecord.dStop);
+        rtColumns.tError.push_back(rtRecord.dError);
+    }
+}
+
+/**
+ * @brief Interval between two consecutive wakeups of a run minus its period.
+ *        The samples of a run are consecutive: the ring only drops the oldest.
+ *
+ * @param rtColumns Samples of one run.
+ *
+ * @return Period errors, nanoseconds.
+ */
+std::vector<int64_t> wakeupPeriodErrors(const RunColumns& rtColumns)
+{
+    const auto dCount = rtColumns.tStop.size();
+    std::vector<int64_t> tErrors((dCount > 1) ? (dCount - 1) : 0);
+    periodErrors(rtColumns.tStop.data(), dCount, rtColumns.dPeriod, tErrors.data());
+    return tErrors;
+}
+
+/**
+ * @brief Print one summary line: the batch statistics and the percentiles.
+ *
+ * @param rdRun Run index.
+ * @param rtColumns Samples of the run, for the clock and the period.
+ * @param rpMetric Metric name.
+ * @param rtValues Sample values, nanoseconds.
+ */
+void printMetric(uint32_t rdRun, const RunColumns& rtColumns, const char* rpMetric,
+        const std::vector<int64_t>& rtValues)
+{
+    const auto tStats = computeStats(rtValues.data(), rtValues.size());
+
+    LatencyHistogram tHistogram;
+    for (const auto dValue : rtValues)
+    {
+        tHistogram.record(Nanos(dValue));
+    }
+
+    printf("%" PRIu32 ",%s,%" PRId64 ",%s,%zu,%" PRIu64 ",%" PRId64 ",%" PRId64 ",%.1lf,%.1lf,%" PRId64 ",%" PRId64
+            ",%" PRId64 ",%" PRId64 "\n", rdRun, clockIdToString(static_cast<ClockTypeId>(rtColumns.dClockId)),
+            rtColumns.dPeriod, rpMetric, tStats.dCount, tHistogram.negativeCount(),
+            tStats.dMin, tStats.dMax, tStats.dMean, tStats.stddev(),
+            tHistogram.percentile(50.0).count(), tHistogram.percentile(99.0).count(),
+            tHistogram.percentile(99.9).count(), tHistogram.percentile(99.99).count());
+}
+
+/**
+ * @brief Print the per-run summaries of the wakeup error, the period
+ *        error and the wakeup interval (stop - start of every sample).
+ *
+ * @param rtTrace Trace to decode.
+ */
+void printSummary(const TraceReader& rtTrace)
+{
+    std::map<uint32_t, RunColumns> tRuns;
+    collectColumns(rtTrace, tRuns);
+
+    printf("# samples = %zu, lost (overwritten) = %" PRIu64 ", kernels = %s\n", rtTrace.size(), rtTrace.lost(),
+            simdLevelToString(activeSimdLevel()));
+    printf("run,clock,period_ns,metric,count,negative,min_ns,max_ns,mean_ns,stddev_ns,p50_ns,p99_ns,p99.9_ns,"
+            "p99.99_ns\n");
+
+    for (auto& rtRun : tRuns)
+    {
+        auto& rtColumns = rtRun.second;
+        printMetric(rtRun.first, rtColumns, "error", rtColumns.tError);
+        printMetric(rtRun.first, rtColumns, "period_error", wakeupPeriodErrors(rtColumns));
+
+        // The interval is computed in place of the stop column.
+        subtract(rtColumns.tStop.data(), rtColumns.tStart.data(), 0, rtColumns.tStop.data(), rtColumns.tStop.size());
+        printMetric(rtRun.first, rtColumns, "interval", rtColumns.tStop);
+    }
+}
+
+/**
+ * @brief Run every batch kernel at the active SIMD level.
+ *
+ * @param rtColumns Samples of one run.
+ * @param rtSec tv_sec of the stop stamps.
+ * @param rtNsec tv_nsec of the stop stamps.
+ *
+ * @return Kernel outputs.
+ */
+KernelOutputs runKernels(const RunColumns& rtColumns, const std::vector<int64_t>& rtSec,
+        const std::vector<int64_t>& rtNsec)
+{
+    const auto dCount = rtColumns.tStop.size();
+    KernelOutputs tOutputs;
+    tOutputs.tNanos.resize(dCount);
+    tOutputs.tInterval.resize(dCount);
+    tOutputs.tPeriodErrors.resize((dCount > 1) ? (dCount - 1) : 0);
+
+    timespecToNanos(rtSec.data(), rtNsec.data(), tOutputs.tNanos.data(), dCount);
+    subtract(rtColumns.tStop.data(), rtColumns.tStart.data(), 0, tOutputs.tInterval.data(), dCount);
+    periodErrors(rtColumns.tStop.data(), dCount, rtColumns.dPeriod, tOutputs.tPeriodErrors.data());
+    tOutputs.tErrorStats = computeStats(rtColumns.tError.data(), dCount);
+    tOutputs.tIntervalStats = computeStats(tOutputs.tInterval.data(), dCount);
+    return tOutputs;
+}
+
+/**
+ * @brief Check the statistics of two kernels match: the integers
+ *        exactly, the variance up to the summation order.
+ */
+bool statsMatch(const SampleStats& rtExpected, const SampleStats& rtActual)
+{
+    const double dScale = (rtExpected.dVariance > 1.0) ? rtExpected.dVariance : 1.0;
+    return (rtExpected.dCount == rtActual.dCount) && (rtExpected.dMin == rtActual.dMin) &&
+        (rtExpected.dMax == rtActual.dMax) && (rtExpected.dMean == rtActual.dMean) &&
+        (std::fabs(rtExpected.dVariance - rtActual.dVariance) <= MAX_VARIANCE_DIFF * dScale);
+}
+
+/**
+ * @brief Run the kernels of the given SIMD level and the scalar ones
+ *        on the samples of every run and compare the outputs.
+ *
+ * @param rtTrace Trace to check the kernels on.
+ * @param reLevel SIMD level to check.
+ *
+ * @return Error code; TEST_FAILED on a mismatch.
+ */
+ErrCode checkKernels(const TraceReader& rtTrace, SimdLevel reLevel)
+{
+    std::map<uint32_t, RunColumns> tRuns;
+    collectColumns(rtTrace, tRuns);
+
+    printf("# samples = %zu, checking %s against Scalar\n", rtTrace.size(), simdLevelToString(reLevel));
+    printf("run,clock,count,nanos,interval,period_error,error_stats,interval_stats\n");
+
+    bool bAllMatch = true;
+    for (const auto& rtRun : tRuns)
+    {
+        const auto& rtColumns = rtRun.second;
+
+        // The stop stamps split back into the timespec fields.
+        std::vector<int64_t> tSec;
+        std::vector<int64_t> tNsec;
+        for (const auto dStop : rtColumns.tStop)
+        {
+            const auto tTime = Nanos(dStop).toTimespec();
+            tSec.push_back(tTime.tv_sec);
+            tNsec.push_back(tTime.tv_nsec);
+        }
+
+        setSimdLevel(SimdLevel::Scalar);
+        const auto tExpected = runKernels(rtColumns, tSec, tNsec);
+        setSimdLevel(reLevel);
+        const auto tActual = runKernels(rtColumns, tSec, tNsec);
+
+        const bool aMatches[] = {
+            (tExpected.tNanos == tActual.tNanos) && (tActual.tNanos == rtColumns.tStop),
+            tExpected.tInterval == tActual.tInterval,
+            tExpected.tPeriodErrors == tActual.tPeriodErrors,
+            statsMatch(tExpected.tErrorStats, tActual.tErrorStats),
+            statsMatch(tExpected.tIntervalStats, tActual.tIntervalStats)
+        };
+
+        printf("%" PRIu32 ",%s,%zu", rtRun.first, clockIdToString(static_cast<ClockTypeId>(rtColumns.dClockId)),
+                rtColumns.tStop.size());
+        for (const auto bMatch : aMatches)
+        {
+            printf(",%s", bMatch ? "ok" : "MISMATCH");
+            bAllMatch = bAllMatch && bMatch;
+        }
+
+        printf("\n");
+    }
+
+    return bAllMatch ? ErrCode::OK : ErrCode::TEST_FAILED;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string tPath;
+    OutputFormat eFormat = OutputFormat::Summary;
+    SimdLevel eSimdLevel = detectSimdLevel();
+    bool bCheckSimd = false;
+
+    OptionParser tOptions("Binary timing trace decoder: prints the samples as CSV or their histogram summaries.");
+    tOptions.add("file", 'f', "Trace file written by posix_clock --trace", tPath, &parseString);
+    tOptions.add("format", 'F', "Output format: csv, summary (default: summary)", eFormat, &parseOutputFormat);
+    tOptions.add("simd", 's', "Statistics kernels: Scalar, SSE4.2, AVX2, NEON (default: the best supported)",
+            eSimdLevel, &parseSimdLevel);
+    tOptions.addFlag("check-simd", 'C', "Compare the --simd kernels with the scalar ones on the trace samples",
+            bCheckSimd);
+
+    const auto tOptionsErr = tOptions.parse(argc, argv);
+    if (ErrCode::OK != tOptionsErr)
+    {
+        exit((ErrCode::NOT_READY == tOptionsErr) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if (tPath.empty())
+    {
+        CMN_LOG_ERROR("No trace file given, see --help");
+        exit(EXIT_FAILURE);
+    }
+
+    if (ErrCode::OK != setSimdLevel(eSimdLevel))
+    {
+        CMN_LOG_ERROR("The %s kernels are not supported on this machine", simdLevelToString(eSimdLevel));
+        exit(EXIT_FAILURE);
+    }
+
+    TraceReader tTrace;
+    if (ErrCode::OK != tTrace.open(tPath.c_str()))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    if (bCheckSimd)
+    {
+        exit((ErrCode::OK == checkKernels(tTrace, eSimdLevel)) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if (OutputFormat::Csv == eFormat)
+    {
+        printCsv(tTrace);
+    }
+    else
+    {
+        printSummary(tTrace);
+    }
+
+    exit(EXIT_SUCCESS);
+}